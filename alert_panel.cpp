@@ -0,0 +1,210 @@
+﻿#include "alert_panel.h"
+#include "alert_rules.h"
+
+#include "imgui.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+namespace
+{
+    std::vector<AlertStatus> statuses;
+    std::vector<AlertRule> editing; // 編集中のルール（空なら一覧だけ表示）
+    bool editOpen = false;
+    std::string editingPath;
+
+    void formatTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::localtime(&t);
+        if (!tm || !std::strftime(buf, size, "%m/%d %H:%M:%S", tm))
+            std::snprintf(buf, size, "-");
+    }
+
+    const char *stateLabel(AlertState state)
+    {
+        switch (state)
+        {
+        case AlertState::Firing:
+            return "発報中";
+        case AlertState::Cooldown:
+            return "間隔待ち";
+        default:
+            return "正常";
+        }
+    }
+
+    ImVec4 stateColor(AlertState state)
+    {
+        switch (state)
+        {
+        case AlertState::Firing:
+            return ImVec4(1.0f, 0.35f, 0.3f, 1.0f);
+        case AlertState::Cooldown:
+            return ImVec4(1.0f, 0.75f, 0.3f, 1.0f);
+        default:
+            return ImVec4(0.5f, 0.85f, 0.5f, 1.0f);
+        }
+    }
+
+    // true なら編集したルールを反映する
+    bool drawEditor()
+    {
+        bool changed = false;
+        int removeAt = -1;
+        for (size_t i = 0; i < editing.size(); ++i)
+        {
+            AlertRule &rule = editing[i];
+            ImGui::PushID(static_cast<int>(i));
+            ImGui::Separator();
+            char name[64];
+            std::snprintf(name, sizeof(name), "%s", rule.name.c_str());
+            ImGui::SetNextItemWidth(160);
+            if (ImGui::InputText("名前", name, sizeof(name)))
+            {
+                rule.name = name;
+                changed = true;
+            }
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(200);
+            if (ImGui::BeginCombo("指標", alertMetricLabel(rule.metric)))
+            {
+                for (int m = 0; m < static_cast<int>(AlertMetric::Count); ++m)
+                {
+                    AlertMetric metric = static_cast<AlertMetric>(m);
+                    if (ImGui::Selectable(alertMetricLabel(metric), metric == rule.metric))
+                    {
+                        rule.metric = metric;
+                        changed = true;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            ImGui::SameLine();
+            if (ImGui::SmallButton("削除"))
+                removeAt = static_cast<int>(i);
+
+            ImGui::SetNextItemWidth(90);
+            changed |= ImGui::InputDouble("発報", &rule.raise, 0.0, 0.0, "%.2f");
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(90);
+            if (ImGui::InputDouble("解除", &rule.clear, 0.0, 0.0, "%.2f"))
+                changed = true;
+            // 解除のしきい値が発報以上だとヒステリシスがなくなる（そのままでは反映も保存もしない）
+            if (!validAlertRule(rule))
+                ImGui::TextColored(ImVec4(1.0f, 0.35f, 0.3f, 1.0f), "解除のしきい値は発報より小さくしてください");
+            ImGui::SetNextItemWidth(90);
+            if (ImGui::InputDouble("窓（秒）", &rule.windowSec, 0.0, 0.0, "%.0f"))
+            {
+                rule.windowSec = std::max(0.0, rule.windowSec);
+                changed = true;
+            }
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(90);
+            if (ImGui::InputDouble("間隔（秒）", &rule.cooldownSec, 0.0, 0.0, "%.0f"))
+            {
+                rule.cooldownSec = std::max(0.0, rule.cooldownSec);
+                changed = true;
+            }
+            ImGui::PopID();
+        }
+        if (removeAt >= 0)
+        {
+            editing.erase(editing.begin() + removeAt);
+            changed = true;
+        }
+        ImGui::Separator();
+        if (ImGui::Button("ルールを追加"))
+        {
+            AlertRule rule;
+            rule.name = "新しいルール";
+            rule.raise = 100.0;
+            rule.clear = 50.0;
+            editing.push_back(rule);
+            changed = true;
+        }
+        return changed;
+    }
+}
+
+void DrawAlertRules(AlertEngine &alerts, const std::string &rulesPath)
+{
+    alerts.snapshot(statuses);
+
+    // 畳んでいても発報中のものは見えるようにする
+    for (const AlertStatus &st : statuses)
+    {
+        if (st.state == AlertState::Firing)
+            ImGui::TextColored(stateColor(st.state), "アラート: %s（%.2f ≧ %.2f）", st.rule.name.c_str(), st.value, st.rule.raise);
+    }
+
+    if (!ImGui::CollapsingHeader("アラート"))
+        return;
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingStretchProp;
+    if (!statuses.empty() && ImGui::BeginTable("alerts", 5, flags))
+    {
+        ImGui::TableSetupColumn("ルール");
+        ImGui::TableSetupColumn("状態");
+        ImGui::TableSetupColumn("値");
+        ImGui::TableSetupColumn("発報 / 解除");
+        ImGui::TableSetupColumn("最終発報");
+        ImGui::TableHeadersRow();
+        for (const AlertStatus &st : statuses)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(st.rule.name.c_str());
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("%s", alertMetricLabel(st.rule.metric));
+            ImGui::TableNextColumn();
+            ImGui::TextColored(stateColor(st.state), "%s", stateLabel(st.state));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", st.value);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f / %.2f", st.rule.raise, st.rule.clear);
+            ImGui::TableNextColumn();
+            if (st.fireCount)
+            {
+                char buf[32];
+                formatTime(st.lastFiredMs, buf, sizeof(buf));
+                ImGui::Text("%s（%u回）", buf, st.fireCount);
+            }
+            else
+            {
+                ImGui::TextDisabled("-");
+            }
+        }
+        ImGui::EndTable();
+    }
+    else if (statuses.empty())
+    {
+        ImGui::TextDisabled("ルールがありません");
+    }
+
+    // テンプレートが変わったら読み込み直したルールを編集する
+    if ((ImGui::Checkbox("ルールを編集", &editOpen) && editOpen) || (editOpen && editingPath != rulesPath))
+    {
+        editing = alerts.rules();
+        editingPath = rulesPath;
+    }
+    if (!editOpen)
+        return;
+    const bool valid = std::all_of(editing.begin(), editing.end(), validAlertRule);
+    ImGui::SameLine();
+    ImGui::BeginDisabled(!valid);
+    if (ImGui::Button("保存"))
+        saveAlertRules(rulesPath, editing);
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    if (ImGui::Button("既定に戻す"))
+    {
+        editing = defaultAlertRules();
+        alerts.setRules(editing);
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("%s", rulesPath.c_str());
+    if (drawEditor() && std::all_of(editing.begin(), editing.end(), validAlertRule))
+        alerts.setRules(editing);
+}
@@ -0,0 +1,9 @@
+﻿#pragma once
+
+#include <string>
+
+class AlertEngine;
+
+// 情報ウィンドウにアラートの状態を出し、ルールを編集する
+// 編集したルールはすぐに評価に反映し、保存でテンプレートのルールファイル（rulesPath）に書く
+void DrawAlertRules(AlertEngine &alerts, const std::string &rulesPath);
@@ -0,0 +1,297 @@
+﻿#include "alert_rules.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    constexpr double kMinRateWindowSec = 10.0;
+
+    double effectiveWindowSec(const AlertRule &rule)
+    {
+        if (rule.metric == AlertMetric::ChangeRate)
+            return std::max(rule.windowSec, kMinRateWindowSec);
+        return std::max(rule.windowSec, 0.0);
+    }
+}
+
+const char *alertMetricName(AlertMetric metric)
+{
+    switch (metric)
+    {
+    case AlertMetric::ChangedPixels:
+        return "changed";
+    case AlertMetric::DiffPercent:
+        return "percent";
+    case AlertMetric::ChangeRate:
+        return "rate";
+    default:
+        return "unknown";
+    }
+}
+
+const char *alertMetricLabel(AlertMetric metric)
+{
+    switch (metric)
+    {
+    case AlertMetric::ChangedPixels:
+        return "変更ピクセル数";
+    case AlertMetric::DiffPercent:
+        return "差分率 %";
+    case AlertMetric::ChangeRate:
+        return "荒らしの速さ（ピクセル/分）";
+    default:
+        return "?";
+    }
+}
+
+void AlertEngine::Window::push(int64_t timeMs, double value)
+{
+    if (count == ring.size())
+    {
+        // 古い順に並べ直して倍に広げる
+        std::vector<Sample> grown(std::max<size_t>(16, ring.size() * 2));
+        for (size_t i = 0; i < count; ++i)
+            grown[i] = ring[(head + i) % ring.size()];
+        ring.swap(grown);
+        head = 0;
+    }
+    ring[(head + count) % ring.size()] = {timeMs, value};
+    ++count;
+    sum += value;
+}
+
+void AlertEngine::Window::expire(int64_t oldestMs)
+{
+    while (count > 0 && ring[head].timeMs < oldestMs)
+    {
+        sum -= ring[head].value;
+        head = (head + 1) % ring.size();
+        --count;
+    }
+    // 足し引きの丸め誤差をためない
+    if (count == 0)
+        sum = 0.0;
+}
+
+double AlertEngine::valueOf(const RuleState &rs, double sample)
+{
+    const double windowSec = effectiveWindowSec(rs.status.rule);
+    if (windowSec <= 0.0 || rs.window.count == 0)
+        return sample;
+    if (rs.status.rule.metric == AlertMetric::ChangeRate)
+        return rs.window.sum * 60.0 / windowSec;
+    return rs.window.sum / static_cast<double>(rs.window.count);
+}
+
+void AlertEngine::setRules(std::vector<AlertRule> rules)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<RuleState> next(rules.size());
+    for (size_t i = 0; i < rules.size(); ++i)
+    {
+        // しきい値や名前だけの変更なら窓と状態を引き継ぐ（編集のたびに発報し直さない）
+        if (i < rules_.size() && rules_[i].status.rule.metric == rules[i].metric &&
+            rules_[i].status.rule.windowSec == rules[i].windowSec)
+            next[i] = std::move(rules_[i]);
+        next[i].status.rule = std::move(rules[i]);
+    }
+    rules_.swap(next);
+}
+
+std::vector<AlertRule> AlertEngine::rules() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<AlertRule> out;
+    out.reserve(rules_.size());
+    for (const RuleState &rs : rules_)
+        out.push_back(rs.status.rule);
+    return out;
+}
+
+void AlertEngine::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (RuleState &rs : rules_)
+    {
+        AlertRule rule = std::move(rs.status.rule);
+        rs = RuleState();
+        rs.status.rule = std::move(rule);
+    }
+}
+
+void AlertEngine::evaluate(int64_t timeMs, int changed, double percent, int newlyWrong, std::vector<AlertTransition> &out)
+{
+    out.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (RuleState &rs : rules_)
+    {
+        AlertStatus &st = rs.status;
+        const AlertRule &rule = st.rule;
+        double sample = 0.0;
+        switch (rule.metric)
+        {
+        case AlertMetric::ChangedPixels:
+            sample = changed;
+            break;
+        case AlertMetric::DiffPercent:
+            sample = percent;
+            break;
+        default:
+            sample = newlyWrong;
+            break;
+        }
+
+        const double windowSec = effectiveWindowSec(rule);
+        if (windowSec > 0.0)
+        {
+            rs.window.push(timeMs, sample);
+            rs.window.expire(timeMs - static_cast<int64_t>(windowSec * 1000.0));
+        }
+        st.value = valueOf(rs, sample);
+
+        const bool above = st.value >= rule.raise;
+        const bool cooled = st.fireCount == 0 || timeMs - st.lastFiredMs >= static_cast<int64_t>(rule.cooldownSec * 1000.0);
+        switch (st.state)
+        {
+        case AlertState::Ok:
+        case AlertState::Cooldown:
+            if (above && cooled)
+            {
+                st.state = AlertState::Firing;
+                st.sinceMs = timeMs;
+                st.lastFiredMs = timeMs;
+                st.fireCount++;
+                out.push_back({rule.name, rule.metric, true, st.value, rule.raise, timeMs});
+            }
+            else if (st.state == AlertState::Ok && above)
+            {
+                st.state = AlertState::Cooldown;
+                st.sinceMs = timeMs;
+            }
+            else if (st.state == AlertState::Cooldown && st.value <= rule.clear)
+            {
+                st.state = AlertState::Ok;
+                st.sinceMs = timeMs;
+            }
+            break;
+        case AlertState::Firing:
+            if (st.value <= rule.clear)
+            {
+                st.state = AlertState::Ok;
+                st.sinceMs = timeMs;
+                out.push_back({rule.name, rule.metric, false, st.value, rule.clear, timeMs});
+            }
+            break;
+        }
+    }
+}
+
+void AlertEngine::snapshot(std::vector<AlertStatus> &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.clear();
+    out.reserve(rules_.size());
+    for (const RuleState &rs : rules_)
+        out.push_back(rs.status);
+}
+
+int AlertEngine::firingCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(std::count_if(rules_.begin(), rules_.end(), [](const RuleState &rs)
+                                          { return rs.status.state == AlertState::Firing; }));
+}
+
+std::vector<AlertRule> defaultAlertRules()
+{
+    return {
+        {"変更ピクセル", AlertMetric::ChangedPixels, 100.0, 50.0, 0.0, 300.0},
+        {"差分率", AlertMetric::DiffPercent, 5.0, 2.0, 60.0, 300.0},
+        {"荒らしの速さ", AlertMetric::ChangeRate, 50.0, 10.0, 120.0, 600.0},
+    };
+}
+
+bool validAlertRule(const AlertRule &rule)
+{
+    return rule.clear < rule.raise;
+}
+
+bool loadAlertRules(const std::string &path, std::vector<AlertRule> &rules)
+{
+    std::ifstream ifs(path);
+    if (!ifs.is_open())
+        return false;
+    rules.clear();
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.rfind("rule=", 0) != 0)
+            continue;
+        std::vector<std::string> fields;
+        std::stringstream ss(line.substr(5));
+        std::string field;
+        while (std::getline(ss, field, ','))
+            fields.push_back(field);
+        if (fields.size() != 6)
+        {
+            std::cerr << "アラートのルールを読めませんでした: " << line << std::endl;
+            continue;
+        }
+        try
+        {
+            AlertRule rule;
+            rule.name = fields[0];
+            rule.metric = AlertMetric::Count;
+            for (int m = 0; m < static_cast<int>(AlertMetric::Count); ++m)
+            {
+                if (fields[1] == alertMetricName(static_cast<AlertMetric>(m)))
+                    rule.metric = static_cast<AlertMetric>(m);
+            }
+            if (rule.metric == AlertMetric::Count)
+                throw std::invalid_argument(fields[1]);
+            rule.raise = std::stod(fields[2]);
+            rule.clear = std::stod(fields[3]);
+            rule.windowSec = std::stod(fields[4]);
+            rule.cooldownSec = std::stod(fields[5]);
+            if (!validAlertRule(rule))
+                throw std::invalid_argument("解除のしきい値が発報以上です");
+            rules.push_back(rule);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "アラートのルールを読めませんでした: " << line << " (" << e.what() << ")" << std::endl;
+        }
+    }
+    return true;
+}
+
+bool saveAlertRules(const std::string &path, const std::vector<AlertRule> &rules)
+{
+    std::ofstream ofs(path);
+    if (!ofs.is_open())
+    {
+        std::cerr << "アラートのルールを保存できませんでした: " << path << std::endl;
+        return false;
+    }
+    for (const AlertRule &rule : rules)
+    {
+        // 区切り文字は名前に使えない
+        std::string name = rule.name;
+        std::replace(name.begin(), name.end(), ',', ' ');
+        ofs << "rule=" << name << ',' << alertMetricName(rule.metric) << ',' << rule.raise << ',' << rule.clear << ','
+            << rule.windowSec << ',' << rule.cooldownSec << std::endl;
+    }
+    return true;
+}
+
+std::string alertRulesPath(const std::string &templatePath)
+{
+    return templatePath + ".alerts";
+}
@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 差分値のしきい値・変化の速さによるアラート
+//
+// ルールごとに時間窓のリング（時刻と値）と合計を持ち、周期ごとに1件足して窓から外れた分を引くだけで評価する
+// （償却 O(1)。窓の長さによらず過去の値を読み直さない）。
+// 発報と解除のしきい値を分けて（ヒステリシス）境目でのばたつきを抑え、解除後の再発報には最短間隔を設ける。
+// 更新スレッドが evaluate し、UIスレッドが snapshot で読む・ルールを書き換える（内部のミューテックスで保護）。
+
+enum class AlertMetric : uint8_t
+{
+    ChangedPixels, // 変更ピクセル数（窓があれば窓内の平均）
+    DiffPercent,   // 差分率 %（同上）
+    ChangeRate,    // 窓内で新たに間違いになったピクセル数（1分あたり）
+    Count
+};
+
+const char *alertMetricName(AlertMetric metric); // ルールファイルでの名前
+const char *alertMetricLabel(AlertMetric metric); // 表示名
+
+struct AlertRule
+{
+    std::string name;
+    AlertMetric metric = AlertMetric::ChangedPixels;
+    double raise = 0.0;        // この値以上で発報
+    double clear = 0.0;        // 発報中はこの値以下になるまで解除しない
+    double windowSec = 0.0;    // 0 なら最新の値そのもの（ChangeRate は最短 10 秒）
+    double cooldownSec = 300.0; // 発報してから次に発報できるまでの最短間隔
+};
+
+enum class AlertState : uint8_t
+{
+    Ok,
+    Firing,
+    Cooldown // 条件は満たしているが、前回の発報から間がないので待っている
+};
+
+struct AlertStatus
+{
+    AlertRule rule;
+    AlertState state = AlertState::Ok;
+    double value = 0.0;
+    int64_t sinceMs = 0;     // 今の状態になった時刻
+    int64_t lastFiredMs = 0;
+    uint32_t fireCount = 0;
+};
+
+// 発報・解除の通知
+struct AlertTransition
+{
+    std::string name;
+    AlertMetric metric = AlertMetric::ChangedPixels;
+    bool firing = false; // false なら解除
+    double value = 0.0;
+    double threshold = 0.0; // 発報なら raise、解除なら clear
+    int64_t timeMs = 0;
+};
+
+class AlertEngine
+{
+public:
+    // 指標か窓が変わったルールは窓と状態を作り直す
+    void setRules(std::vector<AlertRule> rules);
+    std::vector<AlertRule> rules() const;
+    // 監視対象が変わったとき（ルールはそのまま）
+    void reset();
+
+    // 1周期分の値で評価し、状態が変わったルールを out に入れる。newlyWrong はこの周期に間違いになったピクセル数
+    void evaluate(int64_t timeMs, int changed, double percent, int newlyWrong, std::vector<AlertTransition> &out);
+
+    void snapshot(std::vector<AlertStatus> &out) const;
+    int firingCount() const;
+
+private:
+    struct Sample
+    {
+        int64_t timeMs;
+        double value;
+    };
+
+    // 時間窓のリング（満杯になったら倍に広げる）
+    struct Window
+    {
+        std::vector<Sample> ring;
+        size_t head = 0; // 最も古いサンプル
+        size_t count = 0;
+        double sum = 0.0;
+
+        void push(int64_t timeMs, double value);
+        void expire(int64_t oldestMs);
+    };
+
+    struct RuleState
+    {
+        AlertStatus status;
+        Window window;
+    };
+
+    static double valueOf(const RuleState &rs, double sample);
+
+    mutable std::mutex mutex_;
+    std::vector<RuleState> rules_;
+};
+
+// 既定のルール（ルールファイルがないテンプレート用）
+std::vector<AlertRule> defaultAlertRules();
+// 解除のしきい値が発報より小さい（ヒステリシスがある）か。そうでないルールは読み込まない
+bool validAlertRule(const AlertRule &rule);
+// 1行1ルール（rule=名前,指標,発報,解除,窓秒,間隔秒）。ファイルがなければ false
+bool loadAlertRules(const std::string &path, std::vector<AlertRule> &rules);
+bool saveAlertRules(const std::string &path, const std::vector<AlertRule> &rules);
+// テンプレート画像に対応するルールファイルのパス
+std::string alertRulesPath(const std::string &templatePath);
@@ -0,0 +1,373 @@
+﻿// 取得・差分・転送パイプラインのベンチマーク
+//
+// テンプレートサイズ（256², 1k², 4k², 8k²）と不透明率の組み合わせで
+// applyAlphaMask / imageDifferenceSafe / タイルデコード / fetch_tiles_and_crop_cpp / テクスチャ転送 を計測する。
+// 結果は既定で bench_results.json（google-benchmark の JSON 形式）に出力される。
+//
+// fetch_tiles_and_crop_cpp はプロセス内のモックタイルサーバーに対して計測する。
+// 外部の mock_tile_server を使う場合は WPG_BENCH_TILE_URL=http://127.0.0.1:8080 を指定する。
+// テクスチャ転送は本体と同じ TiledTexture（ImTextureData）の転送と ImGui の OpenGL3 バックエンドの描画で、
+// 非表示ウィンドウのGLコンテキストで行う。Linux では Mesa の llvmpipe を使う。
+// WPG_BENCH_CAPTURE にタイルのキャプチャファイル（.wpc）を指定すると、記録した実際の応答を最速で再生して
+// 取得から差分までを通しで計測する（BM_ReplayCapture）。
+
+#include "image_pipeline.h"
+#include "gl_texture.h"
+#include "http_server.h"
+#include "tile_capture.h"
+#include "tiled_texture.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include "imgui_impl_opengl3.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int kSizes[] = {256, 1024, 4096, 8192};
+    const int kDensities[] = {10, 50, 100}; // 不透明ピクセルの割合(%)
+    constexpr int kTileSize = 1000;
+
+    // 不透明率 density% のテンプレートを生成する。色は少数の固定色から選ぶ
+    cv::Mat makeTemplate(int size, int density, unsigned seed = 1)
+    {
+        static const cv::Vec4b colors[] = {
+            cv::Vec4b(0, 0, 0, 255),
+            cv::Vec4b(255, 255, 255, 255),
+            cv::Vec4b(36, 28, 237, 255),
+            cv::Vec4b(228, 147, 64, 255),
+        };
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<int> pct(0, 99), col(0, 3);
+        cv::Mat img(size, size, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+        for (int y = 0; y < size; ++y)
+        {
+            cv::Vec4b *row = img.ptr<cv::Vec4b>(y);
+            for (int x = 0; x < size; ++x)
+            {
+                if (pct(rng) < density)
+                    row[x] = colors[col(rng)];
+            }
+        }
+        return img;
+    }
+
+    // src の約1%のピクセルを書き換えたコピーを返す
+    cv::Mat makeDamaged(const cv::Mat &src, unsigned seed = 2)
+    {
+        cv::Mat img = src.clone();
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<int> dx(0, img.cols - 1), dy(0, img.rows - 1);
+        int n = std::max(1, img.cols * img.rows / 100);
+        for (int i = 0; i < n; ++i)
+            img.at<cv::Vec4b>(dy(rng), dx(rng)) = cv::Vec4b(19, 230, 123, 255);
+        return img;
+    }
+
+    void sizeDensityArgs(benchmark::internal::Benchmark *b)
+    {
+        for (int size : kSizes)
+            for (int density : kDensities)
+                b->Args({size, density});
+        b->ArgNames({"size", "density"})->Unit(benchmark::kMillisecond);
+    }
+
+    void setPixelCounters(benchmark::State &state, int size)
+    {
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(size) * size);
+        state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size) * size * 4);
+    }
+
+    void BM_ApplyAlphaMask(benchmark::State &state)
+    {
+        int size = static_cast<int>(state.range(0));
+        cv::Mat tmpl = makeTemplate(size, static_cast<int>(state.range(1)));
+        cv::Mat live = makeDamaged(tmpl);
+        for (auto _ : state)
+        {
+            cv::Mat masked = applyAlphaMask(live, tmpl);
+            benchmark::DoNotOptimize(masked.data);
+        }
+        setPixelCounters(state, size);
+    }
+    BENCHMARK(BM_ApplyAlphaMask)->Apply(sizeDensityArgs);
+
+    void BM_ImageDifferenceSafe(benchmark::State &state)
+    {
+        int size = static_cast<int>(state.range(0));
+        cv::Mat tmpl = makeTemplate(size, static_cast<int>(state.range(1)));
+        cv::Mat live = applyAlphaMask(makeDamaged(tmpl), tmpl);
+        int changed = 0;
+        for (auto _ : state)
+        {
+            auto [diff, opaque, ch] = imageDifferenceSafe(tmpl, live);
+            benchmark::DoNotOptimize(diff.data);
+            changed = ch;
+        }
+        state.counters["changed"] = changed;
+        setPixelCounters(state, size);
+    }
+    BENCHMARK(BM_ImageDifferenceSafe)->Apply(sizeDensityArgs);
+
+    void BM_TileDecode(benchmark::State &state)
+    {
+        cv::Mat tile = makeTemplate(kTileSize, static_cast<int>(state.range(0)));
+        std::vector<uchar> png;
+        cv::imencode(".png", tile, png);
+        for (auto _ : state)
+        {
+            cv::Mat img = cv::imdecode(png, cv::IMREAD_UNCHANGED);
+            benchmark::DoNotOptimize(img.data);
+        }
+        state.counters["png_bytes"] = static_cast<double>(png.size());
+        setPixelCounters(state, kTileSize);
+    }
+    BENCHMARK(BM_TileDecode)->Arg(10)->Arg(50)->Arg(100)->ArgName("density")->Unit(benchmark::kMillisecond);
+
+    // プロセス内モックサーバー。不透明率ごとに1枚のタイルを全座標で使い回す
+    class InProcessTileServer
+    {
+    public:
+        std::string baseUrl(int density)
+        {
+            if (const char *url = std::getenv("WPG_BENCH_TILE_URL"))
+                return url;
+            if (!server_.running())
+            {
+                // サーバースレッドが tiles_ を読むので、起動前にすべての不透明率のタイルを登録しておく
+                for (int d : kDensities)
+                {
+                    std::vector<uchar> png;
+                    cv::imencode(".png", makeTemplate(kTileSize, d), png);
+                    tiles_[d] = std::string(png.begin(), png.end());
+                }
+                server_.start("127.0.0.1", 0, [this](const HttpRequest &req)
+                              {
+                    HttpResponse res;
+                    int d = 0, tx = 0, ty = 0;
+                    if (std::sscanf(req.path.c_str(), "/d%d/files/s0/tiles/%d/%d.png", &d, &tx, &ty) != 3 || !tiles_.count(d))
+                    {
+                        res.status = 404;
+                        return res;
+                    }
+                    res.contentType = "image/png";
+                    res.body = tiles_.at(d);
+                    return res; });
+            }
+            return "http://127.0.0.1:" + std::to_string(server_.port()) + "/d" + std::to_string(density);
+        }
+
+    private:
+        HttpServer server_;
+        std::map<int, std::string> tiles_; // サーバーの起動前に登録し、以後は読み取りのみ
+    };
+
+    InProcessTileServer &tileServer()
+    {
+        static InProcessTileServer server;
+        return server;
+    }
+
+    void BM_FetchTilesAndCrop(benchmark::State &state)
+    {
+        int size = static_cast<int>(state.range(0));
+        std::string url = tileServer().baseUrl(static_cast<int>(state.range(1)));
+        for (auto _ : state)
+        {
+            // タイル境界をまたぐように開始位置をずらす
+            cv::Mat img = fetch_tiles_and_crop_cpp(url, 0, 0, 500, 500, size, size, kTileSize);
+            if (img.empty())
+            {
+                state.SkipWithError("タイルを取得できませんでした");
+                break;
+            }
+            benchmark::DoNotOptimize(img.data);
+        }
+        int tilesPerSide = (500 + size) / kTileSize + 1;
+        state.counters["tiles"] = tilesPerSide * tilesPerSide;
+        setPixelCounters(state, size);
+    }
+    BENCHMARK(BM_FetchTilesAndCrop)->Apply(sizeDensityArgs)->UseRealTime();
+
+    GLFWwindow *glWindow = nullptr;
+    constexpr int kViewSize = 64;
+
+    // 非表示ウィンドウでGLコンテキストと、タイルを描く ImGui（OpenGL3 バックエンド）を用意する。失敗時は nullptr
+    GLFWwindow *glContext()
+    {
+        static bool tried = false;
+        if (tried)
+            return glWindow;
+        tried = true;
+        if (!glfwInit())
+            return nullptr;
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glWindow = glfwCreateWindow(kViewSize, kViewSize, "bench", nullptr, nullptr);
+        if (!glWindow)
+            return nullptr;
+        glfwMakeContextCurrent(glWindow);
+        glewExperimental = GL_TRUE;
+        glewInit();
+
+        ImGui::CreateContext();
+        ImGui::GetIO().IniFilename = nullptr;
+        ImGui_ImplOpenGL3_Init("#version 330 core");
+        TiledTexture::setDrawCallback(bindNearestSampler);
+        return glWindow;
+    }
+
+    // tex を画面全体に描く1フレーム。タイルの作成・転送の要求はバックエンドが描画の前に処理する
+    void renderFrame(const TiledTexture &tex)
+    {
+        ImGuiIO &io = ImGui::GetIO();
+        io.DisplaySize = ImVec2(kViewSize, kViewSize);
+        io.DeltaTime = 1.0f / 60.0f;
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui::NewFrame();
+        tex.draw(ImGui::GetBackgroundDrawList(), ImVec2(0, 0), ImVec2(kViewSize, kViewSize), ImVec2(0, 0), ImVec2(1, 1));
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        TiledTexture::endFrame();
+        glFinish();
+    }
+
+    // 1反復 = TiledTexture::create（前の画像のタイルの破棄を含む）と描画1フレーム
+    void BM_TiledTextureCreate(benchmark::State &state)
+    {
+        if (!glContext())
+        {
+            state.SkipWithError("GLコンテキストを作成できませんでした");
+            return;
+        }
+        int size = static_cast<int>(state.range(0));
+        cv::Mat img = makeTemplate(size, 100);
+        TiledTexture tex;
+        for (auto _ : state)
+        {
+            tex.create(img);
+            renderFrame(tex);
+        }
+        tex.release();
+        renderFrame(tex);
+        setPixelCounters(state, size);
+    }
+    BENCHMARK(BM_TiledTextureCreate)->Arg(256)->Arg(1024)->Arg(4096)->Arg(8192)->ArgName("size")->Unit(benchmark::kMillisecond)->UseRealTime();
+
+    // 1反復 = TiledTexture::upload と描画1フレーム。
+    // changed=1 は約1%のピクセルが散らばって変わった画像と交互に送る（ほぼ全タイルを転送）、changed=0 は同じ画像（ハッシュの比較だけ）
+    void BM_TiledTextureUpload(benchmark::State &state)
+    {
+        if (!glContext())
+        {
+            state.SkipWithError("GLコンテキストを作成できませんでした");
+            return;
+        }
+        int size = static_cast<int>(state.range(0));
+        bool changed = state.range(1) != 0;
+        cv::Mat frames[2] = {makeTemplate(size, 100), cv::Mat()};
+        frames[1] = changed ? makeDamaged(frames[0]) : frames[0];
+        TiledTexture tex;
+        tex.create(frames[0]);
+        renderFrame(tex);
+        int64_t tiles = 0, i = 0;
+        for (auto _ : state)
+        {
+            tex.upload(frames[++i & 1]);
+            renderFrame(tex);
+            tiles += tex.uploadedTiles();
+        }
+        tex.release();
+        renderFrame(tex);
+        state.counters["tiles_per_upload"] = state.iterations() ? static_cast<double>(tiles) / state.iterations() : 0.0;
+        setPixelCounters(state, size);
+    }
+    BENCHMARK(BM_TiledTextureUpload)
+        ->ArgsProduct({{256, 1024, 4096, 8192}, {0, 1}})
+        ->ArgNames({"size", "changed"})
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+    // 1反復 = キャプチャ全体を待ちなしで1回再生し、周期ごとにデコード・合成・前の周期との差分まで行う
+    void BM_ReplayCapture(benchmark::State &state, const std::string &path)
+    {
+        TileCaptureInfo info;
+        if (!readTileCaptureInfo(path, info) || info.cycles == 0)
+        {
+            state.SkipWithError("キャプチャファイルを読めませんでした");
+            return;
+        }
+        const CaptureRegion &r = info.region;
+        int64_t frames = 0;
+        for (auto _ : state)
+        {
+            if (!startTileReplay({path, 0.0, false}))
+            {
+                state.SkipWithError("キャプチャファイルを再生できませんでした");
+                break;
+            }
+            cv::Mat previous;
+            while (tileReplayActive())
+            {
+                cv::Mat img = fetch_tiles_and_crop_cpp("replay", r.tileX, r.tileY, r.pixelX, r.pixelY, r.width, r.height, r.tileSize);
+                if (img.empty())
+                    continue;
+                if (!previous.empty())
+                    benchmark::DoNotOptimize(std::get<2>(imageDifferenceSafe(previous, img)));
+                previous = img;
+                frames++;
+            }
+        }
+        stopTileReplay();
+        state.counters["cycles"] = static_cast<double>(info.cycles);
+        state.counters["frames_per_sec"] = benchmark::Counter(static_cast<double>(frames), benchmark::Counter::kIsRate);
+    }
+}
+
+int main(int argc, char **argv)
+{
+#ifndef _WIN32
+    // ハードウェアに依存しない結果にするため Mesa のソフトウェアラスタライザを使う
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+#endif
+
+    // 出力先の指定がなければ JSON を bench_results.json に書き出す
+    std::vector<char *> args(argv, argv + argc);
+    bool hasOut = false;
+    for (int i = 1; i < argc; ++i)
+        hasOut |= std::string(argv[i]).rfind("--benchmark_out=", 0) == 0;
+    std::string outArg = "--benchmark_out=bench_results.json";
+    std::string fmtArg = "--benchmark_out_format=json";
+    if (!hasOut)
+    {
+        args.push_back(&outArg[0]);
+        args.push_back(&fmtArg[0]);
+    }
+    int n = static_cast<int>(args.size());
+
+    if (const char *capture = std::getenv("WPG_BENCH_CAPTURE"))
+        benchmark::RegisterBenchmark("BM_ReplayCapture", BM_ReplayCapture, std::string(capture))->Unit(benchmark::kMillisecond)->UseRealTime();
+
+    benchmark::Initialize(&n, args.data());
+    if (benchmark::ReportUnrecognizedArguments(n, args.data()))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    if (glWindow)
+    {
+        releaseNearestSampler();
+        ImGui_ImplOpenGL3_Shutdown();
+        TiledTexture::shutdown();
+        ImGui::DestroyContext();
+        glfwDestroyWindow(glWindow);
+    }
+    glfwTerminate();
+    return 0;
+}
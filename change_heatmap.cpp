@@ -0,0 +1,139 @@
+﻿#include "change_heatmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // 最近の回数の固定小数点（下位4ビットが小数部）
+    constexpr int kRecentShift = 4;
+    constexpr uint32_t kRecentOne = 1u << kRecentShift;
+
+    // 0..255 を透明 → 黄 → 赤 に割り当てる
+    cv::Vec4b heatColor(int t)
+    {
+        uint8_t g = static_cast<uint8_t>(t < 128 ? 255 : 255 - (t - 128) * 2);
+        uint8_t a = static_cast<uint8_t>(64 + t * 191 / 255);
+        return cv::Vec4b(0, g, 255, a);
+    }
+}
+
+void ChangeHeatmap::reset(int width, int height)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    width_ = width;
+    height_ = height;
+    allTime_.assign(static_cast<size_t>(width) * height, 0);
+    recent_.assign(static_cast<size_t>(width) * height, 0);
+    previous_.release();
+    lastTimeMs_ = 0;
+    pendingDecayMs_ = 0.0;
+    ++generation_;
+    ++version_;
+}
+
+void ChangeHeatmap::setHalfLifeMinutes(double minutes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    halfLifeMs_ = std::max(1.0, minutes) * 60.0 * 1000.0;
+}
+
+void ChangeHeatmap::update(const cv::Mat &realtime, const cv::Mat &templ, int64_t timeMs, uint64_t generation)
+{
+    if (realtime.empty() || realtime.type() != CV_8UC4 || templ.type() != CV_8UC4 || realtime.size() != templ.size())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 取得中にテンプレートが差し替わった（前の領域の画像）
+    if (generation != generation_)
+        return;
+    if (realtime.cols != width_ || realtime.rows != height_)
+    {
+        width_ = realtime.cols;
+        height_ = realtime.rows;
+        allTime_.assign(static_cast<size_t>(width_) * height_, 0);
+        recent_.assign(static_cast<size_t>(width_) * height_, 0);
+        previous_.release();
+    }
+
+    // 減衰は半減期の1/8がたまるごとにまとめてかける（毎周期かけると固定小数点の丸めで1回分が数周期で消える）
+    uint32_t decay = 65536;
+    if (lastTimeMs_ > 0 && timeMs > lastTimeMs_)
+        pendingDecayMs_ += static_cast<double>(timeMs - lastTimeMs_);
+    lastTimeMs_ = timeMs;
+    if (pendingDecayMs_ >= halfLifeMs_ / 8.0)
+    {
+        decay = static_cast<uint32_t>(std::lround(65536.0 * std::exp2(-pendingDecayMs_ / halfLifeMs_)));
+        pendingDecayMs_ = 0.0;
+    }
+
+    // 初回は比較する前回の画像がないので記録だけする
+    const bool first = previous_.empty();
+    const int w = width_;
+    cv::parallel_for_(cv::Range(0, height_), [&](const cv::Range &rows)
+                      {
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            const uint32_t *rt = realtime.ptr<uint32_t>(y);
+            const uint32_t *tp = templ.ptr<uint32_t>(y);
+            const uint32_t *pv = first ? nullptr : previous_.ptr<uint32_t>(y);
+            uint16_t *all = allTime_.data() + static_cast<size_t>(y) * w;
+            uint16_t *rec = recent_.data() + static_cast<size_t>(y) * w;
+            for (int x = 0; x < w; ++x)
+            {
+                uint32_t r = rec[x];
+                if (decay != 65536)
+                    r = (r * decay + 32768) >> 16;
+                // テンプレートの不透明部分で、前回から変わって今は間違っているピクセル
+                if (pv && (tp[x] >> 24) && rt[x] != pv[x] && rt[x] != tp[x])
+                {
+                    if (all[x] != UINT16_MAX)
+                        ++all[x];
+                    r = std::min<uint32_t>(r + kRecentOne, UINT16_MAX);
+                }
+                rec[x] = static_cast<uint16_t>(r);
+            }
+        } });
+
+    realtime.copyTo(previous_);
+    ++version_;
+}
+
+void ChangeHeatmap::colorize(HeatmapMode mode, cv::Mat &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.create(height_, width_, CV_8UC4);
+    if (width_ == 0 || height_ == 0)
+        return;
+
+    const std::vector<uint16_t> &counts = mode == HeatmapMode::Recent ? recent_ : allTime_;
+    // 最近の回数は1回未満を表示しない
+    const uint16_t threshold = mode == HeatmapMode::Recent ? kRecentOne / 2 : 1;
+    const uint16_t peak = *std::max_element(counts.begin(), counts.end());
+
+    // 回数 → 色の表（対数目盛りで 0..peak を 256 段階に分ける）。ピクセルごとの対数計算を避ける
+    std::vector<cv::Vec4b> lut(static_cast<size_t>(peak) + 1, cv::Vec4b(0, 0, 0, 0));
+    const double scale = peak > threshold ? 255.0 / std::log1p(static_cast<double>(peak)) : 0.0;
+    for (uint32_t i = threshold; i <= peak; ++i)
+        lut[i] = heatColor(std::min(255, static_cast<int>(std::log1p(static_cast<double>(i)) * scale)));
+
+    for (int y = 0; y < height_; ++y)
+    {
+        const uint16_t *src = counts.data() + static_cast<size_t>(y) * width_;
+        cv::Vec4b *dst = out.ptr<cv::Vec4b>(y);
+        for (int x = 0; x < width_; ++x)
+            dst[x] = lut[src[x]];
+    }
+}
+
+double ChangeHeatmap::countAt(HeatmapMode mode, int x, int y) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (x < 0 || y < 0 || x >= width_ || y >= height_)
+        return 0.0;
+    size_t i = static_cast<size_t>(y) * width_ + x;
+    if (mode == HeatmapMode::Recent)
+        return static_cast<double>(recent_[i]) / kRecentOne;
+    return allTime_[i];
+}
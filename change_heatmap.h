@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// ピクセルごとの荒らし回数のヒートマップ
+//
+// 各周期で「前回から色が変わり、かつテンプレートと違う」ピクセルを1回と数える。
+// 全期間の回数と、半減期で減衰させた最近の回数をそれぞれ16ビットの配列で持ち、
+// 履歴を読み直さずに周期ごとの差分だけで更新する。
+// 更新スレッドが update し、描画スレッドが colorize で読む（内部のミューテックスで保護）。
+// update は imgMutex の外で呼べるように、reset のたびに増える世代を受け取り、古い世代の画像は捨てる。
+
+enum class HeatmapMode
+{
+    Recent, // 半減期で減衰させた回数
+    AllTime // 全期間の回数（65535で飽和）
+};
+
+class ChangeHeatmap
+{
+public:
+    // 大きさが変わったら数え直す
+    void reset(int width, int height);
+    void setHalfLifeMinutes(double minutes);
+
+    // realtime と templ はどちらも CV_8UC4 で同じ大きさ。
+    // generation は templ を取ったときの generation()。その後に reset されていたら何もしない
+    void update(const cv::Mat &realtime, const cv::Mat &templ, int64_t timeMs, uint64_t generation);
+
+    // 回数を色に変換する（少ない所は透明、多い所ほど赤）。対数目盛りで最大値に合わせる
+    void colorize(HeatmapMode mode, cv::Mat &out) const;
+    // 指定ピクセルの回数（最近の回数は小数）
+    double countAt(HeatmapMode mode, int x, int y) const;
+
+    // update のたびに増える。描画側はこれが変わったときだけ色を作り直す
+    uint64_t version() const { return version_; }
+    // reset のたびに増える
+    uint64_t generation() const { return generation_; }
+
+private:
+    mutable std::mutex mutex_;
+    int width_ = 0, height_ = 0;
+    std::vector<uint16_t> allTime_;
+    std::vector<uint16_t> recent_; // 12.4 固定小数点
+    cv::Mat previous_;             // 前回の画像（変化の検出用）
+    int64_t lastTimeMs_ = 0;
+    double pendingDecayMs_ = 0.0; // まだかけていない減衰の時間
+    double halfLifeMs_ = 60.0 * 60.0 * 1000.0;
+    std::atomic<uint64_t> version_{0};
+    std::atomic<uint64_t> generation_{0};
+};
@@ -0,0 +1,164 @@
+﻿#include "cluster_panel.h"
+
+#include "imgui.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+namespace
+{
+    // 一覧を作り直す最短の間隔
+    constexpr double kRefreshSec = 0.5;
+
+    enum Column
+    {
+        ColumnId,
+        ColumnPixels,
+        ColumnBounds,
+        ColumnFirstSeen,
+        ColumnLastChanged
+    };
+
+    std::vector<DamageCluster> clusters;
+    std::vector<DamageCluster> rows; // 絞り込み・並べ替え後
+    uint64_t shownVersion = UINT64_MAX;
+    double lastRefresh = -1.0;
+    int minPixels = 1;
+    bool resort = true;
+    uint32_t selectedId = 0;
+
+    void formatTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::localtime(&t);
+        if (!tm || !std::strftime(buf, size, "%m/%d %H:%M:%S", tm))
+            std::snprintf(buf, size, "-");
+    }
+
+    void sortRows(const ImGuiTableSortSpecs *specs)
+    {
+        if (!specs || specs->SpecsCount == 0)
+            return;
+        const ImGuiTableColumnSortSpecs &spec = specs->Specs[0];
+        const bool ascending = spec.SortDirection == ImGuiSortDirection_Ascending;
+        auto key = [&](const DamageCluster &c) -> int64_t
+        {
+            switch (spec.ColumnUserID)
+            {
+            case ColumnPixels:
+                return c.pixels;
+            case ColumnBounds:
+                return static_cast<int64_t>(c.maxX - c.minX + 1) * (c.maxY - c.minY + 1);
+            case ColumnFirstSeen:
+                return c.firstSeenMs;
+            case ColumnLastChanged:
+                return c.lastChangedMs;
+            default:
+                return c.id;
+            }
+        };
+        std::stable_sort(rows.begin(), rows.end(), [&](const DamageCluster &a, const DamageCluster &b)
+                         { return ascending ? key(a) < key(b) : key(a) > key(b); });
+    }
+}
+
+bool DrawClusterWindow(bool *open, const DamageTracker &tracker, DamageCluster &selected)
+{
+    if (!*open)
+        return false;
+    bool clicked = false;
+    ImGui::Begin("損傷領域", open);
+
+    double now = ImGui::GetTime();
+    if (tracker.version() != shownVersion && (lastRefresh < 0 || now - lastRefresh >= kRefreshSec))
+    {
+        shownVersion = tracker.version();
+        lastRefresh = now;
+        tracker.snapshot(clusters);
+        resort = true;
+        // 選択中の領域は最新の範囲に合わせる（消えたら選択を外す）
+        if (selectedId)
+        {
+            auto it = std::find_if(clusters.begin(), clusters.end(), [](const DamageCluster &c)
+                                   { return c.id == selectedId; });
+            if (it != clusters.end())
+                selected = *it;
+            else
+                selectedId = selected.id = 0;
+        }
+    }
+
+    ImGui::SetNextItemWidth(100);
+    if (ImGui::InputInt("最小ピクセル数", &minPixels))
+    {
+        minPixels = std::max(1, minPixels);
+        resort = true;
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("%zu 領域 / 間違い %d ピクセル", clusters.size(), tracker.wrongPixels());
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+                                  ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable | ImGuiTableFlags_SizingStretchProp;
+    if (ImGui::BeginTable("clusters", 5, flags))
+    {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("ID", ImGuiTableColumnFlags_None, 0.0f, ColumnId);
+        ImGui::TableSetupColumn("ピクセル数", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending, 0.0f, ColumnPixels);
+        ImGui::TableSetupColumn("範囲", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, ColumnBounds);
+        ImGui::TableSetupColumn("初検出", ImGuiTableColumnFlags_None, 0.0f, ColumnFirstSeen);
+        ImGui::TableSetupColumn("最終変化", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, ColumnLastChanged);
+        ImGui::TableHeadersRow();
+
+        ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs();
+        if (resort || (specs && specs->SpecsDirty))
+        {
+            rows.clear();
+            for (const DamageCluster &c : clusters)
+            {
+                if (c.pixels >= minPixels)
+                    rows.push_back(c);
+            }
+            sortRows(specs);
+            if (specs)
+                specs->SpecsDirty = false;
+            resort = false;
+        }
+
+        // 数万領域でも見えている行だけ描く
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(rows.size()));
+        while (clipper.Step())
+        {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+            {
+                const DamageCluster &c = rows[i];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                char label[32];
+                std::snprintf(label, sizeof(label), "%u", c.id);
+                if (ImGui::Selectable(label, c.id == selectedId, ImGuiSelectableFlags_SpanAllColumns))
+                {
+                    selectedId = c.id;
+                    selected = c;
+                    clicked = true;
+                }
+                ImGui::TableNextColumn();
+                ImGui::Text("%d", c.pixels);
+                ImGui::TableNextColumn();
+                ImGui::Text("(%d, %d) %dx%d", c.minX, c.minY, c.maxX - c.minX + 1, c.maxY - c.minY + 1);
+                char buf[32];
+                ImGui::TableNextColumn();
+                formatTime(c.firstSeenMs, buf, sizeof(buf));
+                ImGui::TextUnformatted(buf);
+                ImGui::TableNextColumn();
+                formatTime(c.lastChangedMs, buf, sizeof(buf));
+                ImGui::TextUnformatted(buf);
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+    return clicked;
+}
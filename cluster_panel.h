@@ -0,0 +1,8 @@
+﻿#pragma once
+
+#include "damage_clusters.h"
+
+// 損傷領域ウィンドウ
+// 領域の一覧を並べ替えられる表で表示する。行をクリックすると selected に入れて true を返す（差分画像の拡大に使う）
+// 選択中の領域が更新されたら selected も更新し、消えたら selected.id を 0 にする
+bool DrawClusterWindow(bool *open, const DamageTracker &tracker, DamageCluster &selected);
@@ -0,0 +1,456 @@
+﻿#include "damage_clusters.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr int kDx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    constexpr int kDy[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+
+    // 周囲8マスの間違い（ビット）が8近傍で何個のまとまりになるか
+    struct RingComponents
+    {
+        uint8_t count[256];
+
+        RingComponents()
+        {
+            for (int mask = 0; mask < 256; ++mask)
+            {
+                int seen = 0, components = 0;
+                for (int start = 0; start < 8; ++start)
+                {
+                    if (!(mask & (1 << start)) || (seen & (1 << start)))
+                        continue;
+                    ++components;
+                    int stack[8], top = 0;
+                    stack[top++] = start;
+                    seen |= 1 << start;
+                    while (top)
+                    {
+                        int i = stack[--top];
+                        for (int j = 0; j < 8; ++j)
+                        {
+                            if ((mask & (1 << j)) && !(seen & (1 << j)) &&
+                                std::abs(kDx[i] - kDx[j]) <= 1 && std::abs(kDy[i] - kDy[j]) <= 1)
+                            {
+                                seen |= 1 << j;
+                                stack[top++] = j;
+                            }
+                        }
+                    }
+                }
+                count[mask] = static_cast<uint8_t>(components);
+            }
+        }
+    };
+
+    const RingComponents &ringComponents()
+    {
+        static const RingComponents table;
+        return table;
+    }
+
+    void extend(DamageCluster &c, int x, int y)
+    {
+        c.minX = std::min(c.minX, x);
+        c.minY = std::min(c.minY, y);
+        c.maxX = std::max(c.maxX, x);
+        c.maxY = std::max(c.maxY, y);
+    }
+}
+
+void DamageTracker::reset(int width, int height)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    clear(width, height);
+    ++version_;
+}
+
+void DamageTracker::clear(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    wrong_.assign(static_cast<size_t>(width) * height, 0);
+    parent_.assign(static_cast<size_t>(width) * height, -1);
+    clusters_.clear();
+    wrongCount_ = 0;
+    nextId_ = 1;
+    baseline_ = true;
+}
+
+int32_t DamageTracker::find(int32_t p)
+{
+    while (parent_[p] != p)
+    {
+        parent_[p] = parent_[parent_[p]];
+        p = parent_[p];
+    }
+    return p;
+}
+
+void DamageTracker::link(int32_t a, int32_t b)
+{
+    int32_t ra = find(a), rb = find(b);
+    if (ra == rb)
+        return;
+    auto ia = clusters_.find(ra), ib = clusters_.find(rb);
+    // 情報を持つ根（両方なら大きい方、どちらもなければ番号の小さい方）を残す
+    bool keepA;
+    if (ia != clusters_.end() && ib != clusters_.end())
+        keepA = ia->second.info.pixels >= ib->second.info.pixels;
+    else if (ia != clusters_.end() || ib != clusters_.end())
+        keepA = ia != clusters_.end();
+    else
+        keepA = ra < rb;
+    if (keepA)
+    {
+        std::swap(ra, rb);
+        std::swap(ia, ib);
+    }
+    parent_[ra] = rb;
+    if (ia != clusters_.end())
+        merged_.push_back(ra);
+}
+
+bool DamageTracker::removalKeepsShape(int32_t p) const
+{
+    const int x = p % width_, y = p / width_;
+    int mask = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        int nx = x + kDx[i], ny = y + kDy[i];
+        if (nx >= 0 && ny >= 0 && nx < width_ && ny < height_ && wrong_[ny * width_ + nx])
+            mask |= 1 << i;
+    }
+    // 周囲の間違いピクセルが3x3内でつながっていれば、このピクセルを通る経路は迂回できる
+    return ringComponents().count[mask] == 1;
+}
+
+void DamageTracker::markDirty(int32_t root)
+{
+    ClusterState &state = clusters_[root];
+    if (!state.dirty)
+    {
+        state.dirty = true;
+        dirty_.push_back(root);
+    }
+}
+
+void DamageTracker::rebuild(int32_t root)
+{
+    auto it = clusters_.find(root);
+    if (it == clusters_.end())
+        return;
+    const DamageCluster old = it->second.info;
+    const Span span = it->second.span;
+    clusters_.erase(it);
+
+    // 範囲内でこの木に属するピクセル（直ったものを含む）を集めてつなぎ直す
+    scratch_.clear();
+    for (int y = span.minY; y <= span.maxY; ++y)
+    {
+        for (int x = span.minX; x <= span.maxX; ++x)
+        {
+            int32_t q = y * width_ + x;
+            if (parent_[q] != -1 && find(q) == root)
+                scratch_.push_back(q);
+        }
+    }
+    for (int32_t q : scratch_)
+        parent_[q] = wrong_[q] ? q : -1;
+    // 走査順に並んでいるので、左・左上・上・右上とだけつなげばよい
+    for (int32_t q : scratch_)
+    {
+        if (!wrong_[q])
+            continue;
+        const int x = q % width_, y = q / width_;
+        for (int i = 6; i < 10; ++i)
+        {
+            int nx = x + kDx[i & 7], ny = y + kDy[i & 7];
+            if (nx < 0 || ny < 0 || nx >= width_)
+                continue;
+            int32_t n = ny * width_ + nx;
+            if (!wrong_[n] || parent_[n] == -1)
+                continue;
+            int32_t ra = find(q), rb = find(n);
+            if (ra != rb)
+                parent_[std::max(ra, rb)] = std::min(ra, rb);
+        }
+    }
+
+    // 分かれた領域ごとに集計する。一番大きいものが番号を引き継ぐ
+    std::vector<int32_t> pieces;
+    int32_t lastRoot = -1;
+    ClusterState *piece = nullptr;
+    for (int32_t q : scratch_)
+    {
+        if (!wrong_[q])
+            continue;
+        const int x = q % width_, y = q / width_;
+        int32_t r = find(q);
+        if (r != lastRoot)
+        {
+            lastRoot = r;
+            piece = &clusters_[r];
+            if (piece->info.id == 0)
+            {
+                piece->info = old;
+                piece->info.pixels = 0;
+                piece->info.minX = piece->info.maxX = x;
+                piece->info.minY = piece->info.maxY = y;
+                pieces.push_back(r);
+            }
+        }
+        extend(piece->info, x, y);
+        piece->info.pixels++;
+    }
+    int32_t largest = -1;
+    for (int32_t r : pieces)
+    {
+        ClusterState &state = clusters_[r];
+        state.span = {state.info.minX, state.info.minY, state.info.maxX, state.info.maxY};
+        if (largest == -1 || state.info.pixels > clusters_[largest].info.pixels)
+            largest = r;
+    }
+    for (int32_t r : pieces)
+    {
+        if (r != largest)
+            clusters_[r].info.id = nextId_++;
+    }
+}
+
+bool DamageTracker::rowHasRoot(int y, int minX, int maxX, int32_t root)
+{
+    for (int x = minX; x <= maxX; ++x)
+    {
+        int32_t q = y * width_ + x;
+        if (wrong_[q] && parent_[q] != -1 && find(q) == root)
+            return true;
+    }
+    return false;
+}
+
+bool DamageTracker::columnHasRoot(int x, int minY, int maxY, int32_t root)
+{
+    for (int y = minY; y <= maxY; ++y)
+    {
+        int32_t q = y * width_ + x;
+        if (wrong_[q] && parent_[q] != -1 && find(q) == root)
+            return true;
+    }
+    return false;
+}
+
+void DamageTracker::tighten(int32_t root)
+{
+    auto it = clusters_.find(root);
+    if (it == clusters_.end() || !it->second.tighten)
+        return;
+    it->second.tighten = false;
+    DamageCluster &c = it->second.info;
+    // 端の行・列にこの領域のピクセルが残っていなければ内側へ縮める（span はそのまま）
+    while (c.minY < c.maxY && !rowHasRoot(c.minY, c.minX, c.maxX, root))
+        ++c.minY;
+    while (c.maxY > c.minY && !rowHasRoot(c.maxY, c.minX, c.maxX, root))
+        --c.maxY;
+    while (c.minX < c.maxX && !columnHasRoot(c.minX, c.minY, c.maxY, root))
+        ++c.minX;
+    while (c.maxX > c.minX && !columnHasRoot(c.maxX, c.minY, c.maxY, root))
+        --c.maxX;
+}
+
+void DamageTracker::update(const cv::Mat &realtime, const cv::Mat &templ, int64_t timeMs)
+{
+    added_.clear();
+    removed_.clear();
+    lastBaseline_ = false;
+    if (realtime.empty() || realtime.type() != CV_8UC4 || templ.type() != CV_8UC4 || realtime.size() != templ.size())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (realtime.cols != width_ || realtime.rows != height_)
+        clear(realtime.cols, realtime.rows);
+    lastBaseline_ = baseline_;
+    baseline_ = false;
+
+    // 間違いになったピクセルと直ったピクセル
+    for (int y = 0; y < height_; ++y)
+    {
+        const uint32_t *rt = realtime.ptr<uint32_t>(y);
+        const uint32_t *tp = templ.ptr<uint32_t>(y);
+        const uint8_t *wr = wrong_.data() + static_cast<size_t>(y) * width_;
+        for (int x = 0; x < width_; ++x)
+        {
+            const uint8_t now = (tp[x] >> 24) && rt[x] != tp[x];
+            if (now != wr[x])
+                (now ? added_ : removed_).push_back(y * width_ + x);
+        }
+    }
+    if (added_.empty() && removed_.empty())
+        return;
+
+    // 直ったピクセル: 形が変わらなければ数を減らすだけ、そうでなければ組み直す
+    dirty_.clear();
+    tightened_.clear();
+    for (int32_t p : removed_)
+    {
+        wrong_[p] = 0;
+        --wrongCount_;
+        int32_t root = find(p);
+        ClusterState &state = clusters_[root];
+        if (state.dirty)
+            continue;
+        if (state.info.pixels > 1 && removalKeepsShape(p))
+        {
+            state.info.pixels--;
+            const int x = p % width_, y = p / width_;
+            if (!state.tighten && (x == state.info.minX || x == state.info.maxX || y == state.info.minY || y == state.info.maxY))
+            {
+                state.tighten = true;
+                tightened_.push_back(root);
+            }
+        }
+        else
+        {
+            markDirty(root);
+        }
+    }
+    // 以前どこかの領域に属していたピクセルがまた間違いになった場合も、その領域を組み直す
+    for (int32_t p : added_)
+    {
+        if (parent_[p] != -1)
+            markDirty(find(p));
+    }
+    for (int32_t root : dirty_)
+        rebuild(root);
+    for (int32_t root : tightened_)
+        tighten(root);
+
+    // 間違いになったピクセル: 隣の間違いピクセルとつなぐ
+    // この周期に増えたピクセルどうしは片側（番号の小さい方）からだけ調べる
+    for (int32_t p : added_)
+    {
+        wrong_[p] = 2;
+        parent_[p] = p;
+    }
+    wrongCount_ += static_cast<int>(added_.size());
+    merged_.clear();
+    for (int32_t p : added_)
+    {
+        const int x = p % width_, y = p / width_;
+        for (int i = 0; i < 8; ++i)
+        {
+            int nx = x + kDx[i], ny = y + kDy[i];
+            if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_)
+                continue;
+            int32_t n = ny * width_ + nx;
+            if (wrong_[n] == 1 || (wrong_[n] == 2 && n < p))
+                link(p, n);
+        }
+    }
+    for (int32_t p : added_)
+        wrong_[p] = 1;
+
+    // 結合された領域の情報を残った根へまとめる（古い方の番号と最初の検出時刻を引き継ぐ）
+    for (int32_t from : merged_)
+    {
+        auto it = clusters_.find(from);
+        if (it == clusters_.end())
+            continue;
+        const ClusterState src = it->second;
+        clusters_.erase(it);
+        ClusterState &dst = clusters_[find(from)];
+        if (dst.info.id == 0)
+        {
+            dst = src;
+            continue;
+        }
+        if (src.info.firstSeenMs < dst.info.firstSeenMs || (src.info.firstSeenMs == dst.info.firstSeenMs && src.info.id < dst.info.id))
+        {
+            dst.info.id = src.info.id;
+            dst.info.firstSeenMs = src.info.firstSeenMs;
+        }
+        dst.info.minX = std::min(dst.info.minX, src.info.minX);
+        dst.info.minY = std::min(dst.info.minY, src.info.minY);
+        dst.info.maxX = std::max(dst.info.maxX, src.info.maxX);
+        dst.info.maxY = std::max(dst.info.maxY, src.info.maxY);
+        dst.info.pixels += src.info.pixels;
+        dst.info.lastChangedMs = std::max(dst.info.lastChangedMs, src.info.lastChangedMs);
+        dst.span.minX = std::min(dst.span.minX, src.span.minX);
+        dst.span.minY = std::min(dst.span.minY, src.span.minY);
+        dst.span.maxX = std::max(dst.span.maxX, src.span.maxX);
+        dst.span.maxY = std::max(dst.span.maxY, src.span.maxY);
+    }
+
+    // 増えたピクセルを数える（同じ根が続くことが多いので直前の根を覚えておく）
+    int32_t lastRoot = -1;
+    ClusterState *state = nullptr;
+    for (int32_t p : added_)
+    {
+        int32_t root = find(p);
+        const int x = p % width_, y = p / width_;
+        if (root != lastRoot)
+        {
+            lastRoot = root;
+            state = &clusters_[root];
+            if (state->info.id == 0)
+            {
+                state->info.id = nextId_++;
+                state->info.firstSeenMs = timeMs;
+                state->info.minX = state->info.maxX = x;
+                state->info.minY = state->info.maxY = y;
+                state->span = {x, y, x, y};
+            }
+        }
+        extend(state->info, x, y);
+        state->span.minX = std::min(state->span.minX, x);
+        state->span.minY = std::min(state->span.minY, y);
+        state->span.maxX = std::max(state->span.maxX, x);
+        state->span.maxY = std::max(state->span.maxY, y);
+        state->info.pixels++;
+        state->info.lastChangedMs = timeMs;
+    }
+    ++version_;
+}
+
+void DamageTracker::snapshot(std::vector<DamageCluster> &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.clear();
+    out.reserve(clusters_.size());
+    for (const auto &entry : clusters_)
+        out.push_back(entry.second.info);
+}
+
+void DamageTracker::lookup(const int32_t *pixels, size_t count, uint32_t *ids, int *sizes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int32_t lastRoot = -1;
+    const ClusterState *state = nullptr;
+    for (size_t i = 0; i < count; ++i)
+    {
+        int32_t p = pixels[i];
+        ids[i] = 0;
+        sizes[i] = 0;
+        if (p < 0 || p >= static_cast<int32_t>(wrong_.size()) || !wrong_[p] || parent_[p] == -1)
+            continue;
+        int32_t root = find(p);
+        if (root != lastRoot)
+        {
+            lastRoot = root;
+            auto it = clusters_.find(root);
+            state = it != clusters_.end() ? &it->second : nullptr;
+        }
+        if (state)
+        {
+            ids[i] = state->info.id;
+            sizes[i] = state->info.pixels;
+        }
+    }
+}
+
+int DamageTracker::wrongPixels() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return wrongCount_;
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// 間違っているピクセルの連結領域（8近傍）
+//
+// 周期ごとに全体を連結成分分解するのではなく、間違いになった／直ったピクセルだけを
+// Union-Find に反映する。直ったピクセルで領域が分かれうる場合（周囲の間違いピクセルが3x3内で
+// つながっていないとき）だけ、その領域の範囲を組み直す。外接矩形の端が削れた場合は端の行・列だけを調べて縮める。
+// 更新スレッドが update し、UIスレッドが snapshot で読む（内部のミューテックスで保護）。
+
+struct DamageCluster
+{
+    uint32_t id = 0;       // 領域が続く限り変わらない番号（結合したら古い方、分かれたら大きい方が引き継ぐ）
+    int minX = 0, minY = 0, maxX = 0, maxY = 0; // 外接矩形（両端を含む）
+    int pixels = 0;
+    int64_t firstSeenMs = 0;   // 最初に間違いが見つかった時刻
+    int64_t lastChangedMs = 0; // 最後に間違いピクセルが増えた時刻
+};
+
+class DamageTracker
+{
+public:
+    void reset(int width, int height);
+
+    // realtime と templ はどちらも CV_8UC4 で同じ大きさ
+    void update(const cv::Mat &realtime, const cv::Mat &templ, int64_t timeMs);
+
+    // 直前の update で間違いになった／直ったピクセル（y * 幅 + x）。update を呼ぶスレッドからだけ読む
+    const std::vector<int32_t> &lastAdded() const { return added_; }
+    const std::vector<int32_t> &lastRemoved() const { return removed_; }
+    // 直前の update が reset 後の最初の周期だった（lastAdded は既存の間違いすべてで、新たに荒らされた数ではない）
+    bool lastUpdateWasBaseline() const { return lastBaseline_; }
+
+    void snapshot(std::vector<DamageCluster> &out) const;
+    int wrongPixels() const;
+    // 各ピクセルが属する領域の番号と大きさ（間違いでないピクセルは 0）
+    void lookup(const int32_t *pixels, size_t count, uint32_t *ids, int *sizes);
+    // update のたびに増える
+    uint64_t version() const { return version_; }
+
+private:
+    struct Span
+    {
+        int minX = 0, minY = 0, maxX = 0, maxY = 0;
+    };
+
+    struct ClusterState
+    {
+        DamageCluster info;
+        // 直ったピクセルを含め、この木に属するピクセルがすべて入る矩形（組み直すときに走査する範囲）
+        Span span;
+        bool dirty = false;   // この周期で組み直す
+        bool tighten = false; // 外接矩形の端のピクセルが直った
+    };
+
+    void clear(int width, int height);
+    int32_t find(int32_t p);
+    // 根どうしをつなぐ。消える側の根に領域の情報があれば merged_ に積む
+    void link(int32_t a, int32_t b);
+    bool removalKeepsShape(int32_t p) const;
+    void markDirty(int32_t root);
+    void rebuild(int32_t root);
+    void tighten(int32_t root);
+    bool rowHasRoot(int y, int minX, int maxX, int32_t root);
+    bool columnHasRoot(int x, int minY, int maxY, int32_t root);
+
+    mutable std::mutex mutex_;
+    int width_ = 0, height_ = 0;
+    std::vector<uint8_t> wrong_;
+    std::vector<int32_t> parent_; // -1: どの領域にも属さない
+    // 根 → 領域。parent_ が -1 でないピクセルは、直ったものも含めて必ずその根の span 内にある
+    std::unordered_map<int32_t, ClusterState> clusters_;
+    std::vector<int32_t> added_, removed_, dirty_, tightened_, merged_, scratch_;
+    int wrongCount_ = 0;
+    uint32_t nextId_ = 1;
+    bool baseline_ = true;      // 次の update が clear 後の最初の周期
+    bool lastBaseline_ = false; // 直前の update がそうだった（update を呼ぶスレッドだけが触る）
+    std::atomic<uint64_t> version_{0};
+};
@@ -0,0 +1,241 @@
+﻿#include "diff_series.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+    constexpr uint32_t kSeriesMagic = 0x53475057; // "WPGS"
+    constexpr uint32_t kSeriesVersion = 1;
+    constexpr size_t kLevels = static_cast<size_t>(SeriesLevel::Count);
+
+    // 各段のバケット幅と保持数（4秒周期で生値は約3日、分は約91日、時は約3.7年、日は約11年）
+    constexpr int64_t kBucketMs[kLevels] = {0, 60 * 1000, 60 * 60 * 1000, 24 * 60 * 60 * 1000};
+    constexpr uint32_t kCapacity[kLevels] = {1 << 16, 1 << 17, 1 << 15, 1 << 12};
+
+    struct SeriesLevelHeader
+    {
+        uint64_t offset;   // ファイル先頭からのリングの位置
+        uint32_t capacity;
+        uint32_t reserved;
+        uint64_t count;    // 書き込んだレコード数（集計では開始したバケット数。最後のバケットは集計中）
+        int64_t bucketMs;
+    };
+
+    struct SeriesFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t levels;
+        uint32_t recordSize;
+        int64_t createdMs;
+        int64_t reserved;
+        SeriesLevelHeader level[kLevels];
+    };
+    static_assert(sizeof(SeriesFileHeader) <= 256, "SeriesFileHeader must fit in the first 256 bytes");
+
+    constexpr size_t kDataOffset = 256;
+
+    size_t fileSize()
+    {
+        size_t size = kDataOffset;
+        for (size_t i = 0; i < kLevels; ++i)
+            size += static_cast<size_t>(kCapacity[i]) * sizeof(SeriesRecord);
+        return size;
+    }
+
+    SeriesFileHeader *headerOf(const MappedFile &file)
+    {
+        return reinterpret_cast<SeriesFileHeader *>(file.mutableData());
+    }
+
+    SeriesRecord *ringOf(const MappedFile &file, const SeriesLevelHeader &level)
+    {
+        return reinterpret_cast<SeriesRecord *>(file.mutableData() + level.offset);
+    }
+
+    // 古い方から i 番目のレコード
+    SeriesRecord &recordAt(SeriesRecord *ring, const SeriesLevelHeader &level, uint64_t i)
+    {
+        uint64_t stored = std::min<uint64_t>(level.count, level.capacity);
+        uint64_t first = level.count - stored;
+        return ring[(first + i) % level.capacity];
+    }
+
+    void initHeader(SeriesFileHeader *h, int64_t createdMs)
+    {
+        std::memset(h, 0, kDataOffset);
+        h->magic = kSeriesMagic;
+        h->version = kSeriesVersion;
+        h->levels = static_cast<uint32_t>(kLevels);
+        h->recordSize = sizeof(SeriesRecord);
+        h->createdMs = createdMs;
+        uint64_t offset = kDataOffset;
+        for (size_t i = 0; i < kLevels; ++i)
+        {
+            h->level[i].offset = offset;
+            h->level[i].capacity = kCapacity[i];
+            h->level[i].count = 0;
+            h->level[i].bucketMs = kBucketMs[i];
+            offset += static_cast<uint64_t>(kCapacity[i]) * sizeof(SeriesRecord);
+        }
+    }
+
+    bool headerValid(const SeriesFileHeader *h, size_t size)
+    {
+        if (h->magic != kSeriesMagic || h->version != kSeriesVersion || h->levels != kLevels || h->recordSize != sizeof(SeriesRecord))
+            return false;
+        for (size_t i = 0; i < kLevels; ++i)
+        {
+            const SeriesLevelHeader &l = h->level[i];
+            if (l.capacity != kCapacity[i] || l.bucketMs != kBucketMs[i] || l.offset + static_cast<uint64_t>(l.capacity) * sizeof(SeriesRecord) > size)
+                return false;
+        }
+        return true;
+    }
+}
+
+bool DiffSeries::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_.close();
+    path_.clear();
+    if (!file_.openReadWrite(path, fileSize()))
+    {
+        std::cerr << "差分率の時系列ファイルを開けませんでした: " << path << std::endl;
+        return false;
+    }
+    SeriesFileHeader *h = headerOf(file_);
+    if (h->magic == 0)
+    {
+        initHeader(h, 0);
+    }
+    else if (!headerValid(h, file_.size()))
+    {
+        std::cerr << "差分率の時系列ファイルの形式が違うため作り直します: " << path << std::endl;
+        initHeader(h, 0);
+    }
+    path_ = path;
+    return true;
+}
+
+void DiffSeries::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_.flush();
+    file_.close();
+    path_.clear();
+}
+
+std::string DiffSeries::path() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return path_;
+}
+
+bool DiffSeries::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return file_.isOpen();
+}
+
+void DiffSeries::append(int64_t timeMs, double diffPercent, int changed, int opaque)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_.isOpen())
+        return;
+    SeriesFileHeader *h = headerOf(file_);
+    if (h->createdMs == 0)
+        h->createdMs = timeMs;
+    const float percent = static_cast<float>(diffPercent);
+
+    // 生の値
+    {
+        SeriesLevelHeader &level = h->level[static_cast<size_t>(SeriesLevel::Raw)];
+        SeriesRecord &r = ringOf(file_, level)[level.count % level.capacity];
+        r.timeMs = timeMs;
+        r.meanPercent = r.minPercent = r.maxPercent = percent;
+        r.samples = 1;
+        r.changed = changed;
+        r.opaque = opaque;
+        ++level.count;
+    }
+
+    // 集計: 現在のバケットに足すか、新しいバケットを始める
+    for (size_t i = 1; i < kLevels; ++i)
+    {
+        SeriesLevelHeader &level = h->level[i];
+        SeriesRecord *ring = ringOf(file_, level);
+        const int64_t bucket = timeMs - ((timeMs % level.bucketMs) + level.bucketMs) % level.bucketMs;
+        SeriesRecord *current = level.count ? &ring[(level.count - 1) % level.capacity] : nullptr;
+        if (current && current->timeMs == bucket)
+        {
+            current->meanPercent += (percent - current->meanPercent) / static_cast<float>(current->samples + 1);
+            current->minPercent = std::min(current->minPercent, percent);
+            current->maxPercent = std::max(current->maxPercent, percent);
+            current->samples++;
+            current->changed = std::max(current->changed, changed);
+            current->opaque = opaque;
+        }
+        else if (!current || bucket > current->timeMs)
+        {
+            SeriesRecord &r = ring[level.count % level.capacity];
+            r.timeMs = bucket;
+            r.meanPercent = r.minPercent = r.maxPercent = percent;
+            r.samples = 1;
+            r.changed = changed;
+            r.opaque = opaque;
+            ++level.count;
+        }
+        // 時計が戻った場合の過去のバケットは集計しない
+    }
+}
+
+void DiffSeries::query(SeriesLevel levelId, int64_t fromMs, int64_t toMs, std::vector<SeriesRecord> &out) const
+{
+    out.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_.isOpen() || levelId >= SeriesLevel::Count)
+        return;
+    const SeriesFileHeader *h = headerOf(file_);
+    const SeriesLevelHeader &level = h->level[static_cast<size_t>(levelId)];
+    SeriesRecord *ring = ringOf(file_, level);
+    const uint64_t stored = std::min<uint64_t>(level.count, level.capacity);
+
+    // 時刻順に並んでいるので二分探索で開始位置を求める
+    uint64_t lo = 0, hi = stored;
+    while (lo < hi)
+    {
+        uint64_t mid = (lo + hi) / 2;
+        if (recordAt(ring, level, mid).timeMs < fromMs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint64_t i = lo; i < stored; ++i)
+    {
+        const SeriesRecord &r = recordAt(ring, level, i);
+        if (r.timeMs > toMs)
+            break;
+        out.push_back(r);
+    }
+}
+
+SeriesLevel DiffSeries::levelFor(int64_t spanMs, size_t maxPoints)
+{
+    // 生の値は周期を4秒とみなして点数を見積もる
+    if (spanMs / 4000 <= static_cast<int64_t>(maxPoints))
+        return SeriesLevel::Raw;
+    for (size_t i = 1; i < kLevels; ++i)
+    {
+        if (spanMs / kBucketMs[i] <= static_cast<int64_t>(maxPoints))
+            return static_cast<SeriesLevel>(i);
+    }
+    return SeriesLevel::Day;
+}
+
+int64_t DiffSeries::bucketMs(SeriesLevel level)
+{
+    return level < SeriesLevel::Count ? kBucketMs[static_cast<size_t>(level)] : 0;
+}
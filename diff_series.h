@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 差分率の時系列（テンプレートごとのメモリマップしたリングファイル）
+//
+// 周期ごとの生の値と、分・時・日単位の集計を固定長レコードのリングに持つ。
+// 集計は追記のたびに現在のバケットへ加算するだけなので、何か月分の表示でも生データを読み直す必要がない。
+// 更新スレッドが追記し、UIスレッドが読む（内部のミューテックスで保護）。
+
+enum class SeriesLevel : uint32_t
+{
+    Raw,    // 周期ごと
+    Minute, // 1分ごと
+    Hour,   // 1時間ごと
+    Day,    // 1日ごと（UTC）
+    Count
+};
+
+struct SeriesRecord
+{
+    int64_t timeMs = 0;      // Raw: 計測時刻 / 集計: バケットの開始時刻
+    float meanPercent = 0.0f; // Raw では値そのもの
+    float minPercent = 0.0f;
+    float maxPercent = 0.0f;
+    uint32_t samples = 0;    // バケットに入った計測数
+    int32_t changed = 0;     // Raw: 変更ピクセル数 / 集計: その最大値
+    int32_t opaque = 0;      // 最後の計測の不透明ピクセル数
+};
+static_assert(sizeof(SeriesRecord) == 32, "SeriesRecord must stay 32 bytes");
+
+class DiffSeries
+{
+public:
+    DiffSeries() = default;
+    DiffSeries(const DiffSeries &) = delete;
+    DiffSeries &operator=(const DiffSeries &) = delete;
+
+    // ファイルがなければ作る。形式が違うファイルは作り直す
+    bool open(const std::string &path);
+    void close();
+
+    std::string path() const;
+    bool isOpen() const;
+
+    void append(int64_t timeMs, double diffPercent, int changed, int opaque);
+
+    // [fromMs, toMs] の範囲のレコードを古い順に out へ入れる
+    void query(SeriesLevel level, int64_t fromMs, int64_t toMs, std::vector<SeriesRecord> &out) const;
+
+    // spanMs の範囲を maxPoints 点以下で表せる最も細かい集計
+    static SeriesLevel levelFor(int64_t spanMs, size_t maxPoints);
+    static int64_t bucketMs(SeriesLevel level);
+
+private:
+    mutable std::mutex mutex_;
+    MappedFile file_;
+    std::string path_;
+};
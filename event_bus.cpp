@@ -0,0 +1,494 @@
+﻿#include "event_bus.h"
+#include "alert_rules.h"
+#include "damage_clusters.h"
+#include "trace.h"
+
+#include <cpr/cpr.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+using socket_t = SOCKET;
+static const socket_t kInvalidSocket = INVALID_SOCKET;
+static const int kSendFlags = 0; // 受け手のソケットはノンブロッキングにしてある
+static void closeSocket(socket_t s) { closesocket(s); }
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using socket_t = int;
+static const socket_t kInvalidSocket = -1;
+static const int kSendFlags = MSG_NOSIGNAL | MSG_DONTWAIT;
+static void closeSocket(socket_t s) { close(s); }
+#endif
+
+namespace
+{
+    // 配送待ちの上限。これを超えたら古いものから捨てる
+    constexpr size_t kMaxQueued = 4096;
+    constexpr size_t kMaxWebhookQueued = 1024;
+    constexpr int kWebhookTimeoutMs = 2000;
+
+    // 読むのが遅い受け手は待たずに切断する（途中まで書いた行を残さないため）
+    bool sendAll(socket_t s, const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+            int n = ::send(s, data, static_cast<int>(std::min<size_t>(len, 1 << 20)), kSendFlags);
+            if (n <= 0)
+                return false;
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // webhook はループバックにだけ送る
+    bool isLoopbackUrl(const std::string &url)
+    {
+        size_t scheme = url.find("://");
+        if (scheme == std::string::npos)
+            return false;
+        std::string rest = url.substr(scheme + 3);
+        std::string host;
+        if (!rest.empty() && rest[0] == '[')
+        {
+            size_t close = rest.find(']');
+            if (close == std::string::npos)
+                return false;
+            host = rest.substr(0, close + 1);
+        }
+        else
+        {
+            host = rest.substr(0, rest.find_first_of(":/?#"));
+        }
+        std::transform(host.begin(), host.end(), host.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return host == "localhost" || host == "[::1]" || host.rfind("127.", 0) == 0;
+    }
+
+    void appendf(std::string &out, const char *fmt, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 2, 3)))
+#endif
+        ;
+
+    void appendf(std::string &out, const char *fmt, ...)
+    {
+        char buf[256];
+        va_list args;
+        va_start(args, fmt);
+        int n = std::vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (n > 0)
+            out.append(buf, static_cast<size_t>(n) < sizeof(buf) ? static_cast<size_t>(n) : sizeof(buf) - 1);
+    }
+
+    // JSON 文字列としてエスケープする（制御文字は \u00XX）
+    void appendJsonString(std::string &out, const std::string &s)
+    {
+        out += '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                appendf(out, "\\u%04x", static_cast<unsigned>(static_cast<unsigned char>(c)));
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    struct ClusterChange
+    {
+        int pixels = 0;
+        int clusterPixels = 0;
+        int minX = 0, minY = 0, maxX = 0, maxY = 0;
+    };
+}
+
+bool EventBus::start(const EventSinkOptions &options)
+{
+    stop();
+    options_ = options;
+
+    if (!options_.filePath.empty())
+    {
+        file_ = std::fopen(options_.filePath.c_str(), "ab");
+        if (!file_)
+            std::cerr << "イベントファイルを開けませんでした: " << options_.filePath << std::endl;
+    }
+
+    if (!options_.socketPath.empty())
+    {
+#ifdef _WIN32
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+            std::cerr << "WSAStartupに失敗しました" << std::endl;
+        else
+#endif
+        {
+            socket_t s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (s == kInvalidSocket || options_.socketPath.size() >= sizeof(addr.sun_path))
+            {
+                std::cerr << "イベント用のソケットを作成できませんでした: " << options_.socketPath << std::endl;
+                if (s != kInvalidSocket)
+                    closeSocket(s);
+            }
+            else
+            {
+                std::memcpy(addr.sun_path, options_.socketPath.c_str(), options_.socketPath.size());
+                // 前回の終了時に残ったソケットファイルを消してから待ち受ける
+                std::remove(options_.socketPath.c_str());
+                if (::bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(s, 16) != 0)
+                {
+                    std::cerr << "イベント用のソケットで待ち受けできませんでした: " << options_.socketPath << std::endl;
+                    closeSocket(s);
+                }
+                else
+                {
+                    listenSock_ = static_cast<std::intptr_t>(s);
+                }
+            }
+#ifdef _WIN32
+            if (listenSock_ == -1)
+                WSACleanup();
+#endif
+        }
+    }
+
+    webhook_ = !options_.webhookUrl.empty() && isLoopbackUrl(options_.webhookUrl);
+    if (!options_.webhookUrl.empty() && !webhook_)
+        std::cerr << "webhook の送信先はループバックのみです: " << options_.webhookUrl << std::endl;
+
+    if (!file_ && listenSock_ == -1 && !webhook_)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        stats_ = EventBusStats();
+    }
+    running_ = true;
+    deliverThread_ = std::thread([this]()
+                                 { deliverLoop(); });
+    if (listenSock_ != -1)
+        acceptThread_ = std::thread([this]()
+                                    { acceptLoop(); });
+    if (webhook_)
+        webhookThread_ = std::thread([this]()
+                                     { webhookLoop(); });
+    return true;
+}
+
+void EventBus::stop()
+{
+    if (!running_.exchange(false))
+        return;
+
+    // 積んである分は配送してから止める
+    queueCv_.notify_all();
+    if (deliverThread_.joinable())
+        deliverThread_.join();
+    webhookCv_.notify_all();
+    if (webhookThread_.joinable())
+        webhookThread_.join();
+
+    if (listenSock_ != -1)
+    {
+        socket_t ls = static_cast<socket_t>(listenSock_);
+#ifndef _WIN32
+        ::shutdown(ls, SHUT_RDWR);
+#endif
+        closeSocket(ls);
+        if (acceptThread_.joinable())
+            acceptThread_.join();
+        listenSock_ = -1;
+        {
+            std::lock_guard<std::mutex> lock(clientMutex_);
+            for (std::intptr_t c : clients_)
+                closeSocket(static_cast<socket_t>(c));
+            clients_.clear();
+        }
+        std::remove(options_.socketPath.c_str());
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    if (file_)
+    {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(webhookMutex_);
+        webhookQueue_.clear();
+    }
+    // 止めている間に積まれた分は捨てる
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queue_.clear();
+}
+
+void EventBus::publish(std::string json, uint64_t arrivalNs)
+{
+    if (!running_)
+        return;
+    bool dropped = false;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (queue_.size() >= kMaxQueued)
+        {
+            queue_.pop_front();
+            dropped = true;
+        }
+        queue_.push_back({std::move(json), arrivalNs});
+    }
+    queueCv_.notify_one();
+
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    stats_.published++;
+    if (dropped)
+        stats_.dropped++;
+}
+
+void EventBus::publishDamage(DamageTracker &damage, int width, int64_t timeMs, uint64_t arrivalNs)
+{
+    if (!running_ || width <= 0)
+        return;
+    const std::vector<int32_t> &added = damage.lastAdded();
+    const std::vector<int32_t> &removed = damage.lastRemoved();
+    const int wrong = damage.wrongPixels();
+    const int lastWrong = lastWrongPixels_.exchange(wrong);
+    std::string json;
+
+    // 監視を始めた最初の周期は今の状態だけを知らせる（既存の間違いを全部「増えた」とは扱わない）
+    if (lastWrong < 0)
+    {
+        appendf(json, "{\"type\":\"baseline\",\"seq\":%llu,\"time_ms\":%lld,\"wrong_total\":%d}",
+                static_cast<unsigned long long>(++seq_), static_cast<long long>(timeMs), wrong);
+        publish(std::move(json), arrivalNs);
+        return;
+    }
+
+    if (!added.empty())
+    {
+        ids_.resize(added.size());
+        sizes_.resize(added.size());
+        damage.lookup(added.data(), added.size(), ids_.data(), sizes_.data());
+
+        // 領域ごとにまとめる（番号順に出す）
+        std::map<uint32_t, ClusterChange> changes;
+        for (size_t i = 0; i < added.size(); ++i)
+        {
+            if (ids_[i] == 0)
+                continue;
+            const int x = added[i] % width;
+            const int y = added[i] / width;
+            auto [it, inserted] = changes.try_emplace(ids_[i]);
+            ClusterChange &c = it->second;
+            if (inserted)
+            {
+                c.minX = c.maxX = x;
+                c.minY = c.maxY = y;
+            }
+            c.pixels++;
+            c.clusterPixels = sizes_[i];
+            c.minX = std::min(c.minX, x);
+            c.minY = std::min(c.minY, y);
+            c.maxX = std::max(c.maxX, x);
+            c.maxY = std::max(c.maxY, y);
+        }
+        for (const auto &[id, c] : changes)
+        {
+            json.clear();
+            appendf(json, "{\"type\":\"damage\",\"seq\":%llu,\"time_ms\":%lld,\"cluster\":%u,\"pixels\":%d,\"cluster_pixels\":%d,",
+                    static_cast<unsigned long long>(++seq_), static_cast<long long>(timeMs), id, c.pixels, c.clusterPixels);
+            appendf(json, "\"area\":[%d,%d,%d,%d],\"wrong_total\":%d}", c.minX, c.minY, c.maxX, c.maxY, wrong);
+            publish(std::move(json), arrivalNs);
+        }
+    }
+
+    if (!removed.empty())
+    {
+        json.clear();
+        appendf(json, "{\"type\":\"repaired\",\"seq\":%llu,\"time_ms\":%lld,\"pixels\":%d,\"wrong_total\":%d}",
+                static_cast<unsigned long long>(++seq_), static_cast<long long>(timeMs), static_cast<int>(removed.size()), wrong);
+        publish(std::move(json), arrivalNs);
+    }
+
+    if (lastWrong > 0 && wrong == 0)
+    {
+        json.clear();
+        appendf(json, "{\"type\":\"restored\",\"seq\":%llu,\"time_ms\":%lld}",
+                static_cast<unsigned long long>(++seq_), static_cast<long long>(timeMs));
+        publish(std::move(json), arrivalNs);
+    }
+}
+
+void EventBus::publishAlert(const AlertTransition &alert, uint64_t arrivalNs)
+{
+    if (!running_)
+        return;
+    std::string json;
+    appendf(json, "{\"type\":\"alert\",\"seq\":%llu,\"time_ms\":%lld,\"rule\":",
+            static_cast<unsigned long long>(++seq_), static_cast<long long>(alert.timeMs));
+    appendJsonString(json, alert.name);
+    appendf(json, ",\"metric\":\"%s\",\"state\":\"%s\",\"value\":%.10g,\"threshold\":%.10g}",
+            alertMetricName(alert.metric), alert.firing ? "firing" : "resolved", alert.value, alert.threshold);
+    publish(std::move(json), arrivalNs);
+}
+
+EventBusStats EventBus::stats() const
+{
+    EventBusStats s;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        s = stats_;
+    }
+    std::lock_guard<std::mutex> lock(clientMutex_);
+    s.socketClients = static_cast<int>(clients_.size());
+    return s;
+}
+
+void EventBus::deliverLoop()
+{
+    traceSetThreadName("events");
+    std::deque<Pending> batch;
+    std::string data;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            queueCv_.wait(lock, [this]()
+                          { return !running_ || !queue_.empty(); });
+            if (queue_.empty())
+                break;
+            batch.swap(queue_);
+        }
+
+        // 同じ周期の通知はまとめて1回で書く
+        data.clear();
+        for (const Pending &p : batch)
+        {
+            data += p.line;
+            data += '\n';
+        }
+        if (file_)
+        {
+            std::fwrite(data.data(), 1, data.size(), file_);
+            std::fflush(file_);
+        }
+        broadcast(data);
+
+        const uint64_t nowNs = traceNowNs();
+        {
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            for (const Pending &p : batch)
+            {
+                const uint64_t latencyNs = nowNs > p.arrivalNs ? nowNs - p.arrivalNs : 0;
+                const double latencyMs = latencyNs / 1e6;
+                traceRecord(TraceStage::Event, p.arrivalNs, latencyNs);
+                stats_.delivered++;
+                stats_.lastLatencyMs = latencyMs;
+                stats_.maxLatencyMs = std::max(stats_.maxLatencyMs, latencyMs);
+                if (latencyMs > kLatencyBudgetMs)
+                    stats_.overBudget++;
+            }
+        }
+
+        if (webhook_)
+        {
+            {
+                std::lock_guard<std::mutex> lock(webhookMutex_);
+                for (Pending &p : batch)
+                {
+                    if (webhookQueue_.size() >= kMaxWebhookQueued)
+                        webhookQueue_.pop_front();
+                    webhookQueue_.push_back(std::move(p.line));
+                }
+            }
+            webhookCv_.notify_one();
+        }
+        batch.clear();
+    }
+}
+
+void EventBus::webhookLoop()
+{
+    traceSetThreadName("webhook");
+    while (true)
+    {
+        std::string body;
+        {
+            std::unique_lock<std::mutex> lock(webhookMutex_);
+            webhookCv_.wait(lock, [this]()
+                            { return !running_ || !webhookQueue_.empty(); });
+            if (!running_)
+                break;
+            body = std::move(webhookQueue_.front());
+            webhookQueue_.pop_front();
+        }
+        cpr::Response r = cpr::Post(cpr::Url{options_.webhookUrl},
+                                    cpr::Body{body},
+                                    cpr::Header{{"Content-Type", "application/json"}},
+                                    cpr::Timeout{kWebhookTimeoutMs});
+        if (r.error || r.status_code < 200 || r.status_code >= 300)
+        {
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            stats_.webhookErrors++;
+        }
+    }
+}
+
+void EventBus::acceptLoop()
+{
+    while (running_)
+    {
+        socket_t c = ::accept(static_cast<socket_t>(listenSock_), nullptr, nullptr);
+        if (c == kInvalidSocket)
+        {
+            if (!running_)
+                break;
+            continue;
+        }
+#ifdef _WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket(c, FIONBIO, &nonBlocking);
+#endif
+        std::lock_guard<std::mutex> lock(clientMutex_);
+        clients_.push_back(static_cast<std::intptr_t>(c));
+    }
+}
+
+void EventBus::broadcast(const std::string &data)
+{
+    std::lock_guard<std::mutex> lock(clientMutex_);
+    auto it = std::remove_if(clients_.begin(), clients_.end(), [&data](std::intptr_t c)
+                             {
+        if (sendAll(static_cast<socket_t>(c), data.data(), data.size()))
+            return false;
+        closeSocket(static_cast<socket_t>(c));
+        return true; });
+    clients_.erase(it, clients_.end());
+}
@@ -0,0 +1,111 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DamageTracker;
+struct AlertTransition;
+
+// ピクセル変化の通知（1行1件のJSON）
+//
+// 差分の直後に更新スレッドから publish し、配送は専用スレッドで行う。
+// ローカルの出力先（JSON Lines ファイルと Unix ドメインソケット）にはまとめて書き、
+// webhook はさらに別のスレッドで送るので、遅い受け手が他の出力先の遅延を増やすことはない。
+// タイルの到着からローカルの出力先に書き終えるまでの時間を遅延として計測する（目標 10ms 以内）。
+
+struct EventSinkOptions
+{
+    std::string filePath;   // 追記する .jsonl ファイル（空なら使わない）
+    std::string socketPath; // 待ち受ける Unix ドメインソケット（空なら使わない）
+    std::string webhookUrl; // POST 先。ループバック（127.0.0.1, localhost, [::1]）のみ
+};
+
+struct EventBusStats
+{
+    uint64_t published = 0;
+    uint64_t delivered = 0;     // ローカルの出力先に書き終えた件数
+    uint64_t dropped = 0;       // キューがあふれて捨てた件数
+    uint64_t overBudget = 0;    // 遅延が目標を超えた件数
+    uint64_t webhookErrors = 0;
+    int socketClients = 0;
+    double lastLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+};
+
+class EventBus
+{
+public:
+    // 到着から配送までの目標
+    static constexpr double kLatencyBudgetMs = 10.0;
+
+    EventBus() = default;
+    ~EventBus() { stop(); }
+    EventBus(const EventBus &) = delete;
+    EventBus &operator=(const EventBus &) = delete;
+
+    // 出力先を開いて配送スレッドを起動する。どれも開けなければ false
+    bool start(const EventSinkOptions &options);
+    void stop();
+    bool running() const { return running_; }
+
+    // 1件の JSON オブジェクト（改行なし）を積む。arrivalNs はタイル到着時の traceNowNs()
+    void publish(std::string json, uint64_t arrivalNs);
+
+    // 直前の DamageTracker::update の増減から通知を作って積む。更新スレッドから呼ぶ
+    void publishDamage(DamageTracker &damage, int width, int64_t timeMs, uint64_t arrivalNs);
+    // アラートの発報・解除を積む。更新スレッドから呼ぶ
+    void publishAlert(const AlertTransition &alert, uint64_t arrivalNs);
+    // 監視対象が変わったときに呼ぶ（復旧の判定をやり直す）
+    void resetDamageState() { lastWrongPixels_.store(-1); }
+
+    EventBusStats stats() const;
+
+private:
+    struct Pending
+    {
+        std::string line;
+        uint64_t arrivalNs = 0;
+    };
+
+    void deliverLoop();
+    void webhookLoop();
+    void acceptLoop();
+    void broadcast(const std::string &data);
+
+    EventSinkOptions options_;
+    std::atomic<bool> running_{false};
+    bool webhook_ = false;
+
+    mutable std::mutex queueMutex_;
+    std::condition_variable queueCv_;
+    std::deque<Pending> queue_;
+    std::thread deliverThread_;
+
+    std::mutex webhookMutex_;
+    std::condition_variable webhookCv_;
+    std::deque<std::string> webhookQueue_;
+    std::thread webhookThread_;
+
+    std::FILE *file_ = nullptr;
+
+    mutable std::mutex clientMutex_;
+    std::vector<std::intptr_t> clients_;
+    std::intptr_t listenSock_ = -1;
+    std::thread acceptThread_;
+
+    mutable std::mutex statsMutex_;
+    EventBusStats stats_;
+
+    // publishDamage / publishAlert 用（lastWrongPixels_ 以外は更新スレッドだけが触る）
+    std::atomic<int> lastWrongPixels_{-1};
+    uint64_t seq_ = 0;
+    std::vector<uint32_t> ids_;
+    std::vector<int> sizes_;
+};
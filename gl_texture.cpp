@@ -0,0 +1,29 @@
+﻿#include "gl_texture.h"
+
+#include <GL/glew.h>
+
+namespace
+{
+    GLuint nearestSampler = 0;
+}
+
+void bindNearestSampler(const ImDrawList *, const ImDrawCmd *)
+{
+    if (!nearestSampler)
+    {
+        glGenSamplers(1, &nearestSampler);
+        // タイルの境目で隣のタイルの色がにじまないよう端は引き伸ばす（画像の外はそもそも描かない）
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(nearestSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindSampler(0, nearestSampler);
+}
+
+void releaseNearestSampler()
+{
+    if (nearestSampler)
+        glDeleteSamplers(1, &nearestSampler);
+    nearestSampler = 0;
+}
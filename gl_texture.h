@@ -0,0 +1,13 @@
+﻿#pragma once
+
+#include "imgui.h"
+
+// OpenGL のバックエンドで TiledTexture のタイルを最近傍で描くための描画コールバック
+//
+// バックエンドはテクスチャを線形補間で作るので、拡大すると画素がぼける。
+// TiledTexture::setDrawCallback(bindNearestSampler) で、タイルを描く前にユニット 0 に最近傍のサンプラーを結び付ける
+// （ImDrawCallback_ResetRenderState で外れる）。UIスレッドから使う。
+void bindNearestSampler(const ImDrawList *drawList, const ImDrawCmd *cmd);
+
+// 終了時に GL コンテキストを壊す前に呼ぶ
+void releaseNearestSampler();
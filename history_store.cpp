@@ -0,0 +1,651 @@
+﻿#include "history_store.h"
+#include "palette.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace
+{
+    // キーフレーム間の差分レコード数の上限（差分が小さくても復元時のレコード走査を抑える）
+    constexpr uint32_t kMaxDeltaChain = 4096;
+    // キーフレーム間に適用する変更ピクセル数の上限（全体に対する割合と最小値）
+    constexpr uint64_t kReplayFraction = 8;
+    constexpr uint64_t kMinReplayPixels = 1 << 18;
+
+    uint32_t recordCheck(const HistoryRecordHeader &rec)
+    {
+        return ~(rec.type ^ rec.count ^ rec.payloadBytes ^ static_cast<uint32_t>(rec.timeMs) ^
+                 static_cast<uint32_t>(static_cast<uint64_t>(rec.timeMs) >> 32) ^ kHistoryMagic);
+    }
+
+    void putVarint(std::vector<uint8_t> &out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7)
+        {
+            uint8_t b = *p++;
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    // 透明はすべて 0 にそろえる（applyAlphaMask は RGB を残すため）
+    inline uint32_t normalizePixel(const uint8_t *px)
+    {
+        if (px[3] == 0)
+            return 0;
+        return packBGRA(px[0], px[1], px[2], px[3]);
+    }
+
+    void encodeKeyframe(const std::vector<uint8_t> &state, std::vector<uint8_t> &out)
+    {
+        out.clear();
+        size_t i = 0;
+        while (i < state.size())
+        {
+            size_t run = 1;
+            while (i + run < state.size() && state[i + run] == state[i])
+                ++run;
+            putVarint(out, run);
+            out.push_back(state[i]);
+            i += run;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// HistoryReader
+// ---------------------------------------------------------------------------
+
+bool HistoryReader::open(const std::string &path)
+{
+    close();
+    if (!file_.open(path))
+        return false;
+    if (file_.size() < sizeof(HistoryFileHeader))
+    {
+        file_.close();
+        return false;
+    }
+    std::memcpy(&header_, file_.data(), sizeof(header_));
+    if (header_.magic != kHistoryMagic || header_.version != kHistoryVersion || header_.width <= 0 || header_.height <= 0 ||
+        header_.headerSize < sizeof(HistoryFileHeader))
+    {
+        std::cerr << "履歴ファイルの形式が正しくありません: " << path << std::endl;
+        file_.close();
+        return false;
+    }
+    validEnd_ = header_.headerSize;
+    scan();
+    return true;
+}
+
+bool HistoryReader::refresh()
+{
+    if (!file_.isOpen())
+        return false;
+    std::string path = file_.path();
+    size_t before = frames_.size();
+    // 書き込み側の追記はマップし直さないと見えない
+    file_.close();
+    if (!file_.open(path))
+        return false;
+    scan();
+    return frames_.size() != before;
+}
+
+void HistoryReader::close()
+{
+    file_.close();
+    header_ = HistoryFileHeader();
+    frames_.clear();
+    keyframes_.clear();
+    colors_.clear();
+    validEnd_ = 0;
+}
+
+bool HistoryReader::scan()
+{
+    const uint8_t *base = file_.data();
+    const uint64_t size = file_.size();
+    uint64_t offset = validEnd_;
+    while (offset + sizeof(HistoryRecordHeader) <= size)
+    {
+        HistoryRecordHeader rec;
+        std::memcpy(&rec, base + offset, sizeof(rec));
+        if (rec.check != recordCheck(rec))
+            break;
+        uint64_t next = offset + sizeof(rec) + rec.payloadBytes;
+        if (next > size)
+            break; // 書きかけ
+        const uint8_t *payload = base + offset + sizeof(rec);
+
+        switch (static_cast<HistoryRecordType>(rec.type))
+        {
+        case HistoryRecordType::Color:
+            if (static_cast<uint64_t>(rec.count) * 8 > rec.payloadBytes)
+                return false;
+            for (uint32_t i = 0; i < rec.count; ++i)
+            {
+                uint32_t entry[2];
+                std::memcpy(entry, payload + i * 8, sizeof(entry));
+                if (entry[0] > 255)
+                    continue;
+                if (colors_.size() <= entry[0])
+                    colors_.resize(entry[0] + 1, 0);
+                colors_[entry[0]] = entry[1];
+            }
+            break;
+        case HistoryRecordType::Keyframe:
+        case HistoryRecordType::KeyframeRaw:
+            keyframes_.push_back(frames_.size());
+            frames_.push_back({rec.timeMs, offset, rec.count, true});
+            break;
+        case HistoryRecordType::Delta:
+            // 最初のキーフレームより前の差分は復元できないので無視する
+            if (!keyframes_.empty())
+                frames_.push_back({rec.timeMs, offset, rec.count, false});
+            break;
+        default:
+            break; // 将来のレコード種別は読み飛ばす
+        }
+        offset = next;
+    }
+    validEnd_ = offset;
+    return true;
+}
+
+size_t HistoryReader::frameAtTime(int64_t timeMs) const
+{
+    auto it = std::upper_bound(frames_.begin(), frames_.end(), timeMs, [](int64_t t, const HistoryFrameInfo &f)
+                               { return t < f.timeMs; });
+    if (it == frames_.begin())
+        return 0;
+    return static_cast<size_t>(it - frames_.begin()) - 1;
+}
+
+size_t HistoryReader::keyframeBefore(size_t frame) const
+{
+    auto it = std::upper_bound(keyframes_.begin(), keyframes_.end(), frame);
+    if (it == keyframes_.begin())
+        return 0;
+    return *(it - 1);
+}
+
+bool HistoryReader::applyFrame(size_t frame, std::vector<uint8_t> &state) const
+{
+    if (frame >= frames_.size())
+        return false;
+    const HistoryFrameInfo &info = frames_[frame];
+    HistoryRecordHeader rec;
+    std::memcpy(&rec, file_.data() + info.offset, sizeof(rec));
+    const uint8_t *p = file_.data() + info.offset + sizeof(rec);
+    const uint8_t *end = p + rec.payloadBytes;
+    const size_t pixels = static_cast<size_t>(header_.width) * header_.height;
+
+    // 色テーブルにないインデックスは壊れたレコード（そのまま使うと色の引き当てで範囲外を読む）
+    const size_t colorCount = colors_.size();
+    if (rec.type == static_cast<uint32_t>(HistoryRecordType::KeyframeRaw))
+    {
+        if (rec.payloadBytes < pixels || std::any_of(p, p + pixels, [colorCount](uint8_t c)
+                                                     { return c >= colorCount; }))
+            return false;
+        state.assign(p, p + pixels);
+        return true;
+    }
+    if (info.keyframe)
+    {
+        state.resize(pixels);
+        size_t i = 0;
+        while (i < pixels)
+        {
+            uint64_t run;
+            if (!getVarint(p, end, run) || p >= end || run == 0 || run > pixels - i || *p >= colorCount)
+                return false;
+            std::memset(state.data() + i, *p++, static_cast<size_t>(run));
+            i += static_cast<size_t>(run);
+        }
+        return true;
+    }
+
+    if (state.size() != pixels)
+        return false;
+    uint64_t pos = ~uint64_t(0); // 最初の差分は index + 1
+    for (uint32_t i = 0; i < rec.count; ++i)
+    {
+        uint64_t gap;
+        if (!getVarint(p, end, gap) || p >= end)
+            return false;
+        pos += gap;
+        if (pos >= pixels || *p >= colorCount)
+            return false;
+        state[static_cast<size_t>(pos)] = *p++;
+    }
+    return true;
+}
+
+bool HistoryReader::reconstruct(size_t frame, std::vector<uint8_t> &state) const
+{
+    if (frame >= frames_.size() || keyframes_.empty())
+        return false;
+    for (size_t i = keyframeBefore(frame); i <= frame; ++i)
+    {
+        if (!applyFrame(i, state))
+            return false;
+    }
+    return true;
+}
+
+void HistoryReader::toBGRA(const std::vector<uint8_t> &state, cv::Mat &out) const
+{
+    out.create(header_.height, header_.width, CV_8UC4);
+    if (state.size() != static_cast<size_t>(header_.width) * header_.height)
+    {
+        out.setTo(cv::Scalar(0, 0, 0, 0));
+        return;
+    }
+    uint32_t lut[256] = {};
+    for (size_t i = 0; i < colors_.size() && i < 256; ++i)
+        lut[i] = colors_[i];
+    const uint8_t *src = state.data();
+    for (int y = 0; y < out.rows; ++y)
+    {
+        uint32_t *row = out.ptr<uint32_t>(y);
+        for (int x = 0; x < out.cols; ++x)
+            row[x] = lut[*src++];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// HistoryCursor
+// ---------------------------------------------------------------------------
+
+bool HistoryCursor::open(const std::string &path)
+{
+    close();
+    return reader_.open(path);
+}
+
+void HistoryCursor::close()
+{
+    reader_.close();
+    cache_.clear();
+}
+
+const std::vector<uint8_t> *HistoryCursor::seek(size_t frame)
+{
+    if (frame >= reader_.frames().size())
+        return nullptr;
+    ++tick_;
+
+    // 再生の起点: 直前のキーフレームより後にあるキャッシュ済みフレームのうち最も近いもの
+    size_t key = reader_.keyframeBefore(frame);
+    Entry *base = nullptr;
+    for (Entry &e : cache_)
+    {
+        if (e.frame == frame)
+        {
+            e.lastUsed = tick_;
+            return &e.state;
+        }
+        if (e.frame >= key && e.frame < frame && (!base || e.frame > base->frame))
+            base = &e;
+    }
+
+    // 書き込み先: 空きがなければ起点以外で最も古いもの
+    size_t pixels = static_cast<size_t>(reader_.width()) * reader_.height();
+    size_t capacity = std::max<size_t>(2, cacheBytes_ / std::max<size_t>(pixels, 1));
+    Entry *slot = nullptr;
+    if (cache_.size() < capacity)
+    {
+        size_t baseIndex = base ? static_cast<size_t>(base - cache_.data()) : 0;
+        cache_.emplace_back();
+        if (base)
+            base = &cache_[baseIndex]; // emplace_back で移動したため取り直す
+        slot = &cache_.back();
+    }
+    else
+    {
+        for (Entry &e : cache_)
+        {
+            if (&e != base && (!slot || e.lastUsed < slot->lastUsed))
+                slot = &e;
+        }
+    }
+
+    size_t start = key;
+    if (base)
+    {
+        slot->state = base->state;
+        start = base->frame + 1;
+    }
+    for (size_t i = start; i <= frame; ++i)
+    {
+        if (!reader_.applyFrame(i, slot->state))
+        {
+            slot->frame = SIZE_MAX;
+            slot->lastUsed = 0;
+            return nullptr;
+        }
+    }
+    slot->frame = frame;
+    slot->lastUsed = tick_;
+    return &slot->state;
+}
+
+// ---------------------------------------------------------------------------
+// HistoryWriter
+// ---------------------------------------------------------------------------
+
+bool HistoryWriter::open(const std::string &path, const HistoryRegion &region, int width, int height)
+{
+    close();
+    if (width <= 0 || height <= 0)
+        return false;
+
+    std::error_code ec;
+    uint64_t existing = std::filesystem::exists(path, ec) ? std::filesystem::file_size(path, ec) : 0;
+    if (ec)
+        existing = 0;
+
+    width_ = width;
+    height_ = height;
+    state_.assign(static_cast<size_t>(width) * height, 0);
+    hasFrame_ = false;
+    colors_.clear();
+    colorLookup_.clear();
+    keyframeBytes_ = 0;
+    deltaBytesSinceKey_ = 0;
+    deltasSinceKey_ = 0;
+    changedSinceKey_ = 0;
+
+    if (existing >= sizeof(HistoryFileHeader))
+    {
+        // 続きから追記する
+        uint64_t validEnd = 0;
+        {
+            HistoryReader reader;
+            if (!reader.open(path))
+                return false;
+            const HistoryFileHeader &h = reader.header();
+            if (h.width != width || h.height != height || h.region.tileX != region.tileX || h.region.tileY != region.tileY ||
+                h.region.pixelX != region.pixelX || h.region.pixelY != region.pixelY)
+            {
+                std::cerr << "履歴ファイルの監視領域が一致しません: " << path << std::endl;
+                return false;
+            }
+            colors_ = reader.colors();
+            const auto &frames = reader.frames();
+            if (!frames.empty())
+            {
+                size_t last = frames.size() - 1;
+                if (!reader.reconstruct(last, state_))
+                {
+                    std::cerr << "履歴ファイルの復元に失敗しました: " << path << std::endl;
+                    return false;
+                }
+                hasFrame_ = true;
+                size_t key = reader.keyframeBefore(last);
+                for (size_t i = key; i <= last; ++i)
+                {
+                    uint64_t bytes = (i + 1 < frames.size() ? frames[i + 1].offset : reader.validBytes()) - frames[i].offset;
+                    if (i == key)
+                    {
+                        keyframeBytes_ = bytes;
+                    }
+                    else
+                    {
+                        deltaBytesSinceKey_ += bytes;
+                        changedSinceKey_ += frames[i].changed;
+                    }
+                }
+                deltasSinceKey_ = static_cast<uint32_t>(last - key);
+            }
+            validEnd = reader.validBytes();
+        }
+        // 前回の書きかけレコードを切り捨てる
+        if (validEnd < existing)
+        {
+            std::filesystem::resize_file(path, validEnd, ec);
+            if (ec)
+            {
+                std::cerr << "履歴ファイルの末尾を修復できませんでした: " << path << std::endl;
+                return false;
+            }
+        }
+        file_ = std::fopen(path.c_str(), "ab");
+        if (!file_)
+            return false;
+        fileBytes_ = validEnd;
+        colorsWritten_ = colors_.size();
+        for (size_t i = 0; i < colors_.size(); ++i)
+            colorLookup_.emplace(colors_[i], static_cast<uint8_t>(i));
+    }
+    else
+    {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_)
+        {
+            std::cerr << "履歴ファイルを作成できませんでした: " << path << std::endl;
+            return false;
+        }
+        HistoryFileHeader header;
+        header.width = width;
+        header.height = height;
+        header.region = region;
+        header.createdMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                               std::chrono::system_clock::now().time_since_epoch())
+                               .count();
+        if (std::fwrite(&header, sizeof(header), 1, file_) != 1)
+        {
+            close();
+            return false;
+        }
+        fileBytes_ = sizeof(header);
+        // パレットの色は最初から同じインデックスに置く
+        for (int i = 0; i < kWplacePaletteSize; ++i)
+        {
+            colors_.push_back(wplacePaletteBGRA(i));
+            colorLookup_.emplace(colors_.back(), static_cast<uint8_t>(i));
+        }
+        colorsWritten_ = 0;
+    }
+    path_ = path;
+    return true;
+}
+
+void HistoryWriter::close()
+{
+    if (file_)
+        std::fclose(file_);
+    file_ = nullptr;
+    path_.clear();
+    fileBytes_ = 0;
+    hasFrame_ = false;
+}
+
+uint8_t HistoryWriter::colorIndex(uint32_t bgra)
+{
+    auto it = colorLookup_.find(bgra);
+    if (it != colorLookup_.end())
+        return it->second;
+    if (colors_.size() < 256)
+    {
+        uint8_t index = static_cast<uint8_t>(colors_.size());
+        colors_.push_back(bgra);
+        colorLookup_.emplace(bgra, index);
+        return index;
+    }
+    // テーブルが埋まったら最も近い色で代用する
+    int best = 1;
+    int bestDist = INT32_MAX;
+    for (size_t i = 1; i < colors_.size(); ++i)
+    {
+        int db = static_cast<int>(colors_[i] & 0xff) - static_cast<int>(bgra & 0xff);
+        int dg = static_cast<int>((colors_[i] >> 8) & 0xff) - static_cast<int>((bgra >> 8) & 0xff);
+        int dr = static_cast<int>((colors_[i] >> 16) & 0xff) - static_cast<int>((bgra >> 16) & 0xff);
+        int dist = db * db + dg * dg + dr * dr;
+        if (dist < bestDist)
+        {
+            bestDist = dist;
+            best = static_cast<int>(i);
+        }
+    }
+    colorLookup_.emplace(bgra, static_cast<uint8_t>(best));
+    return static_cast<uint8_t>(best);
+}
+
+bool HistoryWriter::writeRecord(HistoryRecordType type, uint32_t count, int64_t timeMs, const std::vector<uint8_t> &payload)
+{
+    static const uint8_t zeros[8] = {};
+    HistoryRecordHeader rec;
+    rec.type = static_cast<uint32_t>(type);
+    rec.count = count;
+    rec.timeMs = timeMs;
+    size_t pad = (8 - payload.size() % 8) % 8;
+    rec.payloadBytes = static_cast<uint32_t>(payload.size() + pad);
+    rec.check = recordCheck(rec);
+    if (std::fwrite(&rec, sizeof(rec), 1, file_) != 1)
+        return false;
+    if (!payload.empty() && std::fwrite(payload.data(), 1, payload.size(), file_) != payload.size())
+        return false;
+    if (pad && std::fwrite(zeros, 1, pad, file_) != pad)
+        return false;
+    fileBytes_ += sizeof(rec) + rec.payloadBytes;
+    return true;
+}
+
+bool HistoryWriter::writePendingColors(int64_t timeMs)
+{
+    if (colorsWritten_ >= colors_.size())
+        return true;
+    std::vector<uint8_t> payload((colors_.size() - colorsWritten_) * 8);
+    uint8_t *p = payload.data();
+    for (size_t i = colorsWritten_; i < colors_.size(); ++i, p += 8)
+    {
+        uint32_t entry[2] = {static_cast<uint32_t>(i), colors_[i]};
+        std::memcpy(p, entry, sizeof(entry));
+    }
+    if (!writeRecord(HistoryRecordType::Color, static_cast<uint32_t>(colors_.size() - colorsWritten_), timeMs, payload))
+        return false;
+    colorsWritten_ = colors_.size();
+    return true;
+}
+
+int HistoryWriter::append(const cv::Mat &bgra, int64_t timeMs)
+{
+    if (!file_ || bgra.empty() || bgra.type() != CV_8UC4 || bgra.cols != width_ || bgra.rows != height_)
+        return -1;
+
+    changedPixels_.clear();
+    changedColors_.clear();
+    uint32_t lastColor = 0;
+    uint8_t lastIndex = 0;
+    size_t i = 0;
+    for (int y = 0; y < bgra.rows; ++y)
+    {
+        const uint8_t *row = bgra.ptr<uint8_t>(y);
+        for (int x = 0; x < bgra.cols; ++x, ++i)
+        {
+            uint32_t v = normalizePixel(row + x * 4);
+            // 前と同じ色なら色テーブルを引かずに済む
+            if (hasFrame_ && v == colors_[state_[i]])
+                continue;
+            // 塗り潰し領域は同じ色が続くので直前の検索結果を使い回す
+            uint8_t index = (v == lastColor) ? lastIndex : colorIndex(v);
+            lastColor = v;
+            lastIndex = index;
+            if (hasFrame_ && index == state_[i])
+                continue;
+            state_[i] = index;
+            changedPixels_.push_back(static_cast<uint32_t>(i));
+            changedColors_.push_back(index);
+        }
+    }
+    if (hasFrame_ && changedPixels_.empty())
+        return 0;
+
+    bool keyframe = !hasFrame_;
+    if (!keyframe)
+    {
+        payload_.clear();
+        uint64_t prev = ~uint64_t(0);
+        for (size_t k = 0; k < changedPixels_.size(); ++k)
+        {
+            putVarint(payload_, changedPixels_[k] - prev);
+            payload_.push_back(changedColors_[k]);
+            prev = changedPixels_[k];
+        }
+        uint64_t maxReplay = std::max<uint64_t>(state_.size() / kReplayFraction, kMinReplayPixels);
+        keyframe = deltasSinceKey_ >= kMaxDeltaChain || deltaBytesSinceKey_ + payload_.size() > keyframeBytes_ ||
+                   changedSinceKey_ + changedPixels_.size() > maxReplay;
+    }
+
+    bool ok = writePendingColors(timeMs);
+    if (ok && keyframe)
+    {
+        encodeKeyframe(state_, payload_);
+        HistoryRecordType type = HistoryRecordType::Keyframe;
+        if (payload_.size() >= state_.size())
+        {
+            // 細かい模様はランレングスで縮まないので、展開の速い無圧縮にする
+            payload_.assign(state_.begin(), state_.end());
+            type = HistoryRecordType::KeyframeRaw;
+        }
+        ok = writeRecord(type, static_cast<uint32_t>(state_.size()), timeMs, payload_);
+        keyframeBytes_ = sizeof(HistoryRecordHeader) + payload_.size();
+        deltaBytesSinceKey_ = 0;
+        deltasSinceKey_ = 0;
+        changedSinceKey_ = 0;
+    }
+    else if (ok)
+    {
+        ok = writeRecord(HistoryRecordType::Delta, static_cast<uint32_t>(changedPixels_.size()), timeMs, payload_);
+        deltaBytesSinceKey_ += sizeof(HistoryRecordHeader) + payload_.size();
+        ++deltasSinceKey_;
+        changedSinceKey_ += changedPixels_.size();
+    }
+    ok = ok && std::fflush(file_) == 0;
+    if (!ok)
+    {
+        std::cerr << "履歴ファイルに書き込めませんでした: " << path_ << std::endl;
+        close();
+        return -1;
+    }
+    hasFrame_ = true;
+    return static_cast<int>(changedPixels_.size());
+}
+
+std::string historyFilePath(const std::string &dir, const std::string &templateName,
+                            const HistoryRegion &region, int width, int height, const char *extension)
+{
+    std::string stem = templateName.substr(templateName.find_last_of("\\/") + 1);
+    size_t dot = stem.find_last_of('.');
+    if (dot != std::string::npos && dot > 0)
+        stem.resize(dot);
+    for (char &c : stem)
+    {
+        if (std::strchr("<>:\"|?* ", c))
+            c = '_';
+    }
+    if (stem.empty())
+        stem = "template";
+    return dir + stem + "_" + std::to_string(region.tileX) + "-" + std::to_string(region.tileY) + "_" +
+           std::to_string(region.pixelX) + "-" + std::to_string(region.pixelY) + "_" +
+           std::to_string(width) + "x" + std::to_string(height) + extension;
+}
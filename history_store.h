@@ -0,0 +1,193 @@
+﻿#pragma once
+
+#include "mapped_file.h"
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 監視領域の変更履歴（追記専用・メモリマップで読める形式）
+//
+// ファイル = HistoryFileHeader + レコードの列。レコードは 8 バイト境界に揃え、先頭に HistoryRecordHeader を置く。
+//   Color    : 色テーブルへの追加（{index, BGRA} の組）。インデックスは一度割り当てたら変わらない
+//   Keyframe : 全ピクセルの色インデックス（ランレングス符号化。縮まない場合は KeyframeRaw で無圧縮）
+//   Delta    : 前のフレームから変わったピクセルだけ（ピクセル番号の差分の可変長整数 + 色インデックス）
+// 変化のない周期は何も書かないので、ファイルサイズは実際に変わったピクセル数にほぼ比例する。
+// キーフレームは前のキーフレーム以降の差分の合計がキーフレーム自体の大きさを超えるか、
+// 変わったピクセルの合計が全体の 1/8 を超えたときに入れる。任意の時刻の復元はキーフレーム1枚の展開と
+// 高々それと同程度の差分の適用で済み、ファイルサイズも変化量の定数倍に収まる。
+
+constexpr uint32_t kHistoryMagic = 0x48475057; // "WPGH"
+constexpr uint32_t kHistoryVersion = 1;
+
+enum class HistoryRecordType : uint32_t
+{
+    Color = 1,
+    Keyframe = 2,
+    Delta = 3,
+    KeyframeRaw = 4,
+};
+
+// 監視領域（ファイル名とヘッダーの照合に使う）
+struct HistoryRegion
+{
+    int32_t tileX = 0, tileY = 0;
+    int32_t pixelX = 0, pixelY = 0;
+};
+
+struct HistoryFileHeader
+{
+    uint32_t magic = kHistoryMagic;
+    uint32_t version = kHistoryVersion;
+    int32_t width = 0;
+    int32_t height = 0;
+    HistoryRegion region;
+    int64_t createdMs = 0;
+    uint32_t headerSize = sizeof(HistoryFileHeader);
+    uint32_t reserved[5] = {};
+};
+static_assert(sizeof(HistoryFileHeader) == 64, "HistoryFileHeader must stay 64 bytes");
+
+struct HistoryRecordHeader
+{
+    uint32_t type = 0;
+    uint32_t count = 0;        // Color: 追加した色数 / Keyframe: ピクセル数 / Delta: 変わったピクセル数
+    int64_t timeMs = 0;        // UNIX 時刻（ミリ秒）
+    uint32_t payloadBytes = 0; // 8 バイト境界までの詰め物を含む
+    uint32_t check = 0;        // 途中で切れたヘッダーの検出用
+};
+static_assert(sizeof(HistoryRecordHeader) == 24, "HistoryRecordHeader must stay 24 bytes");
+
+struct HistoryFrameInfo
+{
+    int64_t timeMs = 0;
+    uint64_t offset = 0; // レコードヘッダーの位置
+    uint32_t changed = 0;
+    bool keyframe = false;
+};
+
+// 履歴ファイルの読み出し（メモリマップ）
+class HistoryReader
+{
+public:
+    bool open(const std::string &path);
+    // 書き込み側が追記したレコードを取り込む。新しいフレームがあれば true
+    bool refresh();
+    void close();
+
+    bool isOpen() const { return file_.isOpen(); }
+    const HistoryFileHeader &header() const { return header_; }
+    int width() const { return header_.width; }
+    int height() const { return header_.height; }
+    const std::vector<HistoryFrameInfo> &frames() const { return frames_; }
+    const std::vector<uint32_t> &colors() const { return colors_; }
+    // 最後の完全なレコードの終わり（これ以降は書きかけ）
+    uint64_t validBytes() const { return validEnd_; }
+
+    // timeMs 以前で最も新しいフレーム。最初のフレームより前なら 0
+    size_t frameAtTime(int64_t timeMs) const;
+    size_t keyframeBefore(size_t frame) const;
+
+    // state に frame を適用する。Keyframe なら置き換え、Delta なら前のフレームの状態に上書きする。
+    // レコードが壊れている（色テーブルにないインデックスを含む）ときは false
+    bool applyFrame(size_t frame, std::vector<uint8_t> &state) const;
+    // 直前のキーフレームから frame までを適用して復元する
+    bool reconstruct(size_t frame, std::vector<uint8_t> &state) const;
+    // 色インデックスを BGRA 画像にする
+    void toBGRA(const std::vector<uint8_t> &state, cv::Mat &out) const;
+
+private:
+    bool scan();
+
+    MappedFile file_;
+    HistoryFileHeader header_;
+    std::vector<HistoryFrameInfo> frames_;
+    std::vector<size_t> keyframes_; // キーフレームになっているフレーム番号（昇順）
+    std::vector<uint32_t> colors_;
+    uint64_t validEnd_ = 0;
+};
+
+// 任意のフレームへのシーク
+// 直近に復元したフレームを LRU で保持し、キーフレームかキャッシュ済みのフレームのうち近い方から差分を再生する
+class HistoryCursor
+{
+public:
+    explicit HistoryCursor(size_t cacheBytes = 256u << 20) : cacheBytes_(cacheBytes) {}
+
+    bool open(const std::string &path);
+    bool refresh() { return reader_.refresh(); }
+    void close();
+
+    bool isOpen() const { return reader_.isOpen(); }
+    const HistoryReader &reader() const { return reader_; }
+
+    // frame の色インデックス。失敗時は nullptr（次の seek までは有効）
+    const std::vector<uint8_t> *seek(size_t frame);
+
+private:
+    struct Entry
+    {
+        size_t frame = 0;
+        uint64_t lastUsed = 0;
+        std::vector<uint8_t> state;
+    };
+
+    HistoryReader reader_;
+    std::vector<Entry> cache_;
+    size_t cacheBytes_;
+    uint64_t tick_ = 0;
+};
+
+// 履歴ファイルへの追記（更新スレッド専用）
+class HistoryWriter
+{
+public:
+    HistoryWriter() = default;
+    ~HistoryWriter() { close(); }
+    HistoryWriter(const HistoryWriter &) = delete;
+    HistoryWriter &operator=(const HistoryWriter &) = delete;
+
+    // 既存のファイルなら最後のフレームを復元して続きから追記する
+    bool open(const std::string &path, const HistoryRegion &region, int width, int height);
+    void close();
+
+    // 前のフレームから変わったピクセルを記録する。記録したピクセル数（変化なしは 0, 失敗は -1）を返す
+    int append(const cv::Mat &bgra, int64_t timeMs);
+
+    bool isOpen() const { return file_ != nullptr; }
+    const std::string &path() const { return path_; }
+    uint64_t fileBytes() const { return fileBytes_; }
+
+private:
+    uint8_t colorIndex(uint32_t bgra);
+    bool writeRecord(HistoryRecordType type, uint32_t count, int64_t timeMs, const std::vector<uint8_t> &payload);
+    bool writePendingColors(int64_t timeMs);
+
+    std::FILE *file_ = nullptr;
+    std::string path_;
+    int width_ = 0, height_ = 0;
+    uint64_t fileBytes_ = 0;
+
+    std::vector<uint8_t> state_; // 最後に記録したフレームの色インデックス
+    bool hasFrame_ = false;
+    std::vector<uint32_t> colors_;
+    std::unordered_map<uint32_t, uint8_t> colorLookup_;
+    size_t colorsWritten_ = 0;
+
+    uint64_t keyframeBytes_ = 0;      // 最後のキーフレームのレコードサイズ
+    uint64_t deltaBytesSinceKey_ = 0; // それ以降の差分の合計
+    uint32_t deltasSinceKey_ = 0;
+    uint64_t changedSinceKey_ = 0; // それ以降に変わったピクセル数の合計（復元時の書き込み量）
+
+    std::vector<uint32_t> changedPixels_;
+    std::vector<uint8_t> changedColors_;
+    std::vector<uint8_t> payload_;
+};
+
+// 監視領域ごとの履歴ファイル名（dir は末尾の区切り文字を含む）
+// 同じ領域の差分率の時系列などは extension だけを変えて並べる
+std::string historyFilePath(const std::string &dir, const std::string &templateName,
+                            const HistoryRegion &region, int width, int height, const char *extension = ".wph");
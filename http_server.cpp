@@ -0,0 +1,337 @@
+﻿#include "http_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using socket_t = SOCKET;
+static const socket_t kInvalidSocket = INVALID_SOCKET;
+static const int kSendFlags = 0;
+static void closeSocket(socket_t s) { closesocket(s); }
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using socket_t = int;
+static const socket_t kInvalidSocket = -1;
+static const int kSendFlags = MSG_NOSIGNAL; // 切断済みソケットへの書き込みでSIGPIPEを出さない
+static void closeSocket(socket_t s) { close(s); }
+#endif
+
+namespace
+{
+    // 1リクエストのヘッダー部分の上限。これを超える接続は切断する
+    constexpr size_t kMaxHeaderBytes = 16 * 1024;
+
+    bool sendAll(socket_t s, const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+            int n = ::send(s, data, static_cast<int>(std::min<size_t>(len, 1 << 20)), kSendFlags);
+            if (n <= 0)
+                return false;
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::string toLower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return s;
+    }
+
+    std::string trim(const std::string &s)
+    {
+        size_t b = s.find_first_not_of(" \t");
+        size_t e = s.find_last_not_of(" \t\r");
+        if (b == std::string::npos)
+            return std::string();
+        return s.substr(b, e - b + 1);
+    }
+
+    // "GET /path?query HTTP/1.1" とヘッダー行を解析する
+    bool parseRequest(const std::string &head, HttpRequest &req, bool &keepAlive)
+    {
+        size_t lineEnd = head.find("\r\n");
+        std::string requestLine = head.substr(0, lineEnd);
+        size_t sp1 = requestLine.find(' ');
+        size_t sp2 = requestLine.rfind(' ');
+        if (sp1 == std::string::npos || sp2 == sp1)
+            return false;
+
+        req.method = requestLine.substr(0, sp1);
+        std::string target = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+        std::string version = requestLine.substr(sp2 + 1);
+        size_t q = target.find('?');
+        req.path = target.substr(0, q);
+        req.query = (q == std::string::npos) ? std::string() : target.substr(q + 1);
+
+        size_t pos = (lineEnd == std::string::npos) ? head.size() : lineEnd + 2;
+        while (pos < head.size())
+        {
+            size_t end = head.find("\r\n", pos);
+            if (end == std::string::npos)
+                end = head.size();
+            std::string line = head.substr(pos, end - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos)
+                req.headers.emplace_back(trim(line.substr(0, colon)), trim(line.substr(colon + 1)));
+            pos = end + 2;
+        }
+
+        std::string connection = toLower(req.header("Connection"));
+        keepAlive = (version == "HTTP/1.1") ? (connection != "close") : (connection == "keep-alive");
+        return true;
+    }
+}
+
+std::string HttpRequest::header(const std::string &name) const
+{
+    std::string key = toLower(name);
+    for (const auto &h : headers)
+    {
+        if (toLower(h.first) == key)
+            return h.second;
+    }
+    return std::string();
+}
+
+const char *httpStatusText(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 429:
+        return "Too Many Requests";
+    case 500:
+        return "Internal Server Error";
+    case 502:
+        return "Bad Gateway";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Unknown";
+    }
+}
+
+HttpServer::~HttpServer()
+{
+    stop();
+}
+
+bool HttpServer::start(const std::string &bindAddress, int port, Handler handler)
+{
+    if (running_)
+        return false;
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        std::cerr << "WSAStartupに失敗しました" << std::endl;
+        return false;
+    }
+#endif
+
+    socket_t s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == kInvalidSocket)
+    {
+        std::cerr << "ソケットを作成できませんでした" << std::endl;
+        return false;
+    }
+
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&yes), sizeof(yes));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<unsigned short>(port));
+    if (inet_pton(AF_INET, bindAddress.c_str(), &addr.sin_addr) != 1)
+    {
+        std::cerr << "不正なバインドアドレス: " << bindAddress << std::endl;
+        closeSocket(s);
+        return false;
+    }
+    if (::bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(s, 64) != 0)
+    {
+        std::cerr << "ポート " << port << " で待ち受けできませんでした" << std::endl;
+        closeSocket(s);
+        return false;
+    }
+
+    // port=0 の場合に実際に割り当てられたポートを取得
+    socklen_t len = sizeof(addr);
+    getsockname(s, reinterpret_cast<sockaddr *>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+
+    handler_ = std::move(handler);
+    listenSock_ = static_cast<std::intptr_t>(s);
+    running_ = true;
+    acceptThread_ = std::thread([this]()
+                                { acceptLoop(); });
+    return true;
+}
+
+void HttpServer::stop()
+{
+    if (!running_.exchange(false))
+        return;
+
+    // acceptとrecvのブロックを解除するためにソケットを閉じる
+    socket_t ls = static_cast<socket_t>(listenSock_);
+#ifdef _WIN32
+    closeSocket(ls);
+#else
+    ::shutdown(ls, SHUT_RDWR);
+    closeSocket(ls);
+#endif
+    if (acceptThread_.joinable())
+        acceptThread_.join();
+    // acceptLoop が読み終わってから戻す
+    listenSock_ = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(connMutex_);
+        for (Connection *conn : connections_)
+        {
+            if (conn->done)
+                continue;
+#ifdef _WIN32
+            ::shutdown(static_cast<socket_t>(conn->sock), SD_BOTH);
+#else
+            ::shutdown(static_cast<socket_t>(conn->sock), SHUT_RDWR);
+#endif
+        }
+    }
+    reapConnections(true);
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void HttpServer::acceptLoop()
+{
+    // listenSock_ はスレッドの開始前に書かれ、join の後まで変わらない
+    const socket_t ls = static_cast<socket_t>(listenSock_);
+    while (running_)
+    {
+        socket_t c = ::accept(ls, nullptr, nullptr);
+        if (c == kInvalidSocket)
+        {
+            if (!running_)
+                break;
+            continue;
+        }
+
+        int yes = 1;
+        setsockopt(c, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&yes), sizeof(yes));
+
+        reapConnections(false);
+
+        Connection *conn = new Connection;
+        conn->sock = static_cast<std::intptr_t>(c);
+        std::lock_guard<std::mutex> lock(connMutex_);
+        connections_.push_back(conn);
+        conn->thread = std::thread([this, conn]()
+                                   { serveConnection(conn); });
+    }
+}
+
+void HttpServer::serveConnection(Connection *conn)
+{
+    socket_t s = static_cast<socket_t>(conn->sock);
+    std::string buffer;
+    char chunk[4096];
+    bool keepAlive = true;
+
+    while (running_ && keepAlive)
+    {
+        // ヘッダー終端まで読み込む（GETのみ想定のためボディは読まない）
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (buffer.size() > kMaxHeaderBytes)
+                goto done;
+            int n = ::recv(s, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+                goto done;
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+
+        {
+            HttpRequest req;
+            HttpResponse res;
+            if (!parseRequest(buffer.substr(0, headerEnd), req, keepAlive))
+            {
+                res.status = 400;
+                keepAlive = false;
+            }
+            else
+            {
+                res = handler_(req);
+            }
+            buffer.erase(0, headerEnd + 4);
+
+            std::string head = "HTTP/1.1 " + std::to_string(res.status) + " " + httpStatusText(res.status) + "\r\n";
+            if (res.status != 304)
+                head += "Content-Type: " + res.contentType + "\r\n";
+            head += "Content-Length: " + std::to_string(res.status == 304 ? 0 : res.body.size()) + "\r\n";
+            for (const auto &h : res.headers)
+                head += h.first + ": " + h.second + "\r\n";
+            head += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+            if (!sendAll(s, head.data(), head.size()))
+                break;
+            if (res.status != 304 && req.method != "HEAD" && !sendAll(s, res.body.data(), res.body.size()))
+                break;
+        }
+    }
+
+done:
+    // stop() が閉じたソケットを shutdown しないようにロック下で閉じる
+    std::lock_guard<std::mutex> lock(connMutex_);
+    closeSocket(s);
+    conn->done = true;
+}
+
+void HttpServer::reapConnections(bool all)
+{
+    std::vector<Connection *> finished;
+    {
+        std::lock_guard<std::mutex> lock(connMutex_);
+        auto it = std::partition(connections_.begin(), connections_.end(), [all](Connection *c)
+                                 { return !(all || c->done); });
+        finished.assign(it, connections_.end());
+        connections_.erase(it, connections_.end());
+    }
+    for (Connection *conn : finished)
+    {
+        if (conn->thread.joinable())
+            conn->thread.join();
+        delete conn;
+    }
+}
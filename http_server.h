@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 開発・監視用の最小限のHTTP/1.1サーバー
+// GETのみを想定し、接続ごとにスレッドを立てて keep-alive で処理する
+struct HttpRequest
+{
+    std::string method;
+    std::string path;  // クエリを除いたパス
+    std::string query; // '?' 以降（'?' は含まない）
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    // ヘッダー名は大文字小文字を区別しない。見つからなければ空文字列
+    std::string header(const std::string &name) const;
+};
+
+struct HttpResponse
+{
+    int status = 200;
+    std::string contentType = "text/plain; charset=utf-8";
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+class HttpServer
+{
+public:
+    using Handler = std::function<HttpResponse(const HttpRequest &)>;
+
+    HttpServer() = default;
+    ~HttpServer();
+    HttpServer(const HttpServer &) = delete;
+    HttpServer &operator=(const HttpServer &) = delete;
+
+    // bindAddress は "127.0.0.1" など。port に 0 を渡すと空いているポートを使う
+    bool start(const std::string &bindAddress, int port, Handler handler);
+    void stop();
+
+    bool running() const { return running_; }
+    int port() const { return port_; }
+
+private:
+    struct Connection
+    {
+        std::intptr_t sock;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    void acceptLoop();
+    void serveConnection(Connection *conn);
+    void reapConnections(bool all);
+
+    Handler handler_;
+    std::intptr_t listenSock_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{false};
+    std::thread acceptThread_;
+    std::mutex connMutex_;
+    std::vector<Connection *> connections_;
+};
+
+const char *httpStatusText(int status);
@@ -0,0 +1,366 @@
+﻿#include "image_pipeline.h"
+#include "trace.h"
+#include "tile_capture.h"
+#include "tile_cache.h"
+
+#include <curl/curl.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <vector>
+
+std::atomic<bool> abort_fetch{false};
+
+cv::Mat applyAlphaMask(const cv::Mat &src, const cv::Mat &mask)
+{
+    if (src.empty() || mask.empty())
+        return cv::Mat();
+    CV_Assert(src.size() == mask.size());
+    CV_Assert(src.type() == CV_8UC4 && mask.type() == CV_8UC4);
+
+    cv::Mat dst = src.clone();
+    for (int y = 0; y < src.rows; ++y)
+    {
+        const cv::Vec4b *srcRow = src.ptr<cv::Vec4b>(y);
+        const cv::Vec4b *maskRow = mask.ptr<cv::Vec4b>(y);
+        cv::Vec4b *dstRow = dst.ptr<cv::Vec4b>(y);
+        for (int x = 0; x < src.cols; ++x)
+        {
+            uchar srcA = srcRow[x][3] ? 255 : 0;
+            uchar maskA = maskRow[x][3] ? 255 : 0;
+            dstRow[x][3] = srcA & maskA;
+        }
+    }
+    return dst;
+}
+
+void ensureBGRA(cv::Mat &img)
+{
+    if (img.empty())
+        return;
+    if (img.channels() == 3)
+        cv::cvtColor(img, img, cv::COLOR_BGR2BGRA);
+}
+
+std::tuple<cv::Mat, int, int> imageDifferenceSafe(const cv::Mat &img1, const cv::Mat &img2)
+{
+    if (img1.empty() || img2.empty())
+        return {cv::Mat(), 0, 0};
+
+    int w = std::min(img1.cols, img2.cols);
+    int h = std::min(img1.rows, img2.rows);
+    if (w <= 0 || h <= 0)
+        return {cv::Mat(), 0, 0};
+
+    cv::Mat diffImage = cv::Mat::zeros(img1.size(), CV_8UC4);
+    cv::Rect roi(0, 0, w, h);
+    cv::Mat roi1 = img1(roi);
+    cv::Mat roi2 = img2(roi);
+
+    // 差分（RGB絶対値）
+    cv::Mat rgbDiff;
+    if (roi1.channels() >= 3 && roi2.channels() >= 3)
+    {
+        std::vector<cv::Mat> ch1, ch2, chDiff(3);
+        cv::split(roi1, ch1);
+        cv::split(roi2, ch2);
+        for (int i = 0; i < 3; ++i)
+            cv::absdiff(ch1[i], ch2[i], chDiff[i]);
+        cv::merge(chDiff, rgbDiff);
+    }
+    else
+    {
+        cv::absdiff(roi1, roi2, rgbDiff);
+    }
+
+    // アルファチャンネル
+    cv::Mat alpha;
+    if (roi1.channels() == 4)
+        cv::extractChannel(roi1, alpha, 3);
+    else
+        alpha = cv::Mat::ones(roi.size(), CV_8U) * 255;
+
+    // RGBAにマージ
+    cv::Mat merged;
+    std::vector<cv::Mat> ch;
+    cv::split(rgbDiff, ch);
+    ch.push_back(alpha);
+    cv::merge(ch, merged);
+
+    merged.copyTo(diffImage(roi));
+
+    auto [totalOpaquePixels, changedPixels] = countDifference(img1, img2);
+    return {diffImage, totalOpaquePixels, changedPixels};
+}
+
+std::pair<int, int> countDifference(const cv::Mat &img1, const cv::Mat &img2)
+{
+    if (img1.empty() || img2.empty() || img1.type() != CV_8UC4 || img2.type() != CV_8UC4)
+        return {0, 0};
+
+    int w = std::min(img1.cols, img2.cols);
+    int h = std::min(img1.rows, img2.rows);
+
+    // 不透明ピクセルと「間違いピクセル」を1回の走査で数える
+    int totalOpaquePixels = 0;
+    int changedPixels = 0;
+    for (int y = 0; y < h; ++y)
+    {
+        const cv::Vec4b *p1 = img1.ptr<cv::Vec4b>(y);
+        const cv::Vec4b *p2 = img2.ptr<cv::Vec4b>(y);
+        for (int x = 0; x < w; ++x)
+        {
+            if (p1[x][3])
+            {
+                totalOpaquePixels++;
+                if (p1[x] != p2[x])
+                    changedPixels++;
+            }
+        }
+    }
+    return {totalOpaquePixels, changedPixels};
+}
+
+namespace
+{
+    // curl が計測した各区間の累積時間（要求開始からのマイクロ秒）
+    struct CurlTimings
+    {
+        curl_off_t dns = 0;
+        curl_off_t connect = 0;
+        curl_off_t tls = 0;
+        curl_off_t pretransfer = 0;
+        curl_off_t starttransfer = 0;
+        curl_off_t total = 0;
+    };
+
+    CurlTimings readCurlTimings(cpr::Session &session)
+    {
+        CurlTimings t;
+        CURL *curl = session.GetCurlHolder()->handle;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &t.dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &t.connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &t.tls);
+        curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &t.pretransfer);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &t.starttransfer);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &t.total);
+        return t;
+    }
+
+    // 累積時間を区間に分解して呼び出しスレッドのリングに記録する
+    void traceCurlTimings(const CurlTimings &t, uint64_t startNs)
+    {
+        auto record = [startNs](TraceStage stage, curl_off_t fromUs, curl_off_t toUs)
+        {
+            if (toUs > fromUs)
+                traceRecord(stage, startNs + static_cast<uint64_t>(fromUs) * 1000, static_cast<uint64_t>(toUs - fromUs) * 1000);
+        };
+        record(TraceStage::Dns, 0, t.dns);
+        record(TraceStage::Connect, t.dns, t.connect);
+        record(TraceStage::Tls, t.connect, t.tls); // 再利用接続・HTTPでは 0
+        record(TraceStage::Wait, t.pretransfer, t.starttransfer);
+        record(TraceStage::Transfer, t.starttransfer, t.total);
+    }
+}
+
+cpr::Response cancellable_fetch(const std::string &url, const cpr::Header &headers)
+{
+    try
+    {
+        // 区間ごとの時間を取るため Session を直接使う（curlハンドルは取得スレッド内でのみ触る）
+        uint64_t traceStart = traceBegin();
+        auto future = std::async(std::launch::async, [url, headers, traceStart]()
+                                 {
+            cpr::Session session;
+            session.SetUrl(cpr::Url{url});
+            session.SetHeader(headers);
+            session.SetTimeout(cpr::Timeout{5000});
+            cpr::Response r = session.Get();
+            CurlTimings timings;
+            if (traceStart)
+                timings = readCurlTimings(session);
+            return std::make_pair(std::move(r), timings); });
+
+        while (!abort_fetch && future.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready)
+        {
+        }
+
+        if (abort_fetch)
+        {
+            try
+            {
+                // 戻り値を変数に格納して破棄
+                auto ignored = future.get();
+                (void)ignored; // 明示的に破棄
+            }
+            catch (...)
+            {
+            }
+            return cpr::Response{};
+        }
+
+        auto [response, timings] = future.get();
+        if (traceStart)
+            traceCurlTimings(timings, traceStart);
+        return response;
+    }
+    catch (...)
+    {
+        return cpr::Response{};
+    }
+}
+
+namespace
+{
+    TileCache tileCache;
+    // 再生は通常の取得のキャッシュを使わず、周回ごとに空から始める（記録の内容だけで結果が決まるように）
+    TileCache replayTileCache;
+}
+
+cv::Mat fetch_tiles_and_crop_cpp(
+    const std::string &base_url,
+    int tile_x, int tile_y, int x_in_tile, int y_in_tile,
+    int ref_width, int ref_height, int TILE_SIZE)
+{
+    // 末尾のスラッシュは取り除いてからパスを連結する
+    std::string base = base_url;
+    while (!base.empty() && base.back() == '/')
+        base.pop_back();
+
+    int end_x = x_in_tile + ref_width;
+    int end_y = y_in_tile + ref_height;
+    int tile_x_end = tile_x + (end_x / TILE_SIZE);
+    int tile_y_end = tile_y + (end_y / TILE_SIZE);
+
+    int canvas_w = (tile_x_end - tile_x + 1) * TILE_SIZE;
+    int canvas_h = (tile_y_end - tile_y + 1) * TILE_SIZE;
+    cv::Rect roi(x_in_tile, y_in_tile, ref_width, ref_height);
+    roi &= cv::Rect(0, 0, canvas_w, canvas_h);
+    if (roi.width <= 0 || roi.height <= 0)
+        return cv::Mat();
+
+    // キャンバス全体は作らず、切り出し範囲に直接合成する
+    cv::Mat result(roi.height, roi.width, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+
+    cpr::Header baseHeaders = {
+        {"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64)"},
+        {"Accept", "image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8"},
+        {"Referer", "https://www.google.com/"}};
+
+    int tiles_per_row = tile_x_end - tile_x + 1;
+    int tile_count = tiles_per_row * (tile_y_end - tile_y + 1);
+    traceSetGauge(TraceGauge::TilesPending, tile_count);
+    auto fail = []()
+    {
+        traceSetGauge(TraceGauge::TilesPending, 0);
+        return cv::Mat();
+    };
+
+    // 再生中はネットワークの代わりに記録した応答を使う（記録の時刻に合わせて待つ）
+    const CaptureRegion region{tile_x, tile_y, x_in_tile, y_in_tile, ref_width, ref_height, TILE_SIZE, 0};
+    const bool replay = tileReplayActive();
+    bool restart = false;
+    if (replay && !replayCycleBegin(region, restart))
+        return fail();
+    TileCache &cache = replay ? replayTileCache : tileCache;
+    if (restart)
+        cache.clear();
+    // 記録の最初の周期は全タイルを条件なしで取り、再生に要る本体をファイルに残す
+    if (captureCycleBegin(region))
+        tileCache.clear();
+
+    cache.beginCycle();
+
+    int tile_index = 0;
+    for (int ty = tile_y; ty <= tile_y_end; ++ty)
+    {
+        for (int tx = tile_x; tx <= tile_x_end; ++tx)
+        {
+            if (abort_fetch)
+                return fail();
+
+            int oy = (tile_index / tiles_per_row) * TILE_SIZE;
+            int ox = (tile_index % tiles_per_row) * TILE_SIZE;
+            cv::Rect wanted = cv::Rect(ox, oy, TILE_SIZE, TILE_SIZE) & roi;
+
+            // 前回と同じ範囲を切り出すときだけ If-None-Match を付ける
+            std::string key = base + "/" + std::to_string(tx) + "/" + std::to_string(ty);
+            CachedTile cached;
+            cache.lookup(key, cached);
+            cpr::Header headers = baseHeaders;
+            if (!cached.etag.empty() && cached.rect == wanted)
+                headers["If-None-Match"] = cached.etag;
+
+            auto now = std::chrono::system_clock::now();
+            auto epoch = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+            std::string url = base + "/files/s0/tiles/" + std::to_string(tx) + "/" + std::to_string(ty) + ".png" + "?t=" + std::to_string(epoch);
+            cpr::Response r;
+            {
+                WPG_TRACE_SCOPE(TraceStage::Fetch, tile_index);
+                if (!replay)
+                    r = cancellable_fetch(url, headers);
+                else if (!replayTileResponse(tx, ty, headers.count("If-None-Match") > 0, r))
+                    r = cpr::Response{};
+            }
+            if (abort_fetch)
+                return fail();
+            captureTileResponse(tx, ty, r);
+            traceCount(TraceCounter::TileRequests);
+            traceCountHttpStatus(r.status_code);
+            traceCount(TraceCounter::BytesDownloaded, r.downloaded_bytes > 0 ? static_cast<uint64_t>(r.downloaded_bytes) : 0);
+
+            if (r.status_code == 304 && headers.count("If-None-Match"))
+            {
+                traceCount(TraceCounter::CacheHits);
+                if (!cached.part.empty())
+                {
+                    WPG_TRACE_SCOPE(TraceStage::Composite, tile_index);
+                    cached.part.copyTo(result(cached.rect - roi.tl()));
+                }
+            }
+            else
+            {
+                if (r.status_code != 200 || r.text.empty())
+                {
+                    traceCount(TraceCounter::FetchErrors);
+                    return fail();
+                }
+                traceCount(TraceCounter::CacheMisses);
+
+                std::vector<uchar> data(r.text.begin(), r.text.end());
+                cv::Mat img;
+                {
+                    WPG_TRACE_SCOPE(TraceStage::Decode, tile_index);
+                    img = cv::imdecode(data, cv::IMREAD_UNCHANGED);
+                }
+                if (img.empty())
+                {
+                    traceCount(TraceCounter::FetchErrors);
+                    return fail();
+                }
+
+                // タイル画像が TILE_SIZE より小さい場合は実サイズで切り詰める。
+                // その場合 rect != wanted となり、次回も条件なしで取り直す
+                cv::Rect inter = cv::Rect(ox, oy, img.cols, img.rows) & roi;
+                CachedTile fresh;
+                fresh.etag = r.header["ETag"];
+                fresh.rect = inter;
+                if (inter.width > 0 && inter.height > 0)
+                {
+                    WPG_TRACE_SCOPE(TraceStage::Composite, tile_index);
+                    cv::Mat src = img(inter - cv::Point(ox, oy));
+                    src.copyTo(result(inter - roi.tl()));
+                    if (!fresh.etag.empty())
+                        fresh.part = src.clone();
+                }
+                cache.store(key, std::move(fresh));
+            }
+            tile_index++;
+            traceSetGauge(TraceGauge::TilesPending, tile_count - tile_index);
+        }
+    }
+
+    cache.endCycle();
+    captureCycleEnd();
+    return result;
+}
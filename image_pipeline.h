@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cpr/cpr.h>
+#include <atomic>
+#include <string>
+#include <tuple>
+#include <utility>
+
+// 取得処理を中断させるフラグ（設定更新時・終了時に立てる）
+extern std::atomic<bool> abort_fetch;
+
+// src のアルファを mask の不透明部分に限定する（どちらも CV_8UC4）
+cv::Mat applyAlphaMask(const cv::Mat &src, const cv::Mat &mask);
+
+void ensureBGRA(cv::Mat &img);
+
+// 差分画像・img1の不透明ピクセル数・変更ピクセル数を返す
+std::tuple<cv::Mat, int, int> imageDifferenceSafe(const cv::Mat &img1, const cv::Mat &img2);
+
+// 差分画像を作らずに img1の不透明ピクセル数・変更ピクセル数だけを数える（どちらも CV_8UC4）
+std::pair<int, int> countDifference(const cv::Mat &img1, const cv::Mat &img2);
+
+cpr::Response cancellable_fetch(const std::string &url, const cpr::Header &headers);
+
+// base_url 配下のタイルを取得して結合し、指定領域を切り出す。失敗時は空のMat
+cv::Mat fetch_tiles_and_crop_cpp(
+    const std::string &base_url,
+    int tile_x, int tile_y, int x_in_tile, int y_in_tile,
+    int ref_width, int ref_height, int TILE_SIZE = 1000);
@@ -0,0 +1,117 @@
+﻿#include "image_viewer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // 拡大は画像の1ピクセルが画面の256ピクセルまで、縮小は全体表示の1/4まで
+    constexpr double kMinScale = 1.0 / 256.0;
+    constexpr double kMaxFitRatio = 4.0;
+    // ホイール1段あたりの倍率（トラックパッドの小さな量はそのまま指数に使う）
+    constexpr double kWheelZoom = 1.1;
+}
+
+double ImageViewer::fitScale(const ImVec2 &size) const
+{
+    return std::max(imageWidth_ / (double)size.x, imageHeight_ / (double)size.y);
+}
+
+bool ImageViewer::update(int imageWidth, int imageHeight, const char *id)
+{
+    const ImVec2 size = ImGui::GetContentRegionAvail();
+    if (imageWidth <= 0 || imageHeight <= 0 || size.x < 1.0f || size.y < 1.0f)
+    {
+        hovered_ = false;
+        return false;
+    }
+    imageWidth_ = imageWidth;
+    imageHeight_ = imageHeight;
+
+    // ウィンドウの移動ではなくこの項目がドラッグを受け取るように、ボタンとして置く
+    ImGui::InvisibleButton(id, size, ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonRight);
+    itemMin_ = ImGui::GetItemRectMin();
+    itemMax_ = ImGui::GetItemRectMax();
+    hovered_ = ImGui::IsItemHovered();
+    const ImVec2 mid((itemMin_.x + itemMax_.x) * 0.5f, (itemMin_.y + itemMax_.y) * 0.5f);
+
+    ViewerCamera &cam = camera();
+    const double fit = fitScale(size);
+    if (hasPendingRect_)
+    {
+        const float *r = pendingRect_;
+        double w = (r[2] - r[0]) * 1.5 + 16.0;
+        double h = (r[3] - r[1]) * 1.5 + 16.0;
+        cam.centerX = (r[0] + r[2]) * 0.5;
+        cam.centerY = (r[1] + r[3]) * 0.5;
+        cam.scale = std::clamp(std::max(w / size.x, h / size.y), kMinScale, fit * kMaxFitRatio);
+        cam.fit = false;
+        hasPendingRect_ = false;
+    }
+    if (hovered_ && ImGui::IsMouseClicked(ImGuiMouseButton_Right))
+        cam.fit = true;
+    if (cam.fit)
+    {
+        cam.centerX = imageWidth_ * 0.5;
+        cam.centerY = imageHeight_ * 0.5;
+        cam.scale = fit;
+    }
+
+    const ImGuiIO &io = ImGui::GetIO();
+    if (ImGui::IsItemActive() && ImGui::IsMouseDown(ImGuiMouseButton_Left) && (io.MouseDelta.x != 0.0f || io.MouseDelta.y != 0.0f))
+    {
+        cam.centerX -= io.MouseDelta.x * cam.scale;
+        cam.centerY -= io.MouseDelta.y * cam.scale;
+        cam.fit = false;
+    }
+    if (hovered_ && io.MouseWheel != 0.0f)
+    {
+        // カーソルの下の画像の点（ピクセル以下も含む）が拡大縮小の後も同じ画面の位置に来るように中心を動かす
+        const double dx = io.MousePos.x - mid.x, dy = io.MousePos.y - mid.y;
+        const double anchorX = cam.centerX + dx * cam.scale;
+        const double anchorY = cam.centerY + dy * cam.scale;
+        const double newScale = std::clamp(cam.scale / std::pow(kWheelZoom, (double)io.MouseWheel), kMinScale, fit * kMaxFitRatio);
+        cam.centerX = anchorX - dx * newScale;
+        cam.centerY = anchorY - dy * newScale;
+        cam.scale = newScale;
+        cam.fit = false;
+    }
+
+    centerX_ = cam.centerX;
+    centerY_ = cam.centerY;
+    scale_ = cam.scale;
+    const double halfW = size.x * scale_ * 0.5, halfH = size.y * scale_ * 0.5;
+    uv0_ = ImVec2((float)((centerX_ - halfW) / imageWidth_), (float)((centerY_ - halfH) / imageHeight_));
+    uv1_ = ImVec2((float)((centerX_ + halfW) / imageWidth_), (float)((centerY_ + halfH) / imageHeight_));
+    return true;
+}
+
+void ImageViewer::zoomToRect(float x0, float y0, float x1, float y1)
+{
+    pendingRect_[0] = x0;
+    pendingRect_[1] = y0;
+    pendingRect_[2] = x1;
+    pendingRect_[3] = y1;
+    hasPendingRect_ = true;
+}
+
+ImVec2 ImageViewer::imageToScreen(double x, double y) const
+{
+    const double midX = (itemMin_.x + itemMax_.x) * 0.5, midY = (itemMin_.y + itemMax_.y) * 0.5;
+    return ImVec2((float)(midX + (x - centerX_) / scale_), (float)(midY + (y - centerY_) / scale_));
+}
+
+bool ImageViewer::hoveredPixel(int &x, int &y) const
+{
+    if (!hovered_)
+        return false;
+    const ImVec2 mouse = ImGui::GetIO().MousePos;
+    const double midX = (itemMin_.x + itemMax_.x) * 0.5, midY = (itemMin_.y + itemMax_.y) * 0.5;
+    const double px = std::floor(centerX_ + (mouse.x - midX) * scale_);
+    const double py = std::floor(centerY_ + (mouse.y - midY) * scale_);
+    if (px < 0 || py < 0 || px >= imageWidth_ || py >= imageHeight_)
+        return false;
+    x = (int)px;
+    y = (int)py;
+    return true;
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include "imgui.h"
+
+// 画像ビューの表示位置（複数のビューで共有すると連動する）
+//
+// uv ではなく画像のピクセル座標の中心と倍率で持つので、大きさや縦横比の違うウィンドウで共有しても
+// 同じ場所・同じ倍率で表示できる。fit のときはウィンドウごとに画像全体が収まる倍率で中央に表示する。
+struct ViewerCamera
+{
+    double centerX = 0.0, centerY = 0.0; // 表示の中心（画像のピクセル座標）
+    double scale = 1.0;                  // 画面1ピクセルあたりの画像のピクセル数
+    bool fit = true;
+};
+
+// ドラッグで移動・ホイールで拡大縮小・右クリックで全体表示する画像ビュー
+//
+// 拡大縮小はカーソルの下の画像の点を動かさないように中心を動かす（ピクセル以下の位置も保つ）。
+// 描画はしないので、update() が true を返したら uv0()〜uv1() を itemMin()〜itemMax() に描く。
+// ウィンドウが閉じている・折りたたまれている・ドッキングのタブが隠れているときは ImGui::Begin が false を返すので、
+// そのときは update() を呼ばなければ入力の処理も描画もしない。
+class ImageViewer
+{
+public:
+    ImageViewer() = default;
+
+    // linked を渡すとその表示位置を使う（nullptr なら自分だけの表示位置）
+    void setLinked(ViewerCamera *linked) { linked_ = linked; }
+    ViewerCamera &camera() { return linked_ ? *linked_ : own_; }
+
+    // 項目を置いて入力を反映し、今フレームの表示範囲を決める。画像か表示先が空なら false
+    bool update(int imageWidth, int imageHeight, const char *id = "##view");
+    // 画像の矩形 [x0, x1) x [y0, y1) が余白付きで収まるようにする（次の update で反映）
+    void zoomToRect(float x0, float y0, float x1, float y1);
+    // 全体表示に戻す（連動していないときの自分の表示位置も）
+    void reset()
+    {
+        own_.fit = true;
+        camera().fit = true;
+    }
+
+    const ImVec2 &uv0() const { return uv0_; }
+    const ImVec2 &uv1() const { return uv1_; }
+    const ImVec2 &itemMin() const { return itemMin_; }
+    const ImVec2 &itemMax() const { return itemMax_; }
+    // 画像のピクセル座標を画面の座標に
+    ImVec2 imageToScreen(double x, double y) const;
+    // カーソルが画像の上にあればそのピクセル
+    bool hoveredPixel(int &x, int &y) const;
+
+private:
+    double fitScale(const ImVec2 &size) const;
+
+    ViewerCamera own_;
+    ViewerCamera *linked_ = nullptr;
+    int imageWidth_ = 0, imageHeight_ = 0;
+    bool hasPendingRect_ = false;
+    float pendingRect_[4] = {};
+    // 今フレームの表示範囲
+    double centerX_ = 0.0, centerY_ = 0.0, scale_ = 1.0;
+    ImVec2 uv0_, uv1_, itemMin_, itemMax_;
+    bool hovered_ = false;
+};
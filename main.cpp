@@ -8,6 +8,28 @@
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "image_pipeline.h"
+#include "tiled_texture.h"
+#include "gl_texture.h"
+#include "overlay_shader.h"
+#include "image_viewer.h"
+#include "pixel_index.h"
+#include "pixel_inspector.h"
+#include "trace.h"
+#include "perf_panel.h"
+#include "metrics_exporter.h"
+#include "history_store.h"
+#include "timeline_panel.h"
+#include "diff_series.h"
+#include "series_panel.h"
+#include "change_heatmap.h"
+#include "cluster_panel.h"
+#include "repair_panel.h"
+#include "event_bus.h"
+#include "alert_rules.h"
+#include "alert_panel.h"
+#include "tile_capture.h"
+#include "template_cache.h"
 #include <thread>
 #include <chrono>
 #include <atomic>
@@ -23,6 +45,7 @@
 #include <commdlg.h>
 #include <string>
 #include <fstream> // C++のファイルストリームを使用
+#include <ctime>
 
 void setWindowIconFromExe(GLFWwindow *window)
 {
@@ -51,15 +74,51 @@ void setWindowIconFromExe(GLFWwindow *window)
 
 using namespace cv;
 
-std::atomic<bool> abort_fetch{false};
-
 std::atomic<bool> stopThread{false};
 
 static bool showOriginal = true;
 static bool showRealtime = true;
 static bool showDiff = true;
+static bool showOverlay = false;
+// 画像ビューの移動・拡大縮小を連動させる
+static bool linkViews = true;
+// 画像ビューのカーソルの下のピクセルの情報をツールチップに出す
+static bool showPixelInfo = true;
+// 更新スレッドが差分画像を作るかどうか（UIスレッドが毎フレーム、差分画像の画面が実際に見えているかを書く。
+// メニューで開いていても畳まれている・タブの裏に隠れているときは作らない）
+static std::atomic<bool> diffImageWanted{true};
 static bool showSettings = true;
 static bool showInfo = true;
+static bool showPerf = false;
+static bool showTimeline = false;
+static bool showClusters = false;
+static bool showRepair = false;
+static bool traceRecording = false;
+
+// メトリクス公開（Prometheus / OpenMetrics）。外部に晒さないようループバックのみで待ち受ける
+static bool metricsEnabled = false;
+static int metricsPort = 9464;
+
+// 監視領域の変更履歴を history フォルダに記録する
+static bool historyRecording = true;
+
+// 荒らされたピクセルのヒートマップを差分画像に重ねる
+static bool heatmapOverlay = false;
+static bool heatmapAllTime = false;
+static float heatmapHalfLife = 60.0f; // 最近の回数の半減期（分）
+
+// ピクセル変化の通知。ファイルが空ならアプリのフォルダの events.jsonl、ソケットと webhook は空なら使わない
+static bool eventsEnabled = false;
+static std::string eventsFile;
+static std::string eventsSocket;
+static std::string eventsWebhook; // ループバックのURLのみ
+
+// 重ね合わせ画面の表示（不透明度・間違いの色・間違いだけ表示）
+static OverlaySettings overlay;
+
+// 読み込んだテンプレートをパレットの色に合わせる（次に読み込むときから効く）
+static bool quantizeTemplate = true;
+static PaletteQuantizeReport templateQuantize;
 
 static int tile_x = 1818;
 static int tile_y = 806;
@@ -68,11 +127,17 @@ static int pixel_y = 358;
 
 static float UpdateSpeed = 4.0f;
 
+// タイル取得先。ローカルのモックサーバーでベンチマークする場合は http://127.0.0.1:8080 などに変更する
+static std::string tileBaseUrl = "https://backend.wplace.live";
+char tileBaseUrlBuffer[256] = {0};
+
 static std::string szFile = "template.png";
 char szFileBuffer[MAX_PATH] = {0};
 
 // INIファイルの絶対パスを格納するグローバル変数
 std::string iniPath;
+// 履歴ファイルの保存先（末尾に区切り文字を含む）
+std::string historyDir;
 
 // アプリケーション設定をINIファイルに保存する関数
 void SaveAppSettings()
@@ -88,8 +153,29 @@ void SaveAppSettings()
     ofs << "showOriginal=" << showOriginal << std::endl;
     ofs << "showRealtime=" << showRealtime << std::endl;
     ofs << "showDiff=" << showDiff << std::endl;
+    ofs << "showOverlay=" << showOverlay << std::endl;
+    ofs << "link_views=" << linkViews << std::endl;
+    ofs << "pixel_info=" << showPixelInfo << std::endl;
     ofs << "showSettings=" << showSettings << std::endl;
     ofs << "showInfo=" << showInfo << std::endl;
+    ofs << "showPerf=" << showPerf << std::endl;
+    ofs << "showTimeline=" << showTimeline << std::endl;
+    ofs << "showClusters=" << showClusters << std::endl;
+    ofs << "showRepair=" << showRepair << std::endl;
+    ofs << "trace=" << traceRecording << std::endl;
+    ofs << "metrics=" << metricsEnabled << std::endl;
+    ofs << "metrics_port=" << metricsPort << std::endl;
+    ofs << "history=" << historyRecording << std::endl;
+    ofs << "heatmap=" << heatmapOverlay << std::endl;
+    ofs << "heatmap_all_time=" << heatmapAllTime << std::endl;
+    ofs << "heatmap_half_life=" << heatmapHalfLife << std::endl;
+    ofs << "events=" << eventsEnabled << std::endl;
+    ofs << "events_file=" << eventsFile << std::endl;
+    ofs << "events_socket=" << eventsSocket << std::endl;
+    ofs << "events_webhook=" << eventsWebhook << std::endl;
+    ofs << "overlay_blend=" << overlay.blend << std::endl;
+    ofs << "overlay_color=" << ImGui::ColorConvertFloat4ToU32(overlay.highlight) << std::endl;
+    ofs << "overlay_wrong_only=" << overlay.wrongOnly << std::endl;
 
     // 位置系
     ofs << "tile_x=" << tile_x << std::endl;
@@ -100,6 +186,8 @@ void SaveAppSettings()
 
     // パス
     ofs << "path=" << szFile << std::endl;
+    ofs << "quantize_template=" << quantizeTemplate << std::endl;
+    ofs << "tile_base_url=" << tileBaseUrl << std::endl;
 
     ofs.close();
 }
@@ -132,10 +220,54 @@ void LoadAppSettings()
                 showRealtime = (std::stoi(val) != 0);
             else if (key == "showDiff")
                 showDiff = (std::stoi(val) != 0);
+            else if (key == "showOverlay")
+                showOverlay = (std::stoi(val) != 0);
+            else if (key == "link_views")
+                linkViews = (std::stoi(val) != 0);
+            else if (key == "pixel_info")
+                showPixelInfo = (std::stoi(val) != 0);
             else if (key == "showSettings")
                 showSettings = (std::stoi(val) != 0);
             else if (key == "showInfo")
                 showInfo = (std::stoi(val) != 0);
+            else if (key == "showPerf")
+                showPerf = (std::stoi(val) != 0);
+            else if (key == "showTimeline")
+                showTimeline = (std::stoi(val) != 0);
+            else if (key == "showClusters")
+                showClusters = (std::stoi(val) != 0);
+            else if (key == "showRepair")
+                showRepair = (std::stoi(val) != 0);
+            else if (key == "trace")
+                traceRecording = (std::stoi(val) != 0);
+            else if (key == "metrics")
+                metricsEnabled = (std::stoi(val) != 0);
+            else if (key == "metrics_port")
+                metricsPort = std::stoi(val);
+            else if (key == "history")
+                historyRecording = (std::stoi(val) != 0);
+            else if (key == "heatmap")
+                heatmapOverlay = (std::stoi(val) != 0);
+            else if (key == "heatmap_all_time")
+                heatmapAllTime = (std::stoi(val) != 0);
+            else if (key == "heatmap_half_life")
+                heatmapHalfLife = std::stof(val);
+            else if (key == "events")
+                eventsEnabled = (std::stoi(val) != 0);
+            else if (key == "quantize_template")
+                quantizeTemplate = (std::stoi(val) != 0);
+            else if (key == "overlay_blend")
+                overlay.blend = std::clamp(std::stof(val), 0.0f, 1.0f);
+            else if (key == "overlay_color")
+                overlay.highlight = ImGui::ColorConvertU32ToFloat4(static_cast<ImU32>(std::stoul(val)));
+            else if (key == "overlay_wrong_only")
+                overlay.wrongOnly = (std::stoi(val) != 0);
+            else if (key == "events_file")
+                eventsFile = val;
+            else if (key == "events_socket")
+                eventsSocket = val;
+            else if (key == "events_webhook")
+                eventsWebhook = val;
             else if (key == "tile_x")
                 tile_x = std::stoi(val);
             else if (key == "tile_y")
@@ -148,6 +280,8 @@ void LoadAppSettings()
                 UpdateSpeed = std::stof(val);
             else if (key == "path")
                 szFile = val;
+            else if (key == "tile_base_url")
+                tileBaseUrl = val;
         }
         catch (const std::exception &e)
         {
@@ -157,258 +291,23 @@ void LoadAppSettings()
     ifs.close();
 }
 
-cv::Mat applyAlphaMask(const cv::Mat &src, const cv::Mat &mask)
-{
-    if (src.empty() || mask.empty())
-        return cv::Mat();
-    CV_Assert(src.size() == mask.size());
-    CV_Assert(src.type() == CV_8UC4 && mask.type() == CV_8UC4);
-
-    cv::Mat dst = src.clone();
-    for (int y = 0; y < src.rows; ++y)
-    {
-        const cv::Vec4b *srcRow = src.ptr<cv::Vec4b>(y);
-        const cv::Vec4b *maskRow = mask.ptr<cv::Vec4b>(y);
-        cv::Vec4b *dstRow = dst.ptr<cv::Vec4b>(y);
-        for (int x = 0; x < src.cols; ++x)
-        {
-            uchar srcA = srcRow[x][3] ? 255 : 0;
-            uchar maskA = maskRow[x][3] ? 255 : 0;
-            dstRow[x][3] = srcA & maskA;
-        }
-    }
-    return dst;
-}
-
-void ensureBGRA(cv::Mat &img)
-{
-    if (img.empty())
-        return;
-    if (img.channels() == 3)
-        cv::cvtColor(img, img, COLOR_BGR2BGRA);
-}
-
-std::tuple<cv::Mat, int, int> imageDifferenceSafe(const cv::Mat &img1, const cv::Mat &img2)
-{
-    if (img1.empty() || img2.empty())
-        return {cv::Mat(), 0, 0};
-
-    int w = std::min(img1.cols, img2.cols);
-    int h = std::min(img1.rows, img2.rows);
-    if (w <= 0 || h <= 0)
-        return {cv::Mat(), 0, 0};
-
-    cv::Mat diffImage = cv::Mat::zeros(img1.size(), CV_8UC4);
-    cv::Rect roi(0, 0, w, h);
-    cv::Mat roi1 = img1(roi);
-    cv::Mat roi2 = img2(roi);
-
-    // 差分（RGB絶対値）
-    cv::Mat rgbDiff;
-    if (roi1.channels() >= 3 && roi2.channels() >= 3)
-    {
-        std::vector<cv::Mat> ch1, ch2, chDiff(3);
-        cv::split(roi1, ch1);
-        cv::split(roi2, ch2);
-        for (int i = 0; i < 3; ++i)
-            cv::absdiff(ch1[i], ch2[i], chDiff[i]);
-        cv::merge(chDiff, rgbDiff);
-    }
-    else
-    {
-        cv::absdiff(roi1, roi2, rgbDiff);
-    }
-
-    // アルファチャンネル
-    cv::Mat alpha;
-    if (roi1.channels() == 4)
-        cv::extractChannel(roi1, alpha, 3);
-    else
-        alpha = cv::Mat::ones(roi.size(), CV_8U) * 255;
-
-    // RGBAにマージ
-    cv::Mat merged;
-    std::vector<cv::Mat> ch;
-    cv::split(rgbDiff, ch);
-    ch.push_back(alpha);
-    cv::merge(ch, merged);
-
-    merged.copyTo(diffImage(roi));
-
-    // マスク作成：元画像の不透明ピクセル
-    cv::Mat opaqueMask = alpha > 0;
-
-    // 「間違いピクセル」のカウント
-    int changedPixels = 0;
-    for (int y = 0; y < h; ++y)
-    {
-        const cv::Vec4b *p1 = roi1.ptr<cv::Vec4b>(y);
-        const cv::Vec4b *p2 = roi2.ptr<cv::Vec4b>(y);
-        const uchar *maskPtr = opaqueMask.ptr<uchar>(y);
-        for (int x = 0; x < w; ++x)
-        {
-            if (maskPtr[x])
-            {
-                if (p1[x] != p2[x])
-                    changedPixels++;
-            }
-        }
-    }
-
-    int totalOpaquePixels = cv::countNonZero(opaqueMask);
-    return {diffImage, totalOpaquePixels, changedPixels};
-}
-
-cpr::Response cancellable_fetch(const std::string &url, const cpr::Header &headers)
-{
-    try
-    {
-        auto future = cpr::GetAsync(cpr::Url{url}, headers, cpr::Timeout{5000});
-
-        while (!abort_fetch && future.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready)
-        {
-        }
-
-        if (abort_fetch)
-        {
-            try
-            {
-                // 戻り値を変数に格納して破棄
-                cpr::Response ignored = future.get();
-                (void)ignored; // 明示的に破棄
-            }
-            catch (...)
-            {
-            }
-            return cpr::Response{};
-        }
-
-        return future.get();
-    }
-    catch (...)
-    {
-        return cpr::Response{};
-    }
-}
-
-cv::Mat fetch_tiles_and_crop_cpp(
-    int tile_x, int tile_y, int x_in_tile, int y_in_tile,
-    int ref_width, int ref_height, int TILE_SIZE = 1000)
-{
-    int end_x = x_in_tile + ref_width;
-    int end_y = y_in_tile + ref_height;
-    int tile_x_end = tile_x + (end_x / TILE_SIZE);
-    int tile_y_end = tile_y + (end_y / TILE_SIZE);
-
-    int canvas_w = (tile_x_end - tile_x + 1) * TILE_SIZE;
-    int canvas_h = (tile_y_end - tile_y + 1) * TILE_SIZE;
-    cv::Mat canvas(canvas_h, canvas_w, CV_8UC4, cv::Scalar(0, 0, 0, 0));
-
-    cpr::Header headers = {
-        {"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64)"},
-        {"Accept", "image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8"},
-        {"Referer", "https://www.google.com/"}};
-
-    int tile_index = 0;
-    for (int ty = tile_y; ty <= tile_y_end; ++ty)
-    {
-        for (int tx = tile_x; tx <= tile_x_end; ++tx)
-        {
-            if (abort_fetch)
-                return cv::Mat();
-            auto now = std::chrono::system_clock::now();
-            auto epoch = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
-            std::string url = "https://backend.wplace.live/files/s0/tiles/" + std::to_string(tx) + "/" + std::to_string(ty) + ".png" + "?t=" + std::to_string(epoch);
-            cpr::Response r = cancellable_fetch(url, headers);
-            if (abort_fetch)
-                return cv::Mat();
-            if (r.status_code != 200 || r.text.empty())
-                return cv::Mat();
-
-            std::vector<uchar> data(r.text.begin(), r.text.end());
-            cv::Mat img = cv::imdecode(data, cv::IMREAD_UNCHANGED);
-            if (img.empty())
-                return cv::Mat();
-
-            int ty_rel = tile_index / (tile_x_end - tile_x + 1);
-            int tx_rel = tile_index % (tile_x_end - tile_x + 1);
-            int oy = ty_rel * TILE_SIZE;
-            int ox = tx_rel * TILE_SIZE;
-
-            cv::Rect roi_dst(ox, oy, img.cols, img.rows);
-            cv::Rect canvas_rect(0, 0, canvas.cols, canvas.rows);
-            roi_dst &= canvas_rect;
-
-            if (roi_dst.width > 0 && roi_dst.height > 0)
-            {
-                cv::Rect roi_src(0, 0, roi_dst.width, roi_dst.height);
-                img(roi_src).copyTo(canvas(roi_dst));
-            }
-            tile_index++;
-        }
-    }
-
-    cv::Rect roi(x_in_tile, y_in_tile, ref_width, ref_height);
-    cv::Rect canvas_rect(0, 0, canvas.cols, canvas.rows);
-    roi &= canvas_rect;
-    if (roi.width <= 0 || roi.height <= 0)
-        return cv::Mat();
-    return canvas(roi).clone();
-}
-
-GLuint matToTexture(const cv::Mat &mat)
+// 読み込んだテンプレートの減色の結果を情報ウィンドウ用に残す
+void SetTemplateReport(const PaletteQuantizeReport &report)
 {
-    if (mat.empty())
-        return 0;
-    GLuint texID;
-    glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
-    GLenum format = (mat.channels() == 3) ? GL_BGR : GL_BGRA;
-    GLint internalFormat = (mat.channels() == 3) ? GL_RGB8 : GL_RGBA8;
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, mat.cols, mat.rows, 0, format, GL_UNSIGNED_BYTE, mat.data);
-    float borderColor[] = {0.0f, 0.0f, 0.0f, 0.0f};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return texID;
+    templateQuantize = report;
+    if (templateQuantize.unmappable > 0)
+        std::cerr << "テンプレートにパレットで表せないピクセルがあります: " << templateQuantize.unmappable << " ピクセル" << std::endl;
 }
 
-enum class ZoomDir
+// テンプレートを BGRA で読み込み、設定に応じてパレットの色に合わせる（コンパイル済みのファイルがあればそれを使う）
+bool LoadTemplateImage(const std::string &path, const HistoryRegion &target, cv::Mat &img)
 {
-    ZoomIn,
-    ZoomOut
-};
-
-void ApplyZoom(ImVec2 &uv0, ImVec2 &uv1, const ImVec2 &origin, ZoomDir dir, float factor = 1.1f)
-{
-    float zoom = (dir == ZoomDir::ZoomIn) ? factor : (1.0f / factor);
-    uv0.x = (uv0.x - origin.x) * zoom + origin.x;
-    uv0.y = (uv0.y - origin.y) * zoom + origin.y;
-    uv1.x = (uv1.x - origin.x) * zoom + origin.x;
-    uv1.y = (uv1.y - origin.y) * zoom + origin.y;
-}
-
-void CalcUVForAspect(float imgAspect, float winAspect, ImVec2 &uv0, ImVec2 &uv1)
-{
-    ImVec2 uvCenter((uv0.x + uv1.x) * 0.5f, (uv0.y + uv1.y) * 0.5f);
-    float uvWidth = uv1.x - uv0.x;
-    float uvHeight = uv1.y - uv0.y;
-
-    if (imgAspect < winAspect)
-    {
-        float newUvWidth = (winAspect / imgAspect) * uvHeight;
-        uv0.x = uvCenter.x - newUvWidth * 0.5f;
-        uv1.x = uvCenter.x + newUvWidth * 0.5f;
-    }
-    else if (imgAspect > winAspect)
-    {
-        float newUvHeight = (imgAspect / winAspect) * uvWidth;
-        uv0.y = uvCenter.y - newUvHeight * 0.5f;
-        uv1.y = uvCenter.y + newUvHeight * 0.5f;
-    }
+    LoadedTemplate loaded;
+    if (!loadTemplate(path, quantizeTemplate, target, loaded))
+        return false;
+    img = loaded.bgra;
+    SetTemplateReport(loaded.quantize);
+    return true;
 }
 
 int main()
@@ -420,6 +319,8 @@ int main()
     size_t lastSlash = fullPath.find_last_of("\\/");
     std::string appDir = fullPath.substr(0, lastSlash + 1);
     iniPath = appDir + "app_settings.ini";
+    historyDir = appDir + "history\\";
+    CreateDirectoryA(historyDir.c_str(), NULL);
 
     std::string imguiIniPath = appDir + "imgui.ini";
 
@@ -444,6 +345,7 @@ int main()
     io.IniFilename = imguiIniPath.c_str();
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330 core");
+    TiledTexture::setDrawCallback(bindNearestSampler);
     ImGui::StyleColorsDark();
 
     ImFontConfig font_cfg{};
@@ -458,24 +360,87 @@ int main()
 
     // アプリ起動時に設定を読み込む
     LoadAppSettings();
+    setTraceEnabled(traceRecording || showPerf);
     // szFileBufferにszFileの値をコピーして、ImGuiの初期値を設定
     strncpy(szFileBuffer, szFile.c_str(), MAX_PATH);
+    strncpy(tileBaseUrlBuffer, tileBaseUrl.c_str(), sizeof(tileBaseUrlBuffer) - 1);
+
+    metricsSetTemplateName(szFile.substr(szFile.find_last_of("\\/") + 1));
+    if (metricsEnabled && !startMetricsServer("127.0.0.1", metricsPort))
+    {
+        std::cerr << "メトリクスサーバーを起動できませんでした: ポート " << metricsPort << std::endl;
+        metricsEnabled = false;
+    }
 
-    cv::Mat originalImg = cv::imread(szFile, cv::IMREAD_UNCHANGED);
-    if (originalImg.empty())
+    // ピクセル変化の通知（更新スレッドが差分の直後に積む）
+    EventBus events;
+    auto startEvents = [&]()
+    {
+        EventSinkOptions options;
+        options.filePath = eventsFile.empty() ? appDir + "events.jsonl" : eventsFile;
+        options.socketPath = eventsSocket;
+        options.webhookUrl = eventsWebhook;
+        events.resetDamageState();
+        return events.start(options);
+    };
+    if (eventsEnabled && !startEvents())
+    {
+        std::cerr << "イベント通知を開始できませんでした" << std::endl;
+        eventsEnabled = false;
+    }
+
+    // 起動時はウィンドウを出す前なのでその場で読み込み、[更新] からはバックグラウンドで読み込む
+    TemplateLoader templateLoader;
+    double abortFetchUntil = 0.0; // 領域を変えたときに取得中の周期を打ち切る期限（glfwGetTime）
+    cv::Mat originalImg;
+    if (!LoadTemplateImage(szFile, {tile_x, tile_y, pixel_x, pixel_y}, originalImg))
     {
         originalImg = cv::Mat(1, 1, CV_8UC4, cv::Scalar(0, 0, 0, 0));
     }
-    ensureBGRA(originalImg);
-    GLuint originalTexID = matToTexture(originalImg);
+    // 画像はタイルに分けたテクスチャで表示する（大きな画像も表示でき、変わったタイルだけ転送する）
+    // 縮小表示では縮小段を使い、差分は間違いのピクセル、ヒートマップは回数の多いピクセルがどの倍率でも消えないように残す
+    TiledTexture originalTex(TextureLod::Box), realtimeTex(TextureLod::Box), diffTex(TextureLod::AnyWrong), heatTex(TextureLod::MaxAlpha);
+    originalTex.create(originalImg);
     int width = originalImg.cols;
     int height = originalImg.rows;
 
     cv::Mat realtimeImg(height, width, CV_8UC4, cv::Scalar(0, 0, 0, 0));
-    GLuint realtimeTexID = matToTexture(realtimeImg);
+    realtimeTex.create(realtimeImg);
 
     cv::Mat emptyDiff(height, width, CV_8UC4, cv::Scalar(0, 0, 0, 0));
-    GLuint diffTexID = matToTexture(emptyDiff);
+    diffTex.create(emptyDiff);
+
+    // 荒らされた回数のヒートマップ（更新スレッドが数え、差分画像に重ねて表示する）
+    ChangeHeatmap heatmap;
+    heatmap.reset(width, height);
+    heatmap.setHalfLifeMinutes(heatmapHalfLife);
+    heatTex.create(emptyDiff);
+    // ピクセルごとの今の色と最後に変わった時刻（更新スレッドが書き、ツールチップがロックなしで読む）
+    PixelIndex pixelIndex;
+    pixelIndex.reset(width, height);
+    uint64_t heatTexVersion = UINT64_MAX;
+    bool heatTexAllTime = heatmapAllTime;
+    cv::Mat heatImg;
+
+    // 間違いピクセルの連結領域（更新スレッドが更新し、損傷領域ウィンドウが読む）
+    DamageTracker damage;
+    DamageCluster selectedCluster;
+    bool zoomToCluster = false;
+    // 修復リスト（損傷領域と同じ周期の増減で更新する）
+    RepairPlan repairPlan;
+    repairPlan.setRegion({tile_x, tile_y, pixel_x, pixel_y});
+    // 差分値のアラート（ルールはテンプレートごとのファイルに置き、なければ既定のルール）
+    AlertEngine alerts;
+    std::string alertPath = alertRulesPath(szFile);
+    auto loadAlerts = [&]()
+    {
+        std::vector<AlertRule> rules;
+        if (!loadAlertRules(alertPath, rules))
+            rules = defaultAlertRules();
+        alerts.setRules(std::move(rules));
+        alerts.reset();
+    };
+    loadAlerts();
 
     static int tmpTile_x = tile_x;
     static int tmpTile_y = tile_y;
@@ -483,46 +448,178 @@ int main()
     static int tmpPixel_y = pixel_y;
     static float tmpUpdateSpeed = UpdateSpeed;
 
+    // テンプレートか監視領域を差し替えるたびに増やす（damageMutex と imgMutex の両方を取って書き、どちらかを取って読む）。
+    // 更新スレッドは周期の始めに控えた値と比べ、取得中に差し替えられた周期の画像は捨てる
+    uint64_t templateGeneration = 0;
+    // 今の監視領域の履歴ファイル（imgMutex で保護）
+    std::string historyPath = historyFilePath(historyDir, szFile, {tile_x, tile_y, pixel_x, pixel_y}, width, height);
+    std::string seriesPath = historyFilePath(historyDir, szFile, {tile_x, tile_y, pixel_x, pixel_y}, width, height, ".wps");
+    // 差分率の時系列（更新スレッドが追記し、情報ウィンドウが読む）
+    DiffSeries diffSeries;
+
+    // タイムラインで表示している過去のフレーム
+    TimelineFrame historyFrame;
+    bool historyFrameUpdated = false;
+    bool showingHistory = false;
+    // 届いたがまだテクスチャに送っていない画像がある（画面が隠れている間は送らない）
+    bool realtimeUploadPending = false;
+    bool diffUploadPending = false;
+    // emptyDiff が今の realtimeImg より古い（差分画像の画面が見えていなくて作らなかった）。imgMutex で保護
+    bool diffImageStale = false;
+
     double diffPercent = 0.0;
     int totalOpaquePixels = 0;
     int changedPixels = 0;
 
     std::mutex imgMutex;
+    // 損傷領域の更新と変化の通知をテンプレートの差し替えと排他する（imgMutex より先に取る）。
+    // 通知は imgMutex を待たずに差分の直後に積むので、UIスレッドの描画中でも遅れない
+    std::mutex damageMutex;
     std::condition_variable cv_newFrame;
     bool newFrameReady = false;
 
-    ImVec2 OriginalUV0(0, 0), OriginalUV1(1, 1);
-    ImVec2 OriginalOrigin;
-    static bool isPanning = false;
-    static ImVec2 lastMouse;
-    ImVec2 RealtimeUV0(0, 0), RealtimeUV1(1, 1);
-    ImVec2 RealtimeOrigin;
-    bool isPanningRealtime = false;
-    ImVec2 lastMouseRealtime;
-
-    ImVec2 DiffUV0(0, 0), DiffUV1(1, 1);
-    ImVec2 DiffOrigin;
-    bool isPanningDiff = false;
-    ImVec2 lastMouseDiff;
+    // 画像ビュー。連動するときは同じ表示位置を共有する
+    ViewerCamera sharedCamera;
+    ImageViewer originalView, realtimeView, diffView, overlayView;
+    ImageViewer *const views[] = {&originalView, &realtimeView, &diffView, &overlayView};
 
     std::thread updateThread([&]()
                              {
+        traceSetThreadName("update");
+        HistoryWriter history;
+        std::string failedHistoryPath, failedSeriesPath;
+        std::vector<AlertTransition> alertTransitions;
         while(!stopThread){
-            cv::Mat newImg = fetch_tiles_and_crop_cpp(tile_x,tile_y,pixel_x,pixel_y,width,height);
-            if (!newImg.empty()) {
-                newImg = applyAlphaMask(newImg, originalImg);
+            uint64_t cycleStart = traceBegin();
+            std::string baseUrl, histPath, serPath;
+            // この周期はロック中に控えたテンプレート・監視領域・大きさだけを使う（UIスレッドが差し替えても混ざらない）
+            cv::Mat templ;
+            HistoryRegion region;
+            int templWidth = 0, templHeight = 0;
+            uint64_t generation = 0;
+            // 記録したタイルの再生中は履歴に書かず、周期の間隔も再生側に任せる
+            const bool replaying = tileReplayActive();
+            {
                 std::lock_guard<std::mutex> lock(imgMutex);
-                realtimeImg = newImg.clone();
-                auto [diffImg, totalOpaque, changed] = imageDifferenceSafe(originalImg, realtimeImg);
-                diffPercent = (totalOpaque > 0) ? (double)changed / totalOpaque * 100.0 : 0.0;
-                totalOpaquePixels = totalOpaque;
-                changedPixels = changed;
-
-                emptyDiff = diffImg.clone();
-                newFrameReady = true;
-                cv_newFrame.notify_one();
+                baseUrl = tileBaseUrl;
+                if (historyRecording && !replaying) {
+                    histPath = historyPath;
+                    serPath = seriesPath;
+                }
+                templ = originalImg;
+                region = {tile_x, tile_y, pixel_x, pixel_y};
+                templWidth = width;
+                templHeight = height;
+                generation = templateGeneration;
+            }
+            cv::Mat newImg = fetch_tiles_and_crop_cpp(baseUrl,region.tileX,region.tileY,region.pixelX,region.pixelY,templWidth,templHeight);
+            // 領域の一部がタイルの外にあると小さく切り出される。テンプレートと重ねられないので捨てる
+            if (newImg.size() != templ.size())
+                newImg.release();
+            // 変化の通知の遅延はここ（タイルがそろった時点）から測る
+            const uint64_t arrivalNs = traceNowNs();
+            // 再生した画像は表示と差分率にだけ使い、ヒートマップ・損傷領域・修復リスト・イベント・アラート・メトリクス・
+            // ピクセルごとの変化の時刻には入れない（監視中の実際の状態を再生の内容で上書きしないため）。
+            // 取得の途中で再生を始めた場合も再生の画像なので、取得の後にもう一度確かめる
+            const bool replayedFrame = replaying || tileReplayActive();
+            if (replayedFrame) {
+                histPath.clear();
+                serPath.clear();
+            }
+            if (!newImg.empty()) {
+                // ヒートマップはロックの外で更新するので、ロック中に世代を取っておく
+                uint64_t heatGeneration = 0;
+                {
+                    WPG_TRACE_SCOPE(TraceStage::Mask);
+                    newImg = applyAlphaMask(newImg, templ);
+                }
+                // 間違いになった／直ったピクセルが分かった時点で、画像全体の処理や imgMutex を待たずに通知を積む
+                if (!replayedFrame) {
+                    std::lock_guard<std::mutex> lock(damageMutex);
+                    if (generation != templateGeneration)
+                        continue;
+                    WPG_TRACE_SCOPE(TraceStage::Clusters);
+                    auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                    damage.update(newImg, templ, nowMs);
+                    events.publishDamage(damage, newImg.cols, nowMs, arrivalNs);
+                }
+                if (serPath != diffSeries.path()) {
+                    diffSeries.close();
+                    if (!serPath.empty() && serPath != failedSeriesPath && !diffSeries.open(serPath))
+                        failedSeriesPath = serPath;
+                }
+                {
+                    uint64_t lockStart = traceBegin();
+                    std::lock_guard<std::mutex> lock(imgMutex);
+                    traceEnd(TraceStage::LockWait, lockStart);
+                    // 取得中にテンプレートか監視領域が差し替えられたら、古い領域の画像なので何も反映せずに次の周期へ
+                    if (generation != templateGeneration)
+                        continue;
+                    realtimeImg = newImg.clone();
+                    uint64_t diffStart = traceBegin();
+                    // 差分画像は差分画像の画面を表示しているときだけ作る（重ね合わせは GPU で比べる）
+                    const bool buildDiff = diffImageWanted;
+                    cv::Mat diffImg;
+                    int totalOpaque = 0, changed = 0;
+                    if (buildDiff)
+                        std::tie(diffImg, totalOpaque, changed) = imageDifferenceSafe(templ, realtimeImg);
+                    else
+                        std::tie(totalOpaque, changed) = countDifference(templ, realtimeImg);
+                    traceEnd(TraceStage::Diff, diffStart);
+                    diffPercent = (totalOpaque > 0) ? (double)changed / totalOpaque * 100.0 : 0.0;
+                    totalOpaquePixels = totalOpaque;
+                    changedPixels = changed;
+                    if (!replayedFrame)
+                        metricsUpdateTemplate(diffPercent, changed, totalOpaque);
+                    // マップしたメモリへの書き込みだけなのでロック中でよい
+                    if (diffSeries.isOpen()) {
+                        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                        diffSeries.append(nowMs, diffPercent, changed, totalOpaque);
+                    }
+                    heatGeneration = heatmap.generation();
+                    if (!replayedFrame) {
+                        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                        pixelIndex.update(realtimeImg, nowMs);
+                    }
+                    if (!replayedFrame) {
+                        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                        // reset 後の最初の周期は既存の間違いがすべて「増えた」扱いになるので、荒らしの速さには数えない
+                        // （イベント通知がこの周期を baseline として扱うのと同じ）
+                        const int newlyWrong = damage.lastUpdateWasBaseline() ? 0 : static_cast<int>(damage.lastAdded().size());
+                        alerts.evaluate(nowMs, changed, diffPercent, newlyWrong, alertTransitions);
+                        for (const AlertTransition &alert : alertTransitions)
+                            events.publishAlert(alert, arrivalNs);
+                        repairPlan.update(damage, realtimeImg, templ, nowMs);
+                    }
+
+                    if (buildDiff)
+                        emptyDiff = diffImg;
+                    diffImageStale = !buildDiff;
+                    newFrameReady = true;
+                    cv_newFrame.notify_one();
+                }
+                // 全画素を走査するので UIスレッドを待たせないようロックの外で行う。
+                // newImg は realtimeImg に写した後はこのスレッドしか触らず、templ は差し替えられても参照で残る
+                if (!replayedFrame) {
+                    WPG_TRACE_SCOPE(TraceStage::Heatmap);
+                    auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                    heatmap.update(newImg, templ, nowMs, heatGeneration);
+                }
+                // 履歴への追記はディスク書き込みを含むので、ロックの外で通知を積んだ後に行う
+                if (histPath != history.path()) {
+                    history.close();
+                    if (!histPath.empty() && histPath != failedHistoryPath &&
+                        !history.open(histPath, region, newImg.cols, newImg.rows))
+                        failedHistoryPath = histPath;
+                }
+                if (history.isOpen()) {
+                    WPG_TRACE_SCOPE(TraceStage::History);
+                    auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                    history.append(newImg, nowMs);
+                }
             }
-            for(int i=0;i<10 && !stopThread;i++) std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(UpdateSpeed * 100)));
+            traceEnd(TraceStage::Cycle, cycleStart);
+            for(int i=0;i<10 && !stopThread && !(replaying && tileReplayActive());i++) std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(UpdateSpeed * 100)));
         } });
 
     glfwSetWindowCloseCallback(window, [](GLFWwindow *win)
@@ -531,8 +628,15 @@ int main()
         abort_fetch = true;
         stopThread = true; });
 
+    // 落ちたフレームの判定に使うリフレッシュ間隔
+    const GLFWvidmode *vidmode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    const double refreshInterval = 1.0 / ((vidmode && vidmode->refreshRate > 0) ? vidmode->refreshRate : 60);
+    double lastFrameEnd = glfwGetTime();
+
+    traceSetThreadName("render");
     while (!glfwWindowShouldClose(window))
     {
+        uint64_t frameStart = traceBegin();
         glfwPollEvents();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -541,6 +645,73 @@ int main()
         ImGuiViewport *viewport = ImGui::GetMainViewport();
         ImGui::DockSpaceOverViewport(viewport->ID, viewport, ImGuiDockNodeFlags_PassthruCentralNode);
 
+        // バックグラウンドで読み込んだテンプレートを、このフレームの描画の前に差し替える
+        TemplateLoadResult loadedTemplate;
+        if (templateLoader.takeResult(loadedTemplate))
+        {
+            const std::string &templatePath = loadedTemplate.request.path;
+            // 新しい画像はロックの外で用意し、ロック中は差し替えるだけにする
+            // （テクスチャはUIスレッドしか触らないので、描画の前のここで作り直す）
+            cv::Mat newOriginal, newRealtime, newEmpty;
+            if (loadedTemplate.ok)
+            {
+                newOriginal = loadedTemplate.loaded.bgra;
+                newRealtime = cv::Mat(newOriginal.rows, newOriginal.cols, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+                newEmpty = cv::Mat(newOriginal.rows, newOriginal.cols, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+                originalTex.create(newOriginal);
+                realtimeTex.create(newRealtime);
+                diffTex.create(newEmpty);
+                heatTex.create(newEmpty);
+                heatTexVersion = UINT64_MAX;
+                // 画像の大きさが変わるので全体表示に戻す
+                sharedCamera.fit = true;
+                for (ImageViewer *view : views)
+                    view->reset();
+                SetTemplateReport(loadedTemplate.loaded.quantize);
+                metricsSetTemplateName(templatePath.substr(templatePath.find_last_of("\\/") + 1));
+            }
+
+            std::scoped_lock lock(damageMutex, imgMutex);
+            ++templateGeneration;
+            if (loadedTemplate.ok)
+            {
+                originalImg = newOriginal;
+                realtimeImg = newRealtime;
+                emptyDiff = newEmpty;
+                diffImageStale = false;
+                width = originalImg.cols;
+                height = originalImg.rows;
+            }
+
+            const HistoryRegion &target = loadedTemplate.request.target;
+            tile_x = target.tileX;
+            tile_y = target.tileY;
+            pixel_x = target.pixelX;
+            pixel_y = target.pixelY;
+            historyPath = historyFilePath(historyDir, templatePath, {tile_x, tile_y, pixel_x, pixel_y}, width, height);
+            seriesPath = historyFilePath(historyDir, templatePath, {tile_x, tile_y, pixel_x, pixel_y}, width, height, ".wps");
+            // 別の領域の回数と混ざらないよう数え直す
+            heatmap.reset(width, height);
+            pixelIndex.reset(width, height);
+            damage.reset(width, height);
+            events.resetDamageState();
+            alertPath = alertRulesPath(templatePath);
+            loadAlerts();
+            selectedCluster = DamageCluster();
+            repairPlan.reset(width, height);
+            repairPlan.setRegion({tile_x, tile_y, pixel_x, pixel_y});
+
+            // 取得中の周期を打ち切る（UIスレッドは待たず、期限が来たら次のフレームで戻す）
+            abort_fetch = true;
+            abortFetchUntil = glfwGetTime() + 0.1;
+        }
+        if (abortFetchUntil > 0.0 && glfwGetTime() >= abortFetchUntil)
+        {
+            abortFetchUntil = 0.0;
+            if (!glfwWindowShouldClose(window))
+                abort_fetch = false;
+        }
+
         if (ImGui::BeginMainMenuBar())
         {
             if (ImGui::BeginMenu("ウィンドウ"))
@@ -548,201 +719,244 @@ int main()
                 ImGui::MenuItem("オリジナル画像", nullptr, &showOriginal);
                 ImGui::MenuItem("リアルタイム画像", nullptr, &showRealtime);
                 ImGui::MenuItem("差分画像", nullptr, &showDiff);
+                ImGui::MenuItem("重ね合わせ", nullptr, &showOverlay);
+                ImGui::Separator();
+                ImGui::MenuItem("表示を連動", nullptr, &linkViews);
+                ImGui::MenuItem("ピクセル情報を表示", nullptr, &showPixelInfo);
+                ImGui::Separator();
                 ImGui::MenuItem("設定", nullptr, &showSettings);
                 ImGui::MenuItem("情報", nullptr, &showInfo);
+                ImGui::MenuItem("パフォーマンス", nullptr, &showPerf);
+                ImGui::MenuItem("タイムライン", nullptr, &showTimeline);
+                ImGui::MenuItem("損傷領域", nullptr, &showClusters);
+                ImGui::MenuItem("修復リスト", nullptr, &showRepair);
                 ImGui::EndMenu();
             }
-            ImGui::EndMainMenuBar();
-        }
-
-        if (showOriginal)
-        {
-            ImGui::Begin("オリジナル画像", &showOriginal);
-
-            ImVec2 winSize = ImGui::GetContentRegionAvail();
-            ImVec2 uv0 = OriginalUV0;
-            ImVec2 uv1 = OriginalUV1;
-
-            float imgAspect = (float)width / height;
-            float winAspect = winSize.x / winSize.y;
-            CalcUVForAspect(imgAspect, winAspect, uv0, uv1);
-
-            if (ImGui::IsWindowHovered())
+            if (ImGui::BeginMenu("ツール"))
             {
-                ImVec2 mousePos = ImGui::GetMousePos();
-                ImVec2 windowPos = ImGui::GetWindowPos();
-                ImVec2 relativeMouse;
-                relativeMouse.x = mousePos.x - windowPos.x;
-                relativeMouse.y = mousePos.y - windowPos.y;
-                OriginalOrigin.x = uv0.x + (uv1.x - uv0.x) * (relativeMouse.x / winSize.x);
-                OriginalOrigin.y = uv0.y + (uv1.y - uv0.y) * (relativeMouse.y / winSize.y);
-
-                if (io.MouseWheel > 0)
-                    ApplyZoom(uv0, uv1, OriginalOrigin, ZoomDir::ZoomOut);
-                else if (io.MouseWheel < 0)
-                    ApplyZoom(uv0, uv1, OriginalOrigin, ZoomDir::ZoomIn);
-                if (ImGui::IsMouseDragging(ImGuiMouseButton_Left))
+                ImGui::MenuItem("トレース記録", nullptr, &traceRecording);
+                ImGui::MenuItem("履歴を記録", nullptr, &historyRecording);
+                ImGui::MenuItem("テンプレートをパレットに合わせる", nullptr, &quantizeTemplate);
+                if (ImGui::BeginMenu("ヒートマップ"))
                 {
-
-                    if (!isPanning)
+                    ImGui::MenuItem("差分画像に重ねる", nullptr, &heatmapOverlay);
+                    if (ImGui::MenuItem("最近", nullptr, !heatmapAllTime))
+                        heatmapAllTime = false;
+                    if (ImGui::MenuItem("全期間", nullptr, heatmapAllTime))
+                        heatmapAllTime = true;
+                    ImGui::SetNextItemWidth(120);
+                    if (ImGui::SliderFloat("半減期（分）", &heatmapHalfLife, 5.0f, 24.0f * 60.0f, "%.0f", ImGuiSliderFlags_Logarithmic))
+                        heatmap.setHalfLifeMinutes(heatmapHalfLife);
+                    if (ImGui::MenuItem("リセット"))
+                        heatmap.reset(width, height);
+                    ImGui::EndMenu();
+                }
+                if (ImGui::MenuItem("メトリクス公開", nullptr, &metricsEnabled))
+                {
+                    if (metricsEnabled)
                     {
-                        isPanning = true;
-                        lastMouse = mousePos;
+                        if (startMetricsServer("127.0.0.1", metricsPort))
+                            std::cout << "メトリクス: http://127.0.0.1:" << metricsPort << "/metrics" << std::endl;
+                        else
+                        {
+                            std::cerr << "メトリクスサーバーを起動できませんでした: ポート " << metricsPort << std::endl;
+                            metricsEnabled = false;
+                        }
+                    }
+                    else
+                    {
+                        stopMetricsServer();
                     }
-                    ImVec2 delta = ImVec2(
-                        (mousePos.x - lastMouse.x) / winSize.x * (uv1.x - uv0.x),
-                        (mousePos.y - lastMouse.y) / winSize.y * (uv1.y - uv0.y));
-                    uv0.x -= delta.x;
-                    uv1.x -= delta.x;
-                    uv0.y -= delta.y;
-                    uv1.y -= delta.y;
-                    lastMouse = mousePos;
                 }
-                else
+                if (ImGui::BeginMenu("イベント通知"))
                 {
-                    isPanning = false;
+                    if (ImGui::MenuItem("有効", nullptr, &eventsEnabled))
+                    {
+                        if (!eventsEnabled)
+                            events.stop();
+                        else if (!startEvents())
+                        {
+                            std::cerr << "イベント通知を開始できませんでした" << std::endl;
+                            eventsEnabled = false;
+                        }
+                    }
+                    if (events.running())
+                    {
+                        EventBusStats st = events.stats();
+                        ImGui::TextDisabled("送信 %llu件 / 遅延 %.2fms（最大 %.2fms）",
+                                            static_cast<unsigned long long>(st.delivered), st.lastLatencyMs, st.maxLatencyMs);
+                        ImGui::TextDisabled("10ms 超過 %llu件 / 破棄 %llu件 / 接続 %d",
+                                            static_cast<unsigned long long>(st.overBudget), static_cast<unsigned long long>(st.dropped), st.socketClients);
+                        if (st.webhookErrors)
+                            ImGui::TextDisabled("webhook 失敗 %llu件", static_cast<unsigned long long>(st.webhookErrors));
+                    }
+                    ImGui::EndMenu();
                 }
-            }
-            if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Right))
-            {
-                // UVを初期状態に戻す
-                uv0 = ImVec2(0, 0);
-                uv1 = ImVec2(1, 1);
-
-                // 縦横比補正
-                float imgAspect = (float)width / height;
-                ImVec2 winSize = ImGui::GetContentRegionAvail();
-                float winAspect = winSize.x / winSize.y;
-                CalcUVForAspect(imgAspect, winAspect, uv0, uv1);
-            }
-
-            // 更新されたUVを保存
-            OriginalUV0 = uv0;
-            OriginalUV1 = uv1;
-
-            ImGui::Image((void *)(intptr_t)originalTexID, winSize, OriginalUV0, OriginalUV1);
-            ImGui::End();
-        }
-
-        if (showRealtime)
-        {
-            ImGui::Begin("リアルタイム画像", &showRealtime);
-
-            ImVec2 winSize = ImGui::GetContentRegionAvail();
-            ImVec2 uv0 = RealtimeUV0;
-            ImVec2 uv1 = RealtimeUV1;
-
-            float imgAspect = (float)width / height;
-            float winAspect = winSize.x / winSize.y;
-            CalcUVForAspect(imgAspect, winAspect, uv0, uv1);
-
-            if (ImGui::IsWindowHovered())
-            {
-                ImVec2 mousePos = ImGui::GetMousePos();
-                ImVec2 windowPos = ImGui::GetWindowPos();
-                ImVec2 relativeMouse(mousePos.x - windowPos.x, mousePos.y - windowPos.y);
-                RealtimeOrigin.x = uv0.x + (uv1.x - uv0.x) * (relativeMouse.x / winSize.x);
-                RealtimeOrigin.y = uv0.y + (uv1.y - uv0.y) * (relativeMouse.y / winSize.y);
-
-                if (io.MouseWheel > 0)
-                    ApplyZoom(uv0, uv1, RealtimeOrigin, ZoomDir::ZoomOut);
-                else if (io.MouseWheel < 0)
-                    ApplyZoom(uv0, uv1, RealtimeOrigin, ZoomDir::ZoomIn);
-
-                if (ImGui::IsMouseDragging(ImGuiMouseButton_Left))
+                if (ImGui::BeginMenu("タイルの記録と再生"))
                 {
-                    if (!isPanningRealtime)
+                    TileCaptureStats cap = tileCaptureStats();
+                    if (ImGui::MenuItem("タイルの応答を記録", nullptr, cap.active))
+                    {
+                        if (cap.active)
+                        {
+                            stopTileCapture();
+                            std::cout << "タイルの記録を止めました: " << cap.path << std::endl;
+                        }
+                        else
+                        {
+                            char stamp[32];
+                            std::time_t t = std::time(nullptr);
+                            std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&t));
+                            std::string capPath = appDir + "captures\\capture_" + stamp + ".wpc";
+                            if (startTileCapture(capPath))
+                                std::cout << "タイルの記録を始めました: " << capPath << std::endl;
+                        }
+                    }
+                    if (cap.active)
+                        ImGui::TextDisabled("%llu 周期 / %llu 枚 / %.1f MB", static_cast<unsigned long long>(cap.cycles),
+                                            static_cast<unsigned long long>(cap.tiles), cap.bytes / (1024.0 * 1024.0));
+                    ImGui::Separator();
+
+                    static int replaySpeed = 0;
+                    static bool replayLoop = false;
+                    const char *speedLabels[] = {"等速", "10倍速", "100倍速", "最速"};
+                    const double speeds[] = {1.0, 10.0, 100.0, 0.0};
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        if (ImGui::MenuItem(speedLabels[i], nullptr, replaySpeed == i))
+                            replaySpeed = i;
+                    }
+                    ImGui::MenuItem("繰り返す", nullptr, &replayLoop);
+                    if (ImGui::MenuItem("再生...", nullptr, false, !tileReplayActive()))
+                    {
+                        char capFile[MAX_PATH] = {0};
+                        OPENFILENAME ofn;
+                        ZeroMemory(&ofn, sizeof(ofn));
+                        ofn.lStructSize = sizeof(ofn);
+                        ofn.hwndOwner = glfwGetWin32Window(window);
+                        ofn.lpstrFile = capFile;
+                        ofn.nMaxFile = sizeof(capFile);
+                        ofn.lpstrFilter = "Tile Captures\0*.wpc\0All Files\0*.*\0";
+                        ofn.nFilterIndex = 1;
+                        ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+                        if (GetOpenFileName(&ofn))
+                        {
+                            TileCaptureInfo info;
+                            if (readTileCaptureInfo(capFile, info))
+                                std::cout << "再生: " << info.cycles << " 周期 / " << info.tiles << " 枚（タイル " << info.region.tileX << "," << info.region.tileY
+                                          << " 位置 " << info.region.pixelX << "," << info.region.pixelY << "）" << std::endl;
+                            startTileReplay({capFile, speeds[replaySpeed], replayLoop});
+                        }
+                    }
+                    TileReplayProgress rp = tileReplayProgress();
+                    if (rp.active)
                     {
-                        isPanningRealtime = true;
-                        lastMouseRealtime = mousePos;
+                        ImGui::TextDisabled("%zu / %zu 周期, %.1f 周期/秒", rp.cycle, rp.cycles, rp.cyclesPerSec);
+                        if (ImGui::MenuItem("再生を止める"))
+                            stopTileReplay();
                     }
-                    ImVec2 delta(
-                        (mousePos.x - lastMouseRealtime.x) / winSize.x * (uv1.x - uv0.x),
-                        (mousePos.y - lastMouseRealtime.y) / winSize.y * (uv1.y - uv0.y));
-                    uv0.x -= delta.x;
-                    uv1.x -= delta.x;
-                    uv0.y -= delta.y;
-                    uv1.y -= delta.y;
-                    lastMouseRealtime = mousePos;
+                    else if (rp.finished)
+                    {
+                        ImGui::TextDisabled("再生が終わりました（%zu 周期, %.1f 周期/秒）", rp.cycles, rp.cyclesPerSec);
+                    }
+                    ImGui::EndMenu();
                 }
-                else
+                if (ImGui::MenuItem("トレースを書き出す"))
                 {
-                    isPanningRealtime = false;
+                    // chrome://tracing や Perfetto で開ける形式
+                    char stamp[32];
+                    std::time_t t = std::time(nullptr);
+                    std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&t));
+                    std::string tracePath = appDir + "trace_" + stamp + ".json";
+                    if (traceWriteChromeJson(tracePath))
+                        std::cout << "トレースを書き出しました: " << tracePath << std::endl;
                 }
+                ImGui::EndMenu();
             }
+            ImGui::EndMainMenuBar();
+        }
 
-            if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Right))
+        for (ImageViewer *view : views)
+            view->setLinked(linkViews ? &sharedCamera : nullptr);
+        // 今フレームでリアルタイム画像・差分画像を描く画面があるか（転送の要否に使う）
+        bool realtimeVisible = false;
+        bool diffVisible = false;
+        // ツールチップの「今の色」は、タイムラインで過去のフレームを表示中ならそのフレームから引く
+        // （タイムラインはこの後に描くので前フレームの状態を使う）
+        const HistoryRegion pixelRegion{tile_x, tile_y, pixel_x, pixel_y};
+        const cv::Mat *shownFrame = (showingHistory && !historyFrame.realtime.empty()) ? &historyFrame.realtime : nullptr;
+        auto pixelTooltip = [&](const ImageViewer &view)
+        {
+            if (showPixelInfo)
+                DrawPixelTooltip(view, originalImg, pixelIndex, pixelRegion, shownFrame);
+        };
+        // ウィンドウが閉じている・折りたたまれている・タブが隠れているときは Begin が false を返すので、操作も描画もしない
+        if (showOriginal)
+        {
+            if (ImGui::Begin("オリジナル画像", &showOriginal) && originalView.update(width, height))
             {
-                uv0 = ImVec2(0, 0);
-                uv1 = ImVec2(1, 1);
-                CalcUVForAspect(imgAspect, winAspect, uv0, uv1);
+                originalTex.draw(ImGui::GetWindowDrawList(), originalView.itemMin(), originalView.itemMax(), originalView.uv0(), originalView.uv1());
+                pixelTooltip(originalView);
             }
-
-            RealtimeUV0 = uv0;
-            RealtimeUV1 = uv1;
-
-            ImGui::Image((void *)(intptr_t)realtimeTexID, winSize, RealtimeUV0, RealtimeUV1);
             ImGui::End();
         }
 
-        if (showDiff)
+        if (showRealtime)
         {
-            ImGui::Begin("差分画像", &showDiff);
-
-            ImVec2 winSize = ImGui::GetContentRegionAvail();
-            ImVec2 uv0 = DiffUV0;
-            ImVec2 uv1 = DiffUV1;
-
-            float imgAspect = (float)width / height;
-            float winAspect = winSize.x / winSize.y;
-            CalcUVForAspect(imgAspect, winAspect, uv0, uv1);
+            if (ImGui::Begin("リアルタイム画像", &showRealtime) && realtimeView.update(width, height))
+            {
+                realtimeVisible = true;
+                realtimeTex.draw(ImGui::GetWindowDrawList(), realtimeView.itemMin(), realtimeView.itemMax(), realtimeView.uv0(), realtimeView.uv1());
+                pixelTooltip(realtimeView);
+            }
+            ImGui::End();
+        }
 
-            if (ImGui::IsWindowHovered())
+        if (showOverlay)
+        {
+            if (ImGui::Begin("重ね合わせ", &showOverlay))
             {
-                ImVec2 mousePos = ImGui::GetMousePos();
-                ImVec2 windowPos = ImGui::GetWindowPos();
-                ImVec2 relativeMouse(mousePos.x - windowPos.x, mousePos.y - windowPos.y);
-                DiffOrigin.x = uv0.x + (uv1.x - uv0.x) * (relativeMouse.x / winSize.x);
-                DiffOrigin.y = uv0.y + (uv1.y - uv0.y) * (relativeMouse.y / winSize.y);
-
-                if (io.MouseWheel > 0)
-                    ApplyZoom(uv0, uv1, DiffOrigin, ZoomDir::ZoomOut);
-                else if (io.MouseWheel < 0)
-                    ApplyZoom(uv0, uv1, DiffOrigin, ZoomDir::ZoomIn);
-
-                if (ImGui::IsMouseDragging(ImGuiMouseButton_Left))
-                {
-                    if (!isPanningDiff)
-                    {
-                        isPanningDiff = true;
-                        lastMouseDiff = mousePos;
-                    }
-                    ImVec2 delta(
-                        (mousePos.x - lastMouseDiff.x) / winSize.x * (uv1.x - uv0.x),
-                        (mousePos.y - lastMouseDiff.y) / winSize.y * (uv1.y - uv0.y));
-                    uv0.x -= delta.x;
-                    uv1.x -= delta.x;
-                    uv0.y -= delta.y;
-                    uv1.y -= delta.y;
-                    lastMouseDiff = mousePos;
-                }
-                else
+                ImGui::SetNextItemWidth(160.0f);
+                ImGui::SliderFloat("リアルタイム画像の割合", &overlay.blend, 0.0f, 1.0f, "%.2f");
+                ImGui::SameLine();
+                ImGui::ColorEdit4("間違いの色", &overlay.highlight.x, ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_AlphaBar);
+                ImGui::SameLine();
+                ImGui::Checkbox("間違いだけ", &overlay.wrongOnly);
+
+                if (overlayView.update(width, height))
                 {
-                    isPanningDiff = false;
+                    realtimeVisible = true;
+                    DrawOverlayImage(originalTex, realtimeTex, overlay, ImGui::GetWindowDrawList(),
+                                     overlayView.itemMin(), overlayView.itemMax(), overlayView.uv0(), overlayView.uv1());
+                    pixelTooltip(overlayView);
                 }
             }
+            ImGui::End();
+        }
+
+        // 損傷領域ウィンドウで選んだ領域へ移動する
+        if (zoomToCluster)
+        {
+            diffView.zoomToRect((float)selectedCluster.minX, (float)selectedCluster.minY, (float)selectedCluster.maxX + 1, (float)selectedCluster.maxY + 1);
+            zoomToCluster = false;
+        }
 
-            if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Right))
+        if (showDiff)
+        {
+            if (ImGui::Begin("差分画像", &showDiff) && diffView.update(width, height))
             {
-                uv0 = ImVec2(0, 0);
-                uv1 = ImVec2(1, 1);
-                CalcUVForAspect(imgAspect, winAspect, uv0, uv1);
+                diffVisible = true;
+                ImDrawList *drawList = ImGui::GetWindowDrawList();
+                diffTex.draw(drawList, diffView.itemMin(), diffView.itemMax(), diffView.uv0(), diffView.uv1());
+                if (heatmapOverlay)
+                    heatTex.draw(drawList, diffView.itemMin(), diffView.itemMax(), diffView.uv0(), diffView.uv1());
+                // 選択中の損傷領域を枠で示す
+                if (showClusters && selectedCluster.id)
+                    drawList->AddRect(diffView.imageToScreen(selectedCluster.minX, selectedCluster.minY),
+                                      diffView.imageToScreen(selectedCluster.maxX + 1, selectedCluster.maxY + 1),
+                                      IM_COL32(0, 200, 255, 255), 0.0f, 0, 2.0f);
+                pixelTooltip(diffView);
             }
-
-            DiffUV0 = uv0;
-            DiffUV1 = uv1;
-
-            ImGui::Image((void *)(intptr_t)diffTexID, winSize, DiffUV0, DiffUV1);
             ImGui::End();
         }
 
@@ -815,80 +1029,155 @@ int main()
             }
             ImGui::Spacing();
 
+            ImGui::SetCursorPosX(xPos);
+            ImGui::PushFont(bigFont);
+            ImGui::Text("タイルサーバー");
+            ImGui::PopFont();
+            ImGui::PushItemWidth(itemWidth);
+            ImGui::SetCursorPosX(xPos);
+            ImGui::InputText("##タイルサーバー", tileBaseUrlBuffer, sizeof(tileBaseUrlBuffer));
+            ImGui::PopItemWidth();
+            ImGui::Spacing();
+
             ImGui::SetCursorPosX(xPos);
             if (ImGui::Button("更新", ImVec2(itemWidth, 0)))
             {
-                std::lock_guard<std::mutex> lock(imgMutex);
-
-                // ImGuiバッファからszFileに最新のパスをコピー
-                szFile = szFileBuffer;
-
-                if (!szFile.empty())
                 {
-                    cv::Mat newImg = cv::imread(szFile, cv::IMREAD_UNCHANGED);
-                    if (!newImg.empty())
-                    {
-                        originalImg = newImg.clone();
-                        ensureBGRA(originalImg);
-                        if (originalTexID)
-                            glDeleteTextures(1, &originalTexID);
-                        originalTexID = matToTexture(originalImg);
-                        width = originalImg.cols;
-                        height = originalImg.rows;
-                        realtimeImg = cv::Mat(height, width, CV_8UC4, cv::Scalar(0, 0, 0, 0));
-                        emptyDiff = cv::Mat(height, width, CV_8UC4, cv::Scalar(0, 0, 0, 0));
-
-                        if (realtimeTexID)
-                            glDeleteTextures(1, &realtimeTexID);
-                        realtimeTexID = matToTexture(realtimeImg);
-
-                        if (diffTexID)
-                            glDeleteTextures(1, &diffTexID);
-                        diffTexID = matToTexture(emptyDiff);
-                    }
+                    std::lock_guard<std::mutex> lock(imgMutex);
+                    // ImGuiバッファからszFileに最新のパスをコピー
+                    szFile = szFileBuffer;
+                    tileBaseUrl = tileBaseUrlBuffer;
                 }
-
-                tile_x = tmpTile_x;
-                tile_y = tmpTile_y;
-                pixel_x = tmpPixel_x;
-                pixel_y = tmpPixel_y;
                 UpdateSpeed = tmpUpdateSpeed;
-
-                abort_fetch = true;
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                abort_fetch = false;
+                // 画像はバックグラウンドで読み込み、終わったら監視領域と一緒に差し替える（それまでは今のテンプレートのまま）
+                templateLoader.start({szFile, quantizeTemplate, {tmpTile_x, tmpTile_y, tmpPixel_x, tmpPixel_y}});
+            }
+            TemplateLoadProgress loadProgress = templateLoader.progress();
+            if (loadProgress.running)
+            {
+                ImGui::SetCursorPosX(xPos);
+                ImGui::ProgressBar(loadProgress.fraction, ImVec2(itemWidth, 0), loadProgress.stage);
+                ImGui::SetCursorPosX(xPos);
+                ImGui::TextDisabled("テンプレートを読み込み中（%.1f秒）", loadProgress.elapsedMs / 1000.0);
             }
             ImGui::End();
         }
 
+        bool viewingHistory = DrawTimelineWindow(&showTimeline, historyPath, originalImg, historyFrame, historyFrameUpdated);
+
         if (showInfo)
         {
             ImGui::Begin("情報", &showInfo);
             ImGui::PushFont(bigFont);
-            ImGui::Text("差分率: %.2f%%", diffPercent);
-            ImGui::Text("%d / %d", changedPixels, totalOpaquePixels);
-            ImGui::PopFont();
+            if (viewingHistory && !historyFrame.realtime.empty())
+            {
+                double historyPercent = (historyFrame.opaque > 0) ? (double)historyFrame.changed / historyFrame.opaque * 100.0 : 0.0;
+                ImGui::Text("差分率: %.2f%%", historyPercent);
+                ImGui::Text("%d / %d", historyFrame.changed, historyFrame.opaque);
+                ImGui::PopFont();
+                ImGui::TextDisabled("タイムラインで過去の時刻を表示中");
+            }
+            else
+            {
+                ImGui::Text("差分率: %.2f%%", diffPercent);
+                ImGui::Text("%d / %d", changedPixels, totalOpaquePixels);
+                ImGui::PopFont();
+            }
+            if (templateQuantize.remapped > 0 || templateQuantize.unmappable > 0)
+            {
+                ImGui::TextDisabled("テンプレート: %d ピクセルをパレットの色に置き換え（%.1fms）", templateQuantize.remapped, templateQuantize.elapsedMs);
+                if (templateQuantize.unmappable > 0)
+                {
+                    const cv::Rect &r = templateQuantize.unmappableBounds;
+                    ImGui::TextColored(ImVec4(1.0f, 0.7f, 0.2f, 1.0f), "対応する色がない: %d ピクセル（%d,%d - %d,%d）",
+                                       templateQuantize.unmappable, r.x, r.y, r.x + r.width - 1, r.y + r.height - 1);
+                    if (ImGui::IsItemHovered() && ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted("半透明か、最も近いパレット色とも大きく違うピクセル:");
+                        for (const cv::Point &p : templateQuantize.unmappableSamples)
+                            ImGui::Text("(%d, %d)", p.x, p.y);
+                        if (static_cast<size_t>(templateQuantize.unmappable) > templateQuantize.unmappableSamples.size())
+                            ImGui::TextDisabled("ほか %d ピクセル", templateQuantize.unmappable - static_cast<int>(templateQuantize.unmappableSamples.size()));
+                        ImGui::EndTooltip();
+                    }
+                }
+            }
+            DrawAlertRules(alerts, alertPath);
+            DrawDiffSeriesPlot(diffSeries);
             ImGui::End();
         }
 
+        if (DrawClusterWindow(&showClusters, damage, selectedCluster))
+        {
+            zoomToCluster = true;
+            showDiff = true;
+            ImGui::SetWindowFocus("差分画像");
+        }
+
+        DrawRepairWindow(&showRepair, repairPlan, damage, historyPath.substr(0, historyPath.find_last_of('.')) + "_repair");
+
+        DrawPerformanceWindow(&showPerf);
+        // パフォーマンス画面はトレースのリングを読むので、表示中は記録を有効にする
+        setTraceEnabled(traceRecording || showPerf);
+
+        uint64_t lockStart = traceBegin();
         std::unique_lock<std::mutex> lock(imgMutex);
-        if (cv_newFrame.wait_for(lock, std::chrono::milliseconds(1), [&]
-                                 { return newFrameReady; }))
+        traceEnd(TraceStage::LockWait, lockStart);
+        // タイムラインからライブに戻ったら最新の画像を転送し直す
+        if (showingHistory && !viewingHistory)
+            newFrameReady = true;
+        showingHistory = viewingHistory;
+        // 過去のフレームを表示している間は更新スレッドの画像を転送しない
+        if (viewingHistory ? historyFrameUpdated
+                           : cv_newFrame.wait_for(lock, std::chrono::milliseconds(1), [&]
+                                                  { return newFrameReady; }))
         {
-            if (!realtimeImg.empty() && realtimeImg.cols == width && realtimeImg.rows == height)
-            {
-                GLenum format = (realtimeImg.channels() == 3) ? GL_BGR : GL_BGRA;
-                glBindTexture(GL_TEXTURE_2D, realtimeTexID);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, realtimeImg.cols, realtimeImg.rows, format, GL_UNSIGNED_BYTE, realtimeImg.data);
-                glBindTexture(GL_TEXTURE_2D, 0);
-            }
-            if (!emptyDiff.empty() && emptyDiff.cols == width && emptyDiff.rows == height)
-            {
-                glBindTexture(GL_TEXTURE_2D, diffTexID);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, emptyDiff.cols, emptyDiff.rows, GL_BGRA, GL_UNSIGNED_BYTE, emptyDiff.data);
-                glBindTexture(GL_TEXTURE_2D, 0);
-            }
-            newFrameReady = false;
+            realtimeUploadPending = true;
+            diffUploadPending = true;
+            if (viewingHistory)
+                historyFrameUpdated = false;
+            else
+                newFrameReady = false;
+        }
+        // 転送は今フレームで見えている画面の分だけ行う。隠れている間に届いたフレームはまとめて、
+        // 見えるようになったときにその時点の最新の画像だけを送る
+        // 見えていない間（閉じている・畳まれている・タブの裏）に届いたフレームの差分画像はないので、見えるようになったら今の画像から一度だけ作る
+        // （次の周期まで古い差分画像をヒートマップや損傷領域の枠と並べて出さないように）
+        if (diffImageStale && diffVisible && !viewingHistory)
+        {
+            WPG_TRACE_SCOPE(TraceStage::Diff);
+            emptyDiff = std::get<0>(imageDifferenceSafe(originalImg, realtimeImg));
+            diffImageStale = false;
+            diffUploadPending = true;
+        }
+        const cv::Mat &realtimeSource = viewingHistory ? historyFrame.realtime : realtimeImg;
+        const cv::Mat &diffSource = viewingHistory ? historyFrame.diff : emptyDiff;
+        if (realtimeUploadPending && realtimeVisible)
+        {
+            WPG_TRACE_SCOPE(TraceStage::Upload);
+            if (!realtimeSource.empty() && realtimeSource.cols == width && realtimeSource.rows == height)
+                realtimeTex.upload(realtimeSource);
+            realtimeUploadPending = false;
+        }
+        if (diffUploadPending && diffVisible)
+        {
+            WPG_TRACE_SCOPE(TraceStage::Upload);
+            if (!diffSource.empty() && diffSource.cols == width && diffSource.rows == height)
+                diffTex.upload(diffSource);
+            diffUploadPending = false;
+        }
+        lock.unlock();
+        diffImageWanted = diffVisible;
+
+        // ヒートマップは差分画像が見えていて重ねて表示しているときだけ、更新されたら色を作り直して転送する
+        if (heatmapOverlay && diffVisible && (heatmap.version() != heatTexVersion || heatmapAllTime != heatTexAllTime))
+        {
+            WPG_TRACE_SCOPE(TraceStage::Upload);
+            heatTexVersion = heatmap.version();
+            heatTexAllTime = heatmapAllTime;
+            heatmap.colorize(heatmapAllTime ? HeatmapMode::AllTime : HeatmapMode::Recent, heatImg);
+            if (heatImg.cols == width && heatImg.rows == height)
+                heatTex.upload(heatImg);
         }
 
         ImGui::Render();
@@ -906,21 +1195,41 @@ int main()
             ImGui::RenderPlatformWindowsDefault();
             glfwMakeContextCurrent(backup_current_context);
         }
+        // バックエンドが転送・破棄を済ませたタイルの後始末
+        TiledTexture::endFrame();
 
         glfwSwapBuffers(window);
+        traceEnd(TraceStage::Frame, frameStart);
+
+        double frameEnd = glfwGetTime();
+        int missed = static_cast<int>((frameEnd - lastFrameEnd) / refreshInterval) - 1;
+        lastFrameEnd = frameEnd;
+        traceCount(TraceCounter::FramesRendered);
+        if (missed > 0)
+            traceCount(TraceCounter::FramesSkipped, static_cast<uint64_t>(missed));
     }
 
     stopThread = true;
     if (updateThread.joinable())
         updateThread.join();
-
-    glDeleteTextures(1, &originalTexID);
-    glDeleteTextures(1, &realtimeTexID);
-    glDeleteTextures(1, &diffTexID);
+    stopMetricsServer();
+    stopTileReplay();
+    stopTileCapture();
+    events.stop();
+    shutdownTimeline();
+    shutdownRepairPanel();
+
+    originalTex.release();
+    realtimeTex.release();
+    diffTex.release();
+    heatTex.release();
+    releaseOverlayShader();
+    releaseNearestSampler();
 
     SaveAppSettings();
     ImGui::SaveIniSettingsToDisk(imguiIniPath.c_str());
     ImGui_ImplOpenGL3_Shutdown();
+    TiledTexture::shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
     glfwDestroyWindow(window);
@@ -0,0 +1,198 @@
+﻿#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_ = file;
+    mapping_ = mapping;
+    data_ = static_cast<const uint8_t *>(view);
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+    path_ = path;
+    return true;
+}
+
+bool MappedFile::openReadWrite(const std::string &path, size_t size)
+{
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    if (static_cast<size_t>(fileSize.QuadPart) < size)
+        fileSize.QuadPart = static_cast<LONGLONG>(size);
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(fileSize.QuadPart >> 32),
+                                        static_cast<DWORD>(fileSize.QuadPart & 0xffffffff), nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_ = file;
+    mapping_ = mapping;
+    data_ = static_cast<const uint8_t *>(view);
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+    writable_ = true;
+    path_ = path;
+    return true;
+}
+
+void MappedFile::flush()
+{
+    if (writable_ && data_)
+        FlushViewOfFile(data_, 0);
+}
+
+void MappedFile::close()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle(static_cast<HANDLE>(mapping_));
+    if (file_)
+        CloseHandle(static_cast<HANDLE>(file_));
+    file_ = nullptr;
+    mapping_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+    writable_ = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    data_ = static_cast<const uint8_t *>(view);
+    size_ = static_cast<size_t>(st.st_size);
+    path_ = path;
+    return true;
+}
+
+bool MappedFile::openReadWrite(const std::string &path, size_t size)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size_t mapSize = static_cast<size_t>(st.st_size);
+    if (mapSize < size)
+    {
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        mapSize = size;
+    }
+    void *view = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    data_ = static_cast<const uint8_t *>(view);
+    size_ = mapSize;
+    writable_ = true;
+    path_ = path;
+    return true;
+}
+
+void MappedFile::flush()
+{
+    if (writable_ && data_)
+        msync(const_cast<uint8_t *>(data_), size_, MS_ASYNC);
+}
+
+void MappedFile::close()
+{
+    if (data_)
+        munmap(const_cast<uint8_t *>(data_), size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+    writable_ = false;
+}
+
+#endif
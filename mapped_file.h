@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// メモリマップトファイル
+// 読み取り専用なら書き込み側が追記中のファイルも開ける（追記分は開き直して取り込む）。
+// 読み書き用は固定サイズのリングファイルなどに使う
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // 空のファイルは開けない（false を返す）
+    bool open(const std::string &path);
+    // 読み書き用に開く。ファイルがなければ作り、size より小さければ 0 で埋めて広げる
+    bool openReadWrite(const std::string &path, size_t size);
+    // 書き込んだ内容をディスクへ送る（完了は待たない）
+    void flush();
+    void close();
+
+    bool isOpen() const { return data_ != nullptr; }
+    const uint8_t *data() const { return data_; }
+    uint8_t *mutableData() const { return writable_ ? const_cast<uint8_t *>(data_) : nullptr; }
+    size_t size() const { return size_; }
+    const std::string &path() const { return path_; }
+
+private:
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool writable_ = false;
+    std::string path_;
+};
@@ -0,0 +1,185 @@
+﻿#include "metrics_exporter.h"
+#include "http_server.h"
+#include "trace.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+
+namespace
+{
+    // テンプレートごとの最新値。更新スレッドは atomic に書くだけ
+    std::atomic<double> diffPercentValue{0.0};
+    std::atomic<int64_t> changedPixelsValue{0};
+    std::atomic<int64_t> opaquePixelsValue{0};
+    std::atomic<uint64_t> updatesValue{0};
+
+    // 名前はテンプレート変更時とスクレイプ時にしか触らない
+    std::mutex nameMutex;
+    std::string templateName = "template";
+
+    HttpServer server;
+
+    // 公開するHTTPステータス（それ以外は "other" にまとめる）
+    const int kStatusCodes[] = {0, 200, 304, 400, 403, 404, 429, 500, 502, 503, 504};
+
+    // ラベル値のエスケープ（\ と " と改行）
+    std::string escapeLabel(const std::string &v)
+    {
+        std::string out;
+        out.reserve(v.size());
+        for (char c : v)
+        {
+            if (c == '\\' || c == '"')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (c == '\n')
+            {
+                out += "\\n";
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    void appendf(std::string &out, const char *fmt, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 2, 3)))
+#endif
+        ;
+
+    void appendf(std::string &out, const char *fmt, ...)
+    {
+        char buf[512];
+        va_list args;
+        va_start(args, fmt);
+        int n = std::vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (n > 0)
+            out.append(buf, static_cast<size_t>(n) < sizeof(buf) ? static_cast<size_t>(n) : sizeof(buf) - 1);
+    }
+
+    void appendCounter(std::string &out, const char *name, const char *help, uint64_t value)
+    {
+        appendf(out, "# TYPE %s counter\n# HELP %s %s\n%s_total %llu\n", name, name, help, name, static_cast<unsigned long long>(value));
+    }
+}
+
+void metricsSetTemplateName(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(nameMutex);
+    templateName = name;
+}
+
+void metricsUpdateTemplate(double diffPercent, int changedPixels, int opaquePixels)
+{
+    diffPercentValue.store(diffPercent, std::memory_order_relaxed);
+    changedPixelsValue.store(changedPixels, std::memory_order_relaxed);
+    opaquePixelsValue.store(opaquePixels, std::memory_order_relaxed);
+    updatesValue.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string renderOpenMetrics()
+{
+    std::string label;
+    {
+        std::lock_guard<std::mutex> lock(nameMutex);
+        label = escapeLabel(templateName);
+    }
+
+    std::string out;
+    out.reserve(16 * 1024);
+
+    // テンプレートの状態
+    appendf(out, "# TYPE wpg_diff_percent gauge\n# HELP wpg_diff_percent Percentage of opaque template pixels that differ from the canvas.\n");
+    appendf(out, "wpg_diff_percent{template=\"%s\"} %.4f\n", label.c_str(), diffPercentValue.load(std::memory_order_relaxed));
+    appendf(out, "# TYPE wpg_changed_pixels gauge\n# HELP wpg_changed_pixels Opaque template pixels that differ from the canvas.\n");
+    appendf(out, "wpg_changed_pixels{template=\"%s\"} %lld\n", label.c_str(), static_cast<long long>(changedPixelsValue.load(std::memory_order_relaxed)));
+    appendf(out, "# TYPE wpg_opaque_pixels gauge\n# HELP wpg_opaque_pixels Opaque pixels in the template.\n");
+    appendf(out, "wpg_opaque_pixels{template=\"%s\"} %lld\n", label.c_str(), static_cast<long long>(opaquePixelsValue.load(std::memory_order_relaxed)));
+    appendf(out, "# TYPE wpg_template_updates counter\n# HELP wpg_template_updates Completed fetch/diff cycles.\n");
+    appendf(out, "wpg_template_updates_total{template=\"%s\"} %llu\n", label.c_str(), static_cast<unsigned long long>(updatesValue.load(std::memory_order_relaxed)));
+
+    // 区間ヒストグラム（cycle, fetch, dns ... すべて）
+    appendf(out, "# TYPE wpg_stage_duration_seconds histogram\n# HELP wpg_stage_duration_seconds Duration of pipeline stages.\n");
+    for (int s = 0; s < static_cast<int>(TraceStage::Count); ++s)
+    {
+        TraceStage stage = static_cast<TraceStage>(s);
+        TraceHistogramSnapshot h = traceStageHistogram(stage);
+        const char *name = traceStageName(stage);
+        uint64_t cumulative = 0;
+        for (int b = 0; b < kTraceHistogramBuckets; ++b)
+        {
+            cumulative += h.buckets[b];
+            if (b < kTraceHistogramBuckets - 1)
+                appendf(out, "wpg_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", name, kTraceHistogramBounds[b], static_cast<unsigned long long>(cumulative));
+            else
+                appendf(out, "wpg_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", name, static_cast<unsigned long long>(cumulative));
+        }
+        appendf(out, "wpg_stage_duration_seconds_count{stage=\"%s\"} %llu\n", name, static_cast<unsigned long long>(h.count));
+        appendf(out, "wpg_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n", name, h.sumSec);
+    }
+
+    // HTTPステータス
+    appendf(out, "# TYPE wpg_http_responses counter\n# HELP wpg_http_responses Tile responses by HTTP status (0 = transport error).\n");
+    uint64_t listed = 0, total = 0;
+    for (int code = 0; code < 600; ++code)
+        total += traceHttpStatusCount(code);
+    for (int code : kStatusCodes)
+    {
+        uint64_t n = traceHttpStatusCount(code);
+        listed += n;
+        appendf(out, "wpg_http_responses_total{code=\"%d\"} %llu\n", code, static_cast<unsigned long long>(n));
+    }
+    appendf(out, "wpg_http_responses_total{code=\"other\"} %llu\n", static_cast<unsigned long long>(total >= listed ? total - listed : 0));
+
+    appendCounter(out, "wpg_bytes_downloaded", "Bytes received from the tile server.", traceCounterValue(TraceCounter::BytesDownloaded));
+    appendCounter(out, "wpg_cache_hits", "Tiles served from the local cache after a 304.", traceCounterValue(TraceCounter::CacheHits));
+    appendCounter(out, "wpg_cache_misses", "Tiles downloaded and decoded.", traceCounterValue(TraceCounter::CacheMisses));
+    appendCounter(out, "wpg_fetch_errors", "Failed tile fetches or decodes.", traceCounterValue(TraceCounter::FetchErrors));
+    appendCounter(out, "wpg_frames_rendered", "UI frames rendered.", traceCounterValue(TraceCounter::FramesRendered));
+    appendCounter(out, "wpg_frames_skipped", "UI frames dropped past the refresh interval.", traceCounterValue(TraceCounter::FramesSkipped));
+
+    appendf(out, "# TYPE wpg_tiles_pending gauge\n# HELP wpg_tiles_pending Tiles not yet fetched in the current cycle.\n");
+    appendf(out, "wpg_tiles_pending %lld\n", static_cast<long long>(traceGaugeValue(TraceGauge::TilesPending)));
+
+    out += "# EOF\n";
+    return out;
+}
+
+bool startMetricsServer(const std::string &bindAddress, int port)
+{
+    if (server.running())
+        return true;
+    bool ok = server.start(bindAddress, port, [](const HttpRequest &req)
+                           {
+        HttpResponse res;
+        if (req.path != "/metrics")
+        {
+            res.status = 404;
+            return res;
+        }
+        res.contentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        res.body = renderOpenMetrics();
+        return res; });
+    // ヒストグラムは公開している間だけ集計する
+    setTraceHistogramsEnabled(ok);
+    return ok;
+}
+
+void stopMetricsServer()
+{
+    server.stop();
+    setTraceHistogramsEnabled(false);
+}
+
+bool metricsServerRunning()
+{
+    return server.running();
+}
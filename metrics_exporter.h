@@ -0,0 +1,21 @@
+﻿#pragma once
+
+#include <string>
+
+// Prometheus / OpenMetrics 形式のメトリクス公開
+//
+// GET /metrics で、監視中テンプレートの差分値・区間ヒストグラム・HTTPステータス数・転送量などを返す。
+// 値はすべて atomic から読むだけなので、スクレイプが取得・差分スレッドを止めることはない。
+
+// テンプレート名（ラベルに使う）を設定する。テンプレート変更時にUIスレッドから呼ぶ
+void metricsSetTemplateName(const std::string &name);
+
+// 差分計算の結果を記録する。更新スレッドから毎周期呼ぶ（ロックなし）
+void metricsUpdateTemplate(double diffPercent, int changedPixels, int opaquePixels);
+
+bool startMetricsServer(const std::string &bindAddress, int port);
+void stopMetricsServer();
+bool metricsServerRunning();
+
+// 現在値を OpenMetrics テキスト形式で返す
+std::string renderOpenMetrics();
@@ -0,0 +1,214 @@
+﻿#include "overlay_shader.h"
+
+#include <GL/glew.h>
+#include <iostream>
+#include <string>
+
+namespace
+{
+    const char *kVertexShader = R"(#version 330 core
+uniform mat4 ProjMtx;
+in vec2 Position;
+in vec2 UV;
+in vec4 Color;
+out vec2 Frag_UV;
+out vec4 Frag_Color;
+void main()
+{
+    Frag_UV = UV;
+    Frag_Color = Color;
+    gl_Position = ProjMtx * vec4(Position.xy, 0, 1);
+}
+)";
+
+    // Texture（ユニット 0）はテンプレート、Live（ユニット 1）は同じ位置のリアルタイム画像のタイル
+    const char *kFragmentShader = R"(#version 330 core
+uniform sampler2D Texture;
+uniform sampler2D Live;
+uniform float Blend;
+uniform vec4 Highlight;
+uniform int WrongOnly;
+in vec2 Frag_UV;
+in vec4 Frag_Color;
+out vec4 Out_Color;
+void main()
+{
+    vec4 t = texture(Texture, Frag_UV);
+    // Live にはサンプラーを設定していないので、最近傍の画素を直接読む
+    ivec2 size = textureSize(Live, 0);
+    vec4 l = texelFetch(Live, clamp(ivec2(Frag_UV * vec2(size)), ivec2(0), size - 1), 0);
+    // imageDifferenceSafe と同じく、テンプレートの不透明なピクセルで BGRA が1つでも違えば間違い
+    bool wrong = t.a > 0.0 && any(greaterThan(abs(t - l), vec4(0.5 / 255.0)));
+    vec4 color;
+    if (WrongOnly != 0)
+        color = wrong ? vec4(Highlight.rgb, 1.0) : vec4(0.0);
+    else
+    {
+        color = mix(t, l, Blend);
+        if (wrong)
+            color = vec4(mix(color.rgb, Highlight.rgb, Highlight.a), max(color.a, Highlight.a));
+    }
+    Out_Color = color * Frag_Color;
+}
+)";
+
+    struct OverlayUniforms
+    {
+        float blend;
+        float highlight[4];
+        int wrongOnly;
+    };
+
+    GLuint program = 0;
+    bool failed = false;
+    GLint locProj = -1, locTexture = -1, locLive = -1, locBlend = -1, locHighlight = -1, locWrongOnly = -1;
+    // ImGui のシェーダーに合わせた頂点属性の位置（合わせたら覚えておく）
+    GLint boundAttribs[3] = {-1, -1, -1};
+
+    GLuint compile(GLenum type, const char *source)
+    {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        GLint ok = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if (!ok)
+        {
+            char log[1024] = {};
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cerr << "重ね合わせのシェーダーをコンパイルできませんでした: " << log << std::endl;
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+
+    bool link()
+    {
+        glLinkProgram(program);
+        GLint ok = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if (!ok)
+        {
+            char log[1024] = {};
+            glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+            std::cerr << "重ね合わせのシェーダーをリンクできませんでした: " << log << std::endl;
+            return false;
+        }
+        locProj = glGetUniformLocation(program, "ProjMtx");
+        locTexture = glGetUniformLocation(program, "Texture");
+        locLive = glGetUniformLocation(program, "Live");
+        locBlend = glGetUniformLocation(program, "Blend");
+        locHighlight = glGetUniformLocation(program, "Highlight");
+        locWrongOnly = glGetUniformLocation(program, "WrongOnly");
+        return true;
+    }
+
+    bool ensureProgram()
+    {
+        if (program || failed)
+            return program != 0;
+        GLuint vs = compile(GL_VERTEX_SHADER, kVertexShader);
+        GLuint fs = compile(GL_FRAGMENT_SHADER, kFragmentShader);
+        if (vs && fs)
+        {
+            program = glCreateProgram();
+            glAttachShader(program, vs);
+            glAttachShader(program, fs);
+            if (!link())
+            {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+        if (vs)
+            glDeleteShader(vs);
+        if (fs)
+            glDeleteShader(fs);
+        failed = (program == 0);
+        return program != 0;
+    }
+
+    // 描画中に呼ばれる: ImGui のシェーダーから投影行列と頂点属性の位置を受け取り、重ね合わせのシェーダーに切り替える
+    void beginOverlay(const ImDrawList *, const ImDrawCmd *cmd)
+    {
+        const OverlayUniforms &u = *static_cast<const OverlayUniforms *>(cmd->UserCallbackData);
+        GLint imguiProgram = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &imguiProgram);
+        if (!imguiProgram || !program)
+            return;
+
+        // 頂点配列は ImGui が自分のシェーダーの属性の位置で設定済みなので、同じ位置に並べる
+        const char *names[3] = {"Position", "UV", "Color"};
+        GLint attribs[3];
+        bool relink = false;
+        for (int i = 0; i < 3; ++i)
+        {
+            attribs[i] = glGetAttribLocation(imguiProgram, names[i]);
+            if (attribs[i] != boundAttribs[i])
+                relink = true;
+        }
+        if (relink)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                if (attribs[i] >= 0)
+                    glBindAttribLocation(program, attribs[i], names[i]);
+                boundAttribs[i] = attribs[i];
+            }
+            link();
+        }
+
+        float proj[16];
+        glGetUniformfv(imguiProgram, glGetUniformLocation(imguiProgram, "ProjMtx"), proj);
+        glUseProgram(program);
+        glUniformMatrix4fv(locProj, 1, GL_FALSE, proj);
+        glUniform1i(locTexture, 0);
+        glUniform1i(locLive, 1);
+        glUniform1f(locBlend, u.blend);
+        glUniform4fv(locHighlight, 1, u.highlight);
+        glUniform1i(locWrongOnly, u.wrongOnly);
+    }
+
+    // タイルごと: 同じ位置のリアルタイム画像のタイルをユニット 1 に
+    void bindLiveTile(const ImDrawList *, const ImDrawCmd *cmd)
+    {
+        const ImTextureData *tex = *static_cast<ImTextureData *const *>(cmd->UserCallbackData);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(tex->GetTexID()));
+        glActiveTexture(GL_TEXTURE0);
+    }
+}
+
+bool DrawOverlayImage(const TiledTexture &templ, const TiledTexture &live, const OverlaySettings &settings,
+                      ImDrawList *drawList, const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1)
+{
+    if (!ensureProgram())
+    {
+        templ.draw(drawList, pMin, pMax, uv0, uv1);
+        return false;
+    }
+
+    OverlayUniforms u;
+    u.blend = settings.blend;
+    u.highlight[0] = settings.highlight.x;
+    u.highlight[1] = settings.highlight.y;
+    u.highlight[2] = settings.highlight.z;
+    u.highlight[3] = settings.highlight.w;
+    u.wrongOnly = settings.wrongOnly ? 1 : 0;
+    drawList->AddCallback(beginOverlay, &u, sizeof(u));
+    templ.drawPaired(live, bindLiveTile, drawList, pMin, pMax, uv0, uv1);
+    // 以降の描画のために ImGui のシェーダーに戻す
+    drawList->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+    return true;
+}
+
+void releaseOverlayShader()
+{
+    if (program)
+        glDeleteProgram(program);
+    program = 0;
+    failed = false;
+    for (GLint &a : boundAttribs)
+        a = -1;
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include "imgui.h"
+#include "tiled_texture.h"
+
+// テンプレートとリアルタイム画像を重ねて、間違いのピクセルを GPU で強調する表示
+//
+// 差分画像（CPU で作って転送する）を使わず、テンプレートのタイルを ImGui の描画コールバックで切り替えた
+// フラグメントシェーダーで描き、同じ位置のリアルタイム画像のタイルを2枚目のテクスチャとして読んで比べる。
+// シェーダーは OpenGL 3.3 core（GLSL 330）で、ソフトウェア描画（Mesa llvmpipe）でも動く。
+// UIスレッドから使い、シェーダーは最初に描くときに作る。
+
+struct OverlaySettings
+{
+    float blend = 0.5f;                           // 0 でテンプレート、1 でリアルタイム画像
+    ImVec4 highlight = ImVec4(1.0f, 0.0f, 1.0f, 0.8f); // 間違いのピクセルの色（a は混ぜる割合）
+    bool wrongOnly = false;                       // 間違いのピクセルだけを表示する
+};
+
+// uv0〜uv1 の範囲を画面の pMin〜pMax に重ねて描く。
+// シェーダーが使えないときはテンプレートだけを描いて false
+bool DrawOverlayImage(const TiledTexture &templ, const TiledTexture &live, const OverlaySettings &settings,
+                      ImDrawList *drawList, const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1);
+
+// 終了時に GL コンテキストを壊す前に呼ぶ
+void releaseOverlayShader();
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include <cstdint>
+
+// wplace.live のパレット
+//
+// インデックス 0 は透明（未塗装）、1〜63 がキャンバスに置ける色。
+// 色は BGRA を 1 つの uint32_t にまとめた値（b | g<<8 | r<<16 | a<<24, cv::Vec4b と同じ並び）で扱う。
+
+constexpr int kWplacePaletteSize = 64;
+
+struct PaletteColor
+{
+    uint8_t r, g, b;
+    const char *name;
+};
+
+extern const PaletteColor kWplacePalette[kWplacePaletteSize];
+
+inline uint32_t packBGRA(uint8_t b, uint8_t g, uint8_t r, uint8_t a)
+{
+    return static_cast<uint32_t>(b) | static_cast<uint32_t>(g) << 8 | static_cast<uint32_t>(r) << 16 | static_cast<uint32_t>(a) << 24;
+}
+
+// パレットの色を BGRA にしたもの（透明は 0）
+uint32_t wplacePaletteBGRA(int index);
+
+// BGRA と完全に一致するパレットのインデックス。透明（a == 0）は 0、パレット外は -1
+int wplacePaletteIndex(uint32_t bgra);
@@ -0,0 +1,202 @@
+﻿#include "palette_quantize.h"
+#include "palette.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+    constexpr int kLutBits = 6;
+    constexpr int kLutCells = 1 << (3 * kLutBits);
+    // 距離の表は 1/kDistanceScale 刻みで持つ（0.6375 以上は飽和）
+    constexpr float kDistanceScale = 400.0f;
+
+    struct Lab
+    {
+        float L, a, b;
+    };
+
+    float srgbToLinear(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    Lab toOklab(int r8, int g8, int b8)
+    {
+        const float r = srgbToLinear(r8 / 255.0f), g = srgbToLinear(g8 / 255.0f), b = srgbToLinear(b8 / 255.0f);
+        const float l = std::cbrt(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+        const float m = std::cbrt(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+        const float s = std::cbrt(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+        return {0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+                1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+                0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s};
+    }
+
+    // BGRA（b | g<<8 | r<<16）からセル番号
+    inline uint32_t cellOf(uint32_t bgra)
+    {
+        return ((bgra >> 2) & 0x3f) | (((bgra >> 10) & 0x3f) << 6) | (((bgra >> 18) & 0x3f) << 12);
+    }
+
+    struct PaletteLut
+    {
+        std::vector<uint8_t> index;
+        std::vector<uint8_t> distance;
+        uint32_t bgra[kWplacePaletteSize] = {};
+    };
+
+    PaletteLut buildLut()
+    {
+        PaletteLut lut;
+        lut.index.assign(kLutCells, 0);
+        lut.distance.assign(kLutCells, 0);
+        Lab labs[kWplacePaletteSize];
+        for (int i = 1; i < kWplacePaletteSize; ++i)
+        {
+            lut.bgra[i] = wplacePaletteBGRA(i);
+            labs[i] = toOklab(kWplacePalette[i].r, kWplacePalette[i].g, kWplacePalette[i].b);
+        }
+
+        // セルの中心の色で最も近いパレット色を決める
+        cv::parallel_for_(cv::Range(0, 1 << kLutBits), [&](const cv::Range &range)
+                          {
+            for (int r = range.start; r < range.end; ++r)
+            {
+                for (int g = 0; g < (1 << kLutBits); ++g)
+                {
+                    for (int b = 0; b < (1 << kLutBits); ++b)
+                    {
+                        const int shift = 8 - kLutBits;
+                        const int center = 1 << (shift - 1);
+                        Lab c = toOklab((r << shift) + center, (g << shift) + center, (b << shift) + center);
+                        int best = 1;
+                        float bestDist = 1e9f;
+                        for (int i = 1; i < kWplacePaletteSize; ++i)
+                        {
+                            float dL = c.L - labs[i].L, da = c.a - labs[i].a, db = c.b - labs[i].b;
+                            float d = dL * dL + da * da + db * db;
+                            if (d < bestDist)
+                            {
+                                bestDist = d;
+                                best = i;
+                            }
+                        }
+                        const uint32_t cell = static_cast<uint32_t>(b | (g << kLutBits) | (r << (2 * kLutBits)));
+                        lut.index[cell] = static_cast<uint8_t>(best);
+                        lut.distance[cell] = static_cast<uint8_t>(std::min(255.0f, std::sqrt(bestDist) * kDistanceScale));
+                    }
+                }
+            } });
+
+        // パレットの色そのものは必ず自分自身に対応させる
+        for (int i = 1; i < kWplacePaletteSize; ++i)
+        {
+            lut.index[cellOf(lut.bgra[i])] = static_cast<uint8_t>(i);
+            lut.distance[cellOf(lut.bgra[i])] = 0;
+        }
+        return lut;
+    }
+
+    const PaletteLut &paletteLut()
+    {
+        static const PaletteLut lut = buildLut();
+        return lut;
+    }
+
+    struct RowStats
+    {
+        int opaque = 0, exact = 0, remapped = 0, unmappable = 0;
+        int minX = INT32_MAX, minY = INT32_MAX, maxX = -1, maxY = -1;
+        std::vector<cv::Point> samples;
+
+        void addUnmappable(int x, int y)
+        {
+            unmappable++;
+            minX = std::min(minX, x);
+            minY = std::min(minY, y);
+            maxX = std::max(maxX, x);
+            maxY = std::max(maxY, y);
+            if (samples.size() < PaletteQuantizeReport::kMaxSamples)
+                samples.emplace_back(x, y);
+        }
+    };
+
+    // 1画素分。戻り値は量子化後の BGRA、index にはそのパレットのインデックス
+    inline uint32_t quantizePixel(const PaletteLut &lut, uint32_t px, uint8_t maxDistance, int x, int y, RowStats &stats, uint8_t &index)
+    {
+        const uint32_t alpha = px >> 24;
+        index = 0;
+        if (alpha == 0)
+            return 0;
+        const uint32_t cell = cellOf(px);
+        if (alpha >= 128)
+            index = lut.index[cell];
+        const uint32_t out = lut.bgra[index];
+        if (alpha != 255 || lut.distance[cell] > maxDistance)
+            stats.addUnmappable(x, y);
+        if (out)
+        {
+            stats.opaque++;
+            if (out == px)
+                stats.exact++;
+            else
+                stats.remapped++;
+        }
+        return out;
+    }
+
+    // indexRow が nullptr ならインデックスは書かない
+    void quantizeRow(const PaletteLut &lut, uint32_t *row, uint8_t *indexRow, int width, int y, uint8_t maxDistance, RowStats &stats)
+    {
+        uint8_t scratch;
+        for (int x = 0; x < width; ++x)
+            row[x] = quantizePixel(lut, row[x], maxDistance, x, y, stats, indexRow ? indexRow[x] : scratch);
+    }
+}
+
+void quantizeToPalette(cv::Mat &bgra, PaletteQuantizeReport &report, cv::Mat *indices, float maxDistance)
+{
+    report = PaletteQuantizeReport();
+    if (bgra.empty() || bgra.type() != CV_8UC4)
+        return;
+    if (indices)
+        indices->create(bgra.rows, bgra.cols, CV_8U);
+    auto start = std::chrono::steady_clock::now();
+    const PaletteLut &lut = paletteLut();
+    const uint8_t limit = static_cast<uint8_t>(std::clamp(maxDistance * kDistanceScale, 0.0f, 255.0f));
+
+    std::mutex mergeMutex;
+    RowStats total;
+    cv::parallel_for_(cv::Range(0, bgra.rows), [&](const cv::Range &rows)
+                      {
+        RowStats stats;
+        for (int y = rows.start; y < rows.end; ++y)
+            quantizeRow(lut, bgra.ptr<uint32_t>(y), indices ? indices->ptr<uint8_t>(y) : nullptr, bgra.cols, y, limit, stats);
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        total.opaque += stats.opaque;
+        total.exact += stats.exact;
+        total.remapped += stats.remapped;
+        total.unmappable += stats.unmappable;
+        total.minX = std::min(total.minX, stats.minX);
+        total.minY = std::min(total.minY, stats.minY);
+        total.maxX = std::max(total.maxX, stats.maxX);
+        total.maxY = std::max(total.maxY, stats.maxY);
+        total.samples.insert(total.samples.end(), stats.samples.begin(), stats.samples.end()); });
+
+    report.opaque = total.opaque;
+    report.exact = total.exact;
+    report.remapped = total.remapped;
+    report.unmappable = total.unmappable;
+    if (total.unmappable > 0)
+        report.unmappableBounds = cv::Rect(total.minX, total.minY, total.maxX - total.minX + 1, total.maxY - total.minY + 1);
+    // 分割の順によらず左上から並べる
+    std::sort(total.samples.begin(), total.samples.end(), [](const cv::Point &a, const cv::Point &b)
+              { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+    if (total.samples.size() > PaletteQuantizeReport::kMaxSamples)
+        total.samples.resize(PaletteQuantizeReport::kMaxSamples);
+    report.unmappableSamples = std::move(total.samples);
+    report.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// テンプレートを wplace のパレットに合わせる前処理
+//
+// 画像編集ソフトで作ったテンプレートにはパレットにない色（縮小時の中間色・色空間変換のずれなど）が混ざり、
+// そのままだと imageDifferenceSafe が BGRA の完全一致で比べるため、その画素は永久に「変更あり」になる。
+// 各画素を知覚的に近い（OKLab で最も近い）パレット色に置き換える。
+// 色ごとの探索はせず、RGB 各 6 ビット（64x64x64）のセルごとに最も近い色を引く表を最初に一度だけ作る。
+// パレットの色そのものは必ず自分自身に対応させる。
+
+struct PaletteQuantizeReport
+{
+    int opaque = 0;     // 量子化後の不透明ピクセル数
+    int exact = 0;      // もともとパレットの色だった
+    int remapped = 0;   // 近い色に置き換えた
+    int unmappable = 0; // 半透明か、最も近い色でも離れすぎている（置き換えはするが確認が要る）
+    cv::Rect unmappableBounds;
+    std::vector<cv::Point> unmappableSamples; // 左上から最大 kMaxSamples 個
+    double elapsedMs = 0.0;
+
+    static constexpr size_t kMaxSamples = 32;
+};
+
+// bgra（CV_8UC4）をその場で書き換える。アルファは 128 以上を不透明、それ未満を透明にする
+// indices: 指定すると同じ大きさの CV_8U にパレットのインデックス（透明は 0）を書く
+// maxDistance: これより遠い（OKLab のユークリッド距離）色は unmappable として数える
+void quantizeToPalette(cv::Mat &bgra, PaletteQuantizeReport &report, cv::Mat *indices = nullptr, float maxDistance = 0.1f);
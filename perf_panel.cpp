@@ -0,0 +1,214 @@
+﻿#include "perf_panel.h"
+#include "trace.h"
+
+#include "imgui.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    // 百分位を求める対象期間
+    constexpr double kWindowSec = 60.0;
+    // 推移グラフのサンプル数（1秒ごと）
+    constexpr int kHistory = 120;
+    // 区間ごとの推移グラフに使う直近のイベント数
+    constexpr int kStageSpark = 64;
+
+    struct StageStats
+    {
+        int count = 0;
+        float p50 = 0, p95 = 0, p99 = 0; // ミリ秒
+        std::vector<float> recent;       // 直近の所要時間（古い順, ミリ秒）
+    };
+
+    // 1秒ごとの値を保持するリング
+    struct History
+    {
+        std::array<float, kHistory> values{};
+        int offset = 0;
+
+        void push(float v)
+        {
+            values[offset] = v;
+            offset = (offset + 1) % kHistory;
+        }
+
+        float sumLast(int n) const
+        {
+            float sum = 0;
+            for (int i = 1; i <= n; ++i)
+                sum += values[(offset - i + kHistory) % kHistory];
+            return sum;
+        }
+
+        void plot(const char *id, const char *overlay = nullptr) const
+        {
+            ImGui::PlotLines(id, values.data(), kHistory, offset, overlay, 0.0f, FLT_MAX, ImVec2(-1, 40));
+        }
+    };
+
+    std::array<StageStats, static_cast<size_t>(TraceStage::Count)> stageStats;
+    std::array<uint64_t, static_cast<size_t>(TraceCounter::Count)> lastCounters{};
+    History bytesPerSec, cacheHits, cacheMisses, framesRendered, framesSkipped, tilesPending;
+    double lastSampleTime = -1.0;
+    double lastStatsTime = -1.0;
+    std::vector<TraceEvent> eventScratch;
+
+    float percentile(const std::vector<float> &sorted, double p)
+    {
+        if (sorted.empty())
+            return 0.0f;
+        size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+
+    uint64_t counterDelta(TraceCounter c)
+    {
+        uint64_t now = traceCounterValue(c);
+        uint64_t &last = lastCounters[static_cast<size_t>(c)];
+        uint64_t delta = now - last;
+        last = now;
+        return delta;
+    }
+
+    void sampleCounters()
+    {
+        bytesPerSec.push(static_cast<float>(counterDelta(TraceCounter::BytesDownloaded)));
+        cacheHits.push(static_cast<float>(counterDelta(TraceCounter::CacheHits)));
+        cacheMisses.push(static_cast<float>(counterDelta(TraceCounter::CacheMisses)));
+        framesRendered.push(static_cast<float>(counterDelta(TraceCounter::FramesRendered)));
+        framesSkipped.push(static_cast<float>(counterDelta(TraceCounter::FramesSkipped)));
+        tilesPending.push(static_cast<float>(traceGaugeValue(TraceGauge::TilesPending)));
+    }
+
+    void updateStageStats()
+    {
+        uint64_t now = traceNowNs();
+        uint64_t window = static_cast<uint64_t>(kWindowSec * 1e9);
+        eventScratch.clear();
+        traceCollect(eventScratch, now > window ? now - window : 0);
+        std::sort(eventScratch.begin(), eventScratch.end(), [](const TraceEvent &a, const TraceEvent &b)
+                  { return a.startNs < b.startNs; });
+
+        std::array<std::vector<float>, static_cast<size_t>(TraceStage::Count)> durations;
+        for (const auto &ev : eventScratch)
+            durations[static_cast<size_t>(ev.stage)].push_back(ev.durNs / 1e6f);
+
+        for (size_t i = 0; i < durations.size(); ++i)
+        {
+            std::vector<float> &d = durations[i];
+            StageStats &st = stageStats[i];
+            size_t keep = std::min<size_t>(d.size(), kStageSpark);
+            st.recent.assign(d.end() - keep, d.end());
+            st.count = static_cast<int>(d.size());
+            std::sort(d.begin(), d.end());
+            st.p50 = percentile(d, 0.50);
+            st.p95 = percentile(d, 0.95);
+            st.p99 = percentile(d, 0.99);
+        }
+    }
+
+    void formatBytes(char *buf, size_t size, double bytes)
+    {
+        if (bytes >= 1024.0 * 1024.0)
+            std::snprintf(buf, size, "%.2f MB", bytes / (1024.0 * 1024.0));
+        else if (bytes >= 1024.0)
+            std::snprintf(buf, size, "%.1f KB", bytes / 1024.0);
+        else
+            std::snprintf(buf, size, "%.0f B", bytes);
+    }
+}
+
+void DrawPerformanceWindow(bool *open)
+{
+    // 表示していない間も1秒ごとのサンプルは取り続ける（カウンタの差分を読むだけ）
+    double t = ImGui::GetTime();
+    if (lastSampleTime < 0.0)
+    {
+        for (size_t i = 0; i < lastCounters.size(); ++i)
+            lastCounters[i] = traceCounterValue(static_cast<TraceCounter>(i));
+        lastSampleTime = t;
+    }
+    while (t - lastSampleTime >= 1.0)
+    {
+        sampleCounters();
+        lastSampleTime += 1.0;
+    }
+
+    if (!*open)
+        return;
+
+    if (!ImGui::Begin("パフォーマンス", open))
+    {
+        ImGui::End();
+        return;
+    }
+
+    if (t - lastStatsTime >= 0.5)
+    {
+        updateStageStats();
+        lastStatsTime = t;
+    }
+
+    if (!traceEnabled())
+        ImGui::TextDisabled("トレース記録が無効のため区間の統計は更新されません");
+
+    ImGui::Text("区間ごとの所要時間（直近%.0f秒, ms）", kWindowSec);
+    const ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp;
+    if (ImGui::BeginTable("stages", 6, flags))
+    {
+        ImGui::TableSetupColumn("区間");
+        ImGui::TableSetupColumn("件数");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p95");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableSetupColumn("推移", ImGuiTableColumnFlags_WidthStretch, 3.0f);
+        ImGui::TableHeadersRow();
+        for (size_t i = 0; i < stageStats.size(); ++i)
+        {
+            const StageStats &st = stageStats[i];
+            if (st.count == 0)
+                continue;
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(traceStageName(static_cast<TraceStage>(i)));
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", st.count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", st.p50);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", st.p95);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", st.p99);
+            ImGui::TableNextColumn();
+            ImGui::PushID(static_cast<int>(i));
+            ImGui::PlotLines("##spark", st.recent.data(), static_cast<int>(st.recent.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(-1, ImGui::GetTextLineHeight()));
+            ImGui::PopID();
+        }
+        ImGui::EndTable();
+    }
+    ImGui::Spacing();
+
+    char buf[64], overlay[128];
+    formatBytes(buf, sizeof(buf), bytesPerSec.sumLast(60));
+    std::snprintf(overlay, sizeof(overlay), "受信量: %s / 分", buf);
+    bytesPerSec.plot("##bytes", overlay);
+
+    float hits = cacheHits.sumLast(60);
+    float misses = cacheMisses.sumLast(60);
+    float hitRate = (hits + misses > 0) ? hits / (hits + misses) * 100.0f : 0.0f;
+    std::snprintf(overlay, sizeof(overlay), "キャッシュヒット率: %.1f%% (%.0f / %.0f)", hitRate, hits, hits + misses);
+    cacheHits.plot("##cache", overlay);
+
+    std::snprintf(overlay, sizeof(overlay), "フレーム: 描画 %.0f / 落ち %.0f（直近1分）", framesRendered.sumLast(60), framesSkipped.sumLast(60));
+    framesRendered.plot("##frames", overlay);
+    framesSkipped.plot("##skipped");
+
+    std::snprintf(overlay, sizeof(overlay), "取得待ちタイル: %lld", static_cast<long long>(traceGaugeValue(TraceGauge::TilesPending)));
+    tilesPending.plot("##queue", overlay);
+
+    ImGui::End();
+}
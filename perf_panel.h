@@ -0,0 +1,5 @@
+﻿#pragma once
+
+// パフォーマンスウィンドウ
+// trace のリングバッファとカウンタを定期的に読むだけで、表示のための追加の計測は行わない
+void DrawPerformanceWindow(bool *open);
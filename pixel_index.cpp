@@ -0,0 +1,81 @@
+﻿#include "pixel_index.h"
+
+#include "palette.h"
+
+namespace
+{
+    constexpr uint8_t kUnknownIndex = 0xFF;
+    constexpr uint8_t kOffPaletteIndex = 0xFE;
+}
+
+void PixelIndex::reset(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    const size_t count = static_cast<size_t>(width) * height;
+    colors_.reset(new std::atomic<uint8_t>[count]);
+    changedAt_.reset(new std::atomic<uint32_t>[count]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        colors_[i].store(kUnknownIndex, std::memory_order_relaxed);
+        changedAt_[i].store(0, std::memory_order_relaxed);
+    }
+    sinceMs_ = 0;
+}
+
+void PixelIndex::update(const cv::Mat &realtime, int64_t timeMs)
+{
+    if (realtime.type() != CV_8UC4 || realtime.cols != width_ || realtime.rows != height_)
+        return;
+
+    // 前回の色と比べるための BGRA（範囲外のインデックスはどの色とも一致しない値にする）
+    uint32_t bgra[256];
+    for (int i = 0; i < 256; ++i)
+        bgra[i] = (i < kWplacePaletteSize) ? wplacePaletteBGRA(i) : 0x00FFFFFFu;
+    const uint32_t seconds = static_cast<uint32_t>(timeMs / 1000);
+
+    cv::parallel_for_(cv::Range(0, height_), [&](const cv::Range &range)
+                      {
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const cv::Vec4b *row = realtime.ptr<cv::Vec4b>(y);
+            const size_t base = static_cast<size_t>(y) * width_;
+            for (int x = 0; x < width_; ++x)
+            {
+                const cv::Vec4b &p = row[x];
+                uint32_t color = packBGRA(p[0], p[1], p[2], p[3]);
+                // 透明は色を問わず 0 にそろえる（前回の色と比べるため）
+                if (p[3] == 0)
+                    color = 0;
+                const uint8_t previous = colors_[base + x].load(std::memory_order_relaxed);
+                if (bgra[previous] == color)
+                    continue;
+                const int index = wplacePaletteIndex(color);
+                const uint8_t current = (index < 0) ? kOffPaletteIndex : static_cast<uint8_t>(index);
+                if (current == previous)
+                    continue;
+                colors_[base + x].store(current, std::memory_order_relaxed);
+                // 最初の取得は変化として数えない
+                if (previous != kUnknownIndex)
+                    changedAt_[base + x].store(seconds, std::memory_order_relaxed);
+            }
+        } });
+
+    if (sinceMs_ == 0)
+        sinceMs_ = timeMs;
+}
+
+PixelState PixelIndex::at(int x, int y) const
+{
+    PixelState state;
+    if (!colors_ || x < 0 || y < 0 || x >= width_ || y >= height_)
+        return state;
+    const size_t i = static_cast<size_t>(y) * width_ + x;
+    const uint8_t color = colors_[i].load(std::memory_order_relaxed);
+    if (color == kOffPaletteIndex)
+        state.paletteIndex = PixelState::kOffPalette;
+    else if (color != kUnknownIndex)
+        state.paletteIndex = color;
+    state.lastChangedMs = static_cast<int64_t>(changedAt_[i].load(std::memory_order_relaxed)) * 1000;
+    return state;
+}
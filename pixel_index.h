@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// ピクセルごとの今のパレット色と最後に変わった時刻
+//
+// ピクセル情報のツールチップが、カーソルの下の1ピクセルを imgMutex を取らず・画像を写さずに引けるようにする。
+// 更新スレッドが周期ごとに update し（前回と同じ色のピクセルは比較1回で済ませる）、UIスレッドが at で読む。
+// 要素はそれぞれアトミックなので、読む側はロックなしで1ピクセル分を O(1) で読める
+// （同じ周期の色と時刻が揃わないことはあるが、次のフレームで揃う）。
+// reset は update と同時に呼ばない（どちらも imgMutex の中で呼ぶ）。at は reset と同じスレッドから呼ぶ。
+
+struct PixelState
+{
+    static constexpr int kUnknown = -2;    // まだ一度も取得していない
+    static constexpr int kOffPalette = -1; // パレットにない色
+
+    int paletteIndex = kUnknown; // 0 は透明（未塗装）
+    int64_t lastChangedMs = 0;   // 0 なら監視を始めてから変わっていない
+};
+
+class PixelIndex
+{
+public:
+    void reset(int width, int height);
+    // realtime は CV_8UC4 で reset した大きさ
+    void update(const cv::Mat &realtime, int64_t timeMs);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    PixelState at(int x, int y) const;
+    // reset 後に最初に update した時刻（0 ならまだ）
+    int64_t sinceMs() const { return sinceMs_.load(std::memory_order_relaxed); }
+
+private:
+    int width_ = 0, height_ = 0;
+    std::unique_ptr<std::atomic<uint8_t>[]> colors_;    // パレットのインデックス（kUnknownIndex / kOffPaletteIndex）
+    std::unique_ptr<std::atomic<uint32_t>[]> changedAt_; // UNIX 時刻（秒）。0 は変化なし
+    std::atomic<int64_t> sinceMs_{0};
+};
@@ -0,0 +1,148 @@
+﻿#include "pixel_inspector.h"
+#include "history_store.h"
+#include "image_viewer.h"
+#include "palette.h"
+#include "pixel_index.h"
+
+#include "imgui.h"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+namespace
+{
+    // wplace のタイル1枚の大きさ（ピクセル）
+    constexpr int kTileSize = 1000;
+
+    void formatTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::localtime(&t);
+        if (!tm || !std::strftime(buf, size, "%m/%d %H:%M:%S", tm))
+            std::snprintf(buf, size, "-");
+    }
+
+    ImVec4 toImColor(uint32_t bgra)
+    {
+        return ImVec4(((bgra >> 16) & 0xff) / 255.0f, ((bgra >> 8) & 0xff) / 255.0f, (bgra & 0xff) / 255.0f, 1.0f);
+    }
+
+    void swatch(uint32_t bgra)
+    {
+        const float h = ImGui::GetTextLineHeight();
+        ImGui::ColorButton("##color", toImColor(bgra), ImGuiColorEditFlags_NoTooltip, ImVec2(h, h));
+        ImGui::SameLine();
+    }
+
+    // パレットのインデックスを1行で表示。パレット外は bgra があればその色も出す
+    void colorLine(const char *label, int paletteIndex, const uint32_t *bgra)
+    {
+        ImGui::TextUnformatted(label);
+        ImGui::SameLine();
+        if (paletteIndex == PixelState::kUnknown)
+        {
+            ImGui::TextDisabled("未取得");
+        }
+        else if (paletteIndex == 0)
+        {
+            ImGui::TextDisabled("透明");
+        }
+        else if (paletteIndex == PixelState::kOffPalette && bgra)
+        {
+            swatch(*bgra);
+            ImGui::TextDisabled("パレット外 #%02x%02x%02x", (*bgra >> 16) & 0xff, (*bgra >> 8) & 0xff, *bgra & 0xff);
+        }
+        else if (paletteIndex == PixelState::kOffPalette)
+        {
+            ImGui::TextDisabled("パレット外");
+        }
+        else
+        {
+            swatch(wplacePaletteBGRA(paletteIndex));
+            ImGui::Text("%d %s", paletteIndex, kWplacePalette[paletteIndex].name);
+        }
+    }
+
+    int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+}
+
+void DrawPixelTooltip(const ImageViewer &view, const cv::Mat &templ, const PixelIndex &index, const HistoryRegion &region,
+                      const cv::Mat *shown)
+{
+    int x, y;
+    // ドラッグで移動している間は出さない
+    if (ImGui::IsMouseDown(ImGuiMouseButton_Left) || !view.hoveredPixel(x, y))
+        return;
+    if (templ.empty() || x >= templ.cols || y >= templ.rows)
+        return;
+
+    const cv::Vec4b &t = templ.at<cv::Vec4b>(y, x);
+    const uint32_t templColor = (t[3] == 0) ? 0 : packBGRA(t[0], t[1], t[2], t[3]);
+    const int templIndex = wplacePaletteIndex(templColor);
+
+    // 今の色（過去のフレームを表示中ならその画像の色）
+    int currentIndex = PixelState::kUnknown;
+    uint32_t currentColor = 0;
+    PixelState state;
+    if (shown)
+    {
+        if (!shown->empty() && x < shown->cols && y < shown->rows)
+        {
+            const cv::Vec4b &p = shown->at<cv::Vec4b>(y, x);
+            currentColor = (p[3] == 0) ? 0 : packBGRA(p[0], p[1], p[2], p[3]);
+            currentIndex = wplacePaletteIndex(currentColor);
+        }
+    }
+    else
+    {
+        state = index.at(x, y);
+        currentIndex = state.paletteIndex;
+    }
+
+    ImGui::BeginTooltip();
+    const int64_t absX = static_cast<int64_t>(region.tileX) * kTileSize + region.pixelX + x;
+    const int64_t absY = static_cast<int64_t>(region.tileY) * kTileSize + region.pixelY + y;
+    ImGui::Text("タイル %lld, %lld  ピクセル %lld, %lld", (long long)(absX / kTileSize), (long long)(absY / kTileSize),
+                (long long)(absX % kTileSize), (long long)(absY % kTileSize));
+    ImGui::TextDisabled("テンプレート内 %d, %d", x, y);
+    ImGui::Separator();
+
+    if (templIndex == 0)
+        ImGui::TextDisabled("テンプレート: 透明（対象外）");
+    else
+        colorLine("テンプレート:", templIndex, &templColor);
+    // index にはパレット外の色そのものは残らないので、ライブのときは「パレット外」とだけ出す
+    colorLine(shown ? "表示中のフレーム:" : "今の色:", currentIndex, shown ? &currentColor : nullptr);
+
+    if (templIndex != 0 && currentIndex != PixelState::kUnknown)
+    {
+        // どちらもパレット外ならインデックスでは比べられないので色そのもので比べる（ライブでは色が残っていない）
+        const bool bothOffPalette = templIndex == PixelState::kOffPalette && currentIndex == PixelState::kOffPalette;
+        if (bothOffPalette && !shown)
+            ImGui::TextColored(ImVec4(1.0f, 0.75f, 0.3f, 1.0f), "パレット外");
+        else if (bothOffPalette ? templColor == currentColor : templIndex == currentIndex)
+            ImGui::TextColored(ImVec4(0.4f, 0.9f, 0.4f, 1.0f), "一致");
+        else
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "間違い");
+    }
+
+    if (!shown)
+    {
+        char buf[32];
+        if (state.lastChangedMs > 0)
+        {
+            formatTime(state.lastChangedMs, buf, sizeof(buf));
+            const long long minutes = (nowMs() - state.lastChangedMs) / 60000;
+            ImGui::Text("最後の変化: %s（%lld分前）", buf, minutes);
+        }
+        else if (index.sinceMs() > 0)
+        {
+            formatTime(index.sinceMs(), buf, sizeof(buf));
+            ImGui::TextDisabled("監視開始（%s）以降変化なし", buf);
+        }
+    }
+    ImGui::EndTooltip();
+}
@@ -0,0 +1,14 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+
+class ImageViewer;
+class PixelIndex;
+struct HistoryRegion;
+
+// 画像ビューの上にカーソルがあれば、そのピクセルの wplace 上の座標・テンプレートの色・今の色・最後に変わった時刻を
+// ツールチップに出す。ピクセル1つを引くだけなので画像の大きさによらず一定の時間で済む。
+// templ はUIスレッドが差し替えるテンプレート（UIスレッドからはロックなしで読める）。
+// shown はタイムラインで過去のフレームを表示しているときのその画像（ライブなら nullptr で、今の色は index から引く）。
+void DrawPixelTooltip(const ImageViewer &view, const cv::Mat &templ, const PixelIndex &index, const HistoryRegion &region,
+                      const cv::Mat *shown);
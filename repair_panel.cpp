@@ -0,0 +1,184 @@
+﻿#include "repair_panel.h"
+#include "palette.h"
+
+#include "imgui.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // 一覧を作り直す最短の間隔
+    constexpr double kRefreshSec = 1.0;
+
+    const char *kOrderNames[] = {"大きい損傷領域から", "目立つ色から", "古い間違いから"};
+
+    int orderIndex = 0;
+    std::shared_ptr<const std::vector<RepairItem>> items; // 表示中の一覧
+    std::future<std::shared_ptr<const std::vector<RepairItem>>> building;
+    uint64_t builtVersion = UINT64_MAX;
+    int builtOrder = -1;
+    double lastBuild = -1.0;
+    double buildMs = 0.0;
+    double buildStarted = 0.0;
+
+    std::future<bool> exporting;
+    std::string exportMessage;
+    std::string exportPathFor;
+    char exportPathBuffer[512] = {0};
+    bool exportJson = false;
+
+    void formatTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::localtime(&t);
+        if (!tm || !std::strftime(buf, size, "%m/%d %H:%M:%S", tm))
+            std::snprintf(buf, size, "-");
+    }
+
+    bool ready(const std::future<std::shared_ptr<const std::vector<RepairItem>>> &f)
+    {
+        return f.valid() && f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    ImVec4 toImColor(uint32_t bgra)
+    {
+        return ImVec4(((bgra >> 16) & 0xff) / 255.0f, ((bgra >> 8) & 0xff) / 255.0f, (bgra & 0xff) / 255.0f, 1.0f);
+    }
+}
+
+void DrawRepairWindow(bool *open, RepairPlan &plan, DamageTracker &damage, const std::string &exportBase)
+{
+    if (!*open)
+        return;
+    ImGui::Begin("修復リスト", open);
+
+    // 作成が終わった一覧を受け取り、古くなっていれば作り直す
+    double now = ImGui::GetTime();
+    if (ready(building))
+    {
+        items = building.get();
+        buildMs = (now - buildStarted) * 1000.0;
+    }
+    if (!building.valid() && (plan.version() != builtVersion || orderIndex != builtOrder) &&
+        (orderIndex != builtOrder || lastBuild < 0 || now - lastBuild >= kRefreshSec))
+    {
+        builtVersion = plan.version();
+        builtOrder = orderIndex;
+        lastBuild = now;
+        buildStarted = now;
+        RepairOrder order = static_cast<RepairOrder>(orderIndex);
+        building = std::async(std::launch::async, [&plan, &damage, order]
+                              {
+            auto list = std::make_shared<std::vector<RepairItem>>();
+            plan.build(order, damage, *list);
+            return std::shared_ptr<const std::vector<RepairItem>>(list); });
+    }
+
+    ImGui::SetNextItemWidth(180);
+    ImGui::Combo("並び順", &orderIndex, kOrderNames, IM_ARRAYSIZE(kOrderNames));
+    ImGui::SameLine();
+    size_t count = items ? items->size() : 0;
+    ImGui::TextDisabled("%zu ピクセル（%.0f ms）", count, buildMs);
+
+    // 書き出し
+    std::string defaultPath = exportBase + (exportJson ? ".json" : ".csv");
+    if (exportPathFor != defaultPath)
+    {
+        std::snprintf(exportPathBuffer, sizeof(exportPathBuffer), "%s", defaultPath.c_str());
+        exportPathFor = defaultPath;
+    }
+    if (ImGui::RadioButton("CSV", !exportJson))
+        exportJson = false;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("JSON", exportJson))
+        exportJson = true;
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(-100);
+    ImGui::InputText("##repairExportPath", exportPathBuffer, sizeof(exportPathBuffer));
+    ImGui::SameLine();
+    if (exporting.valid() && exporting.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        exportMessage = exporting.get() ? "書き出しました" : "書き出せませんでした";
+    ImGui::BeginDisabled(exporting.valid() || !items || items->empty());
+    if (ImGui::Button("書き出す", ImVec2(-1, 0)))
+    {
+        std::shared_ptr<const std::vector<RepairItem>> snapshot = items;
+        std::string path = exportPathBuffer;
+        bool json = exportJson;
+        exportMessage = "書き出し中...";
+        exporting = std::async(std::launch::async, [snapshot, path, json]
+                               { return json ? writeRepairPlanJson(path, *snapshot) : writeRepairPlanCsv(path, *snapshot); });
+    }
+    ImGui::EndDisabled();
+    if (!exportMessage.empty())
+        ImGui::TextDisabled("%s", exportMessage.c_str());
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY |
+                                  ImGuiTableFlags_Resizable | ImGuiTableFlags_SizingStretchProp;
+    if (items && ImGui::BeginTable("repair", 6, flags))
+    {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("順位");
+        ImGui::TableSetupColumn("タイル");
+        ImGui::TableSetupColumn("ピクセル");
+        ImGui::TableSetupColumn("正しい色");
+        ImGui::TableSetupColumn("領域");
+        ImGui::TableSetupColumn("間違いになった時刻");
+        ImGui::TableHeadersRow();
+
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(items->size()));
+        while (clipper.Step())
+        {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+            {
+                const RepairItem &item = (*items)[i];
+                ImGui::PushID(i);
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                char label[32];
+                std::snprintf(label, sizeof(label), "%d", i + 1);
+                // クリックで座標をクリップボードへ
+                if (ImGui::Selectable(label, false, ImGuiSelectableFlags_SpanAllColumns))
+                {
+                    char coords[96];
+                    std::snprintf(coords, sizeof(coords), "%d,%d %d,%d", item.tileX, item.tileY, item.pixelX, item.pixelY);
+                    ImGui::SetClipboardText(coords);
+                }
+                ImGui::TableNextColumn();
+                ImGui::Text("%d, %d", item.tileX, item.tileY);
+                ImGui::TableNextColumn();
+                ImGui::Text("%d, %d", item.pixelX, item.pixelY);
+                ImGui::TableNextColumn();
+                ImGui::ColorButton("##color", toImColor(item.color), ImGuiColorEditFlags_NoTooltip, ImVec2(ImGui::GetTextLineHeight(), ImGui::GetTextLineHeight()));
+                ImGui::SameLine();
+                if (item.colorIndex > 0)
+                    ImGui::Text("%d %s", item.colorIndex, kWplacePalette[item.colorIndex].name);
+                else
+                    ImGui::TextDisabled("パレット外");
+                ImGui::TableNextColumn();
+                ImGui::Text("#%u (%d)", item.clusterId, item.clusterPixels);
+                ImGui::TableNextColumn();
+                char since[32];
+                formatTime(item.sinceMs, since, sizeof(since));
+                ImGui::TextUnformatted(since);
+                ImGui::PopID();
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+void shutdownRepairPanel()
+{
+    if (building.valid())
+        building.wait();
+    if (exporting.valid())
+        exporting.wait();
+}
@@ -0,0 +1,11 @@
+﻿#pragma once
+
+#include "repair_plan.h"
+
+#include <string>
+
+// 修復リストウィンドウ
+// 一覧の作成と書き出しはバックグラウンドで行う。exportBase は書き出し先の既定のパス（拡張子なし）
+void DrawRepairWindow(bool *open, RepairPlan &plan, DamageTracker &damage, const std::string &exportBase);
+// 作成中・書き出し中の処理を待つ（終了時に RepairPlan と DamageTracker より先に呼ぶ）
+void shutdownRepairPanel();
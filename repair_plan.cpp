@@ -0,0 +1,277 @@
+﻿#include "repair_plan.h"
+#include "palette.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    // wplace のタイル1枚の大きさ（fetch_tiles_and_crop_cpp と同じ）
+    constexpr int kTileSize = 1000;
+
+    // 未塗装はキャンバス上では白に見える
+    void visibleRGB(uint32_t bgra, int &r, int &g, int &b)
+    {
+        if ((bgra >> 24) == 0)
+        {
+            r = g = b = 255;
+            return;
+        }
+        b = bgra & 0xff;
+        g = (bgra >> 8) & 0xff;
+        r = (bgra >> 16) & 0xff;
+    }
+
+    int colorDistance(uint32_t a, uint32_t b)
+    {
+        int ar, ag, ab, br, bg, bb;
+        visibleRGB(a, ar, ag, ab);
+        visibleRGB(b, br, bg, bb);
+        return (ar - br) * (ar - br) + (ag - bg) * (ag - bg) + (ab - bb) * (ab - bb);
+    }
+
+    void hexColor(uint32_t bgra, char *buf, size_t size)
+    {
+        std::snprintf(buf, size, "#%02x%02x%02x", (bgra >> 16) & 0xff, (bgra >> 8) & 0xff, bgra & 0xff);
+    }
+
+    void isoTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::gmtime(&t);
+        if (!tm || !std::strftime(buf, size, "%Y-%m-%dT%H:%M:%SZ", tm))
+            buf[0] = '\0';
+    }
+
+    const char *colorName(int index)
+    {
+        return (index > 0 && index < kWplacePaletteSize) ? kWplacePalette[index].name : "";
+    }
+}
+
+void RepairPlan::reset(int width, int height)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    clear(width, height);
+    ++version_;
+}
+
+void RepairPlan::clear(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    pixels_.clear();
+    since_.clear();
+    slot_.assign(static_cast<size_t>(width) * height, -1);
+    realtime_.release();
+    template_.release();
+}
+
+void RepairPlan::setRegion(const HistoryRegion &region)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    region_ = region;
+}
+
+void RepairPlan::update(const DamageTracker &damage, const cv::Mat &realtime, const cv::Mat &templ, int64_t timeMs)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (realtime.cols != width_ || realtime.rows != height_)
+        clear(realtime.cols, realtime.rows);
+
+    for (int32_t p : damage.lastRemoved())
+    {
+        int32_t s = slot_[p];
+        if (s < 0)
+            continue;
+        // 末尾と入れ替えて消す
+        int32_t last = pixels_.back();
+        pixels_[s] = last;
+        since_[s] = since_.back();
+        slot_[last] = s;
+        pixels_.pop_back();
+        since_.pop_back();
+        slot_[p] = -1;
+    }
+    for (int32_t p : damage.lastAdded())
+    {
+        if (slot_[p] >= 0)
+            continue;
+        slot_[p] = static_cast<int32_t>(pixels_.size());
+        pixels_.push_back(p);
+        since_.push_back(timeMs);
+    }
+    realtime_ = realtime;
+    template_ = templ;
+    ++version_;
+}
+
+size_t RepairPlan::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pixels_.size();
+}
+
+void RepairPlan::build(RepairOrder order, DamageTracker &damage, std::vector<RepairItem> &out, size_t limit) const
+{
+    std::vector<int32_t> pixels;
+    std::vector<int64_t> since;
+    cv::Mat realtime, templ;
+    HistoryRegion region;
+    int width;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pixels = pixels_;
+        since = since_;
+        realtime = realtime_;
+        templ = template_;
+        region = region_;
+        width = width_;
+    }
+    out.clear();
+    if (pixels.empty() || realtime.empty() || templ.empty())
+        return;
+
+    std::vector<uint32_t> ids(pixels.size());
+    std::vector<int> sizes(pixels.size());
+    damage.lookup(pixels.data(), pixels.size(), ids.data(), sizes.data());
+
+    // 並べ替えは 16 バイトのキーで行い、項目は順番が決まってから作る
+    // 同じ優先度なら走査順（近くのピクセルが続くように）
+    struct SortKey
+    {
+        uint64_t primary;
+        int32_t pixel;
+        uint32_t index;
+    };
+    std::vector<SortKey> keys(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        uint64_t primary = 0;
+        switch (order)
+        {
+        case RepairOrder::ClusterSize:
+            primary = static_cast<uint64_t>(UINT32_MAX - static_cast<uint32_t>(sizes[i])) << 32 | ids[i];
+            break;
+        case RepairOrder::Visibility:
+        {
+            const int32_t p = pixels[i];
+            primary = UINT32_MAX - static_cast<uint32_t>(colorDistance(templ.ptr<uint32_t>(p / width)[p % width], realtime.ptr<uint32_t>(p / width)[p % width]));
+            break;
+        }
+        case RepairOrder::Age:
+            primary = static_cast<uint64_t>(since[i]);
+            break;
+        }
+        keys[i] = {primary, pixels[i], static_cast<uint32_t>(i)};
+    }
+    auto less = [](const SortKey &a, const SortKey &b)
+    { return a.primary != b.primary ? a.primary < b.primary : a.pixel < b.pixel; };
+    if (limit < keys.size())
+    {
+        std::partial_sort(keys.begin(), keys.begin() + limit, keys.end(), less);
+        keys.resize(limit);
+    }
+    else
+    {
+        std::sort(keys.begin(), keys.end(), less);
+    }
+
+    out.resize(keys.size());
+    const int originX = region.tileX * kTileSize + region.pixelX;
+    const int originY = region.tileY * kTileSize + region.pixelY;
+    uint32_t lastColor = 0;
+    int lastIndex = 0;
+    for (size_t k = 0; k < keys.size(); ++k)
+    {
+        const size_t i = keys[k].index;
+        RepairItem &item = out[k];
+        item.x = pixels[i] % width;
+        item.y = pixels[i] / width;
+        const int ax = originX + item.x, ay = originY + item.y;
+        item.tileX = ax / kTileSize;
+        item.tileY = ay / kTileSize;
+        item.pixelX = ax % kTileSize;
+        item.pixelY = ay % kTileSize;
+        item.color = templ.ptr<uint32_t>(item.y)[item.x];
+        item.current = realtime.ptr<uint32_t>(item.y)[item.x];
+        // テンプレートは同じ色が続くことが多いので直前の結果を使い回す
+        if (item.color != lastColor || k == 0)
+        {
+            lastColor = item.color;
+            lastIndex = wplacePaletteIndex(item.color);
+        }
+        item.colorIndex = lastIndex;
+        item.clusterId = ids[i];
+        item.clusterPixels = sizes[i];
+        item.sinceMs = since[i];
+        item.distance = colorDistance(item.color, item.current);
+    }
+}
+
+bool writeRepairPlanCsv(const std::string &path, const std::vector<RepairItem> &items)
+{
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs.is_open())
+    {
+        std::cerr << "修復リストを書き出せませんでした: " << path << std::endl;
+        return false;
+    }
+    ofs << "rank,tile_x,tile_y,pixel_x,pixel_y,color_index,color_name,color_hex,current_hex,cluster_id,cluster_pixels,wrong_since\n";
+    char line[256], hex[8], currentHex[8], since[32];
+    int64_t sinceFor = -1;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const RepairItem &item = items[i];
+        hexColor(item.color, hex, sizeof(hex));
+        hexColor(item.current, currentHex, sizeof(currentHex));
+        // 同じ周期に間違いになったピクセルは時刻が同じ
+        if (item.sinceMs != sinceFor)
+        {
+            sinceFor = item.sinceMs;
+            isoTime(item.sinceMs, since, sizeof(since));
+        }
+        int n = std::snprintf(line, sizeof(line), "%zu,%d,%d,%d,%d,%d,%s,%s,%s,%u,%d,%s\n", i + 1,
+                              item.tileX, item.tileY, item.pixelX, item.pixelY, item.colorIndex, colorName(item.colorIndex),
+                              hex, (item.current >> 24) ? currentHex : "", item.clusterId, item.clusterPixels, since);
+        ofs.write(line, n);
+    }
+    return static_cast<bool>(ofs);
+}
+
+bool writeRepairPlanJson(const std::string &path, const std::vector<RepairItem> &items)
+{
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs.is_open())
+    {
+        std::cerr << "修復リストを書き出せませんでした: " << path << std::endl;
+        return false;
+    }
+    ofs << "[\n";
+    char line[384], hex[8], currentHex[8], since[32];
+    int64_t sinceFor = -1;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const RepairItem &item = items[i];
+        hexColor(item.color, hex, sizeof(hex));
+        hexColor(item.current, currentHex, sizeof(currentHex));
+        if (item.sinceMs != sinceFor)
+        {
+            sinceFor = item.sinceMs;
+            isoTime(item.sinceMs, since, sizeof(since));
+        }
+        // 色名はパレットの英語名なのでエスケープは不要
+        int n = std::snprintf(line, sizeof(line),
+                              "  {\"rank\":%zu,\"tile\":[%d,%d],\"pixel\":[%d,%d],\"color_index\":%d,\"color_name\":\"%s\",\"color\":\"%s\","
+                              "\"current\":%s%s%s,\"cluster_id\":%u,\"cluster_pixels\":%d,\"wrong_since\":\"%s\"}%s\n",
+                              i + 1, item.tileX, item.tileY, item.pixelX, item.pixelY, item.colorIndex, colorName(item.colorIndex), hex,
+                              (item.current >> 24) ? "\"" : "", (item.current >> 24) ? currentHex : "null", (item.current >> 24) ? "\"" : "",
+                              item.clusterId, item.clusterPixels, since, i + 1 < items.size() ? "," : "");
+        ofs.write(line, n);
+    }
+    ofs << "]\n";
+    return static_cast<bool>(ofs);
+}
@@ -0,0 +1,69 @@
+﻿#pragma once
+
+#include "damage_clusters.h"
+#include "history_store.h"
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 修復リスト（直すべきピクセルと正しい色の一覧）
+//
+// 間違いピクセルの集合は DamageTracker の周期ごとの増減だけで更新し（追加・削除とも O(1)）、
+// 並べ替えは一覧を求められたときに行う。10万ピクセル以上でも一覧の作成は数十ms で済む。
+
+enum class RepairOrder
+{
+    ClusterSize, // 大きな損傷領域から（領域内は走査順）
+    Visibility,  // 正しい色との差が大きい（目立つ）ピクセルから
+    Age          // 古くから間違っているピクセルから
+};
+
+struct RepairItem
+{
+    int x = 0, y = 0;                          // テンプレート内の座標
+    int tileX = 0, tileY = 0, pixelX = 0, pixelY = 0; // wplace の絶対座標
+    int colorIndex = -1;                       // 正しい色のパレット番号（パレット外は -1）
+    uint32_t color = 0;                        // 正しい色（BGRA）
+    uint32_t current = 0;                      // 今の色（BGRA）
+    uint32_t clusterId = 0;
+    int clusterPixels = 0;
+    int64_t sinceMs = 0;                       // 間違いになった時刻
+    int distance = 0;                          // 正しい色との差（RGB の差の二乗和）
+};
+
+class RepairPlan
+{
+public:
+    void reset(int width, int height);
+    void setRegion(const HistoryRegion &region);
+
+    // damage.update の直後に同じスレッドから呼ぶ。realtime と templ は参照を保持する（書き換えないこと）
+    void update(const DamageTracker &damage, const cv::Mat &realtime, const cv::Mat &templ, int64_t timeMs);
+
+    // 優先順に並べた一覧を作る（limit を超える分は省く）
+    void build(RepairOrder order, DamageTracker &damage, std::vector<RepairItem> &out, size_t limit = SIZE_MAX) const;
+
+    size_t size() const;
+    // update のたびに増える
+    uint64_t version() const { return version_; }
+
+private:
+    void clear(int width, int height);
+
+    mutable std::mutex mutex_;
+    int width_ = 0, height_ = 0;
+    HistoryRegion region_;
+    std::vector<int32_t> pixels_;  // 間違いピクセル（順不同）
+    std::vector<int64_t> since_;   // pixels_ と同じ並び
+    std::vector<int32_t> slot_;    // ピクセル → pixels_ 内の位置（-1: なし）
+    cv::Mat realtime_, template_;
+    std::atomic<uint64_t> version_{0};
+};
+
+// 書き出し（失敗したら false）
+bool writeRepairPlanCsv(const std::string &path, const std::vector<RepairItem> &items);
+bool writeRepairPlanJson(const std::string &path, const std::vector<RepairItem> &items);
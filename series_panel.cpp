@@ -0,0 +1,134 @@
+﻿#include "series_panel.h"
+#include "diff_series.h"
+
+#include "imgui.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+namespace
+{
+    struct Span
+    {
+        const char *label;
+        int64_t ms;
+    };
+    constexpr int64_t kHourMs = 60 * 60 * 1000;
+    constexpr Span kSpans[] = {
+        {"1時間", kHourMs},
+        {"1日", 24 * kHourMs},
+        {"1週間", 7 * 24 * kHourMs},
+        {"30日", 30 * 24 * kHourMs},
+        {"90日", 90 * 24 * kHourMs},
+        {"1年", 365 * 24 * kHourMs},
+    };
+    // グラフの点数の上限（これ以下になる最も細かい集計を使う）
+    constexpr size_t kMaxPoints = 2000;
+    // 読み直す間隔
+    constexpr double kRefreshSec = 1.0;
+
+    int spanIndex = 1;
+    double lastQueryTime = -1.0;
+    int queriedSpan = -1;
+    SeriesLevel queriedLevel = SeriesLevel::Raw;
+    std::vector<SeriesRecord> records;
+    std::vector<float> meanValues, maxValues;
+
+    const char *levelName(SeriesLevel level)
+    {
+        switch (level)
+        {
+        case SeriesLevel::Raw:
+            return "生データ";
+        case SeriesLevel::Minute:
+            return "1分平均";
+        case SeriesLevel::Hour:
+            return "1時間平均";
+        default:
+            return "1日平均";
+        }
+    }
+
+    void formatTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::localtime(&t);
+        if (!tm || !std::strftime(buf, size, "%m/%d %H:%M", tm))
+            std::snprintf(buf, size, "-");
+    }
+}
+
+void DrawDiffSeriesPlot(const DiffSeries &series)
+{
+    if (!ImGui::CollapsingHeader("差分率の推移"))
+        return;
+    if (!series.isOpen())
+    {
+        ImGui::TextDisabled("記録がありません");
+        return;
+    }
+
+    ImGui::SetNextItemWidth(120);
+    if (ImGui::BeginCombo("期間", kSpans[spanIndex].label))
+    {
+        for (int i = 0; i < static_cast<int>(IM_ARRAYSIZE(kSpans)); ++i)
+        {
+            if (ImGui::Selectable(kSpans[i].label, i == spanIndex))
+                spanIndex = i;
+        }
+        ImGui::EndCombo();
+    }
+
+    double now = ImGui::GetTime();
+    if (queriedSpan != spanIndex || lastQueryTime < 0 || now - lastQueryTime >= kRefreshSec)
+    {
+        lastQueryTime = now;
+        queriedSpan = spanIndex;
+        int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        queriedLevel = DiffSeries::levelFor(kSpans[spanIndex].ms, kMaxPoints);
+        series.query(queriedLevel, nowMs - kSpans[spanIndex].ms, nowMs, records);
+        meanValues.resize(records.size());
+        maxValues.resize(records.size());
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            meanValues[i] = records[i].meanPercent;
+            maxValues[i] = records[i].maxPercent;
+        }
+    }
+
+    ImGui::SameLine();
+    ImGui::TextDisabled("%s, %zu 点", levelName(queriedLevel), records.size());
+    if (records.empty())
+    {
+        ImGui::TextDisabled("この期間の記録はありません");
+        return;
+    }
+
+    float top = 0.0f;
+    for (float v : maxValues)
+        top = std::max(top, v);
+    top = top > 0.0f ? top * 1.1f : 1.0f;
+
+    char overlay[64];
+    std::snprintf(overlay, sizeof(overlay), "最大 %.2f%%", top / 1.1f);
+    // 集計の段では最大値を薄く重ね、平均を上に描く
+    ImVec2 pos = ImGui::GetCursorScreenPos();
+    if (queriedLevel != SeriesLevel::Raw)
+    {
+        ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(0.9f, 0.4f, 0.3f, 0.5f));
+        ImGui::PlotLines("##max", maxValues.data(), static_cast<int>(maxValues.size()), 0, nullptr, 0.0f, top, ImVec2(-1, 80));
+        ImGui::PopStyleColor();
+        ImGui::SetCursorScreenPos(pos);
+        ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0, 0, 0, 0));
+    }
+    ImGui::PlotLines("##mean", meanValues.data(), static_cast<int>(meanValues.size()), 0, overlay, 0.0f, top, ImVec2(-1, 80));
+    if (queriedLevel != SeriesLevel::Raw)
+        ImGui::PopStyleColor();
+
+    char from[32], to[32];
+    formatTime(records.front().timeMs, from, sizeof(from));
+    formatTime(records.back().timeMs, to, sizeof(to));
+    ImGui::TextDisabled("%s - %s", from, to);
+}
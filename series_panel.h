@@ -0,0 +1,7 @@
+﻿#pragma once
+
+class DiffSeries;
+
+// 情報ウィンドウに差分率の推移グラフを描く
+// 期間に応じて集計の段を選ぶので、何か月分でも生データは読まない
+void DrawDiffSeriesPlot(const DiffSeries &series);
@@ -0,0 +1,406 @@
+﻿#include "template_cache.h"
+#include "image_pipeline.h"
+#include "mapped_file.h"
+#include "palette.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    double msSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t align8(size_t n)
+    {
+        return (n + 7) & ~static_cast<size_t>(7);
+    }
+
+    // offset から count 個の要素がファイルに収まるか（壊れたヘッダーの大きな値で足し算・掛け算があふれないように）
+    bool fits(const MappedFile &file, uint64_t offset, uint64_t count, uint64_t elementBytes)
+    {
+        return offset <= file.size() && count <= (file.size() - offset) / elementBytes;
+    }
+
+    // ヘッダーと大きさが食い違っていないか（途中で切れたファイルを読まないように）
+    bool validHeader(const MappedFile &file, const TemplateFileHeader &h)
+    {
+        if (h.magic != kTemplateMagic || h.version != kTemplateVersion)
+            return false;
+        if (h.width <= 0 || h.height <= 0)
+            return false;
+        const uint64_t pixels = static_cast<uint64_t>(h.width) * static_cast<uint64_t>(h.height);
+        if (h.indexOffset < kTemplateDataOffset || !fits(file, h.indexOffset, pixels, 1))
+            return false;
+        // 行の開始位置と区間は配列として直接読むので、要素の境界にそろっていること
+        if (h.rowOffset % alignof(uint32_t) != 0 || !fits(file, h.rowOffset, static_cast<uint64_t>(h.height) + 1, sizeof(uint32_t)))
+            return false;
+        if (h.spanOffset % alignof(TemplateSpan) != 0 || !fits(file, h.spanOffset, h.spanCount, sizeof(TemplateSpan)))
+            return false;
+        return h.sampleCount <= PaletteQuantizeReport::kMaxSamples;
+    }
+
+    // 更新時刻（比べるだけなので file_time_type の内部値のまま）。取れなければ 0
+    int64_t sourceWriteTime(const std::string &path)
+    {
+        std::error_code ec;
+        auto t = std::filesystem::last_write_time(path, ec);
+        return ec ? 0 : static_cast<int64_t>(t.time_since_epoch().count());
+    }
+
+    // 区間の部分だけパレットの色を書く（それ以外は透明のまま）
+    void expandSpans(const MappedFile &file, const TemplateFileHeader &h, cv::Mat &bgra)
+    {
+        uint32_t palette[kWplacePaletteSize];
+        for (int i = 0; i < kWplacePaletteSize; ++i)
+            palette[i] = wplacePaletteBGRA(i);
+        const uint8_t *indices = file.data() + h.indexOffset;
+        const uint32_t *rows = reinterpret_cast<const uint32_t *>(file.data() + h.rowOffset);
+        const TemplateSpan *spans = reinterpret_cast<const TemplateSpan *>(file.data() + h.spanOffset);
+
+        bgra = cv::Mat(h.height, h.width, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+        cv::parallel_for_(cv::Range(0, h.height), [&](const cv::Range &range)
+                          {
+            for (int y = range.start; y < range.end; ++y)
+            {
+                uint32_t *dst = bgra.ptr<uint32_t>(y);
+                const uint8_t *src = indices + static_cast<size_t>(y) * h.width;
+                const uint32_t end = std::min<uint64_t>(rows[y + 1], h.spanCount);
+                for (uint32_t s = rows[y]; s < end; ++s)
+                {
+                    const int x1 = std::min(spans[s].x1, h.width);
+                    for (int x = std::max(spans[s].x0, 0); x < x1; ++x)
+                        dst[x] = palette[src[x] & (kWplacePaletteSize - 1)];
+                }
+            } });
+    }
+
+    void reportFromHeader(const TemplateFileHeader &h, PaletteQuantizeReport &report)
+    {
+        report = PaletteQuantizeReport();
+        report.opaque = h.opaque;
+        report.exact = h.exact;
+        report.remapped = h.remapped;
+        report.unmappable = h.unmappable;
+        report.unmappableBounds = cv::Rect(h.unmappableBounds[0], h.unmappableBounds[1], h.unmappableBounds[2], h.unmappableBounds[3]);
+        for (uint32_t i = 0; i < h.sampleCount; ++i)
+            report.unmappableSamples.emplace_back(h.samples[i][0], h.samples[i][1]);
+    }
+
+    // 一時ファイルに書いてから置き換える（書き込み途中のファイルを読まないように）
+    bool writeCompiled(const std::string &path, const cv::Mat &indices, const PaletteQuantizeReport &report,
+                       uint64_t sourceHash, uint64_t sourceBytes, int64_t sourceMtime, const HistoryRegion &target,
+                       size_t &spanCount)
+    {
+        std::vector<uint32_t> rows(static_cast<size_t>(indices.rows) + 1, 0);
+        std::vector<TemplateSpan> spans;
+        for (int y = 0; y < indices.rows; ++y)
+        {
+            rows[y] = static_cast<uint32_t>(spans.size());
+            const uint8_t *src = indices.ptr<uint8_t>(y);
+            int x = 0;
+            while (x < indices.cols)
+            {
+                while (x < indices.cols && src[x] == 0)
+                    ++x;
+                if (x >= indices.cols)
+                    break;
+                TemplateSpan span;
+                span.y = y;
+                span.x0 = x;
+                while (x < indices.cols && src[x] != 0)
+                    ++x;
+                span.x1 = x;
+                spans.push_back(span);
+            }
+        }
+        rows[indices.rows] = static_cast<uint32_t>(spans.size());
+        spanCount = spans.size();
+
+        TemplateFileHeader h;
+        h.sourceHash = sourceHash;
+        h.sourceBytes = sourceBytes;
+        h.sourceMtime = sourceMtime;
+        h.width = indices.cols;
+        h.height = indices.rows;
+        h.target = target;
+        h.indexOffset = kTemplateDataOffset;
+        h.rowOffset = align8(h.indexOffset + static_cast<uint64_t>(indices.cols) * indices.rows);
+        h.spanOffset = align8(h.rowOffset + rows.size() * sizeof(uint32_t));
+        h.spanCount = spans.size();
+        h.opaque = report.opaque;
+        h.exact = report.exact;
+        h.remapped = report.remapped;
+        h.unmappable = report.unmappable;
+        h.unmappableBounds[0] = report.unmappableBounds.x;
+        h.unmappableBounds[1] = report.unmappableBounds.y;
+        h.unmappableBounds[2] = report.unmappableBounds.width;
+        h.unmappableBounds[3] = report.unmappableBounds.height;
+        h.sampleCount = static_cast<uint32_t>(std::min(report.unmappableSamples.size(), PaletteQuantizeReport::kMaxSamples));
+        for (uint32_t i = 0; i < h.sampleCount; ++i)
+        {
+            h.samples[i][0] = report.unmappableSamples[i].x;
+            h.samples[i][1] = report.unmappableSamples[i].y;
+        }
+
+        const std::string tmpPath = path + ".tmp";
+        std::FILE *fp = std::fopen(tmpPath.c_str(), "wb");
+        if (!fp)
+            return false;
+        // 2GB を超えることがあるので ftell ではなく書いた量を数える
+        static const uint8_t zeros[kTemplateDataOffset] = {};
+        uint64_t pos = 0;
+        auto write = [&](const void *data, size_t size)
+        {
+            pos += size;
+            return size == 0 || std::fwrite(data, 1, size, fp) == size;
+        };
+        auto pad = [&](uint64_t offset)
+        {
+            return write(zeros, static_cast<size_t>(offset - pos));
+        };
+        bool ok = write(&h, sizeof(h)) && pad(h.indexOffset);
+        for (int y = 0; ok && y < indices.rows; ++y)
+            ok = write(indices.ptr<uint8_t>(y), indices.cols);
+        ok = ok && pad(h.rowOffset) && write(rows.data(), rows.size() * sizeof(uint32_t));
+        ok = ok && pad(h.spanOffset) && write(spans.data(), spans.size() * sizeof(TemplateSpan));
+        ok = (std::fclose(fp) == 0) && ok;
+
+        std::error_code ec;
+        if (ok)
+            std::filesystem::rename(tmpPath, path, ec);
+        if (!ok || ec)
+        {
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // 監視領域や元の画像の更新時刻だけ変わったときはヘッダーのその部分だけ書き直す
+    template <typename T>
+    void updateHeaderField(std::FILE *fp, size_t offset, const T &value)
+    {
+        if (std::fseek(fp, static_cast<long>(offset), SEEK_SET) == 0)
+            std::fwrite(&value, sizeof(value), 1, fp);
+    }
+}
+
+std::string compiledTemplatePath(const std::string &imagePath)
+{
+    return imagePath + ".wpt";
+}
+
+uint64_t templateSourceHash(const uint8_t *data, size_t size)
+{
+    // 8 バイトずつの FNV-1a 風（暗号用ではなく、変更の検出だけに使う）
+    uint64_t h = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t w;
+        std::memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0x100000001b3ull;
+        h ^= h >> 32;
+    }
+    for (; i < size; ++i)
+        h = (h ^ data[i]) * 0x100000001b3ull;
+    return h;
+}
+
+bool loadTemplate(const std::string &imagePath, bool quantize, const HistoryRegion &target, LoadedTemplate &out,
+                  const TemplateLoadCallback &progress)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto report = [&](const char *stage, float fraction)
+    {
+        if (progress)
+            progress(stage, fraction);
+    };
+    out = LoadedTemplate();
+    out.target = target;
+
+    report("読み込み", 0.0f);
+    MappedFile source;
+    if (!quantize)
+    {
+        if (!source.open(imagePath))
+            return false;
+        cv::Mat encoded(1, static_cast<int>(source.size()), CV_8U, const_cast<uint8_t *>(source.data()));
+        report("デコード", 0.1f);
+        out.bgra = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+        if (out.bgra.empty())
+            return false;
+        ensureBGRA(out.bgra);
+        out.elapsedMs = msSince(start);
+        return true;
+    }
+
+    // 元の画像を読む前に大きさと更新時刻を取る（読んでいる間に書き換えられたら次回ハッシュで気づく）
+    std::error_code ec;
+    const uint64_t sourceBytes = std::filesystem::file_size(imagePath, ec);
+    if (ec)
+        return false;
+    const int64_t sourceMtime = sourceWriteTime(imagePath);
+    uint64_t hash = 0;
+    bool hashed = false;
+    const std::string compiledPath = compiledTemplatePath(imagePath);
+    {
+        MappedFile compiled;
+        if (compiled.open(compiledPath) && compiled.size() >= kTemplateDataOffset)
+        {
+            const TemplateFileHeader &h = *reinterpret_cast<const TemplateFileHeader *>(compiled.data());
+            // 大きさと更新時刻が同じなら元の画像は読まない。更新時刻だけ違えば（コピーし直したなど）内容を比べる
+            const bool sameSize = validHeader(compiled, h) && h.sourceBytes == sourceBytes;
+            bool fresh = sameSize && h.sourceMtime == sourceMtime;
+            if (sameSize && !fresh)
+            {
+                report("読み込み", 0.05f);
+                if (!source.open(imagePath))
+                    return false;
+                hash = templateSourceHash(source.data(), source.size());
+                hashed = true;
+                fresh = h.sourceHash == hash;
+            }
+            if (fresh)
+            {
+                report("展開", 0.5f);
+                expandSpans(compiled, h, out.bgra);
+                reportFromHeader(h, out.quantize);
+                out.spans = static_cast<size_t>(h.spanCount);
+                out.fromCache = true;
+                const bool targetChanged = std::memcmp(&h.target, &target, sizeof(target)) != 0;
+                const bool mtimeChanged = h.sourceMtime != sourceMtime;
+                compiled.close();
+                if (targetChanged || mtimeChanged)
+                {
+                    if (std::FILE *fp = std::fopen(compiledPath.c_str(), "r+b"))
+                    {
+                        if (targetChanged)
+                            updateHeaderField(fp, offsetof(TemplateFileHeader, target), target);
+                        if (mtimeChanged)
+                            updateHeaderField(fp, offsetof(TemplateFileHeader, sourceMtime), sourceMtime);
+                        std::fclose(fp);
+                    }
+                }
+                out.elapsedMs = msSince(start);
+                return true;
+            }
+        }
+    }
+
+    if (!source.isOpen() && !source.open(imagePath))
+        return false;
+    if (!hashed)
+        hash = templateSourceHash(source.data(), source.size());
+    cv::Mat encoded(1, static_cast<int>(source.size()), CV_8U, const_cast<uint8_t *>(source.data()));
+    report("デコード", 0.1f);
+    out.bgra = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+    if (out.bgra.empty())
+        return false;
+    ensureBGRA(out.bgra);
+    report("減色", 0.6f);
+    cv::Mat indices;
+    quantizeToPalette(out.bgra, out.quantize, &indices);
+    report("索引の作成", 0.8f);
+    if (!writeCompiled(compiledPath, indices, out.quantize, hash, sourceBytes, sourceMtime, target, out.spans))
+        std::cerr << "コンパイル済みテンプレートを書き出せませんでした: " << compiledPath << std::endl;
+    out.elapsedMs = msSince(start);
+    return true;
+}
+
+TemplateLoader::~TemplateLoader()
+{
+    // 読み込み中のデコードは止められないので、終わるのを待つ
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hasPending_ = false;
+    }
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void TemplateLoader::start(const TemplateLoadRequest &request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    hasResult_ = false;
+    if (running_)
+    {
+        pending_ = request;
+        hasPending_ = true;
+        return;
+    }
+    // 前のスレッドは終わっているので待たずに済む
+    if (thread_.joinable())
+        thread_.join();
+    running_ = true;
+    progress_ = TemplateLoadProgress();
+    progress_.running = true;
+    progress_.path = request.path;
+    startedAt_ = std::chrono::steady_clock::now();
+    thread_ = std::thread(&TemplateLoader::run, this, request);
+}
+
+TemplateLoadProgress TemplateLoader::progress() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    TemplateLoadProgress p = progress_;
+    if (p.running)
+        p.elapsedMs = msSince(startedAt_);
+    return p;
+}
+
+bool TemplateLoader::takeResult(TemplateLoadResult &out)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!hasResult_)
+        return false;
+    out = std::move(result_);
+    result_ = TemplateLoadResult();
+    hasResult_ = false;
+    return true;
+}
+
+void TemplateLoader::run(TemplateLoadRequest request)
+{
+    for (;;)
+    {
+        TemplateLoadResult result;
+        result.request = request;
+        result.ok = loadTemplate(request.path, request.quantize, request.target, result.loaded,
+                                 [this](const char *stage, float fraction)
+                                 {
+                                     std::lock_guard<std::mutex> lock(mutex_);
+                                     progress_.stage = stage;
+                                     progress_.fraction = fraction;
+                                 });
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (hasPending_)
+        {
+            // 読み込み中に別の要求が来たので、この結果は使わない
+            request = std::move(pending_);
+            hasPending_ = false;
+            progress_ = TemplateLoadProgress();
+            progress_.running = true;
+            progress_.path = request.path;
+            startedAt_ = std::chrono::steady_clock::now();
+            continue;
+        }
+        result_ = std::move(result);
+        hasResult_ = true;
+        progress_.running = false;
+        progress_.fraction = 1.0f;
+        progress_.elapsedMs = msSince(startedAt_);
+        running_ = false;
+        return;
+    }
+}
@@ -0,0 +1,134 @@
+﻿#pragma once
+
+#include "history_store.h"
+#include "palette_quantize.h"
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// コンパイル済みテンプレート（<テンプレート>.wpt）
+//
+// 巨大なテンプレートは PNG のデコードと BGRA への変換・減色だけで数秒かかる。
+// 一度読み込んだらパレットのインデックス（1ピクセル1バイト）と行ごとの不透明な区間の索引を書き出しておき、
+// 次からはそれをメモリマップして区間の部分だけ BGRA に展開する（デコードも減色もしない）。
+// 元の画像ファイルの大きさ・更新時刻・ハッシュをヘッダーに持つ。大きさと更新時刻が同じなら元の画像は読まず、
+// 更新時刻だけ違うときはハッシュを比べ、内容が変わっていたら作り直す。
+// パレットのインデックスで持つので、減色しない設定のときは使わない（毎回デコードする）。
+//
+// ファイル = TemplateFileHeader（kTemplateDataOffset バイト）+ インデックス + 行ごとの区間の開始位置 + 区間の列
+
+constexpr uint32_t kTemplateMagic = 0x54475057; // "WPGT"
+constexpr uint32_t kTemplateVersion = 2;
+constexpr size_t kTemplateDataOffset = 512;
+
+// 不透明なピクセルが続く区間 [x0, x1)
+struct TemplateSpan
+{
+    int32_t y = 0;
+    int32_t x0 = 0, x1 = 0;
+};
+
+struct TemplateFileHeader
+{
+    uint32_t magic = kTemplateMagic;
+    uint32_t version = kTemplateVersion;
+    uint64_t sourceHash = 0;  // 元の画像ファイルの内容のハッシュ
+    uint64_t sourceBytes = 0; // 元の画像ファイルの大きさ
+    int64_t sourceMtime = 0;  // 元の画像ファイルの更新時刻（file_time_type の内部値）
+    int32_t width = 0, height = 0;
+    HistoryRegion target;     // 最後にこのテンプレートで監視した領域
+    uint64_t indexOffset = 0; // width * height バイト
+    uint64_t rowOffset = 0;   // uint32_t × (height + 1)。行 y の区間は [row[y], row[y+1])
+    uint64_t spanOffset = 0;  // TemplateSpan × spanCount
+    uint64_t spanCount = 0;
+    // 減色の結果（読み込みのたびに報告できるように残す）
+    int32_t opaque = 0, exact = 0, remapped = 0, unmappable = 0;
+    int32_t unmappableBounds[4] = {};
+    uint32_t sampleCount = 0;
+    int32_t samples[PaletteQuantizeReport::kMaxSamples][2] = {};
+};
+static_assert(sizeof(TemplateFileHeader) <= kTemplateDataOffset, "TemplateFileHeader must fit in the data offset");
+
+struct LoadedTemplate
+{
+    cv::Mat bgra;                   // CV_8UC4
+    HistoryRegion target;           // 読み込み時に指定した監視領域
+    PaletteQuantizeReport quantize; // 減色しなかったら空
+    size_t spans = 0;               // 不透明な区間の数（コンパイルしなかったら 0）
+    bool fromCache = false;         // コンパイル済みのファイルから読んだ
+    double elapsedMs = 0.0;
+};
+
+std::string compiledTemplatePath(const std::string &imagePath);
+
+// ファイルの内容のハッシュ（変更の検出用）
+uint64_t templateSourceHash(const uint8_t *data, size_t size);
+
+// 読み込みの途中経過（stage は段階の名前、fraction は全体の 0〜1）
+using TemplateLoadCallback = std::function<void(const char *stage, float fraction)>;
+
+// テンプレートを読み込む。quantize なら減色し、コンパイル済みのファイルを使う（なければ・古ければ作る）。
+// target はヘッダーに記録する監視領域（変わっていたらヘッダーだけ書き直す）
+bool loadTemplate(const std::string &imagePath, bool quantize, const HistoryRegion &target, LoadedTemplate &out,
+                  const TemplateLoadCallback &progress = {});
+
+struct TemplateLoadRequest
+{
+    std::string path;
+    bool quantize = true;
+    HistoryRegion target;
+};
+
+struct TemplateLoadResult
+{
+    TemplateLoadRequest request;
+    bool ok = false; // 読めなかったら false（bgra は空）
+    LoadedTemplate loaded;
+};
+
+struct TemplateLoadProgress
+{
+    bool running = false;
+    std::string path;
+    const char *stage = "";
+    float fraction = 0.0f;
+    double elapsedMs = 0.0;
+};
+
+// テンプレートをバックグラウンドで読み込む
+//
+// 読み込み・デコード・減色・索引の作成は専用スレッドで行い、UI スレッドは毎フレーム takeResult() で
+// 終わったかどうかだけ見る。終わるまで今のテンプレートはそのまま使い続け、差し替えは呼び出し側で一度に行う。
+// 読み込み中に start() されたら、今の読み込みが終わった時点でその結果を捨てて新しい要求を読み込む。
+class TemplateLoader
+{
+public:
+    TemplateLoader() = default;
+    ~TemplateLoader();
+    TemplateLoader(const TemplateLoader &) = delete;
+    TemplateLoader &operator=(const TemplateLoader &) = delete;
+
+    void start(const TemplateLoadRequest &request);
+    bool running() const { return running_; }
+    TemplateLoadProgress progress() const;
+    // 読み込みが終わっていれば結果を取り出して true
+    bool takeResult(TemplateLoadResult &out);
+
+private:
+    void run(TemplateLoadRequest request);
+
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    mutable std::mutex mutex_;
+    bool hasPending_ = false;
+    TemplateLoadRequest pending_;
+    bool hasResult_ = false;
+    TemplateLoadResult result_;
+    TemplateLoadProgress progress_;
+    std::chrono::steady_clock::time_point startedAt_;
+};
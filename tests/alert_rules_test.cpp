@@ -0,0 +1,178 @@
+﻿// アラートのルール（alert_rules）の評価とルールファイル
+//
+// 発報・保持・解除のヒステリシス、解除後の最短間隔による再発報の抑制、時間窓の平均と速さを確かめる。
+// ルールファイルは往復でき、解除のしきい値が発報以上のルールや壊れた行を読み込まないことも確かめる。
+
+#include "alert_rules.h"
+#include "test_common.h"
+
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    AlertStatus statusOf(const AlertEngine &engine, size_t index)
+    {
+        std::vector<AlertStatus> statuses;
+        engine.snapshot(statuses);
+        return index < statuses.size() ? statuses[index] : AlertStatus();
+    }
+
+    // 変更ピクセル数だけで1周期評価する
+    std::vector<AlertTransition> evaluateChanged(AlertEngine &engine, int64_t timeMs, int changed)
+    {
+        std::vector<AlertTransition> out;
+        engine.evaluate(timeMs, changed, 0.0, 0, out);
+        return out;
+    }
+
+    // 発報 → しきい値の間で保持 → 解除
+    void testRaiseHoldClear()
+    {
+        AlertEngine engine;
+        engine.setRules({{"changed", AlertMetric::ChangedPixels, 100.0, 50.0, 0.0, 60.0}});
+
+        CHECK(evaluateChanged(engine, 1000, 99).empty());
+        CHECK(statusOf(engine, 0).state == AlertState::Ok);
+
+        std::vector<AlertTransition> out = evaluateChanged(engine, 2000, 100);
+        CHECK(out.size() == 1 && out[0].firing && out[0].threshold == 100.0 && out[0].timeMs == 2000);
+        CHECK(statusOf(engine, 0).state == AlertState::Firing);
+        CHECK(engine.firingCount() == 1);
+
+        // 発報中は解除のしきい値を下回るまで何も通知しない（境目でばたつかない）
+        for (int changed : {99, 120, 51, 100, 80})
+            CHECK(evaluateChanged(engine, 3000, changed).empty());
+        CHECK(statusOf(engine, 0).state == AlertState::Firing);
+        CHECK(statusOf(engine, 0).fireCount == 1);
+
+        out = evaluateChanged(engine, 4000, 50);
+        CHECK(out.size() == 1 && !out[0].firing && out[0].threshold == 50.0 && out[0].value == 50.0);
+        CHECK(statusOf(engine, 0).state == AlertState::Ok);
+        CHECK(statusOf(engine, 0).sinceMs == 4000);
+        CHECK(engine.firingCount() == 0);
+    }
+
+    // 解除してから最短間隔が過ぎるまでは再発報しない
+    void testCooldown()
+    {
+        AlertEngine engine;
+        engine.setRules({{"changed", AlertMetric::ChangedPixels, 100.0, 50.0, 0.0, 60.0}});
+        CHECK(evaluateChanged(engine, 0, 200).size() == 1);
+        CHECK(evaluateChanged(engine, 5000, 10).size() == 1);
+
+        // 前回の発報から 60 秒たつまでは間隔待ちのまま通知しない
+        CHECK(evaluateChanged(engine, 10000, 200).empty());
+        CHECK(statusOf(engine, 0).state == AlertState::Cooldown);
+        CHECK(evaluateChanged(engine, 59999, 200).empty());
+        CHECK(statusOf(engine, 0).state == AlertState::Cooldown);
+        CHECK(statusOf(engine, 0).fireCount == 1);
+
+        // 間隔待ちの間に解除のしきい値を下回れば正常に戻る
+        CHECK(evaluateChanged(engine, 30000, 10).empty());
+        CHECK(statusOf(engine, 0).state == AlertState::Ok);
+
+        std::vector<AlertTransition> out = evaluateChanged(engine, 60000, 200);
+        CHECK(out.size() == 1 && out[0].firing);
+        CHECK(statusOf(engine, 0).fireCount == 2);
+        CHECK(statusOf(engine, 0).lastFiredMs == 60000);
+
+        // 間隔 0 なら解除の直後でも発報できる
+        AlertEngine immediate;
+        immediate.setRules({{"changed", AlertMetric::ChangedPixels, 100.0, 50.0, 0.0, 0.0}});
+        CHECK(evaluateChanged(immediate, 0, 200).size() == 1);
+        CHECK(evaluateChanged(immediate, 1, 0).size() == 1);
+        CHECK(evaluateChanged(immediate, 2, 200).size() == 1);
+    }
+
+    // 時間窓: 差分率は窓内の平均、荒らしの速さは窓内の合計を1分あたりにしたもの
+    void testWindows()
+    {
+        AlertEngine engine;
+        engine.setRules({
+            {"percent", AlertMetric::DiffPercent, 5.0, 2.0, 10.0, 0.0},
+            {"rate", AlertMetric::ChangeRate, 30.0, 6.0, 0.0, 0.0}, // 窓は最短 10 秒になる
+        });
+        std::vector<AlertTransition> out;
+        engine.evaluate(0, 0, 8.0, 3, out);
+        CHECK(out.size() == 1 && out[0].name == "percent");
+        engine.evaluate(5000, 0, 0.0, 2, out);
+        CHECK(statusOf(engine, 0).value == 4.0);
+        CHECK(statusOf(engine, 1).value == 30.0);
+        CHECK(out.size() == 1 && out[0].name == "rate" && out[0].firing);
+        engine.evaluate(10000, 0, 0.0, 0, out);
+        CHECK(statusOf(engine, 0).value == 8.0 / 3.0);
+        // 11 秒後には最初のサンプルが窓から外れる
+        engine.evaluate(11000, 0, 0.0, 0, out);
+        CHECK(statusOf(engine, 0).value == 0.0);
+        CHECK(statusOf(engine, 1).value == 12.0);
+        CHECK(out.size() == 1 && out[0].name == "percent" && !out[0].firing);
+        engine.evaluate(16000, 0, 0.0, 0, out);
+        CHECK(statusOf(engine, 1).value == 0.0);
+        CHECK(out.size() == 1 && out[0].name == "rate" && !out[0].firing);
+
+        // しきい値だけの変更なら状態と窓を引き継ぎ、指標が変われば作り直す
+        engine.evaluate(17000, 0, 40.0, 0, out); // 窓内の平均は 10
+        CHECK(statusOf(engine, 0).state == AlertState::Firing);
+        engine.setRules({
+            {"percent", AlertMetric::DiffPercent, 6.0, 1.0, 10.0, 0.0},
+            {"rate", AlertMetric::ChangedPixels, 30.0, 6.0, 0.0, 0.0},
+        });
+        CHECK(statusOf(engine, 0).state == AlertState::Firing);
+        CHECK(statusOf(engine, 0).fireCount == 2);
+        CHECK(statusOf(engine, 1).fireCount == 0);
+        engine.reset();
+        CHECK(statusOf(engine, 0).state == AlertState::Ok && statusOf(engine, 0).fireCount == 0);
+        CHECK(statusOf(engine, 0).rule.raise == 6.0);
+    }
+
+    void testRuleFile()
+    {
+        const std::string dir = testDirectory("wpg_alert_rules_test");
+        const std::string path = dir + "rules.alerts";
+
+        std::vector<AlertRule> rules;
+        CHECK(!loadAlertRules(path, rules));
+
+        std::vector<AlertRule> saved = defaultAlertRules();
+        saved[0].name = "名前,カンマ";
+        CHECK(saveAlertRules(path, saved));
+        CHECK(loadAlertRules(path, rules));
+        CHECK(rules.size() == saved.size());
+        for (size_t i = 0; i < rules.size() && i < saved.size(); ++i)
+        {
+            CHECK(rules[i].metric == saved[i].metric);
+            CHECK(rules[i].raise == saved[i].raise && rules[i].clear == saved[i].clear);
+            CHECK(rules[i].windowSec == saved[i].windowSec && rules[i].cooldownSec == saved[i].cooldownSec);
+        }
+        CHECK(!rules.empty() && rules[0].name == "名前 カンマ");
+
+        // 解除のしきい値が発報以上のルール、知らない指標、数でない値、欄の数が違う行は読み飛ばす
+        {
+            std::ofstream ofs(path);
+            ofs << "rule=ok,changed,100,50,0,300\r\n"
+                << "rule=equal,changed,100,100,0,300\n"
+                << "rule=above,percent,5,8,60,300\n"
+                << "rule=metric,pixels,100,50,0,300\n"
+                << "rule=number,rate,abc,10,120,600\n"
+                << "rule=short,rate,50,10,120\n"
+                << "# rule=comment,changed,100,50,0,300\n"
+                << "rule=rate,rate,50,10,120,600\n";
+        }
+        CHECK(loadAlertRules(path, rules));
+        CHECK(rules.size() == 2);
+        CHECK(rules.size() == 2 && rules[0].name == "ok" && rules[1].name == "rate");
+        for (const AlertRule &rule : rules)
+            CHECK(validAlertRule(rule));
+        CHECK(!validAlertRule({"equal", AlertMetric::ChangedPixels, 100.0, 100.0, 0.0, 300.0}));
+    }
+}
+
+int main()
+{
+    testRaiseHoldClear();
+    testCooldown();
+    testWindows();
+    testRuleFile();
+    return testResult();
+}
@@ -0,0 +1,336 @@
+﻿// 間違いピクセルの連結領域（damage_clusters）の差分更新
+//
+// ランダムに間違いピクセルを増やしたり直したりしながら、差分で保っている領域が
+// 毎回その場で8近傍の連結成分を数え直した結果と一致すること（数・大きさ・外接矩形・番号の対応）を確かめる。
+// 橋になっているピクセルが直って分かれる場合、二つの領域がつながる場合、直ったピクセルがまた間違いになる場合も個別に調べる。
+
+#include "damage_clusters.h"
+#include "test_common.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace
+{
+    constexpr int kWidth = 40;
+    constexpr int kHeight = 28;
+    const cv::Vec4b kTemplateColor(10, 20, 30, 255);
+    const cv::Vec4b kWrongColor(200, 100, 50, 255);
+
+    // 間違いの有無（y * 幅 + x）から、テンプレートと同じ大きさのリアルタイム画像を作る
+    cv::Mat realtimeFrom(const std::vector<uint8_t> &wrong)
+    {
+        cv::Mat img(kHeight, kWidth, CV_8UC4);
+        for (int y = 0; y < kHeight; ++y)
+        {
+            cv::Vec4b *row = img.ptr<cv::Vec4b>(y);
+            for (int x = 0; x < kWidth; ++x)
+                row[x] = wrong[y * kWidth + x] ? kWrongColor : kTemplateColor;
+        }
+        return img;
+    }
+
+    cv::Mat templateImage()
+    {
+        cv::Mat img(kHeight, kWidth, CV_8UC4);
+        for (int y = 0; y < kHeight; ++y)
+        {
+            cv::Vec4b *row = img.ptr<cv::Vec4b>(y);
+            for (int x = 0; x < kWidth; ++x)
+                row[x] = kTemplateColor;
+        }
+        return img;
+    }
+
+    struct Component
+    {
+        std::vector<int32_t> pixels;
+        int minX = kWidth, minY = kHeight, maxX = -1, maxY = -1;
+    };
+
+    // 比較用: 毎回最初から8近傍で連結成分を数える
+    std::vector<Component> components(const std::vector<uint8_t> &wrong)
+    {
+        std::vector<Component> out;
+        std::vector<uint8_t> seen(wrong.size(), 0);
+        for (int32_t start = 0; start < static_cast<int32_t>(wrong.size()); ++start)
+        {
+            if (!wrong[start] || seen[start])
+                continue;
+            Component c;
+            std::vector<int32_t> stack{start};
+            seen[start] = 1;
+            while (!stack.empty())
+            {
+                const int32_t p = stack.back();
+                stack.pop_back();
+                const int x = p % kWidth, y = p / kWidth;
+                c.pixels.push_back(p);
+                c.minX = std::min(c.minX, x);
+                c.minY = std::min(c.minY, y);
+                c.maxX = std::max(c.maxX, x);
+                c.maxY = std::max(c.maxY, y);
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        const int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= kWidth || ny >= kHeight)
+                            continue;
+                        const int32_t n = ny * kWidth + nx;
+                        if (wrong[n] && !seen[n])
+                        {
+                            seen[n] = 1;
+                            stack.push_back(n);
+                        }
+                    }
+                }
+            }
+            out.push_back(std::move(c));
+        }
+        return out;
+    }
+
+    // 差分で保った領域と数え直した連結成分が一致するか。一致すれば成分ごとの番号を返す
+    std::vector<uint32_t> checkMatches(DamageTracker &tracker, const std::vector<uint8_t> &wrong)
+    {
+        const std::vector<Component> expected = components(wrong);
+        std::vector<DamageCluster> clusters;
+        tracker.snapshot(clusters);
+        std::map<uint32_t, DamageCluster> byId;
+        for (const DamageCluster &c : clusters)
+            byId[c.id] = c;
+        CHECK(byId.size() == clusters.size()); // 番号の重複がない
+        CHECK(clusters.size() == expected.size());
+
+        int total = 0;
+        std::set<uint32_t> used;
+        std::vector<uint32_t> ids;
+        for (const Component &c : expected)
+        {
+            total += static_cast<int>(c.pixels.size());
+            std::vector<uint32_t> pixelIds(c.pixels.size());
+            std::vector<int> sizes(c.pixels.size());
+            tracker.lookup(c.pixels.data(), c.pixels.size(), pixelIds.data(), sizes.data());
+            // 成分のピクセルはすべて同じ領域に属し、その領域は他の成分と共有されない
+            const uint32_t id = pixelIds[0];
+            CHECK(id != 0);
+            CHECK(std::all_of(pixelIds.begin(), pixelIds.end(), [id](uint32_t v) { return v == id; }));
+            CHECK(std::all_of(sizes.begin(), sizes.end(), [&c](int v) { return v == static_cast<int>(c.pixels.size()); }));
+            CHECK(used.insert(id).second);
+            ids.push_back(id);
+
+            auto it = byId.find(id);
+            CHECK(it != byId.end());
+            if (it == byId.end())
+                continue;
+            const DamageCluster &d = it->second;
+            CHECK(d.pixels == static_cast<int>(c.pixels.size()));
+            CHECK(d.minX == c.minX && d.minY == c.minY && d.maxX == c.maxX && d.maxY == c.maxY);
+        }
+        CHECK(tracker.wrongPixels() == total);
+
+        // 間違いでないピクセルはどの領域にも属さない
+        std::vector<int32_t> right;
+        for (int32_t p = 0; p < static_cast<int32_t>(wrong.size()); ++p)
+        {
+            if (!wrong[p])
+                right.push_back(p);
+        }
+        std::vector<uint32_t> rightIds(right.size());
+        std::vector<int> rightSizes(right.size());
+        tracker.lookup(right.data(), right.size(), rightIds.data(), rightSizes.data());
+        CHECK(std::all_of(rightIds.begin(), rightIds.end(), [](uint32_t v) { return v == 0; }));
+        return ids;
+    }
+
+    uint32_t idAt(DamageTracker &tracker, int x, int y)
+    {
+        const int32_t p = y * kWidth + x;
+        uint32_t id = 0;
+        int size = 0;
+        tracker.lookup(&p, 1, &id, &size);
+        return id;
+    }
+
+    void set(std::vector<uint8_t> &wrong, int x0, int y0, int x1, int y1, uint8_t value)
+    {
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+                wrong[y * kWidth + x] = value;
+        }
+    }
+
+    // ランダムな追加・削除の列。塊を置いたり、既存の間違いを少しずつ直したり、ばらばらに反転したりする
+    void testRandomSequences(const cv::Mat &templ)
+    {
+        for (unsigned seed = 1; seed <= 40; ++seed)
+        {
+            std::mt19937 rng(seed);
+            DamageTracker tracker;
+            tracker.reset(kWidth, kHeight);
+            std::vector<uint8_t> wrong(static_cast<size_t>(kWidth) * kHeight, 0);
+            int64_t timeMs = 0;
+            for (int step = 0; step < 60; ++step)
+            {
+                switch (rng() % 4)
+                {
+                case 0: // 矩形の塊を間違いにする
+                {
+                    const int x0 = rng() % kWidth, y0 = rng() % kHeight;
+                    const int x1 = std::min(kWidth - 1, x0 + static_cast<int>(rng() % 6));
+                    const int y1 = std::min(kHeight - 1, y0 + static_cast<int>(rng() % 6));
+                    set(wrong, x0, y0, x1, y1, 1);
+                    break;
+                }
+                case 1: // 矩形の範囲を直す（領域が分かれやすい）
+                {
+                    const int x0 = rng() % kWidth, y0 = rng() % kHeight;
+                    const int x1 = std::min(kWidth - 1, x0 + static_cast<int>(rng() % 3));
+                    const int y1 = std::min(kHeight - 1, y0 + static_cast<int>(rng() % 8));
+                    set(wrong, x0, y0, x1, y1, 0);
+                    break;
+                }
+                case 2: // ばらばらに反転する
+                {
+                    const int count = 1 + rng() % 30;
+                    for (int i = 0; i < count; ++i)
+                        wrong[rng() % wrong.size()] ^= 1;
+                    break;
+                }
+                default: // 間違いピクセルの一部だけを直し、同じ周期に別の場所を間違いにする
+                {
+                    for (uint8_t &w : wrong)
+                    {
+                        if (w && rng() % 5 == 0)
+                            w = 0;
+                    }
+                    const int count = rng() % 10;
+                    for (int i = 0; i < count; ++i)
+                        wrong[rng() % wrong.size()] = 1;
+                    break;
+                }
+                }
+                timeMs += 1000;
+                tracker.update(realtimeFrom(wrong), templ, timeMs);
+                const int before = testFailures();
+                checkMatches(tracker, wrong);
+                if (testFailures() != before)
+                {
+                    std::printf("  seed %u, step %d で一致しませんでした\n", seed, step);
+                    return;
+                }
+            }
+        }
+    }
+
+    // 1ピクセルの橋でつながった二つの塊。橋が直ると分かれ、大きい方が番号を引き継ぐ
+    void testBridgeSplit(const cv::Mat &templ)
+    {
+        DamageTracker tracker;
+        tracker.reset(kWidth, kHeight);
+        std::vector<uint8_t> wrong(static_cast<size_t>(kWidth) * kHeight, 0);
+        set(wrong, 2, 2, 7, 7, 1);   // 36 ピクセル
+        set(wrong, 9, 3, 11, 5, 1);  // 9 ピクセル
+        set(wrong, 8, 4, 8, 4, 1);   // 橋
+        tracker.update(realtimeFrom(wrong), templ, 1000);
+        CHECK(checkMatches(tracker, wrong).size() == 1);
+        const uint32_t id = idAt(tracker, 2, 2);
+
+        set(wrong, 8, 4, 8, 4, 0);
+        tracker.update(realtimeFrom(wrong), templ, 2000);
+        CHECK(checkMatches(tracker, wrong).size() == 2);
+        CHECK(idAt(tracker, 2, 2) == id);
+        CHECK(idAt(tracker, 10, 4) != id);
+        CHECK(idAt(tracker, 10, 4) != 0);
+
+        // 形が変わらない端のピクセルが直っても番号はそのまま、外接矩形は縮む
+        set(wrong, 2, 2, 7, 2, 0);
+        tracker.update(realtimeFrom(wrong), templ, 3000);
+        checkMatches(tracker, wrong);
+        CHECK(idAt(tracker, 2, 3) == id);
+    }
+
+    // 別々の二つの塊がつながると、先に見つかった方の番号と検出時刻を引き継ぐ
+    void testMerge(const cv::Mat &templ)
+    {
+        DamageTracker tracker;
+        tracker.reset(kWidth, kHeight);
+        std::vector<uint8_t> wrong(static_cast<size_t>(kWidth) * kHeight, 0);
+        tracker.update(realtimeFrom(wrong), templ, 0);
+        set(wrong, 20, 10, 21, 11, 1); // 小さいが先に見つかる
+        tracker.update(realtimeFrom(wrong), templ, 1000);
+        const uint32_t older = idAt(tracker, 20, 10);
+        set(wrong, 24, 8, 30, 14, 1);
+        tracker.update(realtimeFrom(wrong), templ, 2000);
+        CHECK(checkMatches(tracker, wrong).size() == 2);
+
+        set(wrong, 22, 11, 23, 11, 1);
+        tracker.update(realtimeFrom(wrong), templ, 3000);
+        CHECK(checkMatches(tracker, wrong).size() == 1);
+        CHECK(idAt(tracker, 30, 14) == older);
+        std::vector<DamageCluster> clusters;
+        tracker.snapshot(clusters);
+        CHECK(clusters.size() == 1 && clusters[0].firstSeenMs == 1000 && clusters[0].lastChangedMs == 3000);
+    }
+
+    // 直ったピクセル（木には残っている）がまた間違いになると、その領域を組み直す
+    void testRebuildOnReadd(const cv::Mat &templ)
+    {
+        DamageTracker tracker;
+        tracker.reset(kWidth, kHeight);
+        std::vector<uint8_t> wrong(static_cast<size_t>(kWidth) * kHeight, 0);
+        set(wrong, 5, 15, 14, 15, 1); // 横一列
+        tracker.update(realtimeFrom(wrong), templ, 1000);
+        const uint32_t id = idAt(tracker, 5, 15);
+
+        // 列の途中が直って二つに分かれる
+        set(wrong, 9, 15, 10, 15, 0);
+        tracker.update(realtimeFrom(wrong), templ, 2000);
+        CHECK(checkMatches(tracker, wrong).size() == 2);
+
+        // 内側のピクセルが直る（形は保たれる）と同時に、直っていた場所がまた間違いになる
+        set(wrong, 9, 15, 10, 15, 1);
+        set(wrong, 12, 15, 12, 15, 0);
+        set(wrong, 12, 14, 12, 14, 1);
+        tracker.update(realtimeFrom(wrong), templ, 3000);
+        CHECK(checkMatches(tracker, wrong).size() == 1);
+        CHECK(idAt(tracker, 5, 15) == id);
+
+        // すべて直ると領域はなくなる
+        std::fill(wrong.begin(), wrong.end(), 0);
+        tracker.update(realtimeFrom(wrong), templ, 4000);
+        CHECK(checkMatches(tracker, wrong).empty());
+        CHECK(tracker.wrongPixels() == 0);
+    }
+
+    // 透明なテンプレートのピクセルは色が違っても間違いにならない
+    void testTransparentTemplate()
+    {
+        cv::Mat templ = templateImage();
+        for (int y = 0; y < kHeight; ++y)
+            templ.ptr<cv::Vec4b>(y)[0] = cv::Vec4b(0, 0, 0, 0);
+        std::vector<uint8_t> wrong(static_cast<size_t>(kWidth) * kHeight, 0);
+        set(wrong, 0, 0, 1, kHeight - 1, 1);
+        DamageTracker tracker;
+        tracker.reset(kWidth, kHeight);
+        tracker.update(realtimeFrom(wrong), templ, 1000);
+        set(wrong, 0, 0, 0, kHeight - 1, 0);
+        checkMatches(tracker, wrong);
+    }
+}
+
+int main()
+{
+    const cv::Mat templ = templateImage();
+    testRandomSequences(templ);
+    testBridgeSplit(templ);
+    testMerge(templ);
+    testRebuildOnReadd(templ);
+    testTransparentTemplate();
+    return testResult();
+}
@@ -0,0 +1,239 @@
+﻿// 履歴ファイル（history_store）の書き込みと読み出しの往復
+//
+// 差分とキーフレームを混ぜて追記したフレームがすべて元どおりに復元できること、
+// 途中で切れた末尾を捨てて続きから追記できること、壊れた色インデックスを読まないことを確かめる。
+
+#include "history_store.h"
+#include "palette.h"
+#include "test_common.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace
+{
+    constexpr int kWidth = 48;
+    constexpr int kHeight = 32;
+    const HistoryRegion kRegion{1818, 806, 120, 340};
+
+    // 書き込み側と同じく、透明なピクセルは BGRA をすべて 0 にそろえた画像
+    cv::Mat normalized(const cv::Mat &img)
+    {
+        cv::Mat out = img.clone();
+        for (int y = 0; y < out.rows; ++y)
+        {
+            cv::Vec4b *row = out.ptr<cv::Vec4b>(y);
+            for (int x = 0; x < out.cols; ++x)
+            {
+                if (row[x][3] == 0)
+                    row[x] = cv::Vec4b(0, 0, 0, 0);
+            }
+        }
+        return out;
+    }
+
+    bool sameImage(const cv::Mat &a, const cv::Mat &b)
+    {
+        if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type())
+            return false;
+        for (int y = 0; y < a.rows; ++y)
+        {
+            if (std::memcmp(a.ptr<uint8_t>(y), b.ptr<uint8_t>(y), static_cast<size_t>(a.cols) * 4) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // パレットの色・パレット外の色・透明（RGB が残っているものを含む）を混ぜる
+    cv::Vec4b randomPixel(std::mt19937 &rng)
+    {
+        int kind = static_cast<int>(rng() % 10);
+        if (kind == 0)
+            return cv::Vec4b(static_cast<uint8_t>(rng()), 0, 0, 0);
+        if (kind == 1)
+            return cv::Vec4b(static_cast<uint8_t>(rng() % 4 * 60), 17, 200, 255);
+        uint32_t c = wplacePaletteBGRA(static_cast<int>(rng() % kWplacePaletteSize));
+        return cv::Vec4b(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff, (c >> 24) & 0xff);
+    }
+
+    // 前のフレームから changed ピクセルを書き換える（0 なら同じ画像）
+    cv::Mat nextFrame(const cv::Mat &prev, int changed, std::mt19937 &rng)
+    {
+        cv::Mat img = prev.clone();
+        for (int i = 0; i < changed; ++i)
+            img.at<cv::Vec4b>(static_cast<int>(rng() % kHeight), static_cast<int>(rng() % kWidth)) = randomPixel(rng);
+        return img;
+    }
+
+    // path の全フレームが expected と同じに復元できるか（順番どおりと、カーソルでの飛び飛びのシーク）
+    void checkFrames(const std::string &path, const std::vector<cv::Mat> &expected, const std::vector<int64_t> &times)
+    {
+        HistoryReader reader;
+        CHECK(reader.open(path));
+        CHECK(reader.width() == kWidth && reader.height() == kHeight);
+        CHECK(reader.frames().size() == expected.size());
+        if (reader.frames().size() != expected.size())
+            return;
+        std::vector<uint8_t> state;
+        cv::Mat img;
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            CHECK(reader.frames()[i].timeMs == times[i]);
+            CHECK(reader.reconstruct(i, state));
+            reader.toBGRA(state, img);
+            CHECK(sameImage(img, expected[i]));
+        }
+
+        HistoryCursor cursor;
+        CHECK(cursor.open(path));
+        std::mt19937 rng(7);
+        for (int n = 0; n < 40; ++n)
+        {
+            size_t i = rng() % expected.size();
+            const std::vector<uint8_t> *s = cursor.seek(i);
+            CHECK(s != nullptr);
+            if (!s)
+                continue;
+            cursor.reader().toBGRA(*s, img);
+            CHECK(sameImage(img, expected[i]));
+        }
+    }
+
+    void testRoundTripAndTornTail(const std::string &dir)
+    {
+        const std::string path = dir + "roundtrip.wph";
+        std::mt19937 rng(1);
+        std::vector<cv::Mat> expected;
+        std::vector<int64_t> times;
+
+        cv::Mat img(kHeight, kWidth, CV_8UC4);
+        for (int y = 0; y < kHeight; ++y)
+            for (int x = 0; x < kWidth; ++x)
+                img.at<cv::Vec4b>(y, x) = randomPixel(rng);
+
+        bool sawKeyframe = false, sawDelta = false;
+        {
+            HistoryWriter writer;
+            CHECK(writer.open(path, kRegion, kWidth, kHeight));
+            for (int i = 0; i < 60; ++i)
+            {
+                // 小さな変化を続け、ときどき大きく変えてキーフレームを入れさせる。変化なしの周期も混ぜる
+                int changed = (i % 17 == 16) ? kWidth * kHeight : (i % 5 == 4) ? 0 : 1 + static_cast<int>(rng() % 20);
+                if (i > 0)
+                    img = nextFrame(img, changed, rng);
+                int written = writer.append(img, 1000 * (i + 1));
+                CHECK(written >= 0);
+                if (written > 0)
+                {
+                    expected.push_back(normalized(img));
+                    times.push_back(1000 * (i + 1));
+                }
+            }
+        }
+        {
+            HistoryReader reader;
+            CHECK(reader.open(path));
+            for (const HistoryFrameInfo &f : reader.frames())
+                (f.keyframe ? sawKeyframe : sawDelta) = true;
+        }
+        CHECK(sawKeyframe && sawDelta);
+        checkFrames(path, expected, times);
+
+        // 最後のレコードの途中で切る（書き込み中の異常終了）。切れたフレームだけがなくなる
+        uint64_t lastOffset = 0;
+        {
+            HistoryReader reader;
+            CHECK(reader.open(path));
+            lastOffset = reader.frames().back().offset;
+        }
+        const uint64_t size = std::filesystem::file_size(path);
+        std::filesystem::resize_file(path, size - 5);
+        expected.pop_back();
+        times.pop_back();
+        checkFrames(path, expected, times);
+
+        // レコードヘッダーの途中で切れていても同じ
+        std::filesystem::resize_file(path, lastOffset + sizeof(HistoryRecordHeader) / 2);
+        checkFrames(path, expected, times);
+
+        // 開き直すと書きかけを捨て、残っている最後のフレームからの差分として続きを書く
+        {
+            HistoryWriter writer;
+            CHECK(writer.open(path, kRegion, kWidth, kHeight));
+            CHECK(writer.fileBytes() == lastOffset);
+            cv::Mat resumed = expected.back().clone();
+            for (int i = 0; i < 5; ++i)
+            {
+                resumed = nextFrame(resumed, 3, rng);
+                int64_t t = 100000 + i * 1000;
+                int written = writer.append(resumed, t);
+                CHECK(written >= 0);
+                if (written > 0)
+                {
+                    expected.push_back(normalized(resumed));
+                    times.push_back(t);
+                }
+            }
+            // 同じ画像なら何も書かない
+            CHECK(writer.append(resumed, 200000) == 0);
+        }
+        CHECK(std::filesystem::file_size(path) > lastOffset);
+        checkFrames(path, expected, times);
+
+        // 監視領域の違うファイルには続けて書かない
+        HistoryWriter other;
+        CHECK(!other.open(path, HistoryRegion{0, 0, 0, 0}, kWidth, kHeight));
+    }
+
+    void testCorruptColorIndex(const std::string &dir)
+    {
+        const std::string path = dir + "corrupt.wph";
+        cv::Mat img(4, 4, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+        {
+            HistoryWriter writer;
+            CHECK(writer.open(path, kRegion, 4, 4));
+            CHECK(writer.append(img, 1000) > 0);
+        }
+        uint64_t payload = 0;
+        size_t colors = 0;
+        {
+            HistoryReader reader;
+            CHECK(reader.open(path));
+            CHECK(reader.frames().size() == 1 && reader.frames()[0].keyframe);
+            payload = reader.frames()[0].offset + sizeof(HistoryRecordHeader);
+            colors = reader.colors().size();
+        }
+        CHECK(colors < 250);
+
+        // 16 ピクセルがすべて同じ色のキーフレーム = {長さ 16, 色インデックス}。色インデックスを表の外にする
+        {
+            std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(static_cast<std::streamoff>(payload + 1));
+            char bad = static_cast<char>(250);
+            f.write(&bad, 1);
+        }
+        HistoryReader reader;
+        CHECK(reader.open(path));
+        std::vector<uint8_t> state;
+        CHECK(!reader.reconstruct(0, state));
+        HistoryCursor cursor;
+        CHECK(cursor.open(path));
+        CHECK(cursor.seek(0) == nullptr);
+        // 続きから書く側も復元に失敗して開かない（範囲外の色を引かない）
+        HistoryWriter writer;
+        CHECK(!writer.open(path, kRegion, 4, 4));
+    }
+}
+
+int main()
+{
+    const std::string dir = testDirectory("wpg_history_store_test");
+    testRoundTripAndTornTail(dir);
+    testCorruptColorIndex(dir);
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    return testResult();
+}
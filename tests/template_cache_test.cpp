@@ -0,0 +1,179 @@
+﻿// コンパイル済みテンプレート（template_cache）の読み込み
+//
+// 2回目からはコンパイル済みのファイルから読み、元の画像の大きさと更新時刻が同じなら元の画像を読まないこと、
+// 更新時刻だけ変わったらハッシュで内容を比べること、内容が変われば作り直すこと、
+// 壊れたヘッダー（大きすぎる区間数など）のファイルは使わずに作り直すことを確かめる。
+
+#include "palette.h"
+#include "template_cache.h"
+#include "test_common.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    constexpr int kWidth = 37;
+    constexpr int kHeight = 23;
+
+    // パレットの色と透明が混ざった画像。variant で色を変える
+    cv::Mat templateImage(int variant)
+    {
+        cv::Mat img(kHeight, kWidth, CV_8UC4);
+        for (int y = 0; y < kHeight; ++y)
+        {
+            uint32_t *row = img.ptr<uint32_t>(y);
+            for (int x = 0; x < kWidth; ++x)
+                row[x] = (x + y) % 5 == 0 ? 0u : wplacePaletteBGRA(1 + (x * 7 + y * 3 + variant) % (kWplacePaletteSize - 1));
+        }
+        return img;
+    }
+
+    bool sameImage(const cv::Mat &a, const cv::Mat &b)
+    {
+        if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type())
+            return false;
+        for (int y = 0; y < a.rows; ++y)
+        {
+            if (std::memcmp(a.ptr(y), b.ptr(y), static_cast<size_t>(a.cols) * a.elemSize()) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    void writePng(const std::string &path, const cv::Mat &img)
+    {
+        std::vector<uchar> png;
+        cv::imencode(".png", img, png);
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        ofs.write(reinterpret_cast<const char *>(png.data()), static_cast<std::streamsize>(png.size()));
+    }
+
+    TemplateFileHeader readHeader(const std::string &path)
+    {
+        TemplateFileHeader h;
+        std::ifstream ifs(path, std::ios::binary);
+        ifs.read(reinterpret_cast<char *>(&h), sizeof(h));
+        return h;
+    }
+
+    void writeHeader(const std::string &path, const TemplateFileHeader &h)
+    {
+        std::fstream fs(path, std::ios::binary | std::ios::in | std::ios::out);
+        fs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    }
+
+    void testCompileAndReuse(const std::string &dir)
+    {
+        const std::string path = dir + "template.png";
+        const HistoryRegion target{1818, 806, 120, 340};
+        const cv::Mat original = templateImage(0);
+        writePng(path, original);
+
+        LoadedTemplate first;
+        CHECK(loadTemplate(path, true, target, first));
+        CHECK(!first.fromCache);
+        CHECK(sameImage(first.bgra, original));
+        CHECK(first.spans > 0);
+        CHECK(std::filesystem::exists(compiledTemplatePath(path)));
+
+        LoadedTemplate second;
+        CHECK(loadTemplate(path, true, target, second));
+        CHECK(second.fromCache);
+        CHECK(sameImage(second.bgra, original));
+        CHECK(second.spans == first.spans);
+        CHECK(second.quantize.opaque == first.quantize.opaque);
+
+        // 監視領域だけ変わったらヘッダーのその部分だけ書き直す
+        const HistoryRegion moved{1819, 806, 0, 0};
+        LoadedTemplate third;
+        CHECK(loadTemplate(path, true, moved, third) && third.fromCache);
+        const TemplateFileHeader movedHeader = readHeader(compiledTemplatePath(path));
+        CHECK(std::memcmp(&movedHeader.target, &moved, sizeof(moved)) == 0);
+
+        // 大きさと更新時刻が同じなら元の画像は読まない（同じ大きさで中身を変えて更新時刻を戻しても古いまま）
+        const auto mtime = std::filesystem::last_write_time(path);
+        std::vector<char> bytes(std::filesystem::file_size(path), 0);
+        {
+            std::ifstream ifs(path, std::ios::binary);
+            ifs.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+        std::vector<char> garbage(bytes.size(), 'x');
+        {
+            std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+            ofs.write(garbage.data(), static_cast<std::streamsize>(garbage.size()));
+        }
+        std::filesystem::last_write_time(path, mtime);
+        LoadedTemplate untouched;
+        CHECK(loadTemplate(path, true, moved, untouched) && untouched.fromCache);
+        CHECK(sameImage(untouched.bgra, original));
+
+        // 更新時刻だけ変わったら内容を比べる。同じならそのまま使い、ヘッダーの更新時刻を書き直す
+        {
+            std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+            ofs.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+        std::filesystem::last_write_time(path, mtime + std::chrono::seconds(5));
+        LoadedTemplate touched;
+        CHECK(loadTemplate(path, true, moved, touched) && touched.fromCache);
+        CHECK(sameImage(touched.bgra, original));
+        const TemplateFileHeader h = readHeader(compiledTemplatePath(path));
+        CHECK(h.sourceMtime == static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count()));
+
+        // 内容が変わったら作り直す
+        const cv::Mat changed = templateImage(1);
+        writePng(path, changed);
+        std::filesystem::last_write_time(path, mtime + std::chrono::seconds(10));
+        LoadedTemplate rebuilt;
+        CHECK(loadTemplate(path, true, moved, rebuilt));
+        CHECK(!rebuilt.fromCache);
+        CHECK(sameImage(rebuilt.bgra, changed));
+        LoadedTemplate reused;
+        CHECK(loadTemplate(path, true, moved, reused) && reused.fromCache);
+        CHECK(sameImage(reused.bgra, changed));
+    }
+
+    // オフセットに大きな値を足すとあふれるヘッダーでも範囲外を読まずに作り直す
+    void testCorruptHeader(const std::string &dir)
+    {
+        const std::string path = dir + "corrupt.png";
+        const cv::Mat original = templateImage(2);
+        writePng(path, original);
+        LoadedTemplate loaded;
+        CHECK(loadTemplate(path, true, HistoryRegion(), loaded) && !loaded.fromCache);
+        const std::string compiled = compiledTemplatePath(path);
+        const TemplateFileHeader good = readHeader(compiled);
+
+        std::vector<TemplateFileHeader> corrupt(6, good);
+        corrupt[0].spanCount = UINT64_MAX / sizeof(TemplateSpan) + 2; // 掛けると小さな値になる
+        corrupt[1].spanOffset = UINT64_MAX - 8;                      // 足すと小さな値になる
+        corrupt[2].indexOffset = UINT64_MAX - 16;
+        corrupt[3].rowOffset = good.rowOffset + 2; // 境界にそろっていない
+        corrupt[4].height = INT32_MAX;
+        corrupt[5].spanCount = good.spanCount + 1;
+        for (const TemplateFileHeader &h : corrupt)
+        {
+            writeHeader(compiled, h);
+            LoadedTemplate reloaded;
+            CHECK(loadTemplate(path, true, HistoryRegion(), reloaded));
+            CHECK(!reloaded.fromCache);
+            CHECK(sameImage(reloaded.bgra, original));
+        }
+
+        // 減色しない設定ではコンパイル済みのファイルを使わない
+        LoadedTemplate plain;
+        CHECK(loadTemplate(path, false, HistoryRegion(), plain) && !plain.fromCache && plain.spans == 0);
+        CHECK(sameImage(plain.bgra, original));
+        CHECK(!loadTemplate(dir + "missing.png", true, HistoryRegion(), plain));
+    }
+}
+
+int main()
+{
+    const std::string dir = testDirectory("wpg_template_cache_test");
+    testCompileAndReuse(dir);
+    testCorruptHeader(dir);
+    return testResult();
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+// テスト用の確認マクロ。失敗しても続けて数え、main は testResult() を返す（ctest は 0 以外を失敗とする）
+
+inline int &testFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                 \
+    do                                                                              \
+    {                                                                               \
+        if (!(cond))                                                                \
+        {                                                                           \
+            std::printf("%s:%d: CHECK(%s) に失敗しました\n", __FILE__, __LINE__, #cond); \
+            testFailures()++;                                                       \
+        }                                                                           \
+    } while (0)
+
+inline int testResult()
+{
+    if (testFailures())
+        std::printf("%d 件の確認に失敗しました\n", testFailures());
+    return testFailures() ? 1 : 0;
+}
+
+// 一時ディレクトリの下にテスト用の空のディレクトリを作る（末尾の区切り文字付き）
+inline std::string testDirectory(const char *name)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / name;
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    std::filesystem::create_directories(dir, ec);
+    return (dir / "").string();
+}
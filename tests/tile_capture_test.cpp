@@ -0,0 +1,200 @@
+﻿// タイルの記録と再生（tile_capture）
+//
+// tests/data/three_cycles.wpc は3周期分の記録（監視領域はタイル (0,0) と (1,0) にまたがる）。
+//   周期1: (0,0) 200 "a0" / (1,0) 200 "b0"
+//   周期2: (0,0) 304 "a0" / (1,0) 200 "b1"
+//   周期3: (0,0) 304 "a0" / (1,0) 304 "b1"
+// 本体は PNG ではなく "tile-X-Y-vN" の文字列（再生はデコードしない）。
+// 記録した 304 が条件なしの要求では直前の 200 の本体で解決されること、末尾のレコードが途中で切れていても
+// 完全なレコードまでは再生できること、記録 API で書いたファイルが同じ応答を返すことを確かめる。
+
+#include "tile_capture.h"
+#include "test_common.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#ifndef WPG_TEST_DATA_DIR
+#define WPG_TEST_DATA_DIR "tests/data/"
+#endif
+
+namespace
+{
+    const std::string kFixture = std::string(WPG_TEST_DATA_DIR) + "three_cycles.wpc";
+    const CaptureRegion kRegion{0, 0, 990, 10, 20, 5, 1000, 0};
+
+    struct Expected
+    {
+        int tileX, tileY;
+        bool conditional;
+        long status;
+        const char *body;
+        const char *etag;
+        long downloaded;
+    };
+
+    bool replayMatches(const Expected &e)
+    {
+        cpr::Response r;
+        if (!replayTileResponse(e.tileX, e.tileY, e.conditional, r))
+            return false;
+        auto etag = r.header.find("ETag");
+        return r.status_code == e.status && r.text == e.body && etag != r.header.end() && etag->second == e.etag &&
+               r.downloaded_bytes == e.downloaded;
+    }
+
+    void truncatedCopy(const std::string &from, const std::string &to, size_t dropBytes)
+    {
+        std::ifstream ifs(from, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        bytes.resize(bytes.size() > dropBytes ? bytes.size() - dropBytes : 0);
+        std::ofstream ofs(to, std::ios::binary | std::ios::trunc);
+        ofs.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    void testInfo()
+    {
+        TileCaptureInfo info;
+        CHECK(readTileCaptureInfo(kFixture, info));
+        CHECK(info.cycles == 3);
+        CHECK(info.tiles == 6);
+        CHECK(info.firstMs == 1700000000000);
+        CHECK(info.lastMs == 1700000002045);
+        CHECK(info.region.pixelX == 990 && info.region.width == 20 && info.region.tileSize == 1000);
+        CHECK(!readTileCaptureInfo(std::string(WPG_TEST_DATA_DIR) + "missing.wpc", info));
+    }
+
+    // 最速で最後まで再生する。304 は条件なしなら直前の 200、条件付きならそのまま 304
+    void testReplay()
+    {
+        CHECK(startTileReplay({kFixture, 0.0, false}));
+        CHECK(tileReplayActive());
+
+        bool restart = false;
+        CHECK(replayCycleBegin(kRegion, restart));
+        CHECK(restart);
+        CHECK(replayMatches({0, 0, false, 200, "tile-0-0-v0", "\"a0\"", 11}));
+        CHECK(replayMatches({1, 0, false, 200, "tile-1-0-v0", "\"b0\"", 11}));
+        cpr::Response r;
+        CHECK(!replayTileResponse(2, 0, false, r)); // 記録にないタイル
+
+        CHECK(replayCycleBegin(kRegion, restart));
+        CHECK(!restart);
+        CHECK(replayMatches({0, 0, true, 304, "", "\"a0\"", 0}));
+        // 再生側のキャッシュが空なら、同じタイルの直前の 200 の本体で解決する
+        CHECK(replayMatches({0, 0, false, 200, "tile-0-0-v0", "\"a0\"", 0}));
+        CHECK(replayMatches({1, 0, false, 200, "tile-1-0-v1", "\"b1\"", 11}));
+
+        CHECK(replayCycleBegin(kRegion, restart));
+        // 直前の 200 は一番新しいもの（周期2の "b1"）
+        CHECK(replayMatches({1, 0, false, 200, "tile-1-0-v1", "\"b1\"", 0}));
+        CHECK(replayMatches({1, 0, true, 304, "", "\"b1\"", 0}));
+        CHECK(tileReplayProgress().cycle == 3);
+
+        // 最後まで再生したら止まり、進捗は残る
+        CHECK(!replayCycleBegin(kRegion, restart));
+        CHECK(!tileReplayActive());
+        TileReplayProgress progress = tileReplayProgress();
+        CHECK(progress.finished && progress.cycles == 3);
+        stopTileReplay();
+    }
+
+    // ループ再生は先頭に戻り、周回の最初の周期で restart を立てる
+    void testLoop()
+    {
+        CHECK(startTileReplay({kFixture, 0.0, true}));
+        bool restart = false;
+        int restarts = 0;
+        for (int i = 0; i < 7; ++i)
+        {
+            CHECK(replayCycleBegin(kRegion, restart));
+            restarts += restart;
+        }
+        CHECK(restarts == 3);
+        CHECK(replayMatches({0, 0, false, 200, "tile-0-0-v0", "\"a0\"", 11}));
+        stopTileReplay();
+        CHECK(!replayCycleBegin(kRegion, restart));
+    }
+
+    // 末尾のレコードが途中で切れたファイル（記録中に落ちた場合）は、完全なレコードまでを再生する
+    void testTruncated()
+    {
+        const std::string dir = testDirectory("wpg_tile_capture_test");
+        // 最後のタイルのレコードは 40 バイト（ヘッダー 32 + ETag 4 + 長さ 4）
+        for (size_t drop : {3, 36})
+        {
+            const std::string path = dir + "truncated.wpc";
+            truncatedCopy(kFixture, path, drop);
+            TileCaptureInfo info;
+            CHECK(readTileCaptureInfo(path, info));
+            CHECK(info.cycles == 3);
+            CHECK(info.tiles == 5);
+
+            CHECK(startTileReplay({path, 0.0, false}));
+            bool restart = false;
+            for (int i = 0; i < 3; ++i)
+                CHECK(replayCycleBegin(kRegion, restart));
+            CHECK(replayMatches({0, 0, false, 200, "tile-0-0-v0", "\"a0\"", 0}));
+            cpr::Response r;
+            CHECK(!replayTileResponse(1, 0, false, r));
+            CHECK(!replayCycleBegin(kRegion, restart));
+            stopTileReplay();
+        }
+
+        // ファイルヘッダーだけしかなければ周期がないので再生しない
+        const std::string headerOnly = dir + "header_only.wpc";
+        truncatedCopy(kFixture, headerOnly, std::filesystem::file_size(kFixture) - sizeof(CaptureFileHeader));
+        TileCaptureInfo info;
+        CHECK(readTileCaptureInfo(headerOnly, info));
+        CHECK(info.cycles == 0);
+        CHECK(!startTileReplay({headerOnly, 0.0, false}));
+        CHECK(!tileReplayActive());
+    }
+
+    // 記録 API で書いたファイルを再生すると同じ応答が返る
+    void testRecordRoundTrip()
+    {
+        const std::string path = testDirectory("wpg_tile_capture_record") + "captures/recorded.wpc";
+        CHECK(startTileCapture(path));
+        CHECK(captureCycleBegin(kRegion));
+        cpr::Response full;
+        full.status_code = 200;
+        full.text = std::string("body\0with-nul", 13);
+        full.header["ETag"] = "\"x1\"";
+        captureTileResponse(0, 0, full);
+        captureCycleEnd();
+        CHECK(!captureCycleBegin(kRegion)); // 2周期目からは false
+        cpr::Response notModified;
+        notModified.status_code = 304;
+        notModified.header["ETag"] = "\"x1\"";
+        captureTileResponse(0, 0, notModified);
+        captureCycleEnd();
+        TileCaptureStats stats = tileCaptureStats();
+        CHECK(stats.active && stats.cycles == 2 && stats.tiles == 2);
+        CHECK(stats.bytes == std::filesystem::file_size(path));
+        stopTileCapture();
+        CHECK(!tileCaptureStats().active);
+
+        CHECK(startTileReplay({path, 0.0, false}));
+        bool restart = false;
+        CHECK(replayCycleBegin(kRegion, restart));
+        cpr::Response r;
+        CHECK(replayTileResponse(0, 0, false, r) && r.status_code == 200 && r.text == full.text);
+        CHECK(replayCycleBegin(kRegion, restart));
+        CHECK(replayTileResponse(0, 0, false, r) && r.status_code == 200 && r.text == full.text);
+        CHECK(replayTileResponse(0, 0, true, r) && r.status_code == 304 && r.text.empty());
+        stopTileReplay();
+    }
+}
+
+int main()
+{
+    testInfo();
+    testReplay();
+    testLoop();
+    testTruncated();
+    testRecordRoundTrip();
+    return testResult();
+}
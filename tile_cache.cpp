@@ -0,0 +1,45 @@
+﻿#include "tile_cache.h"
+
+void TileCache::beginCycle()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &entry : entries_)
+        entry.second.used = false;
+}
+
+bool TileCache::lookup(const std::string &key, CachedTile &out)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+        return false;
+    it->second.used = true;
+    out = it->second.tile;
+    return true;
+}
+
+void TileCache::store(const std::string &key, CachedTile tile)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &entry = entries_[key];
+    entry.tile = std::move(tile);
+    entry.used = true;
+}
+
+void TileCache::endCycle()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        if (it->second.used)
+            ++it;
+        else
+            it = entries_.erase(it);
+    }
+}
+
+void TileCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <map>
+#include <mutex>
+#include <string>
+
+// ETag による条件付き取得のためのタイルキャッシュ
+//
+// 直近の取得で切り出しに使った部分だけを保持するので、メモリはテンプレート1枚分で済む。
+// ロックは引くとき・書き込むとき・周期の終わりの掃除のときだけ取り、タイルの通信の間は持たない。
+// part は書き込んだ後は変更しないので、lookup で写した Mat はロックの外で読んでよい。
+
+struct CachedTile
+{
+    std::string etag;
+    cv::Rect rect; // キャンバス座標での切り出し範囲
+    cv::Mat part;  // rect に対応するタイルの部分画像
+};
+
+class TileCache
+{
+public:
+    // 周期の始めに呼ぶ。この後 lookup・store しなかったタイルは endCycle で捨てる
+    void beginCycle();
+    // key のタイルがあれば out に写して true（画像は参照を共有するので写しても安い）
+    bool lookup(const std::string &key, CachedTile &out);
+    void store(const std::string &key, CachedTile tile);
+    // 今回使わなかったタイル（領域の移動で外れたもの）を捨てる
+    void endCycle();
+    void clear();
+
+private:
+    struct Entry
+    {
+        CachedTile tile;
+        bool used = false;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_; // キーは "base/tx/ty"
+};
@@ -0,0 +1,470 @@
+﻿#include "tile_capture.h"
+#include "image_pipeline.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    uint32_t paddedBytes(size_t bytes)
+    {
+        return static_cast<uint32_t>((bytes + 7) & ~size_t(7));
+    }
+
+    struct ScannedCycle
+    {
+        int64_t timeMs = 0;
+        CaptureRegion region;
+        size_t firstTile = 0;
+        size_t tileCount = 0;
+    };
+
+    struct ScannedTile
+    {
+        int32_t tileX = 0, tileY = 0;
+        int32_t status = 0;
+        int64_t timeMs = 0;
+        uint64_t etagOffset = 0;
+        uint32_t etagBytes = 0;
+        uint64_t bodyOffset = 0;
+        uint32_t bodyBytes = 0;
+        size_t fullTile = SIZE_MAX; // 304 のとき、同じタイルの直前の 200 のレコード
+    };
+
+    // 完全なレコードだけを読む（記録中のファイルの書きかけの末尾は無視する）
+    bool scanCapture(const MappedFile &file, std::vector<ScannedCycle> &cycles, std::vector<ScannedTile> &tiles)
+    {
+        cycles.clear();
+        tiles.clear();
+        std::map<std::pair<int32_t, int32_t>, size_t> lastFull; // タイルごとの直前の 200
+        if (file.size() < sizeof(CaptureFileHeader))
+            return false;
+        CaptureFileHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (header.magic != kCaptureMagic || header.version != kCaptureVersion || header.headerSize < sizeof(header))
+            return false;
+
+        uint64_t offset = header.headerSize;
+        while (offset + sizeof(CaptureRecordHeader) <= file.size())
+        {
+            CaptureRecordHeader rec;
+            std::memcpy(&rec, file.data() + offset, sizeof(rec));
+            const uint64_t payload = offset + sizeof(rec);
+            if (payload + rec.payloadBytes > file.size())
+                break;
+            if (rec.type == static_cast<uint32_t>(CaptureRecordType::Cycle))
+            {
+                if (rec.payloadBytes < sizeof(CaptureRegion))
+                    break;
+                ScannedCycle c;
+                c.timeMs = rec.timeMs;
+                std::memcpy(&c.region, file.data() + payload, sizeof(c.region));
+                c.firstTile = tiles.size();
+                cycles.push_back(c);
+            }
+            else if (rec.type == static_cast<uint32_t>(CaptureRecordType::Tile))
+            {
+                // 最初の Cycle より前のタイルはない（壊れたファイル）
+                if (cycles.empty() || static_cast<uint64_t>(rec.etagBytes) + 4 > rec.payloadBytes)
+                    break;
+                ScannedTile t;
+                t.tileX = rec.tileX;
+                t.tileY = rec.tileY;
+                t.status = rec.status;
+                t.timeMs = rec.timeMs;
+                t.etagOffset = payload;
+                t.etagBytes = rec.etagBytes;
+                std::memcpy(&t.bodyBytes, file.data() + payload + rec.etagBytes, 4);
+                t.bodyOffset = payload + rec.etagBytes + 4;
+                if (static_cast<uint64_t>(rec.etagBytes) + 4 + t.bodyBytes > rec.payloadBytes)
+                    break;
+                const auto key = std::make_pair(t.tileX, t.tileY);
+                if (t.status == 200 && t.bodyBytes > 0)
+                {
+                    lastFull[key] = tiles.size();
+                }
+                else if (t.status == 304)
+                {
+                    auto full = lastFull.find(key);
+                    if (full != lastFull.end())
+                        t.fullTile = full->second;
+                }
+                tiles.push_back(t);
+                cycles.back().tileCount++;
+            }
+            else
+            {
+                break;
+            }
+            offset = payload + rec.payloadBytes;
+        }
+        return true;
+    }
+
+    // 記録
+    std::mutex captureMutex;
+    std::FILE *captureFile = nullptr;
+    std::string capturePath;
+    std::atomic<bool> capturing{false};
+    uint64_t capturedCycles = 0, capturedTiles = 0, capturedBytes = 0;
+
+    bool writeRecord(const CaptureRecordHeader &rec, const void *a, size_t aBytes, const void *b, size_t bBytes, const void *c, size_t cBytes)
+    {
+        static const uint8_t zeros[8] = {};
+        const size_t pad = rec.payloadBytes - (aBytes + bBytes + cBytes);
+        if (std::fwrite(&rec, sizeof(rec), 1, captureFile) != 1)
+            return false;
+        if (aBytes && std::fwrite(a, 1, aBytes, captureFile) != aBytes)
+            return false;
+        if (bBytes && std::fwrite(b, 1, bBytes, captureFile) != bBytes)
+            return false;
+        if (cBytes && std::fwrite(c, 1, cBytes, captureFile) != cBytes)
+            return false;
+        if (pad && std::fwrite(zeros, 1, pad, captureFile) != pad)
+            return false;
+        capturedBytes += sizeof(rec) + rec.payloadBytes;
+        return true;
+    }
+
+    void failCapture()
+    {
+        std::cerr << "タイルの記録に失敗したので停止します: " << capturePath << std::endl;
+        std::fclose(captureFile);
+        captureFile = nullptr;
+        capturing = false;
+    }
+
+    // 再生
+    std::mutex replayMutex;
+    std::atomic<bool> replaying{false};
+    MappedFile replayFile;
+    TileReplayOptions replayOptions;
+    std::vector<ScannedCycle> replayCycles;
+    std::vector<ScannedTile> replayTiles;
+    size_t replayNext = 0;               // 次に始める周期
+    size_t replayCurrent = SIZE_MAX;     // 再生中の周期
+    bool replayFinished = false;
+    bool replayRegionWarned = false;
+    std::chrono::steady_clock::time_point replayAnchor; // 周回の最初の周期を始めた時刻
+    int64_t replayAnchorMs = 0;                         // その周期の記録時刻
+    std::chrono::steady_clock::time_point replayPassStart, replayPassEnd;
+    size_t replayPassCycles = 0;
+
+    std::chrono::steady_clock::time_point scheduledTime(int64_t timeMs)
+    {
+        const double offsetMs = static_cast<double>(timeMs - replayAnchorMs) / replayOptions.speed;
+        return replayAnchor + std::chrono::microseconds(static_cast<int64_t>(std::max(0.0, offsetMs) * 1000.0));
+    }
+
+    // 記録の時刻まで待つ。再生の停止か取得の中断で false
+    bool waitUntil(std::chrono::steady_clock::time_point t)
+    {
+        while (true)
+        {
+            if (!replaying || abort_fetch)
+                return false;
+            auto now = std::chrono::steady_clock::now();
+            if (now >= t)
+                return true;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(t - now, std::chrono::milliseconds(10)));
+        }
+    }
+
+    bool sameRegion(const CaptureRegion &a, const CaptureRegion &b)
+    {
+        return a.tileX == b.tileX && a.tileY == b.tileY && a.pixelX == b.pixelX && a.pixelY == b.pixelY &&
+               a.width == b.width && a.height == b.height && a.tileSize == b.tileSize;
+    }
+}
+
+bool readTileCaptureInfo(const std::string &path, TileCaptureInfo &info)
+{
+    info = TileCaptureInfo();
+    MappedFile file;
+    std::vector<ScannedCycle> cycles;
+    std::vector<ScannedTile> tiles;
+    if (!file.open(path) || !scanCapture(file, cycles, tiles))
+        return false;
+    info.cycles = cycles.size();
+    info.tiles = tiles.size();
+    if (!cycles.empty())
+    {
+        info.firstMs = cycles.front().timeMs;
+        info.lastMs = tiles.empty() ? cycles.back().timeMs : std::max(cycles.back().timeMs, tiles.back().timeMs);
+        info.region = cycles.front().region;
+    }
+    return true;
+}
+
+bool startTileCapture(const std::string &path)
+{
+    stopTileCapture();
+    std::error_code ec;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, ec);
+
+    std::lock_guard<std::mutex> lock(captureMutex);
+    captureFile = std::fopen(path.c_str(), "wb");
+    if (!captureFile)
+    {
+        std::cerr << "キャプチャファイルを作成できませんでした: " << path << std::endl;
+        return false;
+    }
+    // 大きな本体をまとめて書く
+    std::setvbuf(captureFile, nullptr, _IOFBF, 1 << 20);
+    CaptureFileHeader header;
+    header.createdMs = nowMs();
+    if (std::fwrite(&header, sizeof(header), 1, captureFile) != 1)
+    {
+        std::fclose(captureFile);
+        captureFile = nullptr;
+        return false;
+    }
+    capturePath = path;
+    capturedCycles = capturedTiles = 0;
+    capturedBytes = sizeof(header);
+    capturing = true;
+    return true;
+}
+
+void stopTileCapture()
+{
+    std::lock_guard<std::mutex> lock(captureMutex);
+    capturing = false;
+    if (captureFile)
+        std::fclose(captureFile);
+    captureFile = nullptr;
+}
+
+TileCaptureStats tileCaptureStats()
+{
+    std::lock_guard<std::mutex> lock(captureMutex);
+    TileCaptureStats s;
+    s.active = capturing;
+    s.path = capturePath;
+    s.cycles = capturedCycles;
+    s.tiles = capturedTiles;
+    s.bytes = capturedBytes;
+    return s;
+}
+
+bool captureCycleBegin(const CaptureRegion &region)
+{
+    // 再生した応答は記録しない
+    if (!capturing || replaying)
+        return false;
+    std::lock_guard<std::mutex> lock(captureMutex);
+    if (!captureFile)
+        return false;
+    CaptureRecordHeader rec;
+    rec.type = static_cast<uint32_t>(CaptureRecordType::Cycle);
+    rec.tileX = region.tileX;
+    rec.tileY = region.tileY;
+    rec.timeMs = nowMs();
+    rec.payloadBytes = sizeof(region);
+    if (!writeRecord(rec, &region, sizeof(region), nullptr, 0, nullptr, 0))
+    {
+        failCapture();
+        return false;
+    }
+    return ++capturedCycles == 1;
+}
+
+void captureTileResponse(int tileX, int tileY, const cpr::Response &response)
+{
+    if (!capturing || replaying)
+        return;
+    std::lock_guard<std::mutex> lock(captureMutex);
+    if (!captureFile || capturedCycles == 0)
+        return;
+    auto etag = response.header.find("ETag");
+    const std::string empty;
+    const std::string &etagValue = etag != response.header.end() ? etag->second : empty;
+    const uint32_t bodyBytes = static_cast<uint32_t>(response.text.size());
+
+    CaptureRecordHeader rec;
+    rec.type = static_cast<uint32_t>(CaptureRecordType::Tile);
+    rec.status = static_cast<int32_t>(response.status_code);
+    rec.tileX = tileX;
+    rec.tileY = tileY;
+    rec.timeMs = nowMs();
+    rec.etagBytes = static_cast<uint32_t>(etagValue.size());
+    rec.payloadBytes = paddedBytes(etagValue.size() + 4 + response.text.size());
+    if (!writeRecord(rec, etagValue.data(), etagValue.size(), &bodyBytes, 4, response.text.data(), response.text.size()))
+        return failCapture();
+    capturedTiles++;
+}
+
+void captureCycleEnd()
+{
+    if (!capturing)
+        return;
+    std::lock_guard<std::mutex> lock(captureMutex);
+    // 周期ごとにディスクへ送り、異常終了しても直前の周期までは再生できるようにする
+    if (captureFile && std::fflush(captureFile) != 0)
+        failCapture();
+}
+
+bool startTileReplay(const TileReplayOptions &options)
+{
+    stopTileReplay();
+    std::lock_guard<std::mutex> lock(replayMutex);
+    if (!replayFile.open(options.path) || !scanCapture(replayFile, replayCycles, replayTiles) || replayCycles.empty())
+    {
+        std::cerr << "キャプチャファイルを再生できませんでした: " << options.path << std::endl;
+        replayFile.close();
+        return false;
+    }
+    replayOptions = options;
+    replayOptions.speed = std::max(0.0, options.speed);
+    replayNext = 0;
+    replayCurrent = SIZE_MAX;
+    replayFinished = false;
+    replayRegionWarned = false;
+    replayPassCycles = 0;
+    replaying = true;
+    return true;
+}
+
+void stopTileReplay()
+{
+    // 待っている取得処理は replaying を見て抜ける
+    replaying = false;
+    std::lock_guard<std::mutex> lock(replayMutex);
+    replayFile.close();
+    replayCycles.clear();
+    replayTiles.clear();
+    replayCurrent = SIZE_MAX;
+    replayFinished = false;
+}
+
+bool tileReplayActive()
+{
+    return replaying;
+}
+
+TileReplayProgress tileReplayProgress()
+{
+    std::lock_guard<std::mutex> lock(replayMutex);
+    TileReplayProgress p;
+    p.active = replaying;
+    p.finished = replayFinished;
+    p.cycle = replayNext;
+    p.cycles = replayCycles.size();
+    if (replayCurrent < replayCycles.size())
+        p.region = replayCycles[replayCurrent].region;
+    auto end = replayFinished ? replayPassEnd : std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - replayPassStart).count();
+    if (replayPassCycles > 1 && elapsed > 0.0)
+        p.cyclesPerSec = static_cast<double>(replayPassCycles) / elapsed;
+    return p;
+}
+
+bool replayCycleBegin(const CaptureRegion &region, bool &restart)
+{
+    std::chrono::steady_clock::time_point target;
+    bool wait = false;
+    restart = false;
+    {
+        std::lock_guard<std::mutex> lock(replayMutex);
+        if (!replaying || replayCycles.empty())
+            return false;
+        if (replayNext >= replayCycles.size())
+        {
+            if (!replayOptions.loop)
+            {
+                // 以後は通常の取得に戻る（進捗は次の再生まで残す）
+                replayFinished = true;
+                replayCurrent = SIZE_MAX;
+                replayPassEnd = std::chrono::steady_clock::now();
+                replaying = false;
+                return false;
+            }
+            replayNext = 0;
+        }
+        const ScannedCycle &cycle = replayCycles[replayNext];
+        if (!sameRegion(cycle.region, region) && !replayRegionWarned)
+        {
+            std::cerr << "再生中の記録と監視領域が違います（記録: タイル " << cycle.region.tileX << "," << cycle.region.tileY
+                      << " 位置 " << cycle.region.pixelX << "," << cycle.region.pixelY << " 大きさ " << cycle.region.width << "x"
+                      << cycle.region.height << "）" << std::endl;
+            replayRegionWarned = true;
+        }
+        // 周回の始めに時刻の基準を取り直す
+        if (replayNext == 0)
+        {
+            replayAnchor = std::chrono::steady_clock::now();
+            replayAnchorMs = cycle.timeMs;
+            replayPassStart = replayAnchor;
+            replayPassCycles = 0;
+            restart = true;
+        }
+        if (replayOptions.speed > 0.0)
+        {
+            target = scheduledTime(cycle.timeMs);
+            wait = true;
+        }
+        replayCurrent = replayNext++;
+        replayPassCycles++;
+    }
+    return !wait || waitUntil(target);
+}
+
+bool replayTileResponse(int tileX, int tileY, bool conditional, cpr::Response &out)
+{
+    std::chrono::steady_clock::time_point target;
+    bool wait = false;
+    {
+        std::lock_guard<std::mutex> lock(replayMutex);
+        if (!replaying || replayCurrent >= replayCycles.size())
+            return false;
+        const ScannedCycle &cycle = replayCycles[replayCurrent];
+        const ScannedTile *tile = nullptr;
+        for (size_t i = cycle.firstTile; i < cycle.firstTile + cycle.tileCount; ++i)
+        {
+            if (replayTiles[i].tileX == tileX && replayTiles[i].tileY == tileY)
+            {
+                tile = &replayTiles[i];
+                break;
+            }
+        }
+        if (!tile)
+            return false;
+        // 再生側のキャッシュに前の本体がない 304 は、記録にある直前の本体で解決する
+        const ScannedTile *body = tile;
+        if (tile->status == 304 && !conditional)
+        {
+            if (tile->fullTile == SIZE_MAX)
+                return false;
+            body = &replayTiles[tile->fullTile];
+        }
+        out = cpr::Response{};
+        out.status_code = body->status;
+        out.text.assign(reinterpret_cast<const char *>(replayFile.data() + body->bodyOffset), body->bodyBytes);
+        out.downloaded_bytes = tile->bodyBytes;
+        if (body->etagBytes)
+            out.header["ETag"].assign(reinterpret_cast<const char *>(replayFile.data() + body->etagOffset), body->etagBytes);
+        if (replayOptions.speed > 0.0)
+        {
+            target = scheduledTime(tile->timeMs);
+            wait = true;
+        }
+    }
+    return !wait || waitUntil(target);
+}
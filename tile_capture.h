@@ -0,0 +1,120 @@
+﻿#pragma once
+
+#include <cpr/cpr.h>
+#include <cstdint>
+#include <string>
+
+// タイル応答の記録と再生
+//
+// 記録: fetch_tiles_and_crop_cpp が受け取ったタイルの応答（ステータス・ETag・本体）をそのまま時刻付きで追記する。
+// 再生: 記録した応答をネットワークの代わりに返し、デコード以降の処理（合成・マスク・差分…）を実際の通信内容で動かす。
+//   記録の最初の周期は ETag のキャッシュを空にして全タイルを条件なしで取るので、ファイルだけで再生できる。
+//   再生は専用の空のキャッシュから始め、記録された 304 はそのタイルの直前に記録された 200 の本体で解決する。
+// 元の間隔・早送り・待ちなし（最速）で再生できるので、通信なしで再現できる性能計測や不具合の再現に使う。
+//
+// ファイル = CaptureFileHeader + レコードの列（8 バイト境界）。
+//   Cycle : 1周期の開始。監視領域（タイル座標・タイル内の位置・大きさ）を持つ
+//   Tile  : タイル1枚の応答。ペイロードは ETag・本体の長さ（4 バイト）・本体
+// 記録・再生の開始と停止はUIスレッド、フックは更新スレッド（取得処理）から呼ぶ。
+
+constexpr uint32_t kCaptureMagic = 0x43475057; // "WPGC"
+constexpr uint32_t kCaptureVersion = 1;
+
+enum class CaptureRecordType : uint32_t
+{
+    Cycle = 1,
+    Tile = 2,
+};
+
+struct CaptureFileHeader
+{
+    uint32_t magic = kCaptureMagic;
+    uint32_t version = kCaptureVersion;
+    int64_t createdMs = 0;
+    uint32_t headerSize = sizeof(CaptureFileHeader);
+    uint32_t reserved[11] = {};
+};
+static_assert(sizeof(CaptureFileHeader) == 64, "CaptureFileHeader must stay 64 bytes");
+
+struct CaptureRecordHeader
+{
+    uint32_t type = 0;
+    int32_t status = 0;       // Tile: HTTPステータス（通信エラーは 0）
+    int32_t tileX = 0, tileY = 0;
+    int64_t timeMs = 0;       // UNIX 時刻（ミリ秒）。Cycle は周期の開始、Tile は応答を受け取った時刻
+    uint32_t etagBytes = 0;   // Cycle では 0
+    uint32_t payloadBytes = 0; // 8 バイト境界までの詰め物を含む
+};
+static_assert(sizeof(CaptureRecordHeader) == 32, "CaptureRecordHeader must stay 32 bytes");
+
+// 1周期の監視領域（Cycle レコードのペイロード）
+struct CaptureRegion
+{
+    int32_t tileX = 0, tileY = 0;
+    int32_t pixelX = 0, pixelY = 0;
+    int32_t width = 0, height = 0;
+    int32_t tileSize = 0;
+    int32_t reserved = 0;
+};
+static_assert(sizeof(CaptureRegion) == 32, "CaptureRegion must stay 32 bytes");
+
+struct TileCaptureInfo
+{
+    size_t cycles = 0;
+    size_t tiles = 0;
+    int64_t firstMs = 0, lastMs = 0;
+    CaptureRegion region; // 最初の周期の監視領域
+};
+
+struct TileCaptureStats
+{
+    bool active = false;
+    std::string path;
+    uint64_t cycles = 0;
+    uint64_t tiles = 0;
+    uint64_t bytes = 0;
+};
+
+struct TileReplayOptions
+{
+    std::string path;
+    double speed = 1.0; // 元の何倍速で再生するか。0 なら待たずに最速で流す
+    bool loop = false;  // 最後まで再生したら先頭に戻る
+};
+
+struct TileReplayProgress
+{
+    bool active = false;
+    bool finished = false; // 最後まで再生して止まった
+    size_t cycle = 0; // 再生した周期数（ループ中は周回ごとに 0 から）
+    size_t cycles = 0;
+    double cyclesPerSec = 0.0; // 直近の再生速度
+    CaptureRegion region;      // 再生中の周期の監視領域
+};
+
+// ファイルの概要を読む（記録中のファイルも読める）
+bool readTileCaptureInfo(const std::string &path, TileCaptureInfo &info);
+
+bool startTileCapture(const std::string &path);
+void stopTileCapture();
+TileCaptureStats tileCaptureStats();
+
+bool startTileReplay(const TileReplayOptions &options);
+void stopTileReplay();
+// 再生中（最後まで再生したら false に戻る）
+bool tileReplayActive();
+TileReplayProgress tileReplayProgress();
+
+// 以下は fetch_tiles_and_crop_cpp から呼ぶ
+// 記録中なら周期の開始・タイルの応答・周期の終わりを書く（記録していなければ何もしない）。
+// captureCycleBegin は記録の最初の周期なら true を返す（呼び出し側は ETag のキャッシュを空にする）
+bool captureCycleBegin(const CaptureRegion &region);
+void captureTileResponse(int tileX, int tileY, const cpr::Response &response);
+void captureCycleEnd();
+// 再生中の次の周期へ進む。元の時刻に合わせて待つ。最後まで再生したか中断されたら false。
+// 周回の最初の周期なら restart を true にする（呼び出し側は再生用のキャッシュを空にする）
+bool replayCycleBegin(const CaptureRegion &region, bool &restart);
+// 今の周期の記録から (tileX, tileY) の応答を返す。元の時刻に合わせて待つ。記録がなければ false。
+// conditional は呼び出し側が If-None-Match を付けたか。付けていないのに 304 が記録されていれば、
+// そのタイルの直前の 200 の本体を 200 として返す（それもなければ false）
+bool replayTileResponse(int tileX, int tileY, bool conditional, cpr::Response &out);
@@ -0,0 +1,398 @@
+﻿#include "tiled_texture.h"
+
+#include "imgui_internal.h" // RegisterUserTexture
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // タイルの内容のハッシュ（変化の検出だけに使う）
+    uint64_t hashRect(const cv::Mat &mat, const cv::Rect &rect)
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+        const size_t rowBytes = static_cast<size_t>(rect.width) * mat.elemSize();
+        for (int y = rect.y; y < rect.y + rect.height; ++y)
+        {
+            const uint8_t *p = mat.ptr<uint8_t>(y) + static_cast<size_t>(rect.x) * mat.elemSize();
+            size_t i = 0;
+            for (; i + 8 <= rowBytes; i += 8)
+            {
+                uint64_t w;
+                std::memcpy(&w, p + i, 8);
+                h = (h ^ w) * 0x100000001b3ull;
+                h ^= h >> 32;
+            }
+            for (; i < rowBytes; ++i)
+                h = (h ^ p[i]) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    // 作ったタイル（ImGui に登録中）と、破棄を要求してバックエンドが消すのを待っているタイル
+    std::vector<ImTextureData *> liveTextures;
+    std::vector<ImTextureData *> retiredTextures;
+    // タイルを描く前に呼ぶ描画コールバック（setDrawCallback）
+    ImDrawCallback drawCallback = nullptr;
+
+    ImTextureData *createTexture(int width, int height)
+    {
+        ImTextureData *tex = new ImTextureData();
+        tex->Create(ImTextureFormat_RGBA32, width, height);
+        tex->UseColors = true;
+        tex->UsedRect.w = static_cast<unsigned short>(width);
+        tex->UsedRect.h = static_cast<unsigned short>(height);
+        ImGui::RegisterUserTexture(tex);
+        liveTextures.push_back(tex);
+        return tex;
+    }
+
+    void destroyTexture(ImTextureData *tex)
+    {
+        ImGui::UnregisterUserTexture(tex);
+        delete tex;
+    }
+
+    // mat（BGRA か BGR）の rect をテクスチャの (dstX, dstY) に RGBA で書き込み、その範囲の転送を要求する
+    void writeRect(ImTextureData *tex, const cv::Mat &mat, const cv::Rect &rect, int dstX, int dstY)
+    {
+        // 転送が済んだら画素は手放しているので作り直す（書き込む範囲以外は転送しないので初期化しない）
+        if (!tex->Pixels)
+            tex->Pixels = static_cast<unsigned char *>(IM_ALLOC(tex->GetSizeInBytes()));
+        cv::Mat pixels(tex->Height, tex->Width, CV_8UC4, tex->Pixels);
+        cv::Mat dst = pixels(cv::Rect(dstX, dstY, rect.width, rect.height));
+        cv::cvtColor(mat(rect), dst, (mat.channels() == 3) ? cv::COLOR_BGR2RGBA : cv::COLOR_BGRA2RGBA);
+
+        // 作成前なら作成時に全体が送られる
+        if (tex->Status == ImTextureStatus_WantCreate)
+            return;
+        if (tex->Status != ImTextureStatus_WantUpdates)
+        {
+            tex->Updates.resize(0);
+            tex->UpdateRect.x = tex->UpdateRect.y = static_cast<unsigned short>(~0);
+            tex->UpdateRect.w = tex->UpdateRect.h = 0;
+        }
+        ImTextureRect update;
+        update.x = static_cast<unsigned short>(dstX);
+        update.y = static_cast<unsigned short>(dstY);
+        update.w = static_cast<unsigned short>(rect.width);
+        update.h = static_cast<unsigned short>(rect.height);
+        tex->Updates.push_back(update);
+        const int x0 = std::min<int>(tex->UpdateRect.x, update.x), y0 = std::min<int>(tex->UpdateRect.y, update.y);
+        const int x1 = std::max(tex->UpdateRect.x + tex->UpdateRect.w, update.x + update.w);
+        const int y1 = std::max(tex->UpdateRect.y + tex->UpdateRect.h, update.y + update.h);
+        tex->UpdateRect.x = static_cast<unsigned short>(x0);
+        tex->UpdateRect.y = static_cast<unsigned short>(y0);
+        tex->UpdateRect.w = static_cast<unsigned short>(x1 - x0);
+        tex->UpdateRect.h = static_cast<unsigned short>(y1 - y0);
+        tex->SetStatus(ImTextureStatus_WantUpdates);
+    }
+
+    // src の 2x2 を dst の1ピクセルにまとめる（dstRect は dst の座標。src の端は範囲内に丸める）
+    void reduce(const cv::Mat &src, cv::Mat &dst, const cv::Rect &dstRect, TextureLod lod)
+    {
+        cv::parallel_for_(cv::Range(dstRect.y, dstRect.y + dstRect.height), [&](const cv::Range &range)
+                          {
+            for (int y = range.start; y < range.end; ++y)
+            {
+                const cv::Vec4b *row0 = src.ptr<cv::Vec4b>(std::min(y * 2, src.rows - 1));
+                const cv::Vec4b *row1 = src.ptr<cv::Vec4b>(std::min(y * 2 + 1, src.rows - 1));
+                cv::Vec4b *out = dst.ptr<cv::Vec4b>(y);
+                for (int x = dstRect.x; x < dstRect.x + dstRect.width; ++x)
+                {
+                    const int x0 = std::min(x * 2, src.cols - 1);
+                    const int x1 = std::min(x * 2 + 1, src.cols - 1);
+                    const cv::Vec4b *px[4] = {&row0[x0], &row0[x1], &row1[x0], &row1[x1]};
+                    if (lod == TextureLod::AnyWrong || lod == TextureLod::MaxAlpha)
+                    {
+                        int best = 0, bestKey = -1;
+                        uint8_t alpha = 0;
+                        for (int i = 0; i < 4; ++i)
+                        {
+                            const cv::Vec4b &p = *px[i];
+                            alpha = std::max(alpha, p[3]);
+                            int key = !p[3] ? -1 : (lod == TextureLod::MaxAlpha) ? p[3] : p[0] + p[1] + p[2];
+                            if (key > bestKey)
+                            {
+                                bestKey = key;
+                                best = i;
+                            }
+                        }
+                        out[x] = *px[best];
+                        out[x][3] = alpha;
+                    }
+                    else
+                    {
+                        int sum[3] = {0, 0, 0}, alphaSum = 0;
+                        for (int i = 0; i < 4; ++i)
+                        {
+                            const cv::Vec4b &p = *px[i];
+                            for (int c = 0; c < 3; ++c)
+                                sum[c] += p[c] * p[3];
+                            alphaSum += p[3];
+                        }
+                        if (alphaSum == 0)
+                        {
+                            out[x] = cv::Vec4b(0, 0, 0, 0);
+                            continue;
+                        }
+                        for (int c = 0; c < 3; ++c)
+                            out[x][c] = static_cast<uint8_t>((sum[c] + alphaSum / 2) / alphaSum);
+                        out[x][3] = static_cast<uint8_t>((alphaSum + 2) / 4);
+                    }
+                }
+            } });
+    }
+
+    // 1つ上の段の rect を覆うこの段の範囲
+    cv::Rect halfRect(const cv::Rect &rect, int width, int height)
+    {
+        int x0 = rect.x / 2, y0 = rect.y / 2;
+        int x1 = std::min(width, (rect.x + rect.width + 1) / 2);
+        int y1 = std::min(height, (rect.y + rect.height + 1) / 2);
+        return cv::Rect(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+    }
+}
+
+void TiledTexture::createTiles(Level &level, const cv::Mat &image)
+{
+    level.width = image.cols;
+    level.height = image.rows;
+    level.cols = (level.width + kTileSize - 1) / kTileSize;
+    level.rows = (level.height + kTileSize - 1) / kTileSize;
+    level.tiles.resize(static_cast<size_t>(level.cols) * level.rows);
+    for (int ty = 0; ty < level.rows; ++ty)
+    {
+        for (int tx = 0; tx < level.cols; ++tx)
+        {
+            Tile &tile = level.tiles[static_cast<size_t>(ty) * level.cols + tx];
+            tile.rect = cv::Rect(tx * kTileSize, ty * kTileSize,
+                                 std::min(kTileSize, level.width - tx * kTileSize), std::min(kTileSize, level.height - ty * kTileSize));
+            tile.tex = createTexture(tile.rect.width, tile.rect.height);
+            writeRect(tile.tex, image, tile.rect, 0, 0);
+            tile.hash = hashRect(image, tile.rect);
+            uploaded_++;
+        }
+    }
+}
+
+void TiledTexture::create(const cv::Mat &mat)
+{
+    release();
+    if (mat.empty())
+        return;
+    levels_.emplace_back();
+    createTiles(levels_[0], mat);
+    if (lod_ == TextureLod::None || mat.type() != CV_8UC4)
+        return;
+    // 縮小段（1/2 ずつ、長い辺が kMinLevelSize 以下になるまで）
+    const cv::Mat *prev = &mat;
+    while (std::max(prev->cols, prev->rows) > kMinLevelSize)
+    {
+        Level level;
+        level.image = cv::Mat((prev->rows + 1) / 2, (prev->cols + 1) / 2, CV_8UC4);
+        reduce(*prev, level.image, cv::Rect(0, 0, level.image.cols, level.image.rows), lod_);
+        createTiles(level, level.image);
+        levels_.push_back(std::move(level));
+        prev = &levels_.back().image;
+    }
+}
+
+void TiledTexture::refreshLevel(size_t index, const cv::Mat &src, const cv::Rect &rect)
+{
+    Level &level = levels_[index];
+    reduce(src, level.image, rect, lod_);
+    // 変わった範囲に重なるタイルへ、その部分だけ転送する
+    for (Tile &tile : level.tiles)
+    {
+        cv::Rect part = tile.rect & rect;
+        if (part.width <= 0 || part.height <= 0)
+            continue;
+        writeRect(tile.tex, level.image, part, part.x - tile.rect.x, part.y - tile.rect.y);
+        uploaded_++;
+    }
+}
+
+void TiledTexture::upload(const cv::Mat &mat)
+{
+    if (mat.empty())
+        return;
+    if (levels_.empty() || mat.cols != levels_[0].width || mat.rows != levels_[0].height)
+    {
+        create(mat);
+        return;
+    }
+    uploaded_ = 0;
+    std::vector<cv::Rect> dirty;
+    for (Tile &tile : levels_[0].tiles)
+    {
+        uint64_t hash = hashRect(mat, tile.rect);
+        if (hash == tile.hash)
+            continue;
+        writeRect(tile.tex, mat, tile.rect, 0, 0);
+        tile.hash = hash;
+        uploaded_++;
+        dirty.push_back(tile.rect);
+    }
+    if (levels_.size() < 2 || dirty.empty())
+        return;
+
+    // 縮小段は原寸で変わったタイルの範囲だけ作り直す（1段目は渡された画像から）
+    for (size_t i = 1; i < levels_.size(); ++i)
+    {
+        const cv::Mat &src = (i == 1) ? mat : levels_[i - 1].image;
+        for (cv::Rect &rect : dirty)
+        {
+            rect = halfRect(rect, levels_[i].width, levels_[i].height);
+            refreshLevel(i, src, rect);
+        }
+    }
+}
+
+void TiledTexture::release()
+{
+    for (Level &level : levels_)
+    {
+        for (Tile &tile : level.tiles)
+        {
+            if (!tile.tex)
+                continue;
+            liveTextures.erase(std::find(liveTextures.begin(), liveTextures.end(), tile.tex));
+            // このフレームの描画で使っているかもしれないので、バックエンドに消させるのは次のフレームにする
+            // （作成前のものはこのフレームで作らせ、endFrame() で破棄を要求する）
+            if (tile.tex->Status == ImTextureStatus_OK || tile.tex->Status == ImTextureStatus_WantUpdates)
+            {
+                tile.tex->SetStatus(ImTextureStatus_WantDestroy);
+                tile.tex->UnusedFrames = 0;
+            }
+            retiredTextures.push_back(tile.tex);
+        }
+    }
+    levels_.clear();
+    uploaded_ = 0;
+}
+
+void TiledTexture::endFrame()
+{
+    for (ImTextureData *tex : liveTextures)
+    {
+        if (tex->Status == ImTextureStatus_OK && tex->Pixels)
+            tex->DestroyPixels();
+    }
+    for (size_t i = 0; i < retiredTextures.size();)
+    {
+        ImTextureData *tex = retiredTextures[i];
+        if (tex->Status == ImTextureStatus_Destroyed)
+        {
+            destroyTexture(tex);
+            retiredTextures[i] = retiredTextures.back();
+            retiredTextures.pop_back();
+            continue;
+        }
+        if (tex->Status == ImTextureStatus_OK)
+        {
+            tex->DestroyPixels();
+            tex->SetStatus(ImTextureStatus_WantDestroy);
+        }
+        tex->UnusedFrames++;
+        ++i;
+    }
+}
+
+void TiledTexture::shutdown()
+{
+    // バックエンドのテクスチャはバックエンドの終了で消えているので、登録を外して解放するだけ
+    for (ImTextureData *tex : retiredTextures)
+        destroyTexture(tex);
+    retiredTextures.clear();
+    for (ImTextureData *tex : liveTextures)
+        destroyTexture(tex);
+    liveTextures.clear();
+}
+
+void TiledTexture::setDrawCallback(ImDrawCallback callback)
+{
+    drawCallback = callback;
+}
+
+void TiledTexture::draw(ImDrawList *drawList, const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1, ImU32 tint) const
+{
+    drawTiles(drawList, pMin, pMax, uv0, uv1, tint, nullptr, nullptr);
+}
+
+void TiledTexture::drawPaired(const TiledTexture &other, ImDrawCallback bindOther, ImDrawList *drawList,
+                              const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1, ImU32 tint) const
+{
+    // 大きさか段の数が違うとタイルが対応しないので、組にせずに描く
+    if (other.levels_.size() != levels_.size() || other.width() != width() || other.height() != height())
+    {
+        draw(drawList, pMin, pMax, uv0, uv1, tint);
+        return;
+    }
+    drawTiles(drawList, pMin, pMax, uv0, uv1, tint, &other, bindOther);
+}
+
+void TiledTexture::drawTiles(ImDrawList *drawList, const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1, ImU32 tint,
+                             const TiledTexture *other, ImDrawCallback bindOther) const
+{
+    if (levels_.empty() || uv1.x <= uv0.x || uv1.y <= uv0.y || pMax.x <= pMin.x || pMax.y <= pMin.y)
+        return;
+
+    // 画面1ピクセルあたりの原寸のピクセル数から段を選ぶ（1以下なら原寸）
+    const float imagePerScreen = std::max((uv1.x - uv0.x) * levels_[0].width / (pMax.x - pMin.x),
+                                          (uv1.y - uv0.y) * levels_[0].height / (pMax.y - pMin.y));
+    int index = 0;
+    if (imagePerScreen > 1.0f)
+        index = std::min(static_cast<int>(levels_.size()) - 1, static_cast<int>(std::floor(std::log2(imagePerScreen))));
+    const Level &level = levels_[index];
+    const float scale = 1.0f / static_cast<float>(1 << index);
+
+    // 表示範囲（その段のピクセル座標）と重なるタイルだけ
+    const float viewX0 = uv0.x * levels_[0].width * scale, viewX1 = uv1.x * levels_[0].width * scale;
+    const float viewY0 = uv0.y * levels_[0].height * scale, viewY1 = uv1.y * levels_[0].height * scale;
+    const int tx0 = std::max(0, static_cast<int>(viewX0) / kTileSize);
+    const int tx1 = std::min(level.cols - 1, static_cast<int>(viewX1) / kTileSize);
+    const int ty0 = std::max(0, static_cast<int>(viewY0) / kTileSize);
+    const int ty1 = std::min(level.rows - 1, static_cast<int>(viewY1) / kTileSize);
+    const float scaleX = (pMax.x - pMin.x) / (viewX1 - viewX0);
+    const float scaleY = (pMax.y - pMin.y) / (viewY1 - viewY0);
+
+    bool callbackAdded = false;
+    for (int ty = ty0; ty <= ty1; ++ty)
+    {
+        for (int tx = tx0; tx <= tx1; ++tx)
+        {
+            const Tile &tile = level.tiles[static_cast<size_t>(ty) * level.cols + tx];
+            const float x0 = std::max(viewX0, static_cast<float>(tile.rect.x));
+            const float x1 = std::min(viewX1, static_cast<float>(tile.rect.x + tile.rect.width));
+            const float y0 = std::max(viewY0, static_cast<float>(tile.rect.y));
+            const float y1 = std::min(viewY1, static_cast<float>(tile.rect.y + tile.rect.height));
+            if (x1 <= x0 || y1 <= y0)
+                continue;
+            ImVec2 screen0(pMin.x + (x0 - viewX0) * scaleX, pMin.y + (y0 - viewY0) * scaleY);
+            ImVec2 screen1(pMin.x + (x1 - viewX0) * scaleX, pMin.y + (y1 - viewY0) * scaleY);
+            ImVec2 tileUV0((x0 - tile.rect.x) / tile.rect.width, (y0 - tile.rect.y) / tile.rect.height);
+            ImVec2 tileUV1((x1 - tile.rect.x) / tile.rect.width, (y1 - tile.rect.y) / tile.rect.height);
+            if (!callbackAdded && drawCallback)
+            {
+                drawList->AddCallback(drawCallback, nullptr);
+                callbackAdded = true;
+            }
+            if (other)
+            {
+                // テクスチャの ID は描画の直前にバックエンドが作るまで決まらないので、ImTextureData を渡す
+                ImTextureData *otherTex = other->levels_[index].tiles[static_cast<size_t>(ty) * level.cols + tx].tex;
+                drawList->AddCallback(bindOther, &otherTex, sizeof(otherTex));
+            }
+            drawList->AddImage(tile.tex->GetTexRef(), screen0, screen1, tileUV0, tileUV1, tint);
+        }
+    }
+    if (callbackAdded)
+        drawList->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+}
+
+void TiledTexture::image(const ImVec2 &size, const ImVec2 &uv0, const ImVec2 &uv1) const
+{
+    ImGui::Dummy(size);
+    draw(ImGui::GetWindowDrawList(), ImGui::GetItemRectMin(), ImGui::GetItemRectMax(), uv0, uv1);
+}
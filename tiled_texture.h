@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "imgui.h"
+#include <cstdint>
+#include <vector>
+
+// 縮小表示用の段（ミップマップ）の作り方
+enum class TextureLod
+{
+    None,     // 縮小段を持たない（常に原寸のタイルを描く）
+    Box,      // 2x2 の平均（アルファで重み付け）
+    AnyWrong, // 2x2 のうち最も目立つ（RGB の和が大きい）ピクセルを残す。差分画像で1ピクセルの間違いも消えないように
+    MaxAlpha, // 2x2 のうち最も不透明なピクセルを残す。ヒートマップ（回数が多いほど不透明）で多い所が消えないように
+};
+
+// 大きな画像を固定サイズのタイルに分けて持つテクスチャ
+//
+// 1枚のテクスチャは GL_MAX_TEXTURE_SIZE を超えると作れず、小さな変化でも全体を転送し直すことになる。
+// kTileSize 四方のテクスチャに分け、転送ではタイルごとの内容のハッシュを比べて変わったタイルだけ送る。
+// 描画では uv の範囲（画像全体を 0〜1 とした座標）に重なるタイルだけを描く。
+//
+// タイルは ImGui が管理するテクスチャ（ImTextureData）で、作成・部分更新・破棄は要求を出すだけにして、
+// レンダラーのバックエンドが描画の前にまとめて行う（ImGuiBackendFlags_RendererHasTextures が必要）。
+// 書き込んだ画素は転送が済むまでタイルが持ち、endFrame() で手放す。
+//
+// 縮小段を持つ場合は 1/2, 1/4, ... の画像もタイルで持ち、画面1ピクセルあたりの画像のピクセル数に合った段を
+// 1つだけ描く（拡大率 1 以上では原寸）。縮小段は原寸で変わったタイルの範囲だけ作り直して転送する。
+// UIスレッド（GLコンテキストのあるスレッド）からだけ使う。
+class TiledTexture
+{
+public:
+    static constexpr int kTileSize = 1024;
+    // これより小さくなるまで縮小段を作る
+    static constexpr int kMinLevelSize = 64;
+
+    explicit TiledTexture(TextureLod lod = TextureLod::None) : lod_(lod) {}
+    ~TiledTexture() { release(); }
+    TiledTexture(const TiledTexture &) = delete;
+    TiledTexture &operator=(const TiledTexture &) = delete;
+
+    // 画像の大きさでタイルを作り直して全体を転送する
+    void create(const cv::Mat &mat);
+    // 同じ大きさの画像を転送する（変わったタイルだけ）。大きさが違えば作り直す
+    void upload(const cv::Mat &mat);
+    void release();
+
+    bool empty() const { return levels_.empty(); }
+    int width() const { return levels_.empty() ? 0 : levels_[0].width; }
+    int height() const { return levels_.empty() ? 0 : levels_[0].height; }
+    int levels() const { return static_cast<int>(levels_.size()); }
+    // 直前の upload で転送したタイル数（縮小段を含む）
+    int uploadedTiles() const { return uploaded_; }
+
+    // 毎フレーム描画（RenderDrawData）の後に呼ぶ。転送の済んだタイルの画素を手放し、破棄の済んだタイルを解放する
+    static void endFrame();
+    // 終了時、バックエンドの終了（ImGui_ImplOpenGL3_Shutdown）の後、ImGui::DestroyContext の前に呼ぶ
+    static void shutdown();
+    // タイルを描く前に描画リストに積むコールバック（レンダラーに合わせた最近傍のサンプラーの設定など）。
+    // 積んだら描き終わりに ImDrawCallback_ResetRenderState で戻す。nullptr ならバックエンドの既定の補間で描く
+    static void setDrawCallback(ImDrawCallback callback);
+
+    // uv0〜uv1 の範囲を画面の pMin〜pMax に描く
+    void draw(ImDrawList *drawList, const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1,
+              ImU32 tint = IM_COL32_WHITE) const;
+    // draw と同じだが、タイルごとに other の同じ位置のタイル（ImTextureData *）を渡して bindOther を呼んでから描く
+    // （描画コールバックで切り替えたシェーダーに2枚目のテクスチャを渡すため）
+    void drawPaired(const TiledTexture &other, ImDrawCallback bindOther, ImDrawList *drawList,
+                    const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1, ImU32 tint = IM_COL32_WHITE) const;
+    // ImGui::Image の代わり（同じ大きさの項目を置いて描く）
+    void image(const ImVec2 &size, const ImVec2 &uv0, const ImVec2 &uv1) const;
+
+private:
+    struct Tile
+    {
+        ImTextureData *tex = nullptr;
+        cv::Rect rect;     // その段の画像の中の位置
+        uint64_t hash = 0; // 最後に転送した内容（原寸の段だけ使う）
+    };
+
+    struct Level
+    {
+        int width = 0, height = 0;
+        int cols = 0, rows = 0;
+        std::vector<Tile> tiles;
+        cv::Mat image; // 縮小した画像（原寸の段は持たず、渡された画像を使う）
+    };
+
+    void createTiles(Level &level, const cv::Mat &image);
+    void drawTiles(ImDrawList *drawList, const ImVec2 &pMin, const ImVec2 &pMax, const ImVec2 &uv0, const ImVec2 &uv1, ImU32 tint,
+                   const TiledTexture *other, ImDrawCallback bindOther) const;
+    // 段 index の rect（その段の座標）を1つ上の段の画像 src から作り直して転送する
+    void refreshLevel(size_t index, const cv::Mat &src, const cv::Rect &rect);
+
+    TextureLod lod_;
+    std::vector<Level> levels_;
+    int uploaded_ = 0;
+};
@@ -0,0 +1,231 @@
+﻿#include "timelapse_export.h"
+#include "history_store.h"
+#include "trace.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    // 透明（未塗装）部分の背景色
+    const cv::Vec3b kBackground(255, 255, 255);
+
+    int fourccFor(const std::string &path)
+    {
+        std::string ext = path.substr(path.find_last_of('.') + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        if (ext == "avi")
+            return cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+        return cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+    }
+
+    void composeOnBackground(const cv::Mat &bgra, cv::Mat &bgr)
+    {
+        bgr.create(bgra.rows, bgra.cols, CV_8UC3);
+        for (int y = 0; y < bgra.rows; ++y)
+        {
+            const cv::Vec4b *src = bgra.ptr<cv::Vec4b>(y);
+            cv::Vec3b *dst = bgr.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < bgra.cols; ++x)
+                dst[x] = src[x][3] ? cv::Vec3b(src[x][0], src[x][1], src[x][2]) : kBackground;
+        }
+    }
+}
+
+int timelapseMaxScale(int width, int height)
+{
+    return std::max(1, kTimelapseMaxSide / std::max({width, height, 1}));
+}
+
+double timelapseFrameCount(int64_t startMs, int64_t endMs, double speedup, double fps)
+{
+    // 出力1フレームあたりの実時間
+    const double stepMs = speedup * 1000.0 / fps;
+    return std::floor(static_cast<double>(std::max<int64_t>(endMs - startMs, 0)) / stepMs) + 1.0;
+}
+
+bool TimelapseExporter::start(const TimelapseOptions &options)
+{
+    if (running_)
+        return false;
+    if (thread_.joinable())
+        thread_.join();
+
+    cancel_ = false;
+    finished_ = false;
+    framesWritten_ = 0;
+    framesTotal_ = 0;
+    framesPerSec_ = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        error_.clear();
+    }
+    running_ = true;
+    thread_ = std::thread(&TimelapseExporter::run, this, options);
+    return true;
+}
+
+void TimelapseExporter::cancel()
+{
+    // 中止はフレームの間でしか確認しないので、UIスレッドでは待たない
+    cancel_ = true;
+}
+
+void TimelapseExporter::wait()
+{
+    if (thread_.joinable())
+        thread_.join();
+}
+
+TimelapseProgress TimelapseExporter::progress()
+{
+    // 終わったスレッドを回収する（running_ は run の最後に下ろすので、すぐに戻る）
+    if (!running_ && thread_.joinable())
+        thread_.join();
+
+    TimelapseProgress p;
+    p.running = running_;
+    p.finished = finished_;
+    p.cancelling = running_ && cancel_;
+    p.framesWritten = framesWritten_;
+    p.framesTotal = framesTotal_;
+    p.framesPerSec = framesPerSec_;
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    p.error = error_;
+    return p;
+}
+
+void TimelapseExporter::fail(const std::string &message)
+{
+    std::cerr << message << std::endl;
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    error_ = message;
+}
+
+void TimelapseExporter::run(TimelapseOptions options)
+{
+    traceSetThreadName("timelapse");
+
+    HistoryReader reader;
+    if (!reader.open(options.historyPath) || reader.frames().empty())
+    {
+        fail("履歴を開けませんでした: " + options.historyPath);
+        running_ = false;
+        return;
+    }
+    if (options.fps <= 0.0 || options.speedup <= 0.0)
+    {
+        fail("倍速とフレームレートは正の値を指定してください");
+        running_ = false;
+        return;
+    }
+
+    const std::vector<HistoryFrameInfo> &frames = reader.frames();
+    const size_t last = std::min(options.lastFrame, frames.size() - 1);
+    const size_t first = std::min(options.firstFrame, last);
+    const int64_t startMs = frames[first].timeMs;
+    const int64_t endMs = frames[last].timeMs;
+    // 出力1フレームあたりの実時間
+    const double stepMs = options.speedup * 1000.0 / options.fps;
+    const double frameCount = timelapseFrameCount(startMs, endMs, options.speedup, options.fps);
+    if (!(frameCount <= static_cast<double>(kTimelapseMaxFrames)))
+    {
+        fail("出力フレーム数が上限（" + std::to_string(kTimelapseMaxFrames) + "）を超えます。倍速を上げるか範囲を狭めてください");
+        running_ = false;
+        return;
+    }
+    framesTotal_ = static_cast<size_t>(frameCount);
+
+    const int scale = std::clamp(options.scale, 1, timelapseMaxScale(reader.width(), reader.height()));
+    if (scale < options.scale)
+        std::cerr << "タイムラプスの拡大率を " << options.scale << " から " << scale << " に下げました（1辺 " << kTimelapseMaxSide << " ピクセルまで）" << std::endl;
+    const cv::Size outSize(reader.width() * scale, reader.height() * scale);
+
+    cv::VideoWriter writer;
+    if (options.imageSequence)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(options.outputPath, ec);
+    }
+    else if (!writer.open(options.outputPath, fourccFor(options.outputPath), options.fps, outSize, true))
+    {
+        fail("動画ファイルを作成できませんでした: " + options.outputPath);
+        running_ = false;
+        return;
+    }
+
+    // 範囲の先頭まで進める（直前のキーフレームから）
+    std::vector<uint8_t> state;
+    size_t next = reader.keyframeBefore(first);
+    for (; next <= first; ++next)
+    {
+        if (!reader.applyFrame(next, state))
+        {
+            fail("履歴の復元に失敗しました: " + options.historyPath);
+            running_ = false;
+            return;
+        }
+    }
+
+    cv::Mat bgra, out, scaled;
+    const auto started = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < framesTotal_ && !cancel_; ++k)
+    {
+        const double t = startMs + k * stepMs;
+        while (next <= last && frames[next].timeMs <= t)
+        {
+            if (!reader.applyFrame(next++, state))
+            {
+                fail("履歴の復元に失敗しました: " + options.historyPath);
+                running_ = false;
+                return;
+            }
+        }
+
+        reader.toBGRA(state, bgra);
+        if (options.imageSequence)
+            out = bgra; // PNG は透明をそのまま残す
+        else
+            composeOnBackground(bgra, out);
+        if (scale > 1)
+        {
+            cv::resize(out, scaled, outSize, 0, 0, cv::INTER_NEAREST);
+            out = scaled;
+        }
+
+        if (options.imageSequence)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%06zu.png", k);
+            if (!cv::imwrite((std::filesystem::path(options.outputPath) / name).string(), out))
+            {
+                fail("画像を書き出せませんでした: " + options.outputPath);
+                running_ = false;
+                return;
+            }
+        }
+        else
+        {
+            writer.write(out);
+        }
+
+        framesWritten_ = k + 1;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (elapsed > 0.0)
+            framesPerSec_ = (k + 1) / elapsed;
+    }
+
+    writer.release();
+    finished_ = !cancel_;
+    if (finished_)
+        std::cout << "タイムラプスを書き出しました: " << options.outputPath << " (" << framesWritten_ << " フレーム)" << std::endl;
+    running_ = false;
+}
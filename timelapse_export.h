@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// 記録済みの履歴からタイムラプス動画（または連番PNG）を書き出す
+//
+// 履歴を先頭から順に再生しながら1フレームずつ書き出すので、メモリ使用量は出力フレーム数によらず一定。
+// 処理は専用スレッドで行い、進捗は progress() で読む。
+
+// 出力の1辺の上限（ピクセル）。動画エンコーダーが扱える大きさとメモリに収まるよう、拡大率はこれを超えない範囲に抑える
+constexpr int kTimelapseMaxSide = 8000;
+
+// width x height の履歴を書き出すときの拡大率の上限（1 より小さくはしない）
+int timelapseMaxScale(int width, int height);
+
+// 出力フレーム数の上限（30fps で約55分）。長い履歴を小さな倍速で書き出すと際限なく増えるので、超える指定は書き出さない
+constexpr size_t kTimelapseMaxFrames = 100000;
+
+// startMs〜endMs を speedup 倍速・fps で書き出すときの出力フレーム数。
+// 時刻が逆転している（時計の巻き戻し）範囲は長さ 0 として 1 フレーム。上限を超えうるので double で返す
+double timelapseFrameCount(int64_t startMs, int64_t endMs, double speedup, double fps);
+
+struct TimelapseOptions
+{
+    std::string historyPath;
+    std::string outputPath;      // 動画ファイル（.avi は MJPG, それ以外は mp4v）、連番の場合は出力先フォルダ
+    bool imageSequence = false;  // true なら outputPath/frame_000000.png ... に書き出す
+    double speedup = 3600.0;     // 実時間の何倍速で再生するか
+    double fps = 30.0;
+    int scale = 1;               // 拡大率（最近傍）。timelapseMaxScale を超える値はそこまで下げる
+    size_t firstFrame = 0;       // 書き出す履歴フレームの範囲
+    size_t lastFrame = SIZE_MAX;
+};
+
+struct TimelapseProgress
+{
+    bool running = false;
+    bool finished = false;   // 最後まで書き出した
+    bool cancelling = false; // 中止を要求し、書き出し中のフレームが終わるのを待っている
+    size_t framesWritten = 0;
+    size_t framesTotal = 0;
+    double framesPerSec = 0.0; // 書き出しの処理速度
+    std::string error;
+};
+
+class TimelapseExporter
+{
+public:
+    TimelapseExporter() = default;
+    ~TimelapseExporter()
+    {
+        cancel();
+        wait();
+    }
+    TimelapseExporter(const TimelapseExporter &) = delete;
+    TimelapseExporter &operator=(const TimelapseExporter &) = delete;
+
+    // 書き出し中なら false
+    bool start(const TimelapseOptions &options);
+    // 中止を要求する（終了は待たない。終わったスレッドは progress か start で回収する）
+    void cancel();
+    // 書き出しの終了を待つ（アプリの終了時に使う）
+    void wait();
+
+    bool running() const { return running_; }
+    TimelapseProgress progress();
+
+private:
+    void run(TimelapseOptions options);
+    void fail(const std::string &message);
+
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> cancel_{false};
+    std::atomic<bool> finished_{false};
+    std::atomic<size_t> framesWritten_{0};
+    std::atomic<size_t> framesTotal_{0};
+    std::atomic<double> framesPerSec_{0.0};
+    mutable std::mutex errorMutex_;
+    std::string error_;
+};
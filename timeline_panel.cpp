@@ -0,0 +1,436 @@
+﻿#include "timeline_panel.h"
+#include "history_store.h"
+#include "timelapse_export.h"
+#include "trace.h"
+
+#include "imgui.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    struct SeekRequest
+    {
+        std::string path;
+        size_t frame = 0;
+        cv::Mat templ; // 要求時点のテンプレート（UI側の差し替えと競合しないよう参照を持つ）
+    };
+
+    // シーク用スレッドとのやり取り（seekMutex で保護）
+    std::mutex seekMutex;
+    std::condition_variable seekCv;
+    std::thread seekThread;
+    bool seekStop = false;
+    bool hasRequest = false;
+    SeekRequest request;
+    bool hasResult = false;
+    TimelineFrame result;
+    double lastSeekMs = 0.0;
+
+    // UIスレッド側の状態（フレーム一覧は専用のリーダーで読む）
+    HistoryReader frameIndex;
+    std::string indexPath;
+    double lastRefresh = -1.0;
+    bool live = true;
+    int selected = 0;
+    size_t requestedFrame = SIZE_MAX;
+    const void *requestedTemplate = nullptr;
+    char jumpBuffer[32] = {0};
+
+    // タイムラプス書き出しの設定
+    TimelapseExporter exporter;
+    char exportPathBuffer[512] = {0};
+    std::string exportPathFor; // exportPathBuffer の既定値を作った履歴ファイル
+    bool exportSequence = false;
+    float exportSpeedup = 3600.0f;
+    int exportFps = 30;
+    int exportScale = 1;
+    int exportFirst = 0;
+    int exportLast = -1; // -1 は最新まで
+
+    void formatTime(int64_t timeMs, char *buf, size_t size)
+    {
+        std::time_t t = static_cast<std::time_t>(timeMs / 1000);
+        std::tm *tm = std::localtime(&t);
+        if (!tm || !std::strftime(buf, size, "%Y-%m-%d %H:%M:%S", tm))
+            std::snprintf(buf, size, "%lld", static_cast<long long>(timeMs));
+    }
+
+    bool parseTime(const char *text, int64_t &timeMs)
+    {
+        std::tm tm{};
+        int n = std::sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+        if (n < 3)
+            return false;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        std::time_t t = std::mktime(&tm);
+        if (t == static_cast<std::time_t>(-1))
+            return false;
+        timeMs = static_cast<int64_t>(t) * 1000;
+        return true;
+    }
+
+    // 色インデックスからリアルタイム画像と差分画像を1パスで作る（imageDifferenceSafe と同じ結果）
+    void renderFrame(const std::vector<uint8_t> &state, const HistoryReader &reader, const cv::Mat &templ, TimelineFrame &out)
+    {
+        const int w = reader.width();
+        const int h = reader.height();
+        uint32_t lut[256] = {};
+        for (size_t i = 0; i < reader.colors().size() && i < 256; ++i)
+            lut[i] = reader.colors()[i];
+
+        out.realtime.create(h, w, CV_8UC4);
+        out.changed = 0;
+        out.opaque = 0;
+        const bool withDiff = !templ.empty() && templ.type() == CV_8UC4 && templ.cols == w && templ.rows == h;
+        if (withDiff)
+            out.diff.create(h, w, CV_8UC4);
+        else
+            out.diff = cv::Mat(h, w, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+
+        // 4k テンプレートでもシークが数十msに収まるよう行単位で並列化する
+        std::atomic<int> opaque{0}, changed{0};
+        cv::parallel_for_(cv::Range(0, h), [&](const cv::Range &rows)
+                          {
+            int rowOpaque = 0, rowChanged = 0;
+            for (int y = rows.start; y < rows.end; ++y)
+            {
+                const uint8_t *src = state.data() + static_cast<size_t>(y) * w;
+                uint32_t *rt = out.realtime.ptr<uint32_t>(y);
+                if (!withDiff)
+                {
+                    for (int x = 0; x < w; ++x)
+                        rt[x] = lut[src[x]];
+                    continue;
+                }
+                const cv::Vec4b *tp = templ.ptr<cv::Vec4b>(y);
+                cv::Vec4b *dp = out.diff.ptr<cv::Vec4b>(y);
+                for (int x = 0; x < w; ++x)
+                {
+                    uint32_t c = lut[src[x]];
+                    rt[x] = c;
+                    const cv::Vec4b &t = tp[x];
+                    uint8_t cb = static_cast<uint8_t>(c), cg = static_cast<uint8_t>(c >> 8), cr = static_cast<uint8_t>(c >> 16);
+                    dp[x] = cv::Vec4b(static_cast<uint8_t>(t[0] > cb ? t[0] - cb : cb - t[0]),
+                                      static_cast<uint8_t>(t[1] > cg ? t[1] - cg : cg - t[1]),
+                                      static_cast<uint8_t>(t[2] > cr ? t[2] - cr : cr - t[2]), t[3]);
+                    if (t[3])
+                    {
+                        ++rowOpaque;
+                        uint32_t tv;
+                        std::memcpy(&tv, &t, sizeof(tv));
+                        if (tv != c)
+                            ++rowChanged;
+                    }
+                }
+            }
+            opaque += rowOpaque;
+            changed += rowChanged; });
+        out.opaque = opaque;
+        out.changed = changed;
+    }
+
+    void seekWorker()
+    {
+        traceSetThreadName("timeline");
+        HistoryCursor cursor;
+        std::string cursorPath;
+        std::unique_lock<std::mutex> lock(seekMutex);
+        while (true)
+        {
+            seekCv.wait(lock, []
+                        { return seekStop || hasRequest; });
+            if (seekStop)
+                break;
+            SeekRequest req = std::move(request);
+            hasRequest = false;
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            TimelineFrame out;
+            bool ok = false;
+            {
+                WPG_TRACE_SCOPE(TraceStage::Seek, static_cast<int64_t>(req.frame));
+                if (req.path != cursorPath)
+                {
+                    cursorPath = req.path;
+                    cursor.open(req.path);
+                }
+                // UI側のリーダーの方が新しいフレームを知っている場合
+                if (cursor.isOpen() && req.frame >= cursor.reader().frames().size())
+                    cursor.refresh();
+                const std::vector<uint8_t> *state = cursor.isOpen() ? cursor.seek(req.frame) : nullptr;
+                if (state)
+                {
+                    renderFrame(*state, cursor.reader(), req.templ, out);
+                    out.timeMs = cursor.reader().frames()[req.frame].timeMs;
+                    ok = true;
+                }
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            lock.lock();
+            if (ok)
+            {
+                result = std::move(out);
+                hasResult = true;
+            }
+            lastSeekMs = ms;
+        }
+    }
+
+    void drawTimelapseSection(const std::vector<HistoryFrameInfo> &frames)
+    {
+        const int last = static_cast<int>(frames.size()) - 1;
+        if (exportPathFor != indexPath)
+        {
+            // 既定の出力先は履歴ファイルと同じ名前の .avi（OpenCV 内蔵の MJPG で書けるため環境を選ばない）
+            std::string path = indexPath.substr(0, indexPath.find_last_of('.')) + ".avi";
+            std::snprintf(exportPathBuffer, sizeof(exportPathBuffer), "%s", path.c_str());
+            exportPathFor = indexPath;
+            exportFirst = 0;
+            exportLast = -1;
+        }
+        exportFirst = std::min(exportFirst, last);
+        const int rangeLast = (exportLast < 0) ? last : std::min(exportLast, last);
+
+        ImGui::SetNextItemWidth(-1);
+        ImGui::InputText("##exportPath", exportPathBuffer, sizeof(exportPathBuffer));
+        ImGui::Checkbox("連番PNG（出力先をフォルダとして使う）", &exportSequence);
+        ImGui::SetNextItemWidth(120);
+        ImGui::InputFloat("倍速", &exportSpeedup, 0.0f, 0.0f, "%.0f");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(80);
+        ImGui::InputInt("fps", &exportFps, 0);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120);
+        // 出力の1辺が kTimelapseMaxSide を超える拡大率は選べないようにする
+        const int maxScale = std::min(8, timelapseMaxScale(frameIndex.width(), frameIndex.height()));
+        exportScale = std::clamp(exportScale, 1, maxScale);
+        ImGui::SliderInt("拡大", &exportScale, 1, maxScale, "%d", ImGuiSliderFlags_AlwaysClamp);
+        exportSpeedup = std::max(exportSpeedup, 1.0f);
+        exportFps = std::max(exportFps, 1);
+
+        char from[64], to[64];
+        formatTime(frames[exportFirst].timeMs, from, sizeof(from));
+        formatTime(frames[rangeLast].timeMs, to, sizeof(to));
+        ImGui::Text("範囲: %s 〜 %s", from, to);
+        if (ImGui::Button("選択中から"))
+            exportFirst = std::min(selected, rangeLast);
+        ImGui::SameLine();
+        if (ImGui::Button("選択中まで"))
+            exportLast = std::max(selected, exportFirst);
+        ImGui::SameLine();
+        if (ImGui::Button("全体"))
+        {
+            exportFirst = 0;
+            exportLast = -1;
+        }
+
+        const double frameCount = timelapseFrameCount(frames[exportFirst].timeMs, frames[rangeLast].timeMs, exportSpeedup, exportFps);
+        const bool tooLong = frameCount > static_cast<double>(kTimelapseMaxFrames);
+        ImGui::TextDisabled("動画の長さ: 約 %.1f 秒（%.0f フレーム）", (frameCount - 1.0) / exportFps, frameCount);
+        if (tooLong)
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "フレーム数が上限（%zu）を超えます。倍速を上げるか範囲を狭めてください", kTimelapseMaxFrames);
+
+        TimelapseProgress progress = exporter.progress();
+        if (progress.running)
+        {
+            char overlay[96];
+            std::snprintf(overlay, sizeof(overlay), "%zu / %zu  (%.1f フレーム/秒)", progress.framesWritten, progress.framesTotal, progress.framesPerSec);
+            float fraction = progress.framesTotal ? static_cast<float>(progress.framesWritten) / progress.framesTotal : 0.0f;
+            ImGui::ProgressBar(fraction, ImVec2(-1, 0), overlay);
+            if (progress.cancelling)
+                ImGui::TextDisabled("中止しています…");
+            else if (ImGui::Button("中止"))
+                exporter.cancel();
+        }
+        else
+        {
+            ImGui::BeginDisabled(tooLong);
+            const bool exportClicked = ImGui::Button("書き出す");
+            ImGui::EndDisabled();
+            if (exportClicked)
+            {
+                TimelapseOptions options;
+                options.historyPath = indexPath;
+                options.outputPath = exportPathBuffer;
+                options.imageSequence = exportSequence;
+                options.speedup = exportSpeedup;
+                options.fps = exportFps;
+                options.scale = exportScale;
+                options.firstFrame = static_cast<size_t>(exportFirst);
+                options.lastFrame = static_cast<size_t>(rangeLast);
+                exporter.start(options);
+            }
+            if (!progress.error.empty())
+                ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", progress.error.c_str());
+            else if (progress.finished)
+                ImGui::TextDisabled("完了: %zu フレーム（%.1f フレーム/秒）", progress.framesWritten, progress.framesPerSec);
+        }
+    }
+
+    void requestFrame(size_t frame, const cv::Mat &templ)
+    {
+        if (frame == requestedFrame && templ.data == requestedTemplate)
+            return;
+        requestedFrame = frame;
+        requestedTemplate = templ.data;
+
+        std::lock_guard<std::mutex> lock(seekMutex);
+        if (!seekThread.joinable())
+        {
+            seekStop = false;
+            seekThread = std::thread(seekWorker);
+        }
+        request.path = indexPath;
+        request.frame = frame;
+        request.templ = templ;
+        hasRequest = true;
+        seekCv.notify_one();
+    }
+}
+
+bool DrawTimelineWindow(bool *open, const std::string &historyPath, const cv::Mat &templateImg,
+                        TimelineFrame &frame, bool &updated)
+{
+    {
+        std::lock_guard<std::mutex> lock(seekMutex);
+        if (hasResult)
+        {
+            frame = std::move(result);
+            hasResult = false;
+            updated = true;
+        }
+    }
+
+    // ウィンドウを閉じたらライブ表示に戻す
+    if (!*open)
+    {
+        live = true;
+        return false;
+    }
+
+    if (!ImGui::Begin("タイムライン", open))
+    {
+        ImGui::End();
+        return !live;
+    }
+
+    // フレーム一覧は1秒ごとに追記分を取り込む
+    double t = ImGui::GetTime();
+    if (historyPath != indexPath)
+    {
+        frameIndex.close();
+        indexPath = historyPath;
+        live = true;
+        requestedFrame = SIZE_MAX;
+        lastRefresh = -1.0;
+    }
+    if (t - lastRefresh >= 1.0)
+    {
+        if (frameIndex.isOpen())
+            frameIndex.refresh();
+        else if (!indexPath.empty())
+            frameIndex.open(indexPath);
+        lastRefresh = t;
+    }
+
+    const std::vector<HistoryFrameInfo> &frames = frameIndex.frames();
+    if (frames.empty())
+    {
+        ImGui::TextDisabled("この監視領域の履歴はまだありません");
+        ImGui::End();
+        live = true;
+        return false;
+    }
+
+    const int last = static_cast<int>(frames.size()) - 1;
+    if (live)
+        selected = last;
+    selected = std::min(selected, last);
+
+    char label[64];
+    ImGui::Checkbox("ライブ", &live);
+    ImGui::SameLine();
+    if (ImGui::ArrowButton("##prev", ImGuiDir_Left) && selected > 0)
+    {
+        --selected;
+        live = false;
+    }
+    ImGui::SameLine();
+    if (ImGui::ArrowButton("##next", ImGuiDir_Right) && selected < last)
+    {
+        ++selected;
+        live = false;
+    }
+    ImGui::SameLine();
+    formatTime(frames[selected].timeMs, label, sizeof(label));
+    ImGui::SetNextItemWidth(-1);
+    if (ImGui::SliderInt("##frame", &selected, 0, last, label))
+        live = false;
+
+    ImGui::SetNextItemWidth(200);
+    ImGui::InputTextWithHint("##jump", "2025-01-31 21:00:00", jumpBuffer, sizeof(jumpBuffer));
+    ImGui::SameLine();
+    if (ImGui::Button("移動"))
+    {
+        int64_t target;
+        if (parseTime(jumpBuffer, target))
+        {
+            selected = static_cast<int>(frameIndex.frameAtTime(target));
+            live = false;
+        }
+    }
+
+    if (!live)
+    {
+        requestFrame(static_cast<size_t>(selected), templateImg);
+        if (!frame.realtime.empty())
+        {
+            formatTime(frame.timeMs, label, sizeof(label));
+            double percent = frame.opaque > 0 ? static_cast<double>(frame.changed) / frame.opaque * 100.0 : 0.0;
+            ImGui::Text("%s  差分率: %.2f%% (%d / %d)", label, percent, frame.changed, frame.opaque);
+        }
+    }
+    else
+    {
+        requestedFrame = SIZE_MAX;
+    }
+
+    double seekMs;
+    {
+        std::lock_guard<std::mutex> lock(seekMutex);
+        seekMs = lastSeekMs;
+    }
+    ImGui::TextDisabled("フレーム %d / %d  直近の復元 %.1f ms", selected + 1, last + 1, seekMs);
+
+    if (ImGui::CollapsingHeader("タイムラプス書き出し"))
+        drawTimelapseSection(frames);
+
+    ImGui::End();
+    return !live;
+}
+
+void shutdownTimeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(seekMutex);
+        seekStop = true;
+    }
+    seekCv.notify_one();
+    if (seekThread.joinable())
+        seekThread.join();
+    exporter.cancel();
+    exporter.wait();
+    frameIndex.close();
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+
+// タイムライン（記録済みの履歴を任意の時刻まで巻き戻して表示する）
+//
+// シークは専用スレッドで行い、スライダーを動かしている間は最後に要求したフレームだけを復元する。
+
+struct TimelineFrame
+{
+    cv::Mat realtime; // その時刻のリアルタイム画像
+    cv::Mat diff;     // テンプレートとの差分画像（imageDifferenceSafe と同じ形式）
+    int changed = 0;
+    int opaque = 0;
+    int64_t timeMs = 0;
+};
+
+// 過去のフレームを表示中なら true を返す。
+// 新しいフレームの復元が終わったときは frame を置き換えて updated を立てる
+bool DrawTimelineWindow(bool *open, const std::string &historyPath, const cv::Mat &templateImg,
+                        TimelineFrame &frame, bool &updated);
+
+// シーク用スレッドを止める（終了時に呼ぶ）
+void shutdownTimeline();
@@ -0,0 +1,487 @@
+﻿// wplace のタイルサーバーを模したローカルHTTPサーバー
+//
+// フィクスチャディレクトリ内の {root}/{x}/{y}.png を /files/s0/tiles/{x}/{y}.png として配信する。
+// 遅延・ジッター・エラー率・ETag/304・スクリプトによる時間経過でのタイル変更を再現でき、
+// ネットワークに依存しない再現可能なベンチマークに使う。
+//
+// 使い方:
+//   mock_tile_server --root fixtures --port 8080 --latency 40 --jitter 10 --error-rate 0.01 --script mutations.txt
+//
+// スクリプト形式（1行1イベント、# 以降はコメント、時間は起動からの秒数）:
+//   2.0  fill  1818 806  100 100 20 20  255 0 0 255   # タイル(1818,806)の(100,100)から20x20をRGBAで塗る
+//   5.0  noise 1818 806  500                          # ランダムな500ピクセルを書き換える
+
+#include "http_server.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string root = "fixtures";
+        std::string host = "127.0.0.1";
+        int port = 8080;
+        int latencyMs = 0;
+        int jitterMs = 0;
+        double errorRate = 0.0;
+        int errorStatus = 503;
+        bool etag = true;
+        bool blankMissing = false;
+        int tileSize = 1000;
+        std::string script;
+        unsigned seed = 1;
+        bool verbose = false;
+    };
+
+    struct MutationEvent
+    {
+        double timeSec = 0.0;
+        enum class Kind
+        {
+            Fill,
+            Noise
+        } kind = Kind::Fill;
+        int tx = 0, ty = 0;
+        int x = 0, y = 0, w = 0, h = 0;
+        cv::Vec4b color; // BGRA
+        int count = 0;
+    };
+
+    struct Tile
+    {
+        std::string png;
+        std::string etag;
+        cv::Mat img; // 変更適用時のみデコードして保持する
+    };
+
+    // ノイズで使う色（wplace パレットの一部, BGRA）
+    const cv::Vec4b kNoiseColors[] = {
+        cv::Vec4b(0, 0, 0, 255),
+        cv::Vec4b(255, 255, 255, 255),
+        cv::Vec4b(36, 28, 237, 255),
+        cv::Vec4b(39, 127, 255, 255),
+        cv::Vec4b(59, 221, 249, 255),
+        cv::Vec4b(123, 230, 19, 255),
+        cv::Vec4b(228, 147, 64, 255),
+        cv::Vec4b(185, 56, 170, 255),
+    };
+
+    std::atomic<bool> stopRequested{false};
+
+    void onSignal(int)
+    {
+        stopRequested = true;
+    }
+
+    std::string makeEtag(const std::string &data)
+    {
+        // FNV-1a 64bit
+        uint64_t h = 1469598103934665603ULL;
+        for (unsigned char c : data)
+        {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        char buf[24];
+        std::snprintf(buf, sizeof(buf), "\"%016llx\"", static_cast<unsigned long long>(h));
+        return buf;
+    }
+
+    bool readFile(const std::string &path, std::string &out)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs.is_open())
+            return false;
+        std::ostringstream ss;
+        ss << ifs.rdbuf();
+        out = ss.str();
+        return true;
+    }
+
+    bool loadScript(const std::string &path, std::vector<MutationEvent> &events)
+    {
+        std::ifstream ifs(path);
+        if (!ifs.is_open())
+        {
+            std::cerr << "スクリプトを開けません: " << path << std::endl;
+            return false;
+        }
+
+        std::string line;
+        int lineNo = 0;
+        while (std::getline(ifs, line))
+        {
+            ++lineNo;
+            size_t hash = line.find('#');
+            if (hash != std::string::npos)
+                line.erase(hash);
+            std::istringstream ss(line);
+            MutationEvent ev;
+            std::string kind;
+            if (!(ss >> ev.timeSec >> kind))
+                continue;
+
+            bool ok = false;
+            if (kind == "fill")
+            {
+                int r, g, b, a = 255;
+                ev.kind = MutationEvent::Kind::Fill;
+                ok = static_cast<bool>(ss >> ev.tx >> ev.ty >> ev.x >> ev.y >> ev.w >> ev.h >> r >> g >> b);
+                if (!(ss >> a))
+                    a = 255;
+                ev.color = cv::Vec4b((uchar)b, (uchar)g, (uchar)r, (uchar)a);
+            }
+            else if (kind == "noise")
+            {
+                ev.kind = MutationEvent::Kind::Noise;
+                ok = static_cast<bool>(ss >> ev.tx >> ev.ty >> ev.count);
+            }
+
+            if (!ok)
+            {
+                std::cerr << path << ":" << lineNo << ": 解析できない行です" << std::endl;
+                return false;
+            }
+            events.push_back(ev);
+        }
+
+        std::stable_sort(events.begin(), events.end(), [](const MutationEvent &a, const MutationEvent &b)
+                         { return a.timeSec < b.timeSec; });
+        return true;
+    }
+
+    class TileStore
+    {
+    public:
+        TileStore(const Options &opt, std::vector<MutationEvent> events)
+            : opt_(opt), events_(std::move(events)), rng_(opt.seed),
+              start_(std::chrono::steady_clock::now()) {}
+
+        // 見つからなければ false
+        bool get(int tx, int ty, std::string &png, std::string &etag)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            applyDueEvents();
+            Tile *tile = find(tx, ty);
+            if (!tile)
+                return false;
+            png = tile->png;
+            etag = tile->etag;
+            return true;
+        }
+
+        // 遅延・ジッター・エラー注入用の乱数
+        int sampleDelayMs()
+        {
+            if (opt_.latencyMs <= 0 && opt_.jitterMs <= 0)
+                return 0;
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::uniform_int_distribution<int> dist(-opt_.jitterMs, opt_.jitterMs);
+            return std::max(0, opt_.latencyMs + dist(rng_));
+        }
+
+        bool sampleError()
+        {
+            if (opt_.errorRate <= 0.0)
+                return false;
+            std::lock_guard<std::mutex> lock(mutex_);
+            return std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < opt_.errorRate;
+        }
+
+    private:
+        Tile *find(int tx, int ty)
+        {
+            auto key = std::make_pair(tx, ty);
+            auto it = tiles_.find(key);
+            if (it != tiles_.end())
+                return &it->second;
+
+            Tile tile;
+            std::string path = opt_.root + "/" + std::to_string(tx) + "/" + std::to_string(ty) + ".png";
+            if (readFile(path, tile.png))
+            {
+                tile.etag = makeEtag(tile.png);
+            }
+            else if (opt_.blankMissing)
+            {
+                tile.img = cv::Mat(opt_.tileSize, opt_.tileSize, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+                encode(tile);
+            }
+            else
+            {
+                return nullptr;
+            }
+            return &tiles_.emplace(key, std::move(tile)).first->second;
+        }
+
+        void encode(Tile &tile)
+        {
+            std::vector<uchar> buf;
+            cv::imencode(".png", tile.img, buf);
+            tile.png.assign(buf.begin(), buf.end());
+            tile.etag = makeEtag(tile.png);
+        }
+
+        void applyDueEvents()
+        {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+            while (nextEvent_ < events_.size() && events_[nextEvent_].timeSec <= elapsed)
+            {
+                apply(events_[nextEvent_]);
+                ++nextEvent_;
+            }
+        }
+
+        void apply(const MutationEvent &ev)
+        {
+            Tile *tile = find(ev.tx, ev.ty);
+            if (!tile)
+            {
+                std::cerr << "変更対象のタイルがありません: " << ev.tx << "/" << ev.ty << std::endl;
+                return;
+            }
+            if (tile->img.empty())
+            {
+                std::vector<uchar> data(tile->png.begin(), tile->png.end());
+                tile->img = cv::imdecode(data, cv::IMREAD_UNCHANGED);
+                if (tile->img.channels() == 3)
+                    cv::cvtColor(tile->img, tile->img, cv::COLOR_BGR2BGRA);
+            }
+            if (tile->img.empty() || tile->img.type() != CV_8UC4)
+                return;
+
+            cv::Mat &img = tile->img;
+            if (ev.kind == MutationEvent::Kind::Fill)
+            {
+                cv::Rect r(ev.x, ev.y, ev.w, ev.h);
+                r &= cv::Rect(0, 0, img.cols, img.rows);
+                for (int y = r.y; y < r.y + r.height; ++y)
+                {
+                    cv::Vec4b *row = img.ptr<cv::Vec4b>(y);
+                    for (int x = r.x; x < r.x + r.width; ++x)
+                        row[x] = ev.color;
+                }
+            }
+            else
+            {
+                std::uniform_int_distribution<int> dx(0, img.cols - 1), dy(0, img.rows - 1);
+                std::uniform_int_distribution<int> dc(0, static_cast<int>(std::size(kNoiseColors)) - 1);
+                for (int i = 0; i < ev.count; ++i)
+                {
+                    int x = dx(rng_);
+                    int y = dy(rng_);
+                    img.at<cv::Vec4b>(y, x) = kNoiseColors[dc(rng_)];
+                }
+            }
+            encode(*tile);
+
+            if (opt_.verbose)
+                std::cout << "[" << ev.timeSec << "s] タイル " << ev.tx << "/" << ev.ty << " を変更 -> " << tile->etag << std::endl;
+        }
+
+        const Options &opt_;
+        std::vector<MutationEvent> events_;
+        size_t nextEvent_ = 0;
+        std::mt19937 rng_;
+        std::chrono::steady_clock::time_point start_;
+        std::mutex mutex_;
+        std::map<std::pair<int, int>, Tile> tiles_;
+    };
+
+    // "/files/s0/tiles/{x}/{y}.png" を解析する
+    bool parseTilePath(const std::string &path, int &tx, int &ty)
+    {
+        static const std::string prefix = "/files/s0/tiles/";
+        if (path.compare(0, prefix.size(), prefix) != 0)
+            return false;
+        char tail[8] = {0};
+        if (std::sscanf(path.c_str() + prefix.size(), "%d/%d.%7s", &tx, &ty, tail) != 3)
+            return false;
+        return std::string(tail) == "png";
+    }
+
+    bool etagMatches(const std::string &ifNoneMatch, const std::string &etag)
+    {
+        if (ifNoneMatch.empty())
+            return false;
+        if (ifNoneMatch == "*")
+            return true;
+        // W/ 付きやカンマ区切りのリストも許容する
+        return ifNoneMatch.find(etag) != std::string::npos;
+    }
+
+    void printUsage()
+    {
+        std::cout << "mock_tile_server [options]\n"
+                     "  --root DIR          タイルのフィクスチャディレクトリ (既定: fixtures)\n"
+                     "  --host ADDR         待ち受けアドレス (既定: 127.0.0.1)\n"
+                     "  --port N            待ち受けポート (既定: 8080)\n"
+                     "  --latency MS        応答前の固定遅延\n"
+                     "  --jitter MS         遅延に加える ±MS の一様ジッター\n"
+                     "  --error-rate P      P (0..1) の確率でエラーを返す\n"
+                     "  --error-status N    注入するエラーのステータス (既定: 503)\n"
+                     "  --no-etag           ETag/304 を無効化する\n"
+                     "  --blank-missing     存在しないタイルを透明タイルとして返す (既定は404)\n"
+                     "  --tile-size N       透明タイルの一辺 (既定: 1000)\n"
+                     "  --script FILE       時間経過で適用するタイル変更スクリプト\n"
+                     "  --seed N            乱数シード (既定: 1)\n"
+                     "  --verbose           リクエストごとにログを出す\n";
+    }
+
+    bool parseArgs(int argc, char **argv, Options &opt)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string a = argv[i];
+            auto next = [&](std::string &out)
+            {
+                if (i + 1 >= argc)
+                    return false;
+                out = argv[++i];
+                return true;
+            };
+            std::string v;
+            try
+            {
+                if (a == "--root" && next(v))
+                    opt.root = v;
+                else if (a == "--host" && next(v))
+                    opt.host = v;
+                else if (a == "--port" && next(v))
+                    opt.port = std::stoi(v);
+                else if (a == "--latency" && next(v))
+                    opt.latencyMs = std::stoi(v);
+                else if (a == "--jitter" && next(v))
+                    opt.jitterMs = std::stoi(v);
+                else if (a == "--error-rate" && next(v))
+                    opt.errorRate = std::stod(v);
+                else if (a == "--error-status" && next(v))
+                    opt.errorStatus = std::stoi(v);
+                else if (a == "--tile-size" && next(v))
+                    opt.tileSize = std::stoi(v);
+                else if (a == "--script" && next(v))
+                    opt.script = v;
+                else if (a == "--seed" && next(v))
+                    opt.seed = static_cast<unsigned>(std::stoul(v));
+                else if (a == "--no-etag")
+                    opt.etag = false;
+                else if (a == "--blank-missing")
+                    opt.blankMissing = true;
+                else if (a == "--verbose")
+                    opt.verbose = true;
+                else
+                    return false;
+            }
+            catch (const std::exception &)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<MutationEvent> events;
+    if (!opt.script.empty() && !loadScript(opt.script, events))
+        return 1;
+
+    TileStore store(opt, std::move(events));
+    std::atomic<uint64_t> served{0}, notModified{0}, injected{0}, missing{0};
+
+    HttpServer server;
+    bool ok = server.start(opt.host, opt.port, [&](const HttpRequest &req)
+                           {
+        HttpResponse res;
+        if (req.method != "GET" && req.method != "HEAD")
+        {
+            res.status = 405;
+            return res;
+        }
+
+        int tx = 0, ty = 0;
+        if (!parseTilePath(req.path, tx, ty))
+        {
+            res.status = 404;
+            missing++;
+            return res;
+        }
+
+        int delay = store.sampleDelayMs();
+        if (delay > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+        if (store.sampleError())
+        {
+            res.status = opt.errorStatus;
+            res.body = "injected error";
+            injected++;
+            return res;
+        }
+
+        std::string png, etag;
+        if (!store.get(tx, ty, png, etag))
+        {
+            res.status = 404;
+            missing++;
+            return res;
+        }
+
+        res.headers.emplace_back("Cache-Control", "no-cache");
+        if (opt.etag)
+        {
+            res.headers.emplace_back("ETag", etag);
+            if (etagMatches(req.header("If-None-Match"), etag))
+            {
+                res.status = 304;
+                notModified++;
+                return res;
+            }
+        }
+
+        res.contentType = "image/png";
+        res.body = std::move(png);
+        served++;
+        if (opt.verbose)
+            std::cout << req.method << " " << req.path << " -> " << res.status << " (" << res.body.size() << " bytes, " << delay << "ms)" << std::endl;
+        return res; });
+
+    if (!ok)
+        return 1;
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::cout << "http://" << opt.host << ":" << server.port() << "/files/s0/tiles/{x}/{y}.png で待ち受け中 (root=" << opt.root << ")" << std::endl;
+
+    while (!stopRequested)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    server.stop();
+    std::cout << "200: " << served << "  304: " << notModified << "  注入エラー: " << injected << "  404: " << missing << std::endl;
+    return 0;
+}
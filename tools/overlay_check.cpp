@@ -0,0 +1,178 @@
+﻿// 重ね合わせシェーダーの読み戻し確認（ctest の overlay_readback）
+//
+// 非表示ウィンドウの GL コンテキストで、既知のテンプレートとリアルタイム画像の組を DrawOverlayImage で描き、
+// 読み戻した画素で、間違いのピクセルだけが強調色になり、合っているピクセルと透明なピクセルはそのままかを確かめる。
+// タイルは TiledTexture（ImTextureData）で作るので、バックエンドによる作成・転送の経路も通る。
+// Linux では Mesa の llvmpipe を使う。成功なら 0、失敗なら 1、OpenGL 3.3 core のコンテキストを作れないか
+// GLEW を初期化できなければ 77（ctest ではスキップ）を返す。
+
+#include "gl_texture.h"
+#include "overlay_shader.h"
+#include "tiled_texture.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include "imgui_impl_opengl3.h"
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+    constexpr int kImageSize = 32;
+    constexpr int kScale = 8; // 画像1ピクセルを画面の 8x8 に拡大して描く
+    constexpr int kViewSize = kImageSize * kScale;
+
+    const cv::Vec4b kGreen(0, 255, 0, 255); // BGRA
+    const cv::Vec4b kRed(0, 0, 255, 255);
+
+    // 画像の (x, y) に当たる画面の画素を RGB で読む（フレームバッファは下から上）
+    cv::Vec3b readPixel(int x, int y)
+    {
+        unsigned char p[4] = {};
+        glReadPixels(x * kScale + kScale / 2, kViewSize - 1 - (y * kScale + kScale / 2), 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, p);
+        return cv::Vec3b(p[0], p[1], p[2]);
+    }
+
+    int failures = 0;
+
+    void expect(const char *name, int x, int y, const cv::Vec3b &want)
+    {
+        cv::Vec3b got = readPixel(x, y);
+        bool ok = true;
+        for (int c = 0; c < 3; ++c)
+            ok &= std::abs(got[c] - want[c]) <= 2;
+        std::printf("%s %s (%d,%d): RGB %d,%d,%d（期待 %d,%d,%d）\n", ok ? "OK  " : "FAIL", name, x, y,
+                    got[0], got[1], got[2], want[0], want[1], want[2]);
+        if (!ok)
+            failures++;
+    }
+
+    // 1フレーム描いて転送・描画まで済ませる
+    void renderFrame(const TiledTexture &templ, const TiledTexture &live, const OverlaySettings &settings)
+    {
+        ImGuiIO &io = ImGui::GetIO();
+        io.DisplaySize = ImVec2(kViewSize, kViewSize);
+        io.DeltaTime = 1.0f / 60.0f;
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui::NewFrame();
+        DrawOverlayImage(templ, live, settings, ImGui::GetBackgroundDrawList(), ImVec2(0, 0), ImVec2(kViewSize, kViewSize),
+                         ImVec2(0, 0), ImVec2(1, 1));
+        ImGui::Render();
+        glViewport(0, 0, kViewSize, kViewSize);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        TiledTexture::endFrame();
+    }
+}
+
+int main()
+{
+#ifndef _WIN32
+    // ハードウェアに依存しない結果にするため Mesa のソフトウェアラスタライザを使う
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+#endif
+    if (!glfwInit())
+    {
+        std::fprintf(stderr, "GLFWを初期化できませんでした\n");
+        return 77;
+    }
+    // シェーダーは GLSL 330 なので 3.3 core を要求し、作れない環境では失敗ではなくスキップにする
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+    GLFWwindow *window = glfwCreateWindow(64, 64, "overlay_check", nullptr, nullptr);
+    if (!window)
+    {
+        std::fprintf(stderr, "OpenGL 3.3 core のコンテキストを作成できませんでした\n");
+        glfwTerminate();
+        return 77;
+    }
+    glfwMakeContextCurrent(window);
+    glewExperimental = GL_TRUE;
+    GLenum glewError = glewInit();
+    if (glewError != GLEW_OK)
+    {
+        std::fprintf(stderr, "GLEWを初期化できませんでした: %s\n", reinterpret_cast<const char *>(glewGetErrorString(glewError)));
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return 77;
+    }
+
+    // 非表示ウィンドウの既定のフレームバッファは読み戻せるとは限らないので、描画先を用意する
+    GLuint fbo = 0, colorBuffer = 0;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kViewSize, kViewSize);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+
+    ImGui::CreateContext();
+    ImGui::GetIO().IniFilename = nullptr;
+    ImGui_ImplOpenGL3_Init("#version 330 core");
+    TiledTexture::setDrawCallback(bindNearestSampler);
+
+    // 左半分は緑で不透明、右半分は透明なテンプレート。リアルタイム画像は (5,10) だけ赤で、
+    // 透明な部分の (20,10) も赤にする（テンプレートが透明なところは間違いにしない）
+    cv::Mat templImg(kImageSize, kImageSize, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+    for (int y = 0; y < kImageSize; ++y)
+        for (int x = 0; x < kImageSize / 2; ++x)
+            templImg.at<cv::Vec4b>(y, x) = kGreen;
+    cv::Mat liveImg = templImg.clone();
+    liveImg.at<cv::Vec4b>(10, 5) = kRed;
+    liveImg.at<cv::Vec4b>(10, 20) = kRed;
+
+    TiledTexture templ, live;
+    templ.create(templImg);
+    live.create(liveImg);
+
+    const cv::Vec3b green(0, 255, 0), blue(0, 0, 255), black(0, 0, 0);
+    OverlaySettings settings;
+    settings.highlight = ImVec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+    // 作成の要求はタイルを描いたフレームで処理されるので、確かめる前に2フレーム描く
+    settings.blend = 0.0f;
+    for (int i = 0; i < 2; ++i)
+        renderFrame(templ, live, settings);
+    expect("テンプレート: 間違い", 5, 10, blue);
+    expect("テンプレート: 一致", 6, 10, green);
+    expect("テンプレート: 透明", 20, 10, black);
+
+    settings.blend = 1.0f;
+    renderFrame(templ, live, settings);
+    expect("リアルタイム: 間違い", 5, 10, blue);
+    expect("リアルタイム: 一致", 6, 10, green);
+
+    settings.wrongOnly = true;
+    renderFrame(templ, live, settings);
+    expect("間違いだけ: 間違い", 5, 10, blue);
+    expect("間違いだけ: 一致", 6, 10, black);
+    expect("間違いだけ: 透明", 20, 10, black);
+
+    // 転送した画素が描画に反映されるか（変わったタイルだけ送る経路）
+    liveImg.at<cv::Vec4b>(10, 5) = kGreen;
+    live.upload(liveImg);
+    renderFrame(templ, live, settings);
+    expect("直した後: 元の間違い", 5, 10, black);
+
+    templ.release();
+    live.release();
+    renderFrame(templ, live, settings);
+    releaseOverlayShader();
+    releaseNearestSampler();
+    ImGui_ImplOpenGL3_Shutdown();
+    TiledTexture::shutdown();
+    ImGui::DestroyContext();
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteFramebuffers(1, &fbo);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+
+    if (failures)
+        std::printf("%d 件の確認に失敗しました\n", failures);
+    return failures ? 1 : 0;
+}
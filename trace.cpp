@@ -0,0 +1,345 @@
+﻿#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+std::atomic<uint32_t> g_traceFlags{0};
+std::atomic<uint64_t> g_traceCounters[static_cast<size_t>(TraceCounter::Count)] = {};
+std::atomic<int64_t> g_traceGauges[static_cast<size_t>(TraceGauge::Count)] = {};
+
+const double kTraceHistogramBounds[kTraceHistogramBuckets - 1] = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+
+namespace
+{
+    // 1スレッドあたりの保持イベント数（32バイト×16384 = 512KB）
+    constexpr uint64_t kRingCapacity = 1 << 14;
+    // 終了したスレッドのリングは書き出し用に残し、この数を超えたら再利用する
+    constexpr size_t kMaxRings = 32;
+
+    const std::chrono::steady_clock::time_point kEpoch = std::chrono::steady_clock::now();
+
+    // 区間は所要時間の上位8ビットに入れる（所要時間は 2^56 ns ≒ 2年で足りる）
+    constexpr int kStageShift = 56;
+    constexpr uint64_t kDurationMask = (uint64_t(1) << kStageShift) - 1;
+
+    // スロットごとのシーケンス番号で読み手が破れた読み込みを検出する（seqlock）。
+    // seq が奇数の間は書き込み中、2*i+2 なら i 番目のイベントの書き込みが完了している
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> startNs{0};
+        std::atomic<uint64_t> stageDurNs{0}; // 区間 << kStageShift | 所要時間
+        std::atomic<int64_t> arg{0};
+    };
+    static_assert(sizeof(Slot) == 32, "Slot は kRingCapacity のメモリ見積もりに合わせて32バイトにする");
+
+    struct TraceRing
+    {
+        std::atomic<uint64_t> head{0}; // 書き込み済みイベント数
+        uint64_t base = 0;             // 再利用時に前のスレッドのイベントを読み飛ばすための開始位置
+        std::atomic<bool> owned{false};
+        uint32_t tid = 0;
+        char name[32] = {0};
+        Slot slots[kRingCapacity];
+    };
+
+    struct StageHistogram
+    {
+        std::atomic<uint64_t> buckets[kTraceHistogramBuckets] = {};
+        std::atomic<uint64_t> sumNs{0};
+    };
+
+    StageHistogram stageHistograms[static_cast<size_t>(TraceStage::Count)];
+    // kTraceHistogramBounds をナノ秒にしたもの
+    constexpr uint64_t kHistogramBoundsNs[kTraceHistogramBuckets - 1] = {
+        1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000,
+        250000000, 500000000, 1000000000, 2500000000, 5000000000, 10000000000};
+
+    // ステータスコード 0〜599 ごとの応答数
+    constexpr int kHttpStatusSlots = 600;
+    std::atomic<uint64_t> httpStatusCounts[kHttpStatusSlots] = {};
+
+    void observeHistogram(TraceStage stage, uint64_t durNs)
+    {
+        int b = 0;
+        while (b < kTraceHistogramBuckets - 1 && durNs > kHistogramBoundsNs[b])
+            ++b;
+        StageHistogram &h = stageHistograms[static_cast<size_t>(stage)];
+        h.buckets[b].fetch_add(1, std::memory_order_relaxed);
+        h.sumNs.fetch_add(durNs, std::memory_order_relaxed);
+    }
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    uint32_t nextTid = 1;
+
+    // スレッド終了時にリングを手放す。手放されたリングはリング数が上限に達してから再利用する
+    struct RingHandle
+    {
+        TraceRing *ring = nullptr;
+        ~RingHandle()
+        {
+            if (ring)
+                ring->owned.store(false, std::memory_order_release);
+        }
+    };
+
+    TraceRing *acquireRing()
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (rings.size() >= kMaxRings)
+        {
+            for (auto &r : rings)
+            {
+                bool expected = false;
+                if (r->owned.compare_exchange_strong(expected, true))
+                {
+                    r->base = r->head.load(std::memory_order_relaxed);
+                    r->tid = nextTid++;
+                    r->name[0] = '\0';
+                    return r.get();
+                }
+            }
+        }
+        rings.push_back(std::make_unique<TraceRing>());
+        TraceRing *r = rings.back().get();
+        r->owned = true;
+        r->tid = nextTid++;
+        return r;
+    }
+
+    TraceRing &threadRing()
+    {
+        thread_local RingHandle handle;
+        if (!handle.ring)
+            handle.ring = acquireRing();
+        return *handle.ring;
+    }
+
+    void collectRing(const TraceRing &ring, std::vector<TraceEvent> &out, uint64_t sinceNs)
+    {
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        uint64_t first = std::max(ring.base, (head > kRingCapacity) ? head - kRingCapacity : 0);
+        for (uint64_t i = first; i < head; ++i)
+        {
+            const Slot &slot = ring.slots[i % kRingCapacity];
+            uint64_t s1 = slot.seq.load(std::memory_order_acquire);
+            if (s1 != 2 * i + 2)
+                continue; // 上書き中または上書き済み
+            TraceEvent ev;
+            ev.startNs = slot.startNs.load(std::memory_order_relaxed);
+            const uint64_t stageDur = slot.stageDurNs.load(std::memory_order_relaxed);
+            ev.durNs = stageDur & kDurationMask;
+            ev.arg = slot.arg.load(std::memory_order_relaxed);
+            ev.stage = static_cast<TraceStage>(stageDur >> kStageShift);
+            ev.tid = ring.tid;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != s1)
+                continue;
+            if (ev.startNs >= sinceNs)
+                out.push_back(ev);
+        }
+    }
+}
+
+const char *traceStageName(TraceStage stage)
+{
+    switch (stage)
+    {
+    case TraceStage::Cycle:
+        return "cycle";
+    case TraceStage::Fetch:
+        return "fetch";
+    case TraceStage::Dns:
+        return "dns";
+    case TraceStage::Connect:
+        return "connect";
+    case TraceStage::Tls:
+        return "tls";
+    case TraceStage::Wait:
+        return "wait";
+    case TraceStage::Transfer:
+        return "transfer";
+    case TraceStage::Decode:
+        return "decode";
+    case TraceStage::Composite:
+        return "composite";
+    case TraceStage::Mask:
+        return "mask";
+    case TraceStage::Diff:
+        return "diff";
+    case TraceStage::History:
+        return "history";
+    case TraceStage::Seek:
+        return "seek";
+    case TraceStage::Heatmap:
+        return "heatmap";
+    case TraceStage::Clusters:
+        return "clusters";
+    case TraceStage::Event:
+        return "event";
+    case TraceStage::LockWait:
+        return "lock_wait";
+    case TraceStage::Upload:
+        return "upload";
+    case TraceStage::Frame:
+        return "frame";
+    default:
+        return "unknown";
+    }
+}
+
+const char *traceCounterName(TraceCounter counter)
+{
+    switch (counter)
+    {
+    case TraceCounter::TileRequests:
+        return "tile_requests";
+    case TraceCounter::BytesDownloaded:
+        return "bytes_downloaded";
+    case TraceCounter::CacheHits:
+        return "cache_hits";
+    case TraceCounter::CacheMisses:
+        return "cache_misses";
+    case TraceCounter::FetchErrors:
+        return "fetch_errors";
+    case TraceCounter::FramesRendered:
+        return "frames_rendered";
+    case TraceCounter::FramesSkipped:
+        return "frames_skipped";
+    default:
+        return "unknown";
+    }
+}
+
+void setTraceEnabled(bool enabled)
+{
+    if (enabled)
+        g_traceFlags.fetch_or(TraceFlag_Record, std::memory_order_relaxed);
+    else
+        g_traceFlags.fetch_and(~static_cast<uint32_t>(TraceFlag_Record), std::memory_order_relaxed);
+}
+
+void setTraceHistogramsEnabled(bool enabled)
+{
+    if (enabled)
+        g_traceFlags.fetch_or(TraceFlag_Histogram, std::memory_order_relaxed);
+    else
+        g_traceFlags.fetch_and(~static_cast<uint32_t>(TraceFlag_Histogram), std::memory_order_relaxed);
+}
+
+TraceHistogramSnapshot traceStageHistogram(TraceStage stage)
+{
+    const StageHistogram &h = stageHistograms[static_cast<size_t>(stage)];
+    TraceHistogramSnapshot snap;
+    for (int i = 0; i < kTraceHistogramBuckets; ++i)
+    {
+        snap.buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+        snap.count += snap.buckets[i];
+    }
+    snap.sumSec = h.sumNs.load(std::memory_order_relaxed) / 1e9;
+    return snap;
+}
+
+void traceCountHttpStatus(long status)
+{
+    int slot = (status > 0 && status < kHttpStatusSlots) ? static_cast<int>(status) : 0;
+    httpStatusCounts[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t traceHttpStatusCount(int status)
+{
+    if (status < 0 || status >= kHttpStatusSlots)
+        return 0;
+    return httpStatusCounts[status].load(std::memory_order_relaxed);
+}
+
+uint64_t traceNowNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - kEpoch)
+                                     .count()) +
+           1; // 0 は「記録なし」を表すため
+}
+
+void traceRecord(TraceStage stage, uint64_t startNs, uint64_t durNs, int64_t arg)
+{
+    uint32_t flags = g_traceFlags.load(std::memory_order_relaxed);
+    if (flags & TraceFlag_Histogram)
+        observeHistogram(stage, durNs);
+    if (!(flags & TraceFlag_Record))
+        return;
+
+    TraceRing &ring = threadRing();
+    uint64_t i = ring.head.load(std::memory_order_relaxed);
+    Slot &slot = ring.slots[i % kRingCapacity];
+    slot.seq.store(2 * i + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.stageDurNs.store(static_cast<uint64_t>(stage) << kStageShift | std::min(durNs, kDurationMask), std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.seq.store(2 * i + 2, std::memory_order_release);
+    ring.head.store(i + 1, std::memory_order_release);
+}
+
+void traceSetThreadName(const char *name)
+{
+    TraceRing &ring = threadRing();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::snprintf(ring.name, sizeof(ring.name), "%s", name);
+}
+
+void traceCollect(std::vector<TraceEvent> &out, uint64_t sinceNs)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto &r : rings)
+        collectRing(*r, out, sinceNs);
+}
+
+bool traceWriteChromeJson(const std::string &path)
+{
+    std::ofstream ofs(path);
+    if (!ofs.is_open())
+    {
+        std::cerr << "トレースを書き出せませんでした: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<TraceEvent> events;
+    std::vector<std::pair<uint32_t, std::string>> names;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto &r : rings)
+        {
+            collectRing(*r, events, 0);
+            names.emplace_back(r->tid, r->name[0] ? r->name : "thread");
+        }
+    }
+
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char buf[256];
+    for (const auto &n : names)
+    {
+        std::snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                      first ? "" : ",\n", n.first, n.second.c_str());
+        ofs << buf;
+        first = false;
+    }
+    for (const auto &ev : events)
+    {
+        std::snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"cat\":\"wpg\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%lld}}",
+                      first ? "" : ",\n", traceStageName(ev.stage), ev.tid,
+                      ev.startNs / 1000.0, ev.durNs / 1000.0, static_cast<long long>(ev.arg));
+        ofs << buf;
+        first = false;
+    }
+    ofs << "]}\n";
+    return ofs.good();
+}
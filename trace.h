@@ -0,0 +1,172 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ホットパスの区間計測
+//
+// 各スレッドは自分専用のリングバッファにイベントを書き込む（ロックなし・単一ライター）。
+// 無効な間のコストは relaxed load と分岐1つだけ。
+// 貯まったイベントは Chrome の trace_event 形式（chrome://tracing, Perfetto）で書き出せる。
+// 転送量やキャッシュヒットなどの累積カウンタもここに集約し、パフォーマンス画面はこれを読むだけにする。
+// 区間ごとのヒストグラム（メトリクス公開用）も同じ計測点から、ロックなしの atomic 加算で集計する。
+
+enum class TraceStage : uint8_t
+{
+    Cycle,     // 更新スレッドの1周期
+    Fetch,     // タイル1枚のHTTP取得全体
+    Dns,       // 名前解決
+    Connect,   // TCP接続
+    Tls,       // TLSハンドシェイク
+    Wait,      // リクエスト送信から最初の1バイトまで
+    Transfer,  // レスポンス本体の受信
+    Decode,    // PNGデコード
+    Composite, // キャンバスへの合成と切り出し
+    Mask,      // applyAlphaMask
+    Diff,      // imageDifferenceSafe
+    History,   // 履歴ファイルへの追記
+    Seek,      // 履歴のシーク（復元と差分）
+    Heatmap,   // 荒らし回数のヒートマップの更新
+    Clusters,  // 損傷領域（連結領域）の更新
+    Event,     // タイル到着から変化の通知を書き終えるまで
+    LockWait,  // imgMutex の取得待ち
+    Upload,    // テクスチャ転送
+    Frame,     // 描画ループの1フレーム
+    Count
+};
+
+const char *traceStageName(TraceStage stage);
+
+// 単調増加する累積カウンタ（常に有効。relaxed な fetch_add 1回）
+enum class TraceCounter : uint8_t
+{
+    TileRequests,    // タイル取得の応答数
+    BytesDownloaded, // 受信したバイト数
+    CacheHits,       // 304 でキャッシュを使ったタイル
+    CacheMisses,     // 200 で取り直したタイル
+    FetchErrors,     // 取得・デコードの失敗
+    FramesRendered,  // 描画したフレーム
+    FramesSkipped,   // 垂直同期に間に合わず落ちたフレーム
+    Count
+};
+
+// 現在値を表すゲージ
+enum class TraceGauge : uint8_t
+{
+    TilesPending, // 今の周期でまだ取得していないタイル数
+    Count
+};
+
+const char *traceCounterName(TraceCounter counter);
+
+extern std::atomic<uint64_t> g_traceCounters[static_cast<size_t>(TraceCounter::Count)];
+extern std::atomic<int64_t> g_traceGauges[static_cast<size_t>(TraceGauge::Count)];
+
+inline void traceCount(TraceCounter counter, uint64_t delta = 1)
+{
+    g_traceCounters[static_cast<size_t>(counter)].fetch_add(delta, std::memory_order_relaxed);
+}
+
+inline uint64_t traceCounterValue(TraceCounter counter)
+{
+    return g_traceCounters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+}
+
+inline void traceSetGauge(TraceGauge gauge, int64_t value)
+{
+    g_traceGauges[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+}
+
+inline int64_t traceGaugeValue(TraceGauge gauge)
+{
+    return g_traceGauges[static_cast<size_t>(gauge)].load(std::memory_order_relaxed);
+}
+
+struct TraceEvent
+{
+    uint64_t startNs = 0; // traceNowNs() 基準
+    uint64_t durNs = 0;
+    uint32_t tid = 0;
+    TraceStage stage = TraceStage::Cycle;
+    int64_t arg = 0; // タイル番号など区間ごとの補足値
+};
+
+// 区間所要時間のヒストグラム。バケット境界（秒）は最後の +Inf を除いて kTraceHistogramBounds
+constexpr int kTraceHistogramBuckets = 14;
+extern const double kTraceHistogramBounds[kTraceHistogramBuckets - 1];
+
+struct TraceHistogramSnapshot
+{
+    uint64_t buckets[kTraceHistogramBuckets] = {}; // 累積ではなくバケットごとの件数
+    uint64_t count = 0;
+    double sumSec = 0.0;
+};
+
+TraceHistogramSnapshot traceStageHistogram(TraceStage stage);
+
+// HTTPステータスごとの応答数（通信エラーは 0）
+void traceCountHttpStatus(long status);
+uint64_t traceHttpStatusCount(int status);
+
+enum TraceFlags : uint32_t
+{
+    TraceFlag_Record = 1 << 0,    // リングバッファへの記録
+    TraceFlag_Histogram = 1 << 1, // 区間ヒストグラムへの集計
+};
+
+extern std::atomic<uint32_t> g_traceFlags;
+
+inline bool traceEnabled()
+{
+    return (g_traceFlags.load(std::memory_order_relaxed) & TraceFlag_Record) != 0;
+}
+
+void setTraceEnabled(bool enabled);
+void setTraceHistogramsEnabled(bool enabled);
+
+// プロセス起動からの経過ナノ秒（steady_clock）
+uint64_t traceNowNs();
+
+// 区間開始。記録もヒストグラムも無効なら 0 を返し、traceEnd は何もしない
+inline uint64_t traceBegin()
+{
+    return g_traceFlags.load(std::memory_order_relaxed) ? traceNowNs() : 0;
+}
+
+void traceRecord(TraceStage stage, uint64_t startNs, uint64_t durNs, int64_t arg = 0);
+
+inline void traceEnd(TraceStage stage, uint64_t startNs, int64_t arg = 0)
+{
+    if (startNs)
+        traceRecord(stage, startNs, traceNowNs() - startNs, arg);
+}
+
+// 呼び出しスレッドのリングに表示名を付ける（"update", "render" など）
+void traceSetThreadName(const char *name);
+
+// 全スレッドのリングから sinceNs 以降に始まったイベントを集める（記録中でも呼べる）
+void traceCollect(std::vector<TraceEvent> &out, uint64_t sinceNs = 0);
+
+// リングの内容を Chrome trace_event 形式のJSONで書き出す
+bool traceWriteChromeJson(const std::string &path);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(TraceStage stage, int64_t arg = 0)
+        : stage_(stage), arg_(arg), start_(traceBegin()) {}
+    ~TraceScope() { traceEnd(stage_, start_, arg_); }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    TraceStage stage_;
+    int64_t arg_;
+    uint64_t start_;
+};
+
+#define WPG_TRACE_CONCAT_INNER(a, b) a##b
+#define WPG_TRACE_CONCAT(a, b) WPG_TRACE_CONCAT_INNER(a, b)
+#define WPG_TRACE_SCOPE(...) TraceScope WPG_TRACE_CONCAT(wpgTraceScope_, __LINE__)(__VA_ARGS__)